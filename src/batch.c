@@ -0,0 +1,383 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* --stdin-patterns: all search strings from stdin are searched in one pass
+ * over the databases. Plain strings are the keys of an Aho-Corasick
+ * automaton. Globs are keyed with their longest literal part and checked
+ * with fnmatch(), when the key was found. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fnmatch.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "batch.h"
+
+extern char *make_path(const char *path);
+
+/*
+ * ac_goto() returns the child of state 's' for character 'c' or -1.
+ */
+static int ac_goto(struct batch_s *batch, int s, unsigned char c)
+{
+	if (s == 0)
+		return batch->root[c];
+	for (s = batch->state[s].child; s != -1; s = batch->state[s].sibling)
+		if (batch->state[s].ch == c)
+			return s;
+	return -1;
+}
+
+/*
+ * ac_new_state() appends a state and returns its number or -1.
+ */
+static int ac_new_state(struct g_data_s *g_data, struct batch_s *batch)
+{
+	struct ac_state_s *state;
+
+	if (batch->state_len == batch->state_alloc) {
+		batch->state_alloc = batch->state_alloc ? batch->state_alloc * 2 : 1024;
+		if (!(batch->state = realloc(batch->state, sizeof(struct ac_state_s) * batch->state_alloc))) {
+			report_error(g_data, FATAL, "ac_new_state: realloc: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+	state = &batch->state[batch->state_len];
+	state->child = -1;
+	state->sibling = -1;
+	state->fail = 0;
+	state->dict = 0;
+	state->key = -1;
+	state->ch = 0;
+	return batch->state_len++;
+}
+
+/*
+ * ac_add() adds the key of pattern 'p' to the automaton.
+ */
+static int ac_add(struct g_data_s *g_data, struct batch_s *batch,
+		  const char *key, int p)
+{
+	int s = 0, n;
+	unsigned char c;
+
+	for (; *key; key++) {
+		c = g_data->nocase ? tolower((unsigned char)*key) : (unsigned char)*key;
+		if ((n = ac_goto(batch, s, c)) == -1) {
+			if ((n = ac_new_state(g_data, batch)) == -1)
+				return 0;
+			batch->state[n].ch = c;
+			if (s == 0) {
+				batch->root[c] = n;
+			} else {
+				batch->state[n].sibling = batch->state[s].child;
+				batch->state[s].child = n;
+			}
+		}
+		s = n;
+	}
+	batch->pattern[p].next_key = batch->state[s].key;
+	batch->state[s].key = p;
+	return 1;
+}
+
+/*
+ * ac_link() sets the fail and dict links in breadth first order.
+ */
+static int ac_link(struct g_data_s *g_data, struct batch_s *batch)
+{
+	int *queue;
+	int head = 0, tail = 0;
+	int c, s, n, f;
+
+	if (!(queue = malloc(sizeof(int) * batch->state_len))) {
+		report_error(g_data, FATAL, "ac_link: malloc: %s\n", strerror(errno));
+		return 0;
+	}
+	for (c = 0; c < 256; c++) {
+		if (batch->root[c] > 0)
+			queue[tail++] = batch->root[c];
+		else
+			batch->root[c] = 0;
+	}
+	while (head < tail) {
+		s = queue[head++];
+		for (n = batch->state[s].child; n != -1; n = batch->state[n].sibling) {
+			queue[tail++] = n;
+			f = batch->state[s].fail;
+			while (f && ac_goto(batch, f, batch->state[n].ch) == -1)
+				f = batch->state[f].fail;
+			batch->state[n].fail = ac_goto(batch, f, batch->state[n].ch);
+			f = batch->state[n].fail;
+			batch->state[n].dict = batch->state[f].key != -1 ? f : batch->state[f].dict;
+		}
+	}
+	free(queue);
+	return 1;
+}
+
+/*
+ * glob_key() copies the longest literal part of glob 'str' to 'key'.
+ */
+static void glob_key(const char *str, char *key)
+{
+	int len = 0, best = 0;
+	const char *ptr;
+
+	*key = '\0';
+	for (ptr = str; ; ptr++) {
+		if (*ptr == '\\' && ptr[1])
+			ptr++;
+		else if (!*ptr || *ptr == '*' || *ptr == '?' || *ptr == '[') {
+			if (len > best) {
+				best = len;
+				memcpy(key, ptr - len, len);
+				key[len] = '\0';
+			}
+			len = 0;
+			if (!*ptr)
+				break;
+			if (*ptr != '[')
+				continue;
+			/* skip the bracket expression, a ']' right after the
+			 * '[' or the negation is part of it */
+			ptr++;
+			if (*ptr == '!' || *ptr == '^')
+				ptr++;
+			if (*ptr == ']')
+				ptr++;
+			if (!(ptr = strchr(ptr, ']')))
+				break;
+			continue;
+		}
+		len++;
+	}
+}
+
+/*
+ * batch_add() adds a search string to the batch.
+ */
+static int batch_add(struct g_data_s *g_data, struct batch_s *batch,
+		     const char *str)
+{
+	struct batch_pattern_s *pattern;
+	char *key = NULL;
+	int len = strlen(str);
+	int p = batch->count;
+	int ret = 0;
+
+	if (!(batch->pattern = realloc(batch->pattern, sizeof(struct batch_pattern_s) * (p + 1))) ||
+	    !(batch->scan = realloc(batch->scan, sizeof(int) * (p + 1)))) {
+		report_error(g_data, FATAL, "batch_add: realloc: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	pattern = &batch->pattern[p];
+	pattern->next_key = -1;
+	pattern->glob = (strchr(str, '*') || strchr(str, '?') ||
+			 (strchr(str, '[') && strchr(str, ']')));
+	if (!(pattern->str = malloc(len + 3)) || !(key = malloc(len + 1))) {
+		report_error(g_data, FATAL, "batch_add: malloc: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	batch->count++;
+	if (pattern->glob) {
+		/* same as search_db() */
+		pattern->str[0] = '*';
+		strcpy(pattern->str + 1, str);
+		strcat(pattern->str, "*");
+		/* a backslash can not be part of the key, it might escape
+		 * the '*' at the end */
+		glob_key(str, key);
+		if (strchr(key, '\\'))
+			*key = '\0';
+	} else {
+		strcpy(pattern->str, str);
+		strcpy(key, str);
+	}
+	if (!*key) {
+		/* nothing to look for, an empty string matches nothing */
+		if (pattern->glob)
+			batch->scan[batch->scan_len++] = p;
+	} else if (!ac_add(g_data, batch, key, p))
+		goto EXIT;
+	ret = 1;
+EXIT:
+	if (key)
+		free(key);
+	return ret;
+}
+
+/*
+ * batch_init() reads the search strings from stdin, one per line, and
+ * builds the automaton. The index of a search string is its line number,
+ * starting with 0.
+ */
+int batch_init(struct g_data_s *g_data)
+{
+	struct batch_s *batch;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int c;
+	int ret = 0;
+
+	if (g_data->regexp_data) {
+		report_error(g_data, FATAL, "--stdin-patterns can not be used with a regular expression.\n");
+		return 0;
+	}
+	if (!(batch = calloc(1, sizeof(struct batch_s)))) {
+		report_error(g_data, FATAL, "batch_init: calloc: %s\n", strerror(errno));
+		return 0;
+	}
+	g_data->batch = batch;
+	for (c = 0; c < 256; c++)
+		batch->root[c] = -1;
+	if (ac_new_state(g_data, batch) == -1)
+		goto EXIT;
+
+	while ((len = getline(&line, &size, stdin)) != -1) {
+		if (len && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (len && line[len - 1] == '\r')
+			line[--len] = '\0';
+		if (!batch_add(g_data, batch, line))
+			goto EXIT;
+	}
+	if (ferror(stdin)) {
+		report_error(g_data, FATAL, "batch_init: getline: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	if (!ac_link(g_data, batch))
+		goto EXIT;
+	if (!(batch->hit = malloc(sizeof(int) * (batch->count + 1))) ||
+	    !(batch->mark = calloc(batch->count + 1, sizeof(unsigned int)))) {
+		report_error(g_data, FATAL, "batch_init: malloc: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	ret = 1;
+EXIT:
+	if (line)
+		free(line);
+	return ret;
+}
+
+/*
+ * batch_free() frees the batch data.
+ */
+void batch_free(struct g_data_s *g_data)
+{
+	struct batch_s *batch = g_data->batch;
+	int i;
+
+	if (!batch)
+		return;
+	for (i = 0; i < batch->count; i++)
+		free(batch->pattern[i].str);
+	free(batch->pattern);
+	free(batch->state);
+	free(batch->scan);
+	free(batch->hit);
+	free(batch->mark);
+	free(batch);
+	g_data->batch = NULL;
+}
+
+static int int_compare(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * batch_match() finds the search strings, that match 'full_path', and
+ * returns 1, if there is any.
+ */
+int batch_match(struct g_data_s *g_data, const char *full_path)
+{
+	struct batch_s *batch = g_data->batch;
+	const unsigned char *ptr;
+	unsigned char c;
+	int s = 0, n, t, p;
+	int i, len = 0;
+
+	if (++batch->stamp == 0) {
+		memset(batch->mark, 0, sizeof(unsigned int) * (batch->count + 1));
+		batch->stamp = 1;
+	}
+	for (ptr = (const unsigned char *)full_path; *ptr; ptr++) {
+		c = g_data->nocase ? tolower(*ptr) : *ptr;
+		while ((n = ac_goto(batch, s, c)) == -1)
+			s = batch->state[s].fail;
+		s = n;
+		for (t = batch->state[s].key != -1 ? s : batch->state[s].dict; t;
+		     t = batch->state[t].dict) {
+			for (p = batch->state[t].key; p != -1; p = batch->pattern[p].next_key) {
+				if (batch->mark[p] == batch->stamp)
+					continue;
+				batch->mark[p] = batch->stamp;
+				batch->hit[len++] = p;
+			}
+		}
+	}
+	for (i = 0; i < batch->scan_len; i++)
+		batch->hit[len++] = batch->scan[i];
+	if (len > 1)
+		qsort(batch->hit, len, sizeof(int), int_compare);
+	/* the globs still have to match as a whole */
+	batch->hit_len = 0;
+	for (i = 0; i < len; i++) {
+		p = batch->hit[i];
+		if (batch->pattern[p].glob &&
+		    fnmatch(batch->pattern[p].str, full_path,
+			    g_data->nocase ? FNM_CASEFOLD : 0) != 0)
+			continue;
+		batch->hit[batch->hit_len++] = p;
+	}
+	return batch->hit_len > 0;
+}
+
+/*
+ * batch_print() prints 'path' once for every search string, that it
+ * matches, tagged with the index of the search string. Path is without
+ * leading '/'. If 'matched', batch_match() was called for the path last and
+ * its search strings are known, otherwise it is matched again.
+ */
+void batch_print(struct g_data_s *g_data, const char *path, int matched)
+{
+	struct batch_s *batch = g_data->batch;
+	char *full_path;
+	int i;
+
+	/* database paths were matched in search_path() already, diff
+	 * database paths are matched again */
+	if (!matched) {
+		full_path = make_path(path);
+		batch_match(g_data, full_path);
+		free(full_path);
+	}
+	for (i = 0; i < batch->hit_len; i++)
+		printf("%d\t/%s\n", batch->hit[i], path);
+}
@@ -0,0 +1,43 @@
+#ifndef BATCH_H
+#define BATCH_H 1
+
+/* Aho-Corasick automaton state. The children of a state are a linked
+ * list, only the root has a table. */
+struct ac_state_s {
+	int child;		/* first child */
+	int sibling;		/* next child of the parent */
+	int fail;		/* longest proper suffix, that is a state */
+	int dict;		/* next state on the fail chain, that ends a key */
+	int key;		/* first pattern, whose key ends here or -1 */
+	unsigned char ch;
+};
+
+/* Pattern read from stdin */
+struct batch_pattern_s {
+	char *str;		/* literal or glob wrapped with '*' */
+	int glob;
+	int next_key;		/* next pattern with the same key or -1 */
+};
+
+/* --stdin-patterns data */
+struct batch_s {
+	struct batch_pattern_s *pattern;
+	int count;
+	struct ac_state_s *state;
+	int state_len;
+	int state_alloc;
+	int root[256];
+	int *scan;		/* globs without a literal part, always tried */
+	int scan_len;
+	int *hit;		/* patterns, that matched the last path */
+	int hit_len;
+	unsigned int *mark;	/* stamp of the last path, that hit a pattern */
+	unsigned int stamp;
+};
+
+int batch_init(struct g_data_s *g_data);
+void batch_free(struct g_data_s *g_data);
+int batch_match(struct g_data_s *g_data, const char *full_path);
+void batch_print(struct g_data_s *g_data, const char *path, int matched);
+
+#endif /* !BATCH_H */
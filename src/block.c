@@ -0,0 +1,393 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Block compressed database. The writer gets the encoded paths from
+ * encode_flush() a block at a time. The reader hands out the decompressed
+ * blocks like read() does, so the decoders of the plain database read
+ * both formats. A block is only decompressed, when the decoder gets to it. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "profile.h"
+#include "block.h"
+#include "lz.h"
+#include "dirtab.h"
+
+/*
+ * block_create() returns the writer of the blocks, that follow the header
+ * already written to 'fd'.
+ */
+struct block_writer_s *block_create(struct g_data_s *g_data, FILE *fd)
+{
+	struct block_writer_s *block;
+
+	if (!(block = calloc(1, sizeof(struct block_writer_s)))) {
+		report_error(g_data, FATAL, "block_create: calloc: %s\n", strerror(errno));
+		return NULL;
+	}
+	block->offset = ftello(fd);
+	return block;
+}
+
+/*
+ * block_add() adds the block of 'comp_len' bytes, that was written to the
+ * offset of the next block, to the index.
+ */
+int block_add(struct g_data_s *g_data, struct block_writer_s *block,
+	      uint32_t comp_len, uint32_t raw_len)
+{
+	struct block_entry_s *entry;
+
+	if (block->count == block->alloc) {
+		block->alloc = block->alloc ? block->alloc * 2 : 256;
+		if (!(entry = realloc(block->index, sizeof(struct block_entry_s) * block->alloc))) {
+			report_error(g_data, FATAL, "block_add: realloc: %s\n", strerror(errno));
+			return 0;
+		}
+		block->index = entry;
+	}
+	entry = &block->index[block->count++];
+	entry->offset = block->offset;
+	entry->comp_len = comp_len;
+	entry->raw_len = raw_len;
+	block->offset += comp_len;
+	return 1;
+}
+
+/*
+ * block_write() compresses 'len' bytes of encoded paths and writes them as
+ * the next block.
+ */
+int block_write(struct g_data_s *g_data, FILE *fd, struct block_writer_s *block,
+		const char *raw, size_t len)
+{
+	const char *data = raw;
+	size_t comp_len;
+
+	if (!len)
+		return 1;
+	if (len > block->comp_alloc) {
+		free(block->comp);
+		if (!(block->comp = malloc(len))) {
+			block->comp_alloc = 0;
+			report_error(g_data, FATAL, "block_write: malloc: %s\n", strerror(errno));
+			return 0;
+		}
+		block->comp_alloc = len;
+	}
+	/* stored, if it does not get smaller */
+	comp_len = lz_compress((const unsigned char *)raw, len, block->comp, len - 1);
+	if (comp_len)
+		data = (const char *)block->comp;
+	else
+		comp_len = len;
+	if (fflush(fd) == EOF || !write_all(fileno(fd), data, comp_len)) {
+		report_error(g_data, FATAL, "block_write: write(): %s\n", strerror(errno));
+		return 0;
+	}
+	return block_add(g_data, block, comp_len, len);
+}
+
+/*
+ * block_finish() writes the block index and the footer. The last block
+ * has to be written with encode_flush() before.
+ */
+int block_finish(struct g_data_s *g_data, FILE *fd, struct block_writer_s *block)
+{
+	struct block_footer_s footer;
+
+	memset(&footer, 0, sizeof(footer));
+	footer.index_offset = block->offset;
+	footer.count = block->count;
+	memcpy(footer.magic, BLOCK_MAGIC, sizeof(footer.magic));
+	if (fflush(fd) == EOF ||
+	    !write_all(fileno(fd), block->index, sizeof(struct block_entry_s) * block->count) ||
+	    !write_all(fileno(fd), &footer, sizeof(footer))) {
+		report_error(g_data, FATAL, "block_finish: write(): %s\n", strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
+void block_free(struct block_writer_s *block)
+{
+	if (!block)
+		return;
+	free(block->comp);
+	free(block->index);
+	free(block);
+}
+
+/*
+ * block_index() reads the block index, that ends at 'data_end' with the
+ * footer.
+ */
+static int block_index(struct g_data_s *g_data, struct block_reader_s *reader,
+		       const char *database, uint64_t data_end)
+{
+	struct block_footer_s footer;
+	struct block_entry_s *entry;
+	uint64_t i;
+	ssize_t len;
+
+	PROF_COUNT(syscalls, 1);
+	if (data_end < sizeof(struct block_header_s) + sizeof(footer) ||
+	    pread(reader->fd, &footer, sizeof(footer), data_end - sizeof(footer)) != sizeof(footer) ||
+	    memcmp(footer.magic, BLOCK_MAGIC, sizeof(footer.magic)) != 0 ||
+	    footer.count > (data_end - sizeof(footer)) / sizeof(struct block_entry_s) ||
+	    footer.index_offset != data_end - sizeof(footer) - footer.count * sizeof(struct block_entry_s)) {
+		report_error(g_data, FATAL, "block_open: '%s': The database is truncated or damaged.\n", database);
+		return 0;
+	}
+	if (!(reader->index = malloc(sizeof(struct block_entry_s) * (footer.count + 1)))) {
+		report_error(g_data, FATAL, "block_open: malloc: %s\n", strerror(errno));
+		return 0;
+	}
+	PROF_COUNT(syscalls, 1);
+	len = sizeof(struct block_entry_s) * footer.count;
+	if (pread(reader->fd, reader->index, len, footer.index_offset) != len) {
+		report_error(g_data, FATAL, "block_open: '%s': The database is truncated or damaged.\n", database);
+		return 0;
+	}
+	for (i = 0; i < footer.count; i++) {
+		entry = &reader->index[i];
+		/* both headers have the same size */
+		if (entry->comp_len > entry->raw_len ||
+		    entry->offset < sizeof(struct block_header_s) ||
+		    entry->offset + entry->comp_len > footer.index_offset) {
+			report_error(g_data, FATAL, "block_open: '%s': The database is truncated or damaged.\n", database);
+			return 0;
+		}
+	}
+	reader->blocks = 1;
+	reader->count = footer.count;
+	return 1;
+}
+
+/*
+ * block_open() reads the security level of the database 'fd', the header
+ * and the footer of version 2 and the block index, if it is a block
+ * database, or the directory table of a directory table database. The
+ * plain database is read on after the header, or from the second byte in
+ * version 1. The reader has to be closed with block_close() also on error.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int block_open(struct g_data_s *g_data, struct block_reader_s *reader, int fd,
+	       const char *database)
+{
+	struct block_header_s header;
+	struct stat db_stat;
+	ssize_t len;
+
+	memset(reader, 0, sizeof(struct block_reader_s));
+	reader->fd = fd;
+	reader->info.version = 1;
+	len = read(fd, &reader->slevel, 1);
+	PROF_COUNT(syscalls, 1);
+	if (len == 0) {
+		report_error(g_data, FATAL, "block_open: read: '%s': Database file is empty.\n", database);
+		return 0;
+	} else if (len == -1) {
+		report_error(g_data, FATAL, "block_open: read: '%s': %s\n", database, strerror(errno));
+		return 0;
+	}
+	if (reader->slevel != DB_MAGIC[0])
+		return 1;
+
+	PROF_COUNT(syscalls, 2);
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+	    fstat(fd, &db_stat) == -1) {
+		report_error(g_data, FATAL, "block_open: '%s': The database is truncated or damaged.\n", database);
+		return 0;
+	}
+	if (memcmp(header.magic, DB_MAGIC, sizeof(header.magic)) == 0) {
+		if (!db_open(g_data, reader, database))
+			return 0;
+		if (reader->info.format == DB_BLOCK)
+			return block_index(g_data, reader, database, reader->info.data_end);
+		if (reader->info.format == DB_DIRTAB)
+			return dirtab_open(g_data, reader, database, reader->info.data_end);
+		/* the plain data ends before the offset table */
+		reader->data_pos = sizeof(struct db_header_s);
+		reader->data_end = reader->info.data_end;
+		PROF_COUNT(syscalls, 1);
+		if (lseek(fd, reader->data_pos, SEEK_SET) == -1) {
+			report_error(g_data, FATAL, "block_open: lseek: '%s': %s\n", database, strerror(errno));
+			return 0;
+		}
+		return 1;
+	}
+	reader->slevel = header.slevel;
+	if (memcmp(header.magic, DIRTAB_MAGIC, sizeof(header.magic)) == 0)
+		return dirtab_open(g_data, reader, database, db_stat.st_size);
+	if (memcmp(header.magic, BLOCK_MAGIC, sizeof(header.magic)) == 0)
+		return block_index(g_data, reader, database, db_stat.st_size);
+	report_error(g_data, FATAL, "block_open: '%s': The database is truncated or damaged.\n", database);
+	return 0;
+}
+
+/*
+ * block_load() reads and decompresses the block 'i'.
+ */
+static int block_load(struct block_reader_s *reader, uint64_t i)
+{
+	struct block_entry_s *entry = &reader->index[i];
+	unsigned char *buf;
+
+	if (entry->raw_len > reader->raw_alloc) {
+		if (!(buf = realloc(reader->raw, entry->raw_len)))
+			return 0;
+		reader->raw = buf;
+		reader->raw_alloc = entry->raw_len;
+	}
+	if (entry->comp_len > reader->comp_alloc) {
+		if (!(buf = realloc(reader->comp, entry->comp_len)))
+			return 0;
+		reader->comp = buf;
+		reader->comp_alloc = entry->comp_len;
+	}
+	/* a stored block is read straight into place */
+	buf = entry->comp_len == entry->raw_len ? reader->raw : reader->comp;
+	PROF_COUNT(syscalls, 1);
+	if (pread(reader->fd, buf, entry->comp_len, entry->offset) != entry->comp_len) {
+		errno = EIO;
+		return 0;
+	}
+	PROF_COUNT(bytes, entry->comp_len);
+	if (buf == reader->comp &&
+	    lz_decompress(reader->comp, entry->comp_len, reader->raw, entry->raw_len) != entry->raw_len) {
+		errno = EINVAL;
+		return 0;
+	}
+	reader->raw_len = entry->raw_len;
+	reader->raw_pos = 0;
+	return 1;
+}
+
+/*
+ * block_read() reads up to 'count' bytes of encoded paths like read().
+ */
+ssize_t block_read(struct block_reader_s *reader, void *buffer, size_t count)
+{
+	ssize_t len;
+
+	if (reader->dirtab)
+		return dirtab_read(reader->dirtab, buffer, count);
+	if (!reader->blocks) {
+		if (reader->data_end && count > reader->data_end - reader->data_pos)
+			count = reader->data_end - reader->data_pos;
+		if (!count)
+			return 0;
+		len = read(reader->fd, buffer, count);
+		PROF_COUNT(syscalls, 1);
+		if (len > 0) {
+			reader->data_pos += len;
+			PROF_COUNT(bytes, len);
+		}
+		return len;
+	}
+	while (reader->raw_pos == reader->raw_len) {
+		if (reader->next == reader->count)
+			return 0;
+		if (!block_load(reader, reader->next++))
+			return -1;
+	}
+	len = reader->raw_len - reader->raw_pos;
+	if ((size_t)len > count)
+		len = count;
+	memcpy(buffer, reader->raw + reader->raw_pos, len);
+	reader->raw_pos += len;
+	return len;
+}
+
+/*
+ * block_chunk() reads the chunk 'i' of a database of version 2, the block
+ * 'i' decompressed or the plain data from the entry 'i' of the offset table
+ * to the next one. It is read to 'raw' of the reader.
+ *
+ * Returns:  the length of the chunk
+ *           -1 == error
+ */
+ssize_t block_chunk(struct block_reader_s *reader, uint64_t i, unsigned char **raw)
+{
+	uint64_t offset, end;
+	unsigned char *buf;
+
+	if (reader->blocks) {
+		if (i >= reader->count || !block_load(reader, i))
+			return -1;
+		*raw = reader->raw;
+		return reader->raw_len;
+	}
+	if (i >= reader->info.offsets_count) {
+		errno = EINVAL;
+		return -1;
+	}
+	offset = reader->info.offsets[i];
+	end = i + 1 < reader->info.offsets_count ? reader->info.offsets[i + 1] : reader->data_end;
+	if (offset > end || end > reader->data_end) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (end - offset > reader->raw_alloc) {
+		if (!(buf = realloc(reader->raw, end - offset)))
+			return -1;
+		reader->raw = buf;
+		reader->raw_alloc = end - offset;
+	}
+	PROF_COUNT(syscalls, 1);
+	if (pread(reader->fd, reader->raw, end - offset, offset) != (ssize_t)(end - offset)) {
+		errno = EIO;
+		return -1;
+	}
+	PROF_COUNT(bytes, end - offset);
+	*raw = reader->raw;
+	return end - offset;
+}
+
+/*
+ * block_close() frees the reader, the database is not closed.
+ */
+void block_close(struct block_reader_s *reader)
+{
+	free(reader->index);
+	free(reader->raw);
+	free(reader->comp);
+	dirtab_close(reader->dirtab);
+	db_close(&reader->info);
+	reader->dirtab = NULL;
+	reader->index = NULL;
+	reader->raw = NULL;
+	reader->comp = NULL;
+	reader->blocks = 0;
+}
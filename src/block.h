@@ -0,0 +1,86 @@
+#ifndef BLOCK_H
+#define BLOCK_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dbinfo.h"
+
+/* Block compressed database, written by updatedb --compress. The encoded
+ * paths are cut into blocks at path boundaries, the first path of every
+ * block has no common prefix with the one before, and every block is
+ * compressed with lz_compress() on its own. The index of the blocks is
+ * after them:
+ *
+ *   block | block | ... | block_entry_s[count] | footer
+ *
+ * A block, that does not get smaller, is stored as it is, its comp_len is
+ * the same as raw_len. It is the data of a database of version 2, a
+ * database of version 1 starts with its own header instead. */
+#define BLOCK_MAGIC "RLBLK\0\0\1"
+#define BLOCK_RAW_SIZE (128 * 1024)
+
+/* header of version 1 */
+struct block_header_s {
+	char magic[8];
+	char slevel;
+	char pad[7];
+};
+
+struct block_entry_s {
+	uint64_t offset;
+	uint32_t comp_len;
+	uint32_t raw_len;
+};
+
+struct block_footer_s {
+	uint64_t index_offset;
+	uint64_t count;
+	char magic[8];
+};
+
+/* Block writer */
+struct block_writer_s {
+	unsigned char *comp;
+	size_t comp_alloc;
+	struct block_entry_s *index;
+	uint64_t count;
+	uint64_t alloc;
+	uint64_t offset;	/* of the next block */
+};
+
+/* Database reader for all formats */
+struct block_reader_s {
+	int fd;
+	int blocks;		/* 0 for the plain database */
+	struct dirtab_reader_s *dirtab;	/* set for a directory table database */
+	struct db_info_s info;
+	uint64_t data_pos;	/* of the plain data of version 2 */
+	uint64_t data_end;
+	char slevel;
+	struct block_entry_s *index;
+	uint64_t count;
+	uint64_t next;		/* block to load next */
+	unsigned char *raw;
+	size_t raw_len;
+	size_t raw_pos;
+	size_t raw_alloc;
+	unsigned char *comp;
+	size_t comp_alloc;
+};
+
+struct block_writer_s *block_create(struct g_data_s *g_data, FILE *fd);
+int block_add(struct g_data_s *g_data, struct block_writer_s *block,
+	      uint32_t comp_len, uint32_t raw_len);
+int block_write(struct g_data_s *g_data, FILE *fd, struct block_writer_s *block,
+		const char *raw, size_t len);
+int block_finish(struct g_data_s *g_data, FILE *fd, struct block_writer_s *block);
+void block_free(struct block_writer_s *block);
+int block_open(struct g_data_s *g_data, struct block_reader_s *reader, int fd,
+	       const char *database);
+ssize_t block_read(struct block_reader_s *reader, void *buffer, size_t count);
+ssize_t block_chunk(struct block_reader_s *reader, uint64_t i, unsigned char **raw);
+void block_close(struct block_reader_s *reader);
+
+#endif /* !BLOCK_H */
@@ -0,0 +1,347 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Checkpoints of create_db(): a full update, that was interrupted, goes on
+ * from the last checkpoint instead of crawling everything again. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "dbinfo.h"
+#include "ckpt.h"
+
+/* extern functions are defined in slocate.c */
+extern int encode_flush(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data);
+
+/*
+ * ckpt_options() returns what the database is built with, a checkpoint of
+ * other options is not resumed.
+ */
+static char *ckpt_options(struct g_data_s *g_data)
+{
+	char *options;
+	size_t len = 64;
+	int i;
+
+	for (i = 0; g_data->index_paths && g_data->index_paths[i]; i++)
+		len += strlen(g_data->index_paths[i]) + 6;
+	for (i = 0; g_data->exclude && g_data->exclude[i]; i++)
+		len += strlen(g_data->exclude[i]) + 9;
+	if (!(options = malloc(len)))
+		return NULL;
+	sprintf(options, "slevel=%c\nxdev=%d\n", g_data->slevel, g_data->XDEV ? 1 : 0);
+	for (i = 0; g_data->index_paths && g_data->index_paths[i]; i++) {
+		strcat(options, "root=");
+		strcat(options, g_data->index_paths[i]);
+		strcat(options, "\n");
+	}
+	for (i = 0; g_data->exclude && g_data->exclude[i]; i++) {
+		strcat(options, "exclude=");
+		strcat(options, g_data->exclude[i]);
+		strcat(options, "\n");
+	}
+	return options;
+}
+
+static char *ckpt_name(const char *tmp_file)
+{
+	char *name;
+
+	if (!(name = malloc(strlen(tmp_file) + strlen(".ckpt") + 1)))
+		return NULL;
+	strcpy(name, tmp_file);
+	strcat(name, ".ckpt");
+	return name;
+}
+
+/*
+ * ckpt_read() reads the checkpoint 'fp' up to the state of the writer.
+ * Returns 0, if it is no checkpoint or is cut off.
+ */
+static int ckpt_read(FILE *fp, char **options, int32_t *root, int32_t *prev_len, char **path)
+{
+	char magic[sizeof(CKPT_MAGIC) - 1];
+	size_t len = 0;
+
+	if (fread(magic, sizeof(magic), 1, fp) != 1 ||
+	    memcmp(magic, CKPT_MAGIC, sizeof(magic)) != 0 ||
+	    getdelim(options, &len, '\0', fp) == -1 ||
+	    fread(root, sizeof(*root), 1, fp) != 1 ||
+	    fread(prev_len, sizeof(*prev_len), 1, fp) != 1)
+		return 0;
+	len = 0;
+	return getdelim(path, &len, '\0', fp) != -1;
+}
+
+/*
+ * ckpt_create() returns the checkpoint data for the temporary file
+ * 'tmp_file' of create_db().
+ */
+struct ckpt_s *ckpt_create(struct g_data_s *g_data, const char *tmp_file)
+{
+	struct ckpt_s *ckpt;
+
+	if (!(ckpt = calloc(1, sizeof(struct ckpt_s))) ||
+	    !(ckpt->name = ckpt_name(tmp_file)) ||
+	    !(ckpt->options = ckpt_options(g_data))) {
+		report_error(g_data, FATAL, "ckpt_create: malloc: %s\n", strerror(errno));
+		ckpt_done(ckpt, 0);
+		return NULL;
+	}
+	ckpt->g_data = g_data;
+	ckpt->saved = time(NULL);
+	return ckpt;
+}
+
+/*
+ * ckpt_check() returns 1, if there is a checkpoint of the temporary file
+ * 'tmp_file' of 'size' bytes, that can be resumed, and 0 otherwise.
+ */
+int ckpt_check(const char *tmp_file, off_t size)
+{
+	struct db_state_s state;
+	char *name, *options = NULL, *path = NULL;
+	int32_t root, prev_len;
+	FILE *fp;
+	int ok = 0;
+
+	if (!(name = ckpt_name(tmp_file)))
+		return 0;
+	if ((fp = fopen(name, "r"))) {
+		ok = ckpt_read(fp, &options, &root, &prev_len, &path) &&
+		     fread(&state, sizeof(state), 1, fp) == 1 &&
+		     state.format == DB_PLAIN && state.offset <= (uint64_t)size;
+		fclose(fp);
+	}
+	free(options);
+	free(path);
+	free(name);
+	return ok;
+}
+
+/*
+ * ckpt_restore() resumes the checkpoint of the temporary file 'tmp_file',
+ * if there is one of the same options: it opens the file as 'fd', cuts it
+ * at the checkpoint and restores the encoder. A checkpoint, that can't be
+ * resumed, is removed.
+ *
+ * Returns:  1 == resumed
+ *           0 == no checkpoint
+ *          -1 == error
+ */
+int ckpt_restore(struct ckpt_s *ckpt, const char *tmp_file, FILE **fd,
+		 struct enc_data_s *enc_data)
+{
+	struct g_data_s *g_data = ckpt->g_data;
+	struct db_writer_s *db = NULL;
+	struct db_header_s header;
+	struct stat st;
+	char *options = NULL, *path = NULL;
+	int32_t root, prev_len;
+	FILE *fp;
+	int ret = 0;
+
+	if (!(fp = fopen(ckpt->name, "r")))
+		return 0;
+	if (!ckpt_read(fp, &options, &root, &prev_len, &path) ||
+	    strcmp(options, ckpt->options) != 0 ||
+	    !(db = db_load(g_data, fp)) || db->format != DB_PLAIN)
+		goto DISCARD;
+	/* the encoded paths up to the checkpoint have to be there */
+	if (!(*fd = fopen(tmp_file, "r+")))
+		goto DISCARD;
+	if (fstat(fileno(*fd), &st) == -1 || (uint64_t)st.st_size < db->offset ||
+	    fread(&header, sizeof(header), 1, *fd) != 1 ||
+	    memcmp(header.magic, DB_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.slevel != db->slevel) {
+		fclose(*fd);
+		*fd = NULL;
+		goto DISCARD;
+	}
+	if (ftruncate(fileno(*fd), db->offset) == -1 || fseeko(*fd, 0, SEEK_END) == -1) {
+		report_error(g_data, FATAL, "ckpt_restore: %s: %s\n", tmp_file, strerror(errno));
+		ret = -1;
+		goto EXIT;
+	}
+	if (!(ckpt->resume = strdup(path))) {
+		report_error(g_data, FATAL, "ckpt_restore: strdup: %s\n", strerror(errno));
+		ret = -1;
+		goto EXIT;
+	}
+	ckpt->resume_root = root;
+	enc_data->db = db;
+	enc_data->prev_line = path;
+	enc_data->prev_line_len = strlen(path);
+	enc_data->prev_alloc = enc_data->prev_line_len + 1;
+	enc_data->prev_len = prev_len;
+	db = NULL;
+	path = NULL;
+	if (g_data->VERBOSE)
+		fprintf(stderr, "%s: resuming the update after %s\n", g_data->progname, ckpt->resume);
+	ret = 1;
+	goto EXIT;
+DISCARD:
+	if (g_data->VERBOSE)
+		fprintf(stderr, "%s: the checkpoint %s does not fit, starting over\n", g_data->progname, ckpt->name);
+	unlink(ckpt->name);
+EXIT:
+	fclose(fp);
+	db_free(db);
+	free(options);
+	free(path);
+	return ret;
+}
+
+/*
+ * ckpt_skip() tells, what the crawl does with 'path' while a checkpoint is
+ * resumed: the paths up to the checkpoint are in the temporary file
+ * already, only the directories above it are read again.
+ */
+int ckpt_skip(struct ckpt_s *ckpt, const char *path)
+{
+	size_t len;
+	int c;
+
+	if (!ckpt || !ckpt->resume)
+		return CKPT_ENCODE;
+	if (ckpt->root < ckpt->resume_root)
+		return CKPT_SKIP;
+	if (ckpt->root == ckpt->resume_root) {
+		if ((c = tree_compare(path, ckpt->resume)) < 0) {
+			len = strlen(path);
+			if (strncmp(ckpt->resume, path, len) == 0 &&
+			    (path[len - 1] == '/' || ckpt->resume[len] == '/'))
+				return CKPT_DESCEND;
+			return CKPT_SKIP;
+		}
+		if (c == 0) {
+			free(ckpt->resume);
+			ckpt->resume = NULL;
+			return CKPT_DESCEND;
+		}
+	}
+	/* the path of the checkpoint is gone */
+	free(ckpt->resume);
+	ckpt->resume = NULL;
+	return CKPT_ENCODE;
+}
+
+/*
+ * ckpt_save() is called after a path was encoded. If g_data->CHECKPOINT
+ * seconds passed, it writes the encoded paths to the disk and saves the
+ * checkpoint next to the temporary file.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int ckpt_save(struct ckpt_s *ckpt, FILE *fd, struct enc_data_s *enc_data)
+{
+	struct g_data_s *g_data;
+	char *tmp_name = NULL;
+	int32_t root, prev_len;
+	FILE *fp = NULL;
+	int ret = 0;
+
+	if (!ckpt || ++ckpt->paths < CKPT_EVERY)
+		return 1;
+	g_data = ckpt->g_data;
+	ckpt->paths = 0;
+	if (time(NULL) - ckpt->saved < g_data->CHECKPOINT)
+		return 1;
+	if (!encode_flush(g_data, fd, enc_data))
+		return 0;
+	if (fdatasync(fileno(fd)) == -1) {
+		report_error(g_data, FATAL, "ckpt_save: fdatasync: %s\n", strerror(errno));
+		return 0;
+	}
+	if (!(tmp_name = malloc(strlen(ckpt->name) + strlen(".tmp") + 1))) {
+		report_error(g_data, FATAL, "ckpt_save: malloc: %s\n", strerror(errno));
+		return 0;
+	}
+	strcpy(tmp_name, ckpt->name);
+	strcat(tmp_name, ".tmp");
+	if (!(fp = fopen(tmp_name, "w"))) {
+		report_error(g_data, FATAL, "ckpt_save: %s: %s\n", tmp_name, strerror(errno));
+		goto EXIT;
+	}
+	root = ckpt->root;
+	prev_len = enc_data->prev_len;
+	if (fwrite(CKPT_MAGIC, sizeof(CKPT_MAGIC) - 1, 1, fp) != 1 ||
+	    fwrite(ckpt->options, strlen(ckpt->options) + 1, 1, fp) != 1 ||
+	    fwrite(&root, sizeof(root), 1, fp) != 1 ||
+	    fwrite(&prev_len, sizeof(prev_len), 1, fp) != 1 ||
+	    fwrite(enc_data->prev_line, enc_data->prev_line_len + 1, 1, fp) != 1) {
+		report_error(g_data, FATAL, "ckpt_save: fwrite: %s: %s\n", tmp_name, strerror(errno));
+		goto EXIT;
+	}
+	if (!db_save(g_data, fp, enc_data->db))
+		goto EXIT;
+	if (fflush(fp) == EOF || fdatasync(fileno(fp)) == -1) {
+		report_error(g_data, FATAL, "ckpt_save: %s: %s\n", tmp_name, strerror(errno));
+		goto EXIT;
+	}
+	if (fclose(fp) == EOF) {
+		fp = NULL;
+		report_error(g_data, FATAL, "ckpt_save: fclose: %s: %s\n", tmp_name, strerror(errno));
+		goto EXIT;
+	}
+	fp = NULL;
+	if (rename(tmp_name, ckpt->name) == -1) {
+		report_error(g_data, FATAL, "ckpt_save: rename(): Could not rename '%s' to '%s': %s\n", tmp_name, ckpt->name, strerror(errno));
+		goto EXIT;
+	}
+	ckpt->saved = time(NULL);
+	ret = 1;
+EXIT:
+	if (fp) {
+		fclose(fp);
+		unlink(tmp_name);
+	}
+	free(tmp_name);
+	return ret;
+}
+
+/*
+ * ckpt_done() removes the checkpoint, if the database is in place, and
+ * frees the checkpoint data.
+ */
+void ckpt_done(struct ckpt_s *ckpt, int ok)
+{
+	if (!ckpt)
+		return;
+	if (ok && ckpt->name && unlink(ckpt->name) == -1 && errno != ENOENT)
+		report_error(ckpt->g_data, WARNING, "ckpt_done: unlink(): %s: %s\n", ckpt->name, strerror(errno));
+	free(ckpt->name);
+	free(ckpt->options);
+	free(ckpt->resume);
+	free(ckpt);
+}
@@ -0,0 +1,52 @@
+#ifndef CKPT_H
+#define CKPT_H 1
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* --checkpoint: create_db() saves its state every few seconds to the file
+ * '<temp file>.ckpt', after the encoded paths are on the disk:
+ *
+ *   CKPT_MAGIC | options '\0' | root | prev_len | path '\0' | writer state
+ *
+ * The options are what the database is built with. The root is the index
+ * of the indexed path, that was crawled, the path is the last one, that
+ * was encoded, and the state of the writer ends with the length of the
+ * temporary file. An update with the same options, that finds the
+ * checkpoint, cuts the temporary file there and goes on with the crawl
+ * after the path. The crawl order is the order of the database, so only
+ * the directories above the path are read again. */
+#define CKPT_MAGIC "RLCKPT\0\1"
+#define CKPT_INTERVAL 60	/* seconds, if --checkpoint has no value */
+#define CKPT_EVERY 1024		/* paths between looking at the clock */
+
+/* Return values of ckpt_skip() */
+#define CKPT_ENCODE  0		/* a path after the checkpoint */
+#define CKPT_DESCEND 1		/* encoded, but there are paths below it */
+#define CKPT_SKIP    2		/* encoded with everything below it */
+
+/* Checkpoint data */
+struct ckpt_s {
+	struct g_data_s *g_data;
+	char *name;		/* of the checkpoint */
+	char *options;
+	time_t saved;
+	unsigned long paths;	/* encoded since the clock was looked at */
+	int root;		/* index of the indexed path, that is crawled */
+	/* the checkpoint, that is resumed */
+	char *resume;		/* path, NULL after it was passed */
+	int resume_root;
+};
+
+struct enc_data_s;
+
+struct ckpt_s *ckpt_create(struct g_data_s *g_data, const char *tmp_file);
+int ckpt_check(const char *tmp_file, off_t size);
+int ckpt_restore(struct ckpt_s *ckpt, const char *tmp_file, FILE **fd,
+		 struct enc_data_s *enc_data);
+int ckpt_skip(struct ckpt_s *ckpt, const char *path);
+int ckpt_save(struct ckpt_s *ckpt, FILE *fd, struct enc_data_s *enc_data);
+void ckpt_done(struct ckpt_s *ckpt, int ok);
+
+#endif /* !CKPT_H */
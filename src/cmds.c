@@ -27,6 +27,8 @@
 #include "utils.h"
 #include "cmds.h"
 #include "conf.h"
+#include "throttle.h"
+#include "ckpt.h"
 
 /* Init Command Data */
 struct cmd_data_s *init_cmd_data(struct g_data_s *g_data)
@@ -83,11 +85,16 @@ void usage(struct g_data_s *g_data)
 	       "Search:          %s [-qi] [-d <path>] [--database=<path1:path2:...>]\n", SL_VERSION, g_data->progname);
 	for (i = 0; i < strlen(g_data->progname)-1; i+=1)
 	    printf(" ");	       
-	printf("                   <search string>\n"
+	printf("                   [--profile] <search string>\n"
+	       "                 %s [-qi] [-n <num>] [-d <path>] --session\n"
+	       "                 %s [-qi] [-n <num>] [-d <path>] --stdin-patterns\n"
 	       "                 %s [-r <regexp>] [--regexp=<regexp>]\n"
+	       "                 %s [-d <path>] --statistics\n"
+	       "                 %s [--count] --diff-db <old> <new>\n"
 	       "Update database: %s [-qv] [-o <file>] [--output=<file>]\n"
 	       "                 %s [-e <dir1,dir2,...>] [-f <fs_type1,...> ] [-l <level>]\n"
-	       , g_data->progname, g_data->progname, g_data->progname);
+	       , g_data->progname, g_data->progname, g_data->progname, g_data->progname,
+	       g_data->progname, g_data->progname, g_data->progname);
 	
 	for (i = 0; i < strlen(g_data->progname)-1; i+=1)
 	    printf(" ");
@@ -95,14 +102,21 @@ void usage(struct g_data_s *g_data)
 	printf(
 #ifndef __FreeBSD__
 	       "                   [-c <file>] <[-U <path>] [-u]> [-I] [--initdiffdb]\n"
-	       "                   [--fast-update] [--full-update]\n"
+	       "                   [--fast-update] [--full-update] [--search-image]\n"
+	       "                   [--threads=<num>] [--native-crawl] [--inode-order]\n"
+	       "                   [--incremental] [--compress] [--dir-table]\n"
+	       "                   [--diff-memory=<mb>] [--xdev] [--prune-fs] [--skip-binds]\n"
+	       "                   [--per-filesystem] [--shards] [--throttle[=<percent>]]\n"
+	       "                   [--checkpoint[=<seconds>]] [--from-list=<file>]\n"
+	       "                   [--merge-db=<database>]\n"
 #else
 	       "                   <[-U <path>] [-u]>\n"
 #endif
 	       "General:         %s [-Vh] [--version] [--help]\n\n"
 	       "   Options:\n"
 	       "   -u                 - Create rlocate database starting at path /.\n"
-	       "   -U <dir>           - Create rlocate database starting at path <dir>.\n", g_data->progname);
+	       "   -U <dir>           - Create rlocate database starting at path <dir>.\n"
+	       "                        Give it more than once to index several paths.\n", g_data->progname);
 	
 #ifndef __FreeBSD__
 	printf("   -c <file>           - Parse original GNU Locate's configuration file\n"
@@ -130,12 +144,68 @@ void usage(struct g_data_s *g_data)
 	       "   --output=<file>    - Specifies the database to create.\n"
 	       "   -d <path>\n"
 	       "   --database=<path>  - Specfies the path of databases to search in.\n"
+	       "   --profile          - Print where the time of a search went on stderr.\n"
+	       "   --statistics       - Print the format, the number of paths, the root\n"
+	       "                        and the time of the update of the database.\n"
+	       "   --diff-db          - Print the paths, that are only in the database\n"
+	       "                        <new> after '+' and only in <old> after '-'.\n"
+	       "   --count            - Print only the numbers of them with --diff-db.\n"
+	       "   --session          - Read search strings from stdin, one per line, and\n"
+	       "                        end the results of each with an empty line.\n"
+	       "   --stdin-patterns   - Read search strings from stdin, one per line, and\n"
+	       "                        search all of them at once. Every path is printed\n"
+	       "                        after the line number of the search string, that\n"
+	       "                        it matched, counted from 0, and a tab.\n"
 	       "   -I\n"
 	       "   --initdiffdb       - Initialize the diff database if user database is\n"
 	       "                        created. If default database is created --initdiffdb\n"
 	       "                        is implied.\n"
 	       "   --fast-update      - Force fast update of the default database.\n"
 	       "   --full-update      - Force full update of the default database.\n"
+	       "   --search-image     - Write an uncompressed search image next to the\n"
+	       "                        database, that is searched instead of it.\n"
+	       "   --threads=<num>    - Read directories with <num> threads, when the\n"
+	       "                        database is created.\n"
+	       "   --native-crawl     - Read directories with getdents64() and openat()\n"
+	       "                        instead of fts, when the database is created.\n"
+	       "   --inode-order      - Read the directories like --native-crawl and\n"
+	       "                        stat the entries in inode order on rotational,\n"
+	       "                        network or file systems without d_type.\n"
+	       "   --incremental      - Read only the directories, that changed since the\n"
+	       "                        last --incremental update, on a full update.\n"
+	       "   --compress         - Write a block compressed database.\n"
+	       "   --dir-table        - Write a database with a table of the directories\n"
+	       "                        and the names grouped under them.\n"
+	       "   --diff-memory=<mb> - Sort the paths added since the last update in\n"
+	       "                        <mb> megabytes of memory on a fast update, the\n"
+	       "                        rest in temporary files. The default is 64.\n"
+	       "   --xdev             - Do not descend into directories on other file\n"
+	       "                        systems than the indexed path.\n"
+	       "   --prune-fs         - Exclude the network and pseudo file systems, that\n"
+	       "                        are mounted below the indexed path.\n"
+	       "   --skip-binds       - Skip the bind mounts below the indexed path, that\n"
+	       "                        show a directory, that is indexed elsewhere.\n"
+	       "   --per-filesystem   - Read every mounted file system with its own\n"
+	       "                        thread, when the database is created.\n"
+	       "   --shards           - Write a database for every file system and build\n"
+	       "                        only the ones of the changed file systems again,\n"
+	       "                        if rlocated keeps a diff database for it.\n"
+	       "   --throttle[=<percent>]\n"
+	       "                      - Crawl with the idle I/O priority and slow down,\n"
+	       "                        while the I/O or CPU of the machine is stalled\n"
+	       "                        more than <percent> of the time. The default is 10.\n"
+	       "   --checkpoint[=<seconds>]\n"
+	       "                      - Save the state of the update every <seconds>, so\n"
+	       "                        that an interrupted one goes on from there. The\n"
+	       "                        default is 60.\n"
+	       "   --from-list=<file> - Encode the paths of <file>, one per line or '\\0'\n"
+	       "                        terminated, instead of reading the directories.\n"
+	       "                        \"-\" is stdin. Give it more than once to read\n"
+	       "                        several lists at the same time.\n"
+	       "   --merge-db=<database>\n"
+	       "                      - Encode the paths of <database> and of its diff\n"
+	       "                        database instead of reading the directories.\n"
+	       "                        Give it more than once to merge several ones.\n"
 	       "   -h\n"
 	       "   --help             - Display this help.\n"
 	       "   -v\n"
@@ -443,6 +513,51 @@ EXIT:
 	return ret;
 }
 
+/* Add a path to index, -U can be given more than once */
+int add_index_path(struct g_data_s *g_data, char *path)
+{
+	char **index_paths;
+	int len;
+
+	for (len = 0; g_data->index_paths && g_data->index_paths[len]; len++);
+
+	if (!(index_paths = realloc(g_data->index_paths, sizeof(char *) * (len+2)))) {
+		report_error(g_data, FATAL, "add_index_path: realloc: %s\n", strerror(errno));
+		return 0;
+	}
+	g_data->index_paths = index_paths;
+	if (!(index_paths[len] = strdup(path))) {
+		report_error(g_data, FATAL, "add_index_path: strdup: %s\n", strerror(errno));
+		return 0;
+	}
+	index_paths[len+1] = NULL;
+
+	return 1;
+}
+
+/* Add a file to 'files', --from-list and --merge-db can be given more than
+ * once */
+int add_file(struct g_data_s *g_data, char ***files, char *file)
+{
+	char **list;
+	int len;
+
+	for (len = 0; *files && (*files)[len]; len++);
+
+	if (!(list = realloc(*files, sizeof(char *) * (len+2)))) {
+		report_error(g_data, FATAL, "add_file: realloc: %s\n", strerror(errno));
+		return 0;
+	}
+	*files = list;
+	if (!(list[len] = strdup(file))) {
+		report_error(g_data, FATAL, "add_file: strdup: %s\n", strerror(errno));
+		return 0;
+	}
+	list[len+1] = NULL;
+
+	return 1;
+}
+
 /* Set the regexp_data */
 int set_regexp_data(struct g_data_s *g_data, char *pattern)
 {
@@ -525,6 +640,44 @@ int parse_dash(struct g_data_s *g_data, char *option)
                 g_data->FAST_UPDATE = TRUE;
         } else if (strcmp(uc_option, "FULL-UPDATE") == 0) {
                 g_data->FULL_UPDATE = TRUE;
+	} else if (strcmp(uc_option, "PROFILE") == 0) {
+		g_data->PROFILE = TRUE;
+	} else if (strcmp(uc_option, "SEARCH-IMAGE") == 0) {
+		g_data->SEARCH_IMAGE = TRUE;
+	} else if (strcmp(uc_option, "SESSION") == 0) {
+		g_data->SESSION = TRUE;
+	} else if (strcmp(uc_option, "STDIN-PATTERNS") == 0) {
+		g_data->STDIN_PATTERNS = TRUE;
+	} else if (strcmp(uc_option, "NATIVE-CRAWL") == 0) {
+		g_data->NATIVE_CRAWL = TRUE;
+	} else if (strcmp(uc_option, "INODE-ORDER") == 0) {
+		g_data->INODE_ORDER = TRUE;
+	} else if (strcmp(uc_option, "INCREMENTAL") == 0) {
+		g_data->INCREMENTAL = TRUE;
+	} else if (strcmp(uc_option, "COMPRESS") == 0) {
+		g_data->COMPRESS = TRUE;
+	} else if (strcmp(uc_option, "DIR-TABLE") == 0) {
+		g_data->DIR_TABLE = TRUE;
+	} else if (strcmp(uc_option, "STATISTICS") == 0) {
+		g_data->STATISTICS = TRUE;
+	} else if (strcmp(uc_option, "DIFF-DB") == 0) {
+		g_data->DIFF_DB = TRUE;
+	} else if (strcmp(uc_option, "COUNT") == 0) {
+		g_data->COUNT = TRUE;
+	} else if (strcmp(uc_option, "XDEV") == 0) {
+		g_data->XDEV = TRUE;
+	} else if (strcmp(uc_option, "PRUNE-FS") == 0) {
+		g_data->PRUNE_FS = TRUE;
+	} else if (strcmp(uc_option, "SKIP-BINDS") == 0) {
+		g_data->SKIP_BINDS = TRUE;
+	} else if (strcmp(uc_option, "PER-FILESYSTEM") == 0) {
+		g_data->PER_FILESYSTEM = TRUE;
+	} else if (strcmp(uc_option, "SHARDS") == 0) {
+		g_data->SHARDS = TRUE;
+	} else if (strcmp(uc_option, "THROTTLE") == 0) {
+		g_data->THROTTLE = THROTTLE_BUDGET;
+	} else if (strcmp(uc_option, "CHECKPOINT") == 0) {
+		g_data->CHECKPOINT = CKPT_INTERVAL;
 
 	}
 
@@ -547,6 +700,41 @@ int parse_dash(struct g_data_s *g_data, char *option)
 				ret = 0;
 				goto EXIT;
 			}
+		} else if (strcmp(uc_option,"THREADS") == 0) {
+			if ((g_data->THREADS = atoi(ptr)) < 1) {
+				report_error(g_data, FATAL, "Invalid number of threads: %s\n", ptr);
+				ret = 0;
+				goto EXIT;
+			}
+		} else if (strcmp(uc_option,"DIFF-MEMORY") == 0) {
+			if (atoi(ptr) < 1) {
+				report_error(g_data, FATAL, "Invalid diff memory: %s\n", ptr);
+				ret = 0;
+				goto EXIT;
+			}
+			g_data->DIFF_MEMORY = (size_t)atoi(ptr) * 1024 * 1024;
+		} else if (strcmp(uc_option,"THROTTLE") == 0) {
+			if ((g_data->THROTTLE = atoi(ptr)) < 1 || g_data->THROTTLE > 100) {
+				report_error(g_data, FATAL, "Invalid throttle budget: %s\n", ptr);
+				ret = 0;
+				goto EXIT;
+			}
+		} else if (strcmp(uc_option,"CHECKPOINT") == 0) {
+			if ((g_data->CHECKPOINT = atoi(ptr)) < 1) {
+				report_error(g_data, FATAL, "Invalid checkpoint interval: %s\n", ptr);
+				ret = 0;
+				goto EXIT;
+			}
+		} else if (strcmp(uc_option,"FROM-LIST") == 0) {
+			if (!add_file(g_data, &g_data->from_list, ptr)) {
+				ret = 0;
+				goto EXIT;
+			}
+		} else if (strcmp(uc_option,"MERGE-DB") == 0) {
+			if (!add_file(g_data, &g_data->merge_db, ptr)) {
+				ret = 0;
+				goto EXIT;
+			}
 		}
 	}
 
@@ -769,11 +957,12 @@ struct cmd_data_s * parse_cmds(struct g_data_s *g_data, int argc, char **argv)
 
 			/* Index from a specific path */
 		 case 'U':
-			/* TODO: Parse multiple paths to index */
 			cmd_data->updatedb = TRUE;
 			if (g_data->index_path)
 			    free(g_data->index_path);
 			g_data->index_path = strdup(optarg);
+			if (!add_index_path(g_data, optarg))
+			    goto EXIT;
 			add_default_db = 0;
 			break;
 		 case 'c':
@@ -863,7 +1052,10 @@ struct cmd_data_s * parse_cmds(struct g_data_s *g_data, int argc, char **argv)
 		}
 	}
 
-	if (!cmd_data->updatedb) {
+	if (cmd_data->updatedb)
+	    parse_updatedb(g_data, cmd_data->updatedb_conf);
+	/* --diff-db reads only the databases given as arguments */
+	else if (!g_data->DIFF_DB) {
 		/* Parse environment variables */
 		if ((ENV_locate_path = getenv("LOCATE_PATH"))) {
 			if (!parse_userdb(g_data, getenv("LOCATE_PATH")))
@@ -874,8 +1066,7 @@ struct cmd_data_s * parse_cmds(struct g_data_s *g_data, int argc, char **argv)
 			if (!parse_userdb(g_data, DEFAULT_DB))
 			    goto EXIT;
 		}
-	} else
-	    parse_updatedb(g_data, cmd_data->updatedb_conf);
+	}
 
 	return cmd_data;
 
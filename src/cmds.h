@@ -29,5 +29,7 @@ void free_cmd_data(struct cmd_data_s *cmd_data);
 struct cmd_data_s * parse_cmds(struct g_data_s *g_data, int argc, char **argv);
 int parse_fs_exclude(struct g_data_s *g_data, char *data_str);
 int parse_exclude(struct g_data_s *g_data, char *estr);
+int add_index_path(struct g_data_s *g_data, char *path);
+int add_file(struct g_data_s *g_data, char ***files, char *file);
 
 #endif
@@ -0,0 +1,532 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* --threads: parallel crawl for create_db(). Worker threads list
+ * directories, every worker has its own deque of directories to list and
+ * steals from the others, when it is empty. The encoder walks the listed
+ * directories in the order of fts_read() with rlocate_ftscompare(), so the
+ * database is the same as with the serial crawl, and lists a directory
+ * itself, if no worker has taken it yet. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "crawl.h"
+#include "prune.h"
+#include "throttle.h"
+
+extern int encode(struct g_data_s *g_data, FILE *fd, char *path, struct enc_data_s *enc_data);
+
+/* Worker argument */
+struct crawl_worker_s {
+	struct crawl_s *crawl;
+	int self;
+};
+
+/*
+ * crawl_excluded() returns 1, if the path is excluded. It is the same test
+ * as match_exclude() without the verbose output.
+ */
+static int crawl_excluded(struct g_data_s *g_data, const char *path)
+{
+	return g_data->prune && prune_match(g_data->prune, path, PRUNE_EXACT);
+}
+
+/*
+ * crawl_new_dir() returns a directory, that has to be listed.
+ */
+static struct crawl_dir_s *crawl_new_dir(struct g_data_s *g_data, char *path,
+					 struct stat *dir_stat,
+					 struct crawl_dir_s *parent)
+{
+	struct crawl_dir_s *dir;
+
+	if (!(dir = calloc(1, sizeof(struct crawl_dir_s)))) {
+		report_error(g_data, FATAL, "crawl_new_dir: calloc: %s\n", strerror(errno));
+		return NULL;
+	}
+	dir->path = path;
+	dir->dev = dir_stat->st_dev;
+	dir->ino = dir_stat->st_ino;
+	dir->nlink = dir_stat->st_nlink;
+	dir->parent = parent;
+	dir->state = CRAWL_PENDING;
+	return dir;
+}
+
+/*
+ * crawl_free_dir() frees a directory after it was encoded.
+ */
+static void crawl_free_dir(struct crawl_dir_s *dir)
+{
+	free(dir->path);
+	free(dir->item);
+	free(dir->names);
+	dir->path = NULL;
+	dir->item = NULL;
+	dir->names = NULL;
+	if (!dir->queued)
+		free(dir);
+}
+
+/*
+ * crawl_path() returns the path of entry 'name' in 'dir', as fts_read()
+ * builds it.
+ */
+static char *crawl_path(struct g_data_s *g_data, const char *dir,
+			const char *name)
+{
+	int dir_len = strlen(dir);
+	char *path;
+
+	/* no double '/' below the root directory */
+	if (dir_len && dir[dir_len - 1] == '/')
+		dir_len--;
+	if (!(path = malloc(dir_len + strlen(name) + 2))) {
+		report_error(g_data, FATAL, "crawl_path: malloc: %s\n", strerror(errno));
+		return NULL;
+	}
+	memcpy(path, dir, dir_len);
+	path[dir_len] = '/';
+	strcpy(path + dir_len + 1, name);
+	return path;
+}
+
+static int crawl_compare(const void *e1, const void *e2, void *names)
+{
+	return strcmp((char *)names + ((const struct crawl_item_s *)e1)->name,
+		      (char *)names + ((const struct crawl_item_s *)e2)->name);
+}
+
+/*
+ * crawl_list() reads the entries of a directory and sorts them. The
+ * entries are stat()ed, skipped and descended into exactly like fts_build()
+ * does with FTS_PHYSICAL | FTS_NOSTAT, and FTS_XDEV for --xdev, including
+ * the directories, that fts_read() returns twice, because they could not
+ * be opened.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+static int crawl_list(struct crawl_s *crawl, struct crawl_dir_s *dir)
+{
+	struct g_data_s *g_data = crawl->g_data;
+	DIR *dirp = NULL;
+	struct dirent *entry;
+	struct stat st;
+	struct crawl_dir_s *t;
+	struct crawl_item_s *item;
+	char *name;
+	char *path;
+	long nlinks;
+	int names_len = 0, names_alloc = 0, alloc = 0;
+	int fd, len, descend;
+	int ret = 0;
+
+	if ((fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW)) == -1 ||
+	    !(dirp = fdopendir(fd))) {
+		if (fd != -1)
+			close(fd);
+		/* FTS_DNR */
+		dir->reemit = 1;
+		return 1;
+	}
+	/* fts_build() changes into the directory and returns no entries, if
+	 * it can't */
+	if (fstatat(fd, ".", &st, 0) == -1) {
+		ret = 1;
+		goto EXIT;
+	}
+	/* the subdirectories are counted with the link count */
+	nlinks = (long)dir->nlink - 2;
+
+	while ((entry = readdir(dirp))) {
+		name = entry->d_name;
+		if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+			continue;
+		descend = 0;
+		if (nlinks && (entry->d_type == DT_DIR || entry->d_type == DT_UNKNOWN)) {
+			if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+				continue;	/* FTS_NS */
+			if (S_ISDIR(st.st_mode)) {
+				if (nlinks > 0)
+					nlinks--;
+				descend = 1;
+				/* FTS_DC */
+				for (t = dir; t; t = t->parent)
+					if (t->dev == st.st_dev && t->ino == st.st_ino)
+						descend = 0;
+				/* FTS_XDEV */
+				if (g_data->XDEV && st.st_dev != crawl->dev)
+					descend = 0;
+			}
+		}
+		len = strlen(name) + 1;
+		if (names_len + len > names_alloc) {
+			names_alloc = names_alloc * 2 + len + 256;
+			if (!(dir->names = realloc(dir->names, names_alloc))) {
+				report_error(g_data, FATAL, "crawl_list: realloc: %s\n", strerror(errno));
+				goto EXIT;
+			}
+		}
+		if (dir->count == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			if (!(dir->item = realloc(dir->item, sizeof(struct crawl_item_s) * alloc))) {
+				report_error(g_data, FATAL, "crawl_list: realloc: %s\n", strerror(errno));
+				goto EXIT;
+			}
+		}
+		item = &dir->item[dir->count++];
+		item->name = names_len;
+		item->dir = NULL;
+		memcpy(dir->names + names_len, name, len);
+		names_len += len;
+		if (!descend)
+			continue;
+		if (!(path = crawl_path(g_data, dir->path, name)))
+			goto EXIT;
+		if (crawl_excluded(g_data, path)) {
+			free(path);
+			continue;
+		}
+		if (!(item->dir = crawl_new_dir(g_data, path, &st, dir))) {
+			free(path);
+			goto EXIT;
+		}
+	}
+	throttle_read(g_data->throttle, dir->count);
+	if (dir->count > 1)
+		qsort_r(dir->item, dir->count, sizeof(struct crawl_item_s),
+			crawl_compare, dir->names);
+	ret = 1;
+EXIT:
+	closedir(dirp);
+	return ret;
+}
+
+/*
+ * crawl_push() queues the subdirectories of 'dir' in the deque of worker
+ * 'self', the first one at the tail, where the owner takes it from.
+ * Called with the lock held.
+ */
+static int crawl_push(struct crawl_s *crawl, int self, struct crawl_dir_s *dir)
+{
+	struct crawl_deque_s *deque = &crawl->deque[self];
+	int i;
+
+	for (i = dir->count - 1; i >= 0; i--) {
+		if (!dir->item[i].dir)
+			continue;
+		if (deque->tail == deque->alloc) {
+			if (deque->head > 0) {
+				memmove(deque->dir, deque->dir + deque->head,
+					sizeof(struct crawl_dir_s *) * (deque->tail - deque->head));
+				deque->tail -= deque->head;
+				deque->head = 0;
+			} else {
+				deque->alloc = deque->alloc ? deque->alloc * 2 : 256;
+				if (!(deque->dir = realloc(deque->dir, sizeof(struct crawl_dir_s *) * deque->alloc))) {
+					report_error(crawl->g_data, FATAL, "crawl_push: realloc: %s\n", strerror(errno));
+					return 0;
+				}
+			}
+		}
+		dir->item[i].dir->queued = 1;
+		deque->dir[deque->tail++] = dir->item[i].dir;
+	}
+	pthread_cond_broadcast(&crawl->work);
+	return 1;
+}
+
+/*
+ * crawl_take() takes the next directory for worker 'self': from the tail
+ * of its own deque or from the head of another one. Called with the lock
+ * held.
+ */
+static struct crawl_dir_s *crawl_take(struct crawl_s *crawl, int self)
+{
+	struct crawl_deque_s *deque;
+	struct crawl_dir_s *dir;
+	int i, n = crawl->threads + 1;
+
+	for (i = 0; i < n; i++) {
+		deque = &crawl->deque[(self + i) % n];
+		if (deque->head == deque->tail)
+			continue;
+		if (i == 0)
+			dir = deque->dir[--deque->tail];
+		else
+			dir = deque->dir[deque->head++];
+		if (deque->head == deque->tail)
+			deque->head = deque->tail = 0;
+		return dir;
+	}
+	return NULL;
+}
+
+/*
+ * crawl_claimed() lists a directory, that was claimed by worker 'self',
+ * and queues its subdirectories. Called with the lock held, that is
+ * released while the directory is read.
+ */
+static void crawl_claimed(struct crawl_s *crawl, int self,
+			  struct crawl_dir_s *dir)
+{
+	int ok;
+
+	crawl->listed++;
+	pthread_mutex_unlock(&crawl->lock);
+	ok = crawl_list(crawl, dir);
+	pthread_mutex_lock(&crawl->lock);
+	if (!ok || !crawl_push(crawl, self, dir))
+		crawl->error = 1;
+	dir->state = CRAWL_DONE;
+	pthread_cond_broadcast(&crawl->done);
+}
+
+/*
+ * crawl_worker() lists directories, until the crawl is over.
+ */
+static void *crawl_worker(void *arg)
+{
+	struct crawl_worker_s *worker = arg;
+	struct crawl_s *crawl = worker->crawl;
+	struct crawl_dir_s *dir;
+	int parked;
+
+	pthread_mutex_lock(&crawl->lock);
+	while (!crawl->stop && !crawl->error) {
+		/* don't get too far ahead of the encoder */
+		if (crawl->listed >= CRAWL_MAX_LISTED) {
+			pthread_cond_wait(&crawl->room, &crawl->lock);
+			continue;
+		}
+		/* a throttled worker waits, while the machine is busy */
+		if (crawl->g_data->throttle) {
+			pthread_mutex_unlock(&crawl->lock);
+			parked = throttle_park(crawl->g_data->throttle, worker->self);
+			pthread_mutex_lock(&crawl->lock);
+			if (parked)
+				continue;
+		}
+		if (!(dir = crawl_take(crawl, worker->self))) {
+			pthread_cond_wait(&crawl->work, &crawl->lock);
+			continue;
+		}
+		dir->queued = 0;
+		if (dir->state == CRAWL_DEAD)
+			free(dir);
+		else if (dir->state == CRAWL_PENDING) {
+			dir->state = CRAWL_CLAIMED;
+			crawl_claimed(crawl, worker->self, dir);
+		}
+	}
+	pthread_mutex_unlock(&crawl->lock);
+	return NULL;
+}
+
+/*
+ * crawl_wait() waits, until 'dir' is listed. If no worker has taken it
+ * yet, the encoder lists it itself.
+ */
+static int crawl_wait(struct crawl_s *crawl, struct crawl_dir_s *dir)
+{
+	int ok;
+
+	pthread_mutex_lock(&crawl->lock);
+	if (dir->state == CRAWL_PENDING) {
+		dir->state = CRAWL_CLAIMED;
+		crawl_claimed(crawl, crawl->threads, dir);
+	}
+	while (dir->state != CRAWL_DONE && !crawl->error)
+		pthread_cond_wait(&crawl->done, &crawl->lock);
+	ok = !crawl->error;
+	pthread_mutex_unlock(&crawl->lock);
+	return ok;
+}
+
+/*
+ * crawl_walk() encodes the entries of 'dir' and descends into the
+ * subdirectories in the order of fts_read().
+ */
+static int crawl_walk(struct crawl_s *crawl, FILE *fd,
+		      struct enc_data_s *enc_data, struct crawl_dir_s *dir)
+{
+	struct g_data_s *g_data = crawl->g_data;
+	struct crawl_item_s *item;
+	char *leaf = NULL;
+	char *path;
+	int matched;
+	int i;
+	int ret = 0;
+
+	if (!crawl_wait(crawl, dir))
+		goto EXIT;
+	for (i = 0; i < dir->count; i++) {
+		item = &dir->item[i];
+		if (item->dir)
+			path = item->dir->path;
+		else if (!(path = leaf = crawl_path(g_data, dir->path, dir->names + item->name)))
+			goto EXIT;
+		matched = 0;
+		if (!g_data->exclude || !(matched = match_exclude(g_data, path))) {
+			if (!encode(g_data, fd, path, enc_data))
+				goto EXIT;
+			if (item->dir && !crawl_walk(crawl, fd, enc_data, item->dir))
+				goto EXIT;
+		} else if (matched == -1) {
+			goto EXIT;
+		}
+		if (leaf) {
+			free(leaf);
+			leaf = NULL;
+		}
+	}
+	if (dir->reemit && !encode(g_data, fd, dir->path, enc_data))
+		goto EXIT;
+	ret = 1;
+EXIT:
+	if (leaf)
+		free(leaf);
+	/* after an error, a worker might still be listing it */
+	pthread_mutex_lock(&crawl->lock);
+	if (dir->state == CRAWL_DONE) {
+		crawl->listed--;
+		if (dir->queued)
+			dir->state = CRAWL_DEAD;
+		crawl_free_dir(dir);
+		pthread_cond_broadcast(&crawl->room);
+	}
+	pthread_mutex_unlock(&crawl->lock);
+	return ret;
+}
+
+/*
+ * crawl_tree() encodes 'root' with g_data->THREADS workers.
+ */
+int crawl_tree(struct g_data_s *g_data, const char *root_path, FILE *fd,
+	       struct enc_data_s *enc_data)
+{
+	struct crawl_s crawl;
+	struct crawl_worker_s *worker = NULL;
+	pthread_t *thread = NULL;
+	struct crawl_dir_s *root = NULL;
+	struct stat root_stat;
+	char *path = NULL;
+	int started = 0;
+	int matched = 0;
+	int i;
+	int ret = 0;
+
+	memset(&crawl, 0, sizeof(crawl));
+	crawl.g_data = g_data;
+	crawl.threads = g_data->THREADS;
+	throttle_workers(g_data->throttle, crawl.threads);
+	pthread_mutex_init(&crawl.lock, NULL);
+	pthread_cond_init(&crawl.work, NULL);
+	pthread_cond_init(&crawl.done, NULL);
+	pthread_cond_init(&crawl.room, NULL);
+
+	/* fts_read() skips a root, that can not be stat()ed */
+	if (lstat(root_path, &root_stat) == -1) {
+		ret = 1;
+		goto EXIT;
+	}
+	if (g_data->exclude && (matched = match_exclude(g_data, (char *)root_path))) {
+		ret = matched != -1;
+		goto EXIT;
+	}
+	if (!encode(g_data, fd, (char *)root_path, enc_data))
+		goto EXIT;
+	if (!S_ISDIR(root_stat.st_mode)) {
+		ret = 1;
+		goto EXIT;
+	}
+	crawl.dev = root_stat.st_dev;
+	if (!(path = strdup(root_path))) {
+		report_error(g_data, FATAL, "crawl_tree: strdup: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	if (!(root = crawl_new_dir(g_data, path, &root_stat, NULL))) {
+		free(path);
+		goto EXIT;
+	}
+	/* one deque for every worker and one for the encoder */
+	if (!(crawl.deque = calloc(crawl.threads + 1, sizeof(struct crawl_deque_s))) ||
+	    !(worker = calloc(crawl.threads, sizeof(struct crawl_worker_s))) ||
+	    !(thread = calloc(crawl.threads, sizeof(pthread_t)))) {
+		report_error(g_data, FATAL, "crawl_tree: calloc: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	for (started = 0; started < crawl.threads; started++) {
+		worker[started].crawl = &crawl;
+		worker[started].self = started;
+		if ((errno = pthread_create(&thread[started], NULL, crawl_worker, &worker[started]))) {
+			report_error(g_data, FATAL, "crawl_tree: pthread_create: %s\n", strerror(errno));
+			goto EXIT;
+		}
+	}
+	ret = crawl_walk(&crawl, fd, enc_data, root);
+	root = NULL;
+EXIT:
+	pthread_mutex_lock(&crawl.lock);
+	crawl.stop = 1;
+	pthread_cond_broadcast(&crawl.work);
+	pthread_cond_broadcast(&crawl.room);
+	pthread_mutex_unlock(&crawl.lock);
+	for (i = 0; i < started; i++)
+		pthread_join(thread[i], NULL);
+	/* only encoded directories are left in the deques after a
+	 * successful crawl */
+	for (i = 0; crawl.deque && i <= crawl.threads; i++) {
+		while (crawl.deque[i].head < crawl.deque[i].tail) {
+			root = crawl.deque[i].dir[crawl.deque[i].head++];
+			root->queued = 0;
+			if (root->state == CRAWL_DEAD)
+				free(root);
+		}
+		free(crawl.deque[i].dir);
+	}
+	root = NULL;
+	if (crawl.deque)
+		free(crawl.deque);
+	if (worker)
+		free(worker);
+	if (thread)
+		free(thread);
+	pthread_cond_destroy(&crawl.work);
+	pthread_cond_destroy(&crawl.done);
+	pthread_cond_destroy(&crawl.room);
+	pthread_mutex_destroy(&crawl.lock);
+	return ret;
+}
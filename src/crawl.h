@@ -0,0 +1,67 @@
+#ifndef CRAWL_H
+#define CRAWL_H 1
+
+#include <pthread.h>
+#include <sys/types.h>
+
+/* Listed directories, that were not encoded yet. The workers wait, when
+ * they are that far ahead of the encoder. */
+#define CRAWL_MAX_LISTED 4096
+
+/* Directory states */
+#define CRAWL_PENDING 0		/* waiting in a deque */
+#define CRAWL_CLAIMED 1		/* being listed */
+#define CRAWL_DONE    2		/* listed */
+#define CRAWL_DEAD    3		/* encoded, but still in a deque */
+
+struct crawl_dir_s;
+
+/* Directory entry */
+struct crawl_item_s {
+	int name;			/* offset in names */
+	struct crawl_dir_s *dir;	/* set, if it is descended into */
+};
+
+/* Directory, that is listed by one of the workers */
+struct crawl_dir_s {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	nlink_t nlink;
+	struct crawl_dir_s *parent;
+	int state;
+	int queued;		/* it is in a deque */
+	int reemit;		/* fts returns it a second time */
+	struct crawl_item_s *item;
+	int count;
+	char *names;
+};
+
+/* Work stealing deque. The owner takes from the tail, thieves from the
+ * head. */
+struct crawl_deque_s {
+	struct crawl_dir_s **dir;
+	int head;
+	int tail;
+	int alloc;
+};
+
+/* Crawl data, the deques and the states are protected by lock */
+struct crawl_s {
+	struct g_data_s *g_data;
+	pthread_mutex_t lock;
+	pthread_cond_t work;		/* a directory was queued */
+	pthread_cond_t done;		/* a directory was listed */
+	pthread_cond_t room;		/* a listed directory was encoded */
+	struct crawl_deque_s *deque;
+	int threads;
+	dev_t dev;			/* of the root for --xdev */
+	int listed;
+	int stop;
+	int error;
+};
+
+int crawl_tree(struct g_data_s *g_data, const char *root, FILE *fd,
+	       struct enc_data_s *enc_data);
+
+#endif /* !CRAWL_H */
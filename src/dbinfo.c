@@ -0,0 +1,614 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Header and footer of the database. The header says, how to read the
+ * data, the footer, how many paths there are, where the data ends, when and
+ * from what the database was built and how many times it was updated. A
+ * database, whose footer is not where the header says, is truncated. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "profile.h"
+#include "block.h"
+#include "dbinfo.h"
+
+/*
+ * db_generation() returns the generation of the database 'database' or 0,
+ * if there is none or it has no footer.
+ */
+static uint64_t db_generation(const char *database)
+{
+	struct db_header_s header;
+	struct db_footer_s footer;
+	struct stat db_stat;
+	uint64_t generation = 0;
+	int fd;
+
+	if ((fd = open(database, O_RDONLY)) == -1)
+		return 0;
+	if (fstat(fd, &db_stat) == 0 &&
+	    (uint64_t)db_stat.st_size >= sizeof(header) + sizeof(footer) &&
+	    pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+	    pread(fd, &footer, sizeof(footer), db_stat.st_size - sizeof(footer)) == sizeof(footer) &&
+	    memcmp(header.magic, DB_MAGIC, sizeof(header.magic)) == 0 &&
+	    memcmp(footer.magic, DB_MAGIC, sizeof(footer.magic)) == 0)
+		generation = footer.generation;
+	close(fd);
+	return generation;
+}
+
+/*
+ * db_create() writes the header of a database of 'format' to 'fd' and
+ * returns the writer. The generation follows the one of the database, that
+ * is replaced.
+ */
+struct db_writer_s *db_create(struct g_data_s *g_data, FILE *fd, int format)
+{
+	struct db_writer_s *db;
+	struct db_header_s header;
+
+	if (!(db = calloc(1, sizeof(struct db_writer_s)))) {
+		report_error(g_data, FATAL, "db_create: calloc: %s\n", strerror(errno));
+		return NULL;
+	}
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DB_MAGIC, sizeof(header.magic));
+	header.version = DB_VERSION;
+	header.format = format;
+	header.slevel = g_data->slevel;
+	if (fwrite(&header, sizeof(header), 1, fd) != 1) {
+		report_error(g_data, FATAL, "db_create: fwrite: %s\n", strerror(errno));
+		free(db);
+		return NULL;
+	}
+	db->format = format;
+	db->slevel = header.slevel;
+	db->offset = sizeof(header);
+	db->built = time(NULL);
+	db->generation = db_generation(g_data->output_db) + 1;
+	return db;
+}
+
+/*
+ * db_offset() adds the position of a path, that is encoded without a
+ * common prefix, to the offset table.
+ */
+int db_offset(struct g_data_s *g_data, struct db_writer_s *db, uint64_t offset)
+{
+	uint64_t *ptr;
+
+	if (db->offsets_count == db->offsets_alloc) {
+		db->offsets_alloc = db->offsets_alloc ? db->offsets_alloc * 2 : 256;
+		if (!(ptr = realloc(db->offsets, sizeof(uint64_t) * db->offsets_alloc))) {
+			report_error(g_data, FATAL, "db_offset: realloc: %s\n", strerror(errno));
+			return 0;
+		}
+		db->offsets = ptr;
+	}
+	db->offsets[db->offsets_count++] = offset;
+	return 1;
+}
+
+/*
+ * db_varint() writes 'v' to 'buf' seven bits at a time and returns the
+ * number of bytes.
+ */
+static size_t db_varint(unsigned char *buf, uint64_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		buf[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	buf[n++] = v;
+	return n;
+}
+
+static int db_varint_get(const char **pos, const char *end, uint64_t *v)
+{
+	uint64_t x = 0;
+	unsigned char b;
+	int shift = 0;
+
+	do {
+		if (*pos == end || shift > 63)
+			return 0;
+		b = *(*pos)++;
+		x |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+	*v = x;
+	return 1;
+}
+
+/*
+ * db_set() copies the path 'path' of 'len' bytes to 'buf'.
+ */
+static int db_set(char **buf, size_t *alloc, const char *path, size_t len)
+{
+	char *ptr;
+
+	if (len + 1 > *alloc) {
+		if (!(ptr = realloc(*buf, len + 1)))
+			return 0;
+		*buf = ptr;
+		*alloc = len + 1;
+	}
+	memcpy(*buf, path, len + 1);
+	return 1;
+}
+
+/*
+ * db_chunks_add() appends the summary of a chunk to the chunks of 'db'.
+ */
+static int db_chunks_add(struct db_writer_s *db, uint64_t count, uint64_t last_prefix,
+			 const char *first, const char *min, const char *max)
+{
+	size_t first_len = strlen(first) + 1;
+	size_t min_len = strlen(min) + 1;
+	size_t max_len = strlen(max) + 1;
+	size_t need = db->chunks_len + 2 * 10 + first_len + min_len + max_len;
+	unsigned char *ptr;
+
+	if (need > db->chunks_alloc) {
+		if (!(ptr = realloc(db->chunks, need * 2)))
+			return 0;
+		db->chunks = (char *)ptr;
+		db->chunks_alloc = need * 2;
+	}
+	ptr = (unsigned char *)db->chunks + db->chunks_len;
+	ptr += db_varint(ptr, count);
+	ptr += db_varint(ptr, last_prefix);
+	memcpy(ptr, first, first_len);
+	ptr += first_len;
+	memcpy(ptr, min, min_len);
+	ptr += min_len;
+	memcpy(ptr, max, max_len);
+	ptr += max_len;
+	db->chunks_len = (char *)ptr - db->chunks;
+	return 1;
+}
+
+/*
+ * db_chunk_add() adds the path 'path' of 'len' bytes, that was encoded with
+ * the common prefix 'prefix', to the chunk, that is written.
+ */
+int db_chunk_add(struct g_data_s *g_data, struct db_writer_s *db,
+		 const char *path, size_t len, size_t prefix)
+{
+	if (!db->chunk_count) {
+		if (!db_set(&db->first, &db->first_alloc, path, len) ||
+		    !db_set(&db->min, &db->min_alloc, path, len) ||
+		    !db_set(&db->max, &db->max_alloc, path, len))
+			goto NOMEM;
+	} else if (strcmp(path, db->min) < 0) {
+		if (!db_set(&db->min, &db->min_alloc, path, len))
+			goto NOMEM;
+	} else if (strcmp(path, db->max) > 0) {
+		if (!db_set(&db->max, &db->max_alloc, path, len))
+			goto NOMEM;
+	}
+	db->chunk_count++;
+	db->last_prefix = prefix;
+	return 1;
+NOMEM:
+	report_error(g_data, FATAL, "db_chunk_add: realloc: %s\n", strerror(errno));
+	return 0;
+}
+
+/*
+ * db_chunk_end() ends the chunk, that is written, at the end of a block or
+ * before the next entry of the offset table.
+ */
+int db_chunk_end(struct g_data_s *g_data, struct db_writer_s *db)
+{
+	if (!db->chunk_count)
+		return 1;
+	if (!db_chunks_add(db, db->chunk_count, db->last_prefix, db->first, db->min, db->max)) {
+		report_error(g_data, FATAL, "db_chunk_end: realloc: %s\n", strerror(errno));
+		return 0;
+	}
+	db->chunk_count = 0;
+	return 1;
+}
+
+/*
+ * db_chunk_copy() adds the summary of a chunk, that was copied from the
+ * database, that is updated.
+ */
+int db_chunk_copy(struct g_data_s *g_data, struct db_writer_s *db,
+		  const struct db_chunk_s *chunk)
+{
+	if (!db_chunks_add(db, chunk->count, chunk->last_prefix, chunk->first, chunk->min, chunk->max)) {
+		report_error(g_data, FATAL, "db_chunk_copy: realloc: %s\n", strerror(errno));
+		return 0;
+	}
+	db->count += chunk->count;
+	return 1;
+}
+
+/*
+ * db_info_add() appends 'key=value\0' to 'info'.
+ */
+static int db_info_add(char **info, size_t *len, const char *key, const char *value)
+{
+	size_t n = strlen(key) + 1 + strlen(value) + 1;
+	char *ptr;
+
+	if (!(ptr = realloc(*info, *len + n)))
+		return 0;
+	sprintf(ptr + *len, "%s=%s", key, value);
+	*info = ptr;
+	*len += n;
+	return 1;
+}
+
+/*
+ * db_finish() writes the offset table, the info, the chunks and the footer.
+ * The data of the format has to be written before.
+ */
+int db_finish(struct g_data_s *g_data, FILE *fd, struct db_writer_s *db)
+{
+	struct db_footer_s footer;
+	char *info = NULL;
+	size_t info_len = 0;
+	off_t data_end;
+	int i;
+	int ret = 0;
+
+	if (!db_chunk_end(g_data, db))
+		goto EXIT;
+	if (fflush(fd) == EOF || (data_end = ftello(fd)) == -1) {
+		report_error(g_data, FATAL, "db_finish: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	for (i = 0; g_data->index_paths && g_data->index_paths[i]; i++) {
+		if (!db_info_add(&info, &info_len, "root", g_data->index_paths[i]))
+			goto NOMEM;
+	}
+	for (i = 0; g_data->exclude && g_data->exclude[i]; i++) {
+		if (!db_info_add(&info, &info_len, "exclude", g_data->exclude[i]))
+			goto NOMEM;
+	}
+	for (i = 0; g_data->alias && g_data->alias[i]; i++) {
+		if (!db_info_add(&info, &info_len, "alias", g_data->alias[i]))
+			goto NOMEM;
+	}
+	memset(&footer, 0, sizeof(footer));
+	footer.count = db->count;
+	footer.data_end = data_end;
+	footer.offsets_count = db->offsets_count;
+	footer.info_len = info_len;
+	footer.chunks_len = db->chunks_len;
+	footer.built = db->built;
+	footer.generation = db->generation;
+	footer.version = DB_VERSION;
+	footer.format = db->format;
+	footer.slevel = db->slevel;
+	memcpy(footer.magic, DB_MAGIC, sizeof(footer.magic));
+	if (fwrite(db->offsets, sizeof(uint64_t), db->offsets_count, fd) != db->offsets_count ||
+	    fwrite(info, 1, info_len, fd) != info_len ||
+	    fwrite(db->chunks, 1, db->chunks_len, fd) != db->chunks_len ||
+	    fwrite(&footer, sizeof(footer), 1, fd) != 1) {
+		report_error(g_data, FATAL, "db_finish: fwrite: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	ret = 1;
+	goto EXIT;
+NOMEM:
+	report_error(g_data, FATAL, "db_finish: realloc: %s\n", strerror(errno));
+EXIT:
+	if (info)
+		free(info);
+	return ret;
+}
+
+void db_free(struct db_writer_s *db)
+{
+	if (!db)
+		return;
+	free(db->offsets);
+	free(db->first);
+	free(db->min);
+	free(db->max);
+	free(db->chunks);
+	free(db);
+}
+
+/*
+ * db_save() writes the state of the writer 'db' to the checkpoint 'fp'.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int db_save(struct g_data_s *g_data, FILE *fp, const struct db_writer_s *db)
+{
+	struct db_state_s state;
+
+	memset(&state, 0, sizeof(state));
+	state.count = db->count;
+	state.offset = db->offset;
+	state.offsets_count = db->offsets_count;
+	state.chunk_count = db->chunk_count;
+	state.last_prefix = db->last_prefix;
+	state.chunks_len = db->chunks_len;
+	state.built = db->built;
+	state.generation = db->generation;
+	state.format = db->format;
+	state.slevel = db->slevel;
+	if (fwrite(&state, sizeof(state), 1, fp) != 1 ||
+	    fwrite(db->offsets, sizeof(uint64_t), db->offsets_count, fp) != db->offsets_count ||
+	    fwrite(db->chunks, 1, db->chunks_len, fp) != db->chunks_len ||
+	    (db->chunk_count &&
+	     (fwrite(db->first, strlen(db->first) + 1, 1, fp) != 1 ||
+	      fwrite(db->min, strlen(db->min) + 1, 1, fp) != 1 ||
+	      fwrite(db->max, strlen(db->max) + 1, 1, fp) != 1))) {
+		report_error(g_data, FATAL, "db_save: fwrite: %s\n", strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * db_load() returns the writer, whose state db_save() wrote to 'fp'. It
+ * returns NULL without an error, if the state is cut off.
+ */
+struct db_writer_s *db_load(struct g_data_s *g_data, FILE *fp)
+{
+	struct db_writer_s *db;
+	struct db_state_s state;
+
+	if (fread(&state, sizeof(state), 1, fp) != 1)
+		return NULL;
+	if (!(db = calloc(1, sizeof(struct db_writer_s)))) {
+		report_error(g_data, FATAL, "db_load: calloc: %s\n", strerror(errno));
+		return NULL;
+	}
+	db->format = state.format;
+	db->slevel = state.slevel;
+	db->count = state.count;
+	db->offset = state.offset;
+	db->built = state.built;
+	db->generation = state.generation;
+	db->chunk_count = state.chunk_count;
+	db->last_prefix = state.last_prefix;
+	if ((state.offsets_count &&
+	     !(db->offsets = malloc(sizeof(uint64_t) * state.offsets_count))) ||
+	    (state.chunks_len && !(db->chunks = malloc(state.chunks_len)))) {
+		report_error(g_data, FATAL, "db_load: malloc: %s\n", strerror(errno));
+		db_free(db);
+		return NULL;
+	}
+	db->offsets_count = db->offsets_alloc = state.offsets_count;
+	db->chunks_len = db->chunks_alloc = state.chunks_len;
+	if (fread(db->offsets, sizeof(uint64_t), db->offsets_count, fp) != db->offsets_count ||
+	    fread(db->chunks, 1, db->chunks_len, fp) != db->chunks_len ||
+	    (db->chunk_count &&
+	     (getdelim(&db->first, &db->first_alloc, '\0', fp) == -1 ||
+	      getdelim(&db->min, &db->min_alloc, '\0', fp) == -1 ||
+	      getdelim(&db->max, &db->max_alloc, '\0', fp) == -1))) {
+		db_free(db);
+		return NULL;
+	}
+	return db;
+}
+
+/*
+ * db_open() reads the footer, the offset table, the info and the chunks of
+ * the database
+ * of version 2, that is open in 'reader'. It is called by block_open().
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int db_open(struct g_data_s *g_data, struct block_reader_s *reader,
+	    const char *database)
+{
+	struct db_info_s *info = &reader->info;
+	struct db_header_s header;
+	struct db_footer_s footer;
+	struct stat db_stat;
+	uint64_t tail;
+	char *buf = NULL;
+
+	PROF_COUNT(syscalls, 3);
+	if (fstat(reader->fd, &db_stat) == -1 ||
+	    (uint64_t)db_stat.st_size < sizeof(header) + sizeof(footer) ||
+	    pread(reader->fd, &header, sizeof(header), 0) != sizeof(header) ||
+	    pread(reader->fd, &footer, sizeof(footer), db_stat.st_size - sizeof(footer)) != sizeof(footer))
+		goto DAMAGED;
+	if (memcmp(footer.magic, DB_MAGIC, sizeof(footer.magic)) != 0)
+		goto DAMAGED;
+	if (header.version != DB_VERSION) {
+		report_error(g_data, FATAL, "db_open: '%s': Unknown database version %d.\n", database, header.version);
+		return 0;
+	}
+	/* the tail is the offset table, the info and the chunks */
+	tail = db_stat.st_size - sizeof(footer) - footer.data_end;
+	if (footer.version != header.version || footer.format != header.format || footer.slevel != header.slevel ||
+	    footer.data_end < sizeof(header) ||
+	    footer.data_end > db_stat.st_size - sizeof(footer) ||
+	    footer.offsets_count > tail / sizeof(uint64_t) ||
+	    footer.info_len > tail - footer.offsets_count * sizeof(uint64_t) ||
+	    footer.chunks_len != tail - footer.offsets_count * sizeof(uint64_t) - footer.info_len)
+		goto DAMAGED;
+	if (header.format > DB_DIRTAB) {
+		report_error(g_data, FATAL, "db_open: '%s': Unknown database format %d.\n", database, header.format);
+		return 0;
+	}
+	if (!(buf = malloc(tail + 1))) {
+		report_error(g_data, FATAL, "db_open: malloc: %s\n", strerror(errno));
+		return 0;
+	}
+	PROF_COUNT(syscalls, 1);
+	if (pread(reader->fd, buf, tail, footer.data_end) != (ssize_t)tail) {
+		free(buf);
+		goto DAMAGED;
+	}
+	buf[tail] = '\0';
+	/* all are in the one buffer */
+	info->offsets = (uint64_t *)buf;
+	info->offsets_count = footer.offsets_count;
+	info->info = buf + footer.offsets_count * sizeof(uint64_t);
+	info->info_len = footer.info_len;
+	info->chunks = info->info + footer.info_len;
+	info->chunks_len = footer.chunks_len;
+	info->version = header.version;
+	info->format = header.format;
+	info->count = footer.count;
+	info->data_end = footer.data_end;
+	info->built = footer.built;
+	info->generation = footer.generation;
+	reader->slevel = header.slevel;
+	return 1;
+DAMAGED:
+	report_error(g_data, FATAL, "db_open: '%s': The database is truncated or damaged.\n", database);
+	return 0;
+}
+
+/*
+ * db_chunks() returns the 'count' chunks of the database, that point into
+ * 'info', or NULL, if there are none or they are damaged. The array has to
+ * be freed.
+ */
+struct db_chunk_s *db_chunks(struct g_data_s *g_data, struct db_info_s *info,
+			     uint64_t *count)
+{
+	struct db_chunk_s *chunks = NULL, *ptr;
+	const char *pos = info->chunks;
+	const char *end = pos + info->chunks_len;
+	uint64_t alloc = 0;
+	int i;
+
+	*count = 0;
+	while (pos < end) {
+		if (*count == alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			if (!(ptr = realloc(chunks, sizeof(struct db_chunk_s) * alloc))) {
+				report_error(g_data, FATAL, "db_chunks: realloc: %s\n", strerror(errno));
+				goto ERROR;
+			}
+			chunks = ptr;
+		}
+		ptr = &chunks[*count];
+		if (!db_varint_get(&pos, end, &ptr->count) ||
+		    !db_varint_get(&pos, end, &ptr->last_prefix))
+			goto ERROR;
+		/* the buffer of db_open() ends with '\0' */
+		for (i = 0; i < 3; i++) {
+			if (i == 0)
+				ptr->first = pos;
+			else if (i == 1)
+				ptr->min = pos;
+			else
+				ptr->max = pos;
+			pos += strlen(pos) + 1;
+			if (pos > end)
+				goto ERROR;
+		}
+		(*count)++;
+	}
+	return chunks;
+ERROR:
+	free(chunks);
+	*count = 0;
+	return NULL;
+}
+
+void db_close(struct db_info_s *info)
+{
+	free(info->offsets);
+	info->offsets = NULL;
+	info->info = NULL;
+	info->chunks = NULL;
+}
+
+/*
+ * db_statistics() prints what the header and the footer say about the
+ * database 'database'.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int db_statistics(struct g_data_s *g_data, const char *database)
+{
+	static const char *format[] = { "plain", "block compressed", "directory table" };
+	struct block_reader_s reader;
+	struct db_info_s *info = &reader.info;
+	struct db_chunk_s *chunks;
+	uint64_t chunks_count;
+	struct stat db_stat;
+	char built[64];
+	const char *p;
+	time_t t;
+	int fd = -1;
+	int ret = 0;
+
+	memset(&reader, 0, sizeof(reader));
+	if ((fd = open(database, O_RDONLY)) == -1 || fstat(fd, &db_stat) == -1) {
+		report_error(g_data, FATAL, "db_statistics: '%s': %s\n", database, strerror(errno));
+		goto EXIT;
+	}
+	if (!block_open(g_data, &reader, fd, database))
+		goto EXIT;
+	if (reader.dirtab)
+		info->format = DB_DIRTAB;
+	else if (reader.blocks)
+		info->format = DB_BLOCK;
+	printf("Database %s:\n", database);
+	printf("\tformat: %s, version %d\n", format[info->format], info->version);
+	printf("\tsecurity level: %c\n", reader.slevel);
+	printf("\tsize: %lld bytes\n", (long long)db_stat.st_size);
+	if (info->version > 1) {
+		t = info->built;
+		strftime(built, sizeof(built), "%Y-%m-%d %H:%M:%S", localtime(&t));
+		printf("\tpaths: %llu\n", (unsigned long long)info->count);
+		printf("\tbuilt: %s\n", built);
+		printf("\tgeneration: %llu\n", (unsigned long long)info->generation);
+		if (info->offsets_count)
+			printf("\toffset table: %llu entries\n", (unsigned long long)info->offsets_count);
+		if ((chunks = db_chunks(g_data, info, &chunks_count))) {
+			printf("\tchunks: %llu\n", (unsigned long long)chunks_count);
+			free(chunks);
+		}
+		for (p = info->info; p < info->info + info->info_len; p += strlen(p) + 1)
+			printf("\t%s\n", p);
+	}
+	ret = 1;
+EXIT:
+	block_close(&reader);
+	if (fd != -1)
+		close(fd);
+	return ret;
+}
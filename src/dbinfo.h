@@ -0,0 +1,151 @@
+#ifndef DBINFO_H
+#define DBINFO_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* Database of version 2. It starts with the header and ends with the
+ * footer, the data of the format is in between:
+ *
+ *   header | data | uint64_t offsets[offsets_count] | info | chunks | footer
+ *
+ * The data is the encoded paths, the blocks of --compress with their index
+ * or the records and the table of --dir-table. The offset table has the
+ * position of every DB_OFFSET_EVERY-th path of the plain format, that is
+ * encoded without a common prefix, so it can be decoded from there. The
+ * info is 'key=value\0' strings with the root and the excludes.
+ *
+ * The paths from one entry of the offset table to the next, or the paths
+ * of a block, are a chunk. For every chunk there is the number of paths
+ * and the common prefix of the last one as varints, and its first, its
+ * smallest and its largest path, '\0' terminated. A fast update copies the
+ * chunks, that none of the added paths fall into.
+ *
+ * A database of version 1 starts with the security level '0' or '1', or
+ * with the magic of a block or directory table database, and has no
+ * footer. */
+#define DB_MAGIC "RLDB\0\0\0\2"
+#define DB_VERSION 2
+#define DB_OFFSET_EVERY 4096
+
+/* format */
+#define DB_PLAIN  0
+#define DB_BLOCK  1
+#define DB_DIRTAB 2
+
+struct db_header_s {
+	char magic[8];
+	uint16_t version;
+	uint8_t format;
+	char slevel;
+	uint32_t pad;
+};
+
+struct db_footer_s {
+	uint64_t count;		/* number of paths */
+	uint64_t data_end;
+	uint64_t offsets_count;
+	uint64_t info_len;
+	int64_t built;		/* time the update started */
+	uint64_t generation;	/* number of updates of the database */
+	uint64_t chunks_len;
+	uint64_t pad;
+	uint16_t version;
+	uint8_t format;
+	char slevel;
+	uint32_t pad2;
+	char magic[8];
+};
+
+/* Chunk of a database, that is read */
+struct db_chunk_s {
+	uint64_t count;
+	uint64_t last_prefix;
+	const char *first;
+	const char *min;	/* by strcmp() */
+	const char *max;
+};
+
+/* Database writer */
+struct db_writer_s {
+	int format;
+	char slevel;		/* of the header */
+	uint64_t count;
+	uint64_t offset;	/* of the end of the plain data written so far */
+	uint64_t *offsets;
+	uint64_t offsets_count;
+	uint64_t offsets_alloc;
+	time_t built;
+	uint64_t generation;
+	/* the chunk, that is written */
+	uint64_t chunk_count;
+	uint64_t last_prefix;
+	char *first;
+	size_t first_alloc;
+	char *min;
+	size_t min_alloc;
+	char *max;
+	size_t max_alloc;
+	/* summaries of the chunks written */
+	char *chunks;
+	size_t chunks_len;
+	size_t chunks_alloc;
+};
+
+/* What the header and the footer say about a database */
+struct db_info_s {
+	int version;		/* 1 if there is no footer */
+	int format;
+	uint64_t count;
+	uint64_t data_end;
+	uint64_t *offsets;
+	uint64_t offsets_count;
+	char *info;
+	uint64_t info_len;
+	char *chunks;
+	uint64_t chunks_len;
+	int64_t built;
+	uint64_t generation;
+};
+
+/* State of a writer in a checkpoint of create_db(), it is followed by the
+ * offset table, the chunks and, if a chunk is written, its first, smallest
+ * and largest path */
+struct db_state_s {
+	uint64_t count;
+	uint64_t offset;
+	uint64_t offsets_count;
+	uint64_t chunk_count;
+	uint64_t last_prefix;
+	uint64_t chunks_len;
+	int64_t built;
+	uint64_t generation;
+	uint8_t format;
+	char slevel;
+	uint16_t pad;
+	uint32_t pad2;
+};
+
+struct block_reader_s;
+
+struct db_writer_s *db_create(struct g_data_s *g_data, FILE *fd, int format);
+int db_offset(struct g_data_s *g_data, struct db_writer_s *db, uint64_t offset);
+int db_chunk_add(struct g_data_s *g_data, struct db_writer_s *db,
+		 const char *path, size_t len, size_t prefix);
+int db_chunk_end(struct g_data_s *g_data, struct db_writer_s *db);
+int db_chunk_copy(struct g_data_s *g_data, struct db_writer_s *db,
+		  const struct db_chunk_s *chunk);
+int db_finish(struct g_data_s *g_data, FILE *fd, struct db_writer_s *db);
+void db_free(struct db_writer_s *db);
+int db_save(struct g_data_s *g_data, FILE *fp, const struct db_writer_s *db);
+struct db_writer_s *db_load(struct g_data_s *g_data, FILE *fp);
+int db_open(struct g_data_s *g_data, struct block_reader_s *reader,
+	    const char *database);
+struct db_chunk_s *db_chunks(struct g_data_s *g_data, struct db_info_s *info,
+			     uint64_t *count);
+void db_close(struct db_info_s *info);
+int db_statistics(struct g_data_s *g_data, const char *database);
+
+#endif /* !DBINFO_H */
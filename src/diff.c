@@ -0,0 +1,511 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* External sort of the added paths for the fast update. The paths are
+ * collected in one buffer until --diff-memory is used up, then they are
+ * sorted and written as a run to a temporary file, like walk.c does with
+ * big directories. The runs are merged with a heap, when the fast update
+ * reads them. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "profile.h"
+#include "diff.h"
+
+/*
+ * diff_create() returns the added paths, that use 'memory' bytes at most.
+ */
+struct diff_s *diff_create(struct g_data_s *g_data, size_t memory)
+{
+	struct diff_s *diff;
+
+	if (!(diff = calloc(1, sizeof(struct diff_s)))) {
+		report_error(g_data, FATAL, "diff_create: calloc: %s\n", strerror(errno));
+		return NULL;
+	}
+	diff->memory = memory;
+	return diff;
+}
+
+/*
+ * diff_compare() compares two paths in the buffer.
+ */
+static int diff_compare(const void *e1, const void *e2, void *names)
+{
+	return strcmp((char *)names + *(const size_t *)e1,
+		      (char *)names + *(const size_t *)e2);
+}
+
+/*
+ * diff_sort() sorts the paths in memory and drops the duplicates.
+ */
+static void diff_sort(struct diff_s *diff)
+{
+	size_t i, n = 0;
+
+	if (diff->count > 1)
+		qsort_r(diff->entry, diff->count, sizeof(size_t), diff_compare, diff->names);
+	for (i = 0; i < diff->count; i++) {
+		if (n && strcmp(diff->names + diff->entry[i], diff->names + diff->entry[n - 1]) == 0)
+			continue;
+		diff->entry[n++] = diff->entry[i];
+	}
+	diff->count = n;
+}
+
+/*
+ * diff_index() adds the path 'path' at 'offset' of the run to its index.
+ */
+static int diff_index(struct diff_run_s *run, const char *path, uint64_t offset)
+{
+	size_t len = strlen(path) + 1;
+	void *ptr;
+
+	if (run->index_count == run->index_alloc) {
+		run->index_alloc = run->index_alloc * 2 + 64;
+		if (!(ptr = realloc(run->key, sizeof(size_t) * run->index_alloc)))
+			return 0;
+		run->key = ptr;
+		if (!(ptr = realloc(run->offset, sizeof(uint64_t) * run->index_alloc)))
+			return 0;
+		run->offset = ptr;
+	}
+	if (run->keys_len + len > run->keys_alloc) {
+		if (!(ptr = realloc(run->keys, run->keys_alloc * 2 + len)))
+			return 0;
+		run->keys = ptr;
+		run->keys_alloc = run->keys_alloc * 2 + len;
+	}
+	memcpy(run->keys + run->keys_len, path, len);
+	run->key[run->index_count] = run->keys_len;
+	run->offset[run->index_count++] = offset;
+	run->keys_len += len;
+	return 1;
+}
+
+/*
+ * diff_spill() writes the paths, that are in memory, to a new run.
+ */
+static int diff_spill(struct g_data_s *g_data, struct diff_s *diff)
+{
+	struct diff_run_s *run;
+	const char *path;
+	size_t i, len;
+	void *ptr;
+
+	if (diff->runs == diff->run_alloc) {
+		if (!(ptr = realloc(diff->run, sizeof(struct diff_run_s) * (diff->run_alloc * 2 + 8))))
+			goto NOMEM;
+		diff->run = ptr;
+		if (!(ptr = realloc(diff->heap, sizeof(int) * (diff->run_alloc * 2 + 8))))
+			goto NOMEM;
+		diff->heap = ptr;
+		diff->run_alloc = diff->run_alloc * 2 + 8;
+	}
+	run = &diff->run[diff->runs];
+	memset(run, 0, sizeof(struct diff_run_s));
+	diff_sort(diff);
+	if (!(run->fp = tmpfile())) {
+		report_error(g_data, FATAL, "diff_spill: tmpfile: %s\n", strerror(errno));
+		return 0;
+	}
+	diff->runs++;
+	for (i = 0; i < diff->count; i++) {
+		path = diff->names + diff->entry[i];
+		len = strlen(path) + 1;
+		if (i % DIFF_INDEX_EVERY == 0 && !diff_index(run, path, run->len))
+			goto NOMEM;
+		if (fwrite(path, len, 1, run->fp) != 1) {
+			report_error(g_data, FATAL, "diff_spill: fwrite: %s\n", strerror(errno));
+			return 0;
+		}
+		run->len += len;
+	}
+	run->count = diff->count;
+	diff->names_len = 0;
+	diff->count = 0;
+	return 1;
+NOMEM:
+	report_error(g_data, FATAL, "diff_spill: realloc: %s\n", strerror(errno));
+	return 0;
+}
+
+/*
+ * diff_add() adds the path 'path' without the leading '/'.
+ */
+int diff_add(struct g_data_s *g_data, struct diff_s *diff, const char *path)
+{
+	size_t len = strlen(path) + 1;
+	size_t n;
+	void *ptr;
+
+	if (diff->count &&
+	    diff->names_len + len + sizeof(size_t) * (diff->count + 1) > diff->memory &&
+	    !diff_spill(g_data, diff))
+		return 0;
+	if (diff->names_len + len > diff->names_alloc) {
+		n = diff->names_alloc * 2 + len;
+		if (n > diff->memory && diff->names_len + len <= diff->memory)
+			n = diff->memory;
+		if (!(ptr = realloc(diff->names, n)))
+			goto NOMEM;
+		diff->names = ptr;
+		diff->names_alloc = n;
+	}
+	if (diff->count == diff->alloc) {
+		if (!(ptr = realloc(diff->entry, sizeof(size_t) * (diff->alloc * 2 + 1024))))
+			goto NOMEM;
+		diff->entry = ptr;
+		diff->alloc = diff->alloc * 2 + 1024;
+	}
+	memcpy(diff->names + diff->names_len, path, len);
+	diff->entry[diff->count++] = diff->names_len;
+	diff->names_len += len;
+	return 1;
+NOMEM:
+	report_error(g_data, FATAL, "diff_add: realloc: %s\n", strerror(errno));
+	return 0;
+}
+
+static uint64_t diff_hash(const char *s)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/*
+ * diff_bloom() sets the bits of 'path' in the Bloom filter, or checks them,
+ * if 'set' is 0.
+ */
+static int diff_bloom(struct diff_s *diff, const char *path, int set)
+{
+	uint64_t h = diff_hash(path);
+	uint64_t h2 = (h >> 32) | 1;
+	uint64_t bit;
+	int i;
+
+	for (i = 0; i < DIFF_BLOOM_HASHES; i++) {
+		bit = (h + i * h2) % diff->bloom_bits;
+		if (set)
+			diff->bloom[bit / 8] |= 1 << (bit % 8);
+		else if (!(diff->bloom[bit / 8] & (1 << (bit % 8))))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * diff_read() reads the next path of a run. Returns 0 at the end.
+ */
+static int diff_read(struct diff_run_s *run)
+{
+	return getdelim(&run->rec, &run->size, '\0', run->fp) > 0;
+}
+
+/*
+ * diff_sift() moves the run at position 'i' of the heap down.
+ */
+static void diff_sift(struct diff_s *diff, int i)
+{
+	int c, t;
+
+	for (;;) {
+		c = i * 2 + 1;
+		if (c >= diff->heap_len)
+			break;
+		if (c + 1 < diff->heap_len &&
+		    strcmp(diff->run[diff->heap[c + 1]].rec, diff->run[diff->heap[c]].rec) < 0)
+			c++;
+		if (strcmp(diff->run[diff->heap[c]].rec, diff->run[diff->heap[i]].rec) >= 0)
+			break;
+		t = diff->heap[i];
+		diff->heap[i] = diff->heap[c];
+		diff->heap[c] = t;
+		i = c;
+	}
+}
+
+/*
+ * diff_finish() sorts the paths after the last one was added. If there are
+ * runs, the rest is written as the last one, the Bloom filter is filled
+ * and the merge starts.
+ */
+int diff_finish(struct g_data_s *g_data, struct diff_s *diff)
+{
+	struct diff_run_s *run;
+	uint64_t count = 0;
+	int i;
+
+	if (!diff->runs) {
+		diff_sort(diff);
+		return 1;
+	}
+	if (diff->count && !diff_spill(g_data, diff))
+		return 0;
+	/* the paths are not needed in memory anymore */
+	free(diff->names);
+	free(diff->entry);
+	diff->names = NULL;
+	diff->entry = NULL;
+	diff->names_alloc = 0;
+	diff->alloc = 0;
+	for (i = 0; i < diff->runs; i++)
+		count += diff->run[i].count;
+	diff->bloom_bits = count * DIFF_BLOOM_BITS + 64;
+	if (!(diff->bloom = calloc(diff->bloom_bits / 8 + 1, 1))) {
+		report_error(g_data, FATAL, "diff_finish: calloc: %s\n", strerror(errno));
+		return 0;
+	}
+	for (i = 0; i < diff->runs; i++) {
+		run = &diff->run[i];
+		if (fflush(run->fp) == EOF) {
+			report_error(g_data, FATAL, "diff_finish: fflush: %s\n", strerror(errno));
+			return 0;
+		}
+		rewind(run->fp);
+		while (diff_read(run)) {
+			PROF_COUNT(bytes, strlen(run->rec) + 1);
+			diff_bloom(diff, run->rec, 1);
+		}
+		if (ferror(run->fp)) {
+			report_error(g_data, FATAL, "diff_finish: read: %s\n", strerror(errno));
+			return 0;
+		}
+		rewind(run->fp);
+		if (diff_read(run))
+			diff->heap[diff->heap_len++] = i;
+	}
+	for (i = diff->heap_len / 2 - 1; i >= 0; i--)
+		diff_sift(diff, i);
+	return 1;
+}
+
+/*
+ * diff_head() returns the smallest path, that was not passed with
+ * diff_next() yet, or NULL at the end.
+ */
+const char *diff_head(struct diff_s *diff)
+{
+	if (!diff->runs)
+		return diff->next < diff->count ? diff->names + diff->entry[diff->next] : NULL;
+	return diff->heap_len ? diff->run[diff->heap[0]].rec : NULL;
+}
+
+/*
+ * diff_next() passes the path returned by diff_head(). A path, that is in
+ * more runs, is returned once.
+ */
+int diff_next(struct g_data_s *g_data, struct diff_s *diff)
+{
+	struct diff_run_s *run;
+	size_t len;
+	void *ptr;
+
+	if (!diff->runs) {
+		diff->next++;
+		return 1;
+	}
+	if (!diff->heap_len)
+		return 1;
+	run = &diff->run[diff->heap[0]];
+	len = strlen(run->rec) + 1;
+	if (len > diff->prev_alloc) {
+		if (!(ptr = realloc(diff->prev, len))) {
+			report_error(g_data, FATAL, "diff_next: realloc: %s\n", strerror(errno));
+			return 0;
+		}
+		diff->prev = ptr;
+		diff->prev_alloc = len;
+	}
+	memcpy(diff->prev, run->rec, len);
+	do {
+		run = &diff->run[diff->heap[0]];
+		if (!diff_read(run)) {
+			if (ferror(run->fp)) {
+				report_error(g_data, FATAL, "diff_next: read: %s\n", strerror(errno));
+				return 0;
+			}
+			diff->heap[0] = diff->heap[--diff->heap_len];
+		}
+		diff_sift(diff, 0);
+	} while (diff->heap_len && strcmp(diff->run[diff->heap[0]].rec, diff->prev) == 0);
+	return 1;
+}
+
+/*
+ * diff_lower() sets 'found' to the first path of the run, that is not
+ * smaller than 'path', or to NULL. It points into the index or into the
+ * lookup buffer.
+ */
+static int diff_lower(struct g_data_s *g_data, struct diff_s *diff, struct diff_run_s *run,
+		      const char *path, const char **found)
+{
+	size_t lo = 0, hi = run->index_count, mid;
+	uint64_t start, end;
+	const char *p;
+	void *ptr;
+
+	*found = NULL;
+	/* the last part of the run, that starts with a path not after it */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(run->keys + run->key[mid], path) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0) {
+		if (run->index_count)
+			*found = run->keys + run->key[0];
+		return 1;
+	}
+	start = run->offset[lo - 1];
+	end = lo < run->index_count ? run->offset[lo] : run->len;
+	if (end - start + 1 > diff->buf_alloc) {
+		if (!(ptr = realloc(diff->buf, end - start + 1))) {
+			report_error(g_data, FATAL, "diff_lower: realloc: %s\n", strerror(errno));
+			return 0;
+		}
+		diff->buf = ptr;
+		diff->buf_alloc = end - start + 1;
+	}
+	PROF_COUNT(syscalls, 1);
+	if (pread(fileno(run->fp), diff->buf, end - start, start) != (ssize_t)(end - start)) {
+		report_error(g_data, FATAL, "diff_lower: pread: %s\n", errno ? strerror(errno) : "short read");
+		return 0;
+	}
+	diff->buf[end - start] = '\0';
+	for (p = diff->buf; p < diff->buf + (end - start); p += strlen(p) + 1) {
+		if (strcmp(p, path) >= 0) {
+			*found = p;
+			return 1;
+		}
+	}
+	if (lo < run->index_count)
+		*found = run->keys + run->key[lo];
+	return 1;
+}
+
+/*
+ * diff_lower_memory() returns the first path in memory, that is not
+ * smaller than 'path', or NULL.
+ */
+static const char *diff_lower_memory(struct diff_s *diff, const char *path)
+{
+	size_t lo = 0, hi = diff->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(diff->names + diff->entry[mid], path) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < diff->count ? diff->names + diff->entry[lo] : NULL;
+}
+
+/*
+ * diff_find() checks, if the path 'path' without the leading '/' was added.
+ *
+ * Returns:  1 == added
+ *           0 == not added
+ *          -1 == error
+ */
+int diff_find(struct g_data_s *g_data, struct diff_s *diff, const char *path)
+{
+	const char *found;
+	int i;
+
+	if (!diff->runs)
+		return (found = diff_lower_memory(diff, path)) && strcmp(found, path) == 0;
+	if (!diff_bloom(diff, path, 0))
+		return 0;
+	for (i = 0; i < diff->runs; i++) {
+		if (!diff_lower(g_data, diff, &diff->run[i], path, &found))
+			return -1;
+		if (found && strcmp(found, path) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * diff_range() checks, if a path between 'lo' and 'hi' was added.
+ *
+ * Returns:  1 == added
+ *           0 == not added
+ *          -1 == error
+ */
+int diff_range(struct g_data_s *g_data, struct diff_s *diff, const char *lo,
+	       const char *hi)
+{
+	const char *found;
+	int i;
+
+	if (!diff->runs)
+		return (found = diff_lower_memory(diff, lo)) && strcmp(found, hi) <= 0;
+	for (i = 0; i < diff->runs; i++) {
+		if (!diff_lower(g_data, diff, &diff->run[i], lo, &found))
+			return -1;
+		if (found && strcmp(found, hi) <= 0)
+			return 1;
+	}
+	return 0;
+}
+
+void diff_free(struct diff_s *diff)
+{
+	struct diff_run_s *run;
+	int i;
+
+	if (!diff)
+		return;
+	for (i = 0; i < diff->runs; i++) {
+		run = &diff->run[i];
+		fclose(run->fp);
+		free(run->rec);
+		free(run->keys);
+		free(run->key);
+		free(run->offset);
+	}
+	free(diff->run);
+	free(diff->heap);
+	free(diff->names);
+	free(diff->entry);
+	free(diff->prev);
+	free(diff->bloom);
+	free(diff->buf);
+	free(diff);
+}
@@ -0,0 +1,72 @@
+#ifndef DIFF_H
+#define DIFF_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* The paths added since the last update, that the fast update merges into
+ * the database, sorted by strcmp() and without duplicates. They are kept
+ * in memory up to --diff-memory, beyond it they are sorted in runs in
+ * temporary files, that are merged. Whether a path was added is answered
+ * by a Bloom filter over all the runs and a sparse index of every run, so
+ * only a few hundred bytes of a run are read for a path, that passes the
+ * filter. */
+#define DIFF_MEMORY_SIZE (64 * 1024 * 1024)
+/* every DIFF_INDEX_EVERY-th path of a run is in its index */
+#define DIFF_INDEX_EVERY 64
+/* bits of the Bloom filter for every path and the number of hashes */
+#define DIFF_BLOOM_BITS 10
+#define DIFF_BLOOM_HASHES 7
+
+/* Sorted run in a temporary file */
+struct diff_run_s {
+	FILE *fp;
+	uint64_t len;
+	uint64_t count;
+	char *rec;		/* current path of the merge */
+	size_t size;
+	/* index */
+	char *keys;		/* paths, '\0' terminated */
+	size_t keys_len;
+	size_t keys_alloc;
+	size_t *key;		/* offsets in keys */
+	uint64_t *offset;	/* offsets in the run */
+	size_t index_count;
+	size_t index_alloc;
+};
+
+/* Added paths */
+struct diff_s {
+	size_t memory;
+	char *names;		/* paths in memory, '\0' terminated */
+	size_t names_len;
+	size_t names_alloc;
+	size_t *entry;		/* offsets in names */
+	size_t count;
+	size_t alloc;
+	size_t next;
+	struct diff_run_s *run;
+	int runs;
+	int run_alloc;
+	int *heap;		/* runs ordered by their current path */
+	int heap_len;
+	char *prev;		/* path, that the merge returned last */
+	size_t prev_alloc;
+	unsigned char *bloom;
+	uint64_t bloom_bits;
+	char *buf;		/* part of a run read for a lookup */
+	size_t buf_alloc;
+};
+
+struct diff_s *diff_create(struct g_data_s *g_data, size_t memory);
+int diff_add(struct g_data_s *g_data, struct diff_s *diff, const char *path);
+int diff_finish(struct g_data_s *g_data, struct diff_s *diff);
+const char *diff_head(struct diff_s *diff);
+int diff_next(struct g_data_s *g_data, struct diff_s *diff);
+int diff_find(struct g_data_s *g_data, struct diff_s *diff, const char *path);
+int diff_range(struct g_data_s *g_data, struct diff_s *diff, const char *lo,
+	       const char *hi);
+void diff_free(struct diff_s *diff);
+
+#endif /* !DIFF_H */
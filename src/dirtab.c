@@ -0,0 +1,613 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Directory table database. The writer gets the paths from encode() and
+ * groups the names of a directory in one record. A search matches the
+ * directory of a record once, and a string without '/' only against the
+ * names, so the paths are only put together for the hits. The decoders of
+ * the plain database get the paths encoded from dirtab_read(). */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "profile.h"
+#include "block.h"
+#include "dirtab.h"
+
+extern int search_path(struct g_data_s *g_data, char *full_path, char *search_str, int globflag);
+
+static uint64_t dirtab_hash(const char *s, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	while (len--) {
+		h ^= (unsigned char)*s++;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/*
+ * dirtab_rehash() doubles the hash of the directories.
+ */
+static int dirtab_rehash(struct dirtab_writer_s *dirtab)
+{
+	uint64_t slots = dirtab->slots ? dirtab->slots * 2 : 1024;
+	uint64_t *slot;
+	uint64_t i, h;
+
+	if (!(slot = calloc(slots, sizeof(uint64_t))))
+		return 0;
+	for (i = 0; i < dirtab->count; i++) {
+		h = dirtab_hash(dirtab->table + dirtab->dir[i],
+				dirtab->dir[i + 1] - dirtab->dir[i] - 1);
+		while (slot[h & (slots - 1)])
+			h++;
+		slot[h & (slots - 1)] = i + 1;
+	}
+	free(dirtab->slot);
+	dirtab->slot = slot;
+	dirtab->slots = slots;
+	return 1;
+}
+
+/*
+ * dirtab_lookup() returns the number of the directory 'dir' in 'id', it is
+ * added to the table, if it is not there.
+ */
+static int dirtab_lookup(struct g_data_s *g_data, struct dirtab_writer_s *dirtab,
+			 const char *dir, size_t len, uint64_t *id)
+{
+	uint64_t h, i;
+	void *ptr;
+
+	if ((dirtab->count + 1) * 2 > dirtab->slots && !dirtab_rehash(dirtab)) {
+		report_error(g_data, FATAL, "dirtab_lookup: calloc: %s\n", strerror(errno));
+		return 0;
+	}
+	h = dirtab_hash(dir, len);
+	while ((i = dirtab->slot[h & (dirtab->slots - 1)])) {
+		i -= 1;
+		if (dirtab->dir[i + 1] - dirtab->dir[i] - 1 == len &&
+		    memcmp(dirtab->table + dirtab->dir[i], dir, len) == 0) {
+			*id = i;
+			return 1;
+		}
+		h++;
+	}
+	/* the offsets end with the end of the table */
+	if (dirtab->count + 2 > dirtab->alloc) {
+		dirtab->alloc = dirtab->alloc ? dirtab->alloc * 2 : 1024;
+		if (!(ptr = realloc(dirtab->dir, sizeof(uint64_t) * dirtab->alloc))) {
+			report_error(g_data, FATAL, "dirtab_lookup: realloc: %s\n", strerror(errno));
+			return 0;
+		}
+		dirtab->dir = ptr;
+		dirtab->dir[0] = 0;
+	}
+	if (dirtab->table_len + len + 1 > dirtab->table_alloc) {
+		dirtab->table_alloc = dirtab->table_alloc ? dirtab->table_alloc * 2 : 64 * 1024;
+		if (dirtab->table_alloc < dirtab->table_len + len + 1)
+			dirtab->table_alloc = dirtab->table_len + len + 1;
+		if (!(ptr = realloc(dirtab->table, dirtab->table_alloc))) {
+			report_error(g_data, FATAL, "dirtab_lookup: realloc: %s\n", strerror(errno));
+			return 0;
+		}
+		dirtab->table = ptr;
+	}
+	memcpy(dirtab->table + dirtab->table_len, dir, len);
+	dirtab->table[dirtab->table_len + len] = '\0';
+	dirtab->table_len += len + 1;
+	dirtab->dir[dirtab->count + 1] = dirtab->table_len;
+	dirtab->slot[h & (dirtab->slots - 1)] = dirtab->count + 1;
+	*id = dirtab->count++;
+	return 1;
+}
+
+/*
+ * dirtab_varint() writes 'v' to 'buf' seven bits at a time and returns the
+ * number of bytes.
+ */
+static size_t dirtab_varint(unsigned char *buf, uint64_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		buf[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	buf[n++] = v;
+	return n;
+}
+
+static int dirtab_varint_get(const char **pos, const char *end, uint64_t *v)
+{
+	uint64_t x = 0;
+	unsigned char b;
+	int shift = 0;
+
+	do {
+		if (*pos == end || shift > 63)
+			return 0;
+		b = *(*pos)++;
+		x |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+	*v = x;
+	return 1;
+}
+
+/*
+ * dirtab_create() returns the writer of the records, that follow the header
+ * already written to 'fd'.
+ */
+struct dirtab_writer_s *dirtab_create(struct g_data_s *g_data, FILE *fd)
+{
+	struct dirtab_writer_s *dirtab;
+
+	if (!(dirtab = calloc(1, sizeof(struct dirtab_writer_s)))) {
+		report_error(g_data, FATAL, "dirtab_create: calloc: %s\n", strerror(errno));
+		return NULL;
+	}
+	dirtab->offset = ftello(fd);
+	return dirtab;
+}
+
+/*
+ * dirtab_flush() writes the names, that were added for the current
+ * directory, as a record.
+ */
+int dirtab_flush(struct g_data_s *g_data, FILE *fd, struct dirtab_writer_s *dirtab)
+{
+	unsigned char head[20];
+	size_t len;
+
+	if (!dirtab->names_len)
+		return 1;
+	len = dirtab_varint(head, dirtab->cur);
+	len += dirtab_varint(head + len, dirtab->names_len);
+	if (fwrite(head, 1, len, fd) != len ||
+	    fwrite(dirtab->names, 1, dirtab->names_len, fd) != dirtab->names_len) {
+		report_error(g_data, FATAL, "dirtab_flush: fwrite: %s\n", strerror(errno));
+		return 0;
+	}
+	dirtab->offset += len + dirtab->names_len;
+	dirtab->names_len = 0;
+	return 1;
+}
+
+/*
+ * dirtab_add() adds 'path' to the record of its directory. The record is
+ * written, when the next path is in another directory.
+ */
+int dirtab_add(struct g_data_s *g_data, FILE *fd, struct dirtab_writer_s *dirtab,
+	       const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	size_t dir_len = slash ? (size_t)(slash - path) + 1 : 0;
+	size_t name_len = strlen(path + dir_len);
+	char *ptr;
+
+	if (!dirtab->names_len || dir_len != dirtab->cur_len ||
+	    dirtab->names_len + name_len + 1 > DIRTAB_NAMES_SIZE ||
+	    memcmp(path, dirtab->table + dirtab->dir[dirtab->cur], dir_len) != 0) {
+		if (!dirtab_flush(g_data, fd, dirtab) ||
+		    !dirtab_lookup(g_data, dirtab, path, dir_len, &dirtab->cur))
+			return 0;
+		dirtab->cur_len = dir_len;
+	}
+	if (dirtab->names_len + name_len + 1 > dirtab->names_alloc) {
+		dirtab->names_alloc = dirtab->names_len + name_len + 1;
+		if (dirtab->names_alloc < DIRTAB_NAMES_SIZE)
+			dirtab->names_alloc = DIRTAB_NAMES_SIZE;
+		if (!(ptr = realloc(dirtab->names, dirtab->names_alloc))) {
+			report_error(g_data, FATAL, "dirtab_add: realloc: %s\n", strerror(errno));
+			return 0;
+		}
+		dirtab->names = ptr;
+	}
+	memcpy(dirtab->names + dirtab->names_len, path + dir_len, name_len + 1);
+	dirtab->names_len += name_len + 1;
+	return 1;
+}
+
+/*
+ * dirtab_finish() writes the directory table and the footer. The last
+ * record has to be written with encode_flush() before. Every directory is
+ * written as the length of the prefix it has in common with the one before
+ * and the rest of it.
+ */
+int dirtab_finish(struct g_data_s *g_data, FILE *fd, struct dirtab_writer_s *dirtab)
+{
+	struct dirtab_footer_s footer;
+	unsigned char head[10];
+	const char *dir, *prev = "";
+	size_t prefix, len, n;
+	uint64_t i;
+
+	memset(&footer, 0, sizeof(footer));
+	footer.table_offset = dirtab->offset;
+	footer.dir_count = dirtab->count;
+	memcpy(footer.magic, DIRTAB_MAGIC, sizeof(footer.magic));
+	for (i = 0; i < dirtab->count; i++) {
+		dir = dirtab->table + dirtab->dir[i];
+		len = dirtab->dir[i + 1] - dirtab->dir[i];
+		for (prefix = 0; prefix < len - 1 && dir[prefix] == prev[prefix]; prefix++)
+			;
+		n = dirtab_varint(head, prefix);
+		if (fwrite(head, 1, n, fd) != n ||
+		    fwrite(dir + prefix, 1, len - prefix, fd) != len - prefix)
+			goto ERROR;
+		footer.table_len += n + len - prefix;
+		prev = dir;
+	}
+	if (fwrite(&footer, sizeof(footer), 1, fd) != 1)
+		goto ERROR;
+	return 1;
+ERROR:
+	report_error(g_data, FATAL, "dirtab_finish: fwrite: %s\n", strerror(errno));
+	return 0;
+}
+
+void dirtab_free(struct dirtab_writer_s *dirtab)
+{
+	if (!dirtab)
+		return;
+	free(dirtab->table);
+	free(dirtab->dir);
+	free(dirtab->slot);
+	free(dirtab->names);
+	free(dirtab);
+}
+
+/*
+ * dirtab_open() maps the directory table database, that is open in
+ * 'reader', and reads its table. The records and the table end at 'data_end'
+ * with the footer. It is called by block_open().
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int dirtab_open(struct g_data_s *g_data, struct block_reader_s *reader,
+		const char *database, uint64_t data_end)
+{
+	struct dirtab_reader_s *dirtab;
+	struct dirtab_footer_s footer;
+	struct stat db_stat;
+	const char *p, *end, *name;
+	uint64_t i, prefix;
+	size_t len, alloc = 0;
+	char *ptr;
+
+	if (!(dirtab = calloc(1, sizeof(struct dirtab_reader_s)))) {
+		report_error(g_data, FATAL, "dirtab_open: calloc: %s\n", strerror(errno));
+		return 0;
+	}
+	dirtab->map = MAP_FAILED;
+	reader->dirtab = dirtab;
+	PROF_COUNT(syscalls, 2);
+	if (fstat(reader->fd, &db_stat) == -1 ||
+	    data_end > (uint64_t)db_stat.st_size ||
+	    data_end < sizeof(struct dirtab_header_s) + sizeof(footer))
+		goto DAMAGED;
+	dirtab->map_len = db_stat.st_size;
+	dirtab->map = mmap(NULL, dirtab->map_len, PROT_READ, MAP_SHARED, reader->fd, 0);
+	if (dirtab->map == MAP_FAILED) {
+		report_error(g_data, FATAL, "dirtab_open: mmap: '%s': %s\n", database, strerror(errno));
+		return 0;
+	}
+	memcpy(&footer, dirtab->map + data_end - sizeof(footer), sizeof(footer));
+	if (memcmp(footer.magic, DIRTAB_MAGIC, sizeof(footer.magic)) != 0 ||
+	    footer.table_offset < sizeof(struct dirtab_header_s) ||
+	    footer.table_offset > data_end - sizeof(footer) ||
+	    footer.table_len != data_end - sizeof(footer) - footer.table_offset ||
+	    footer.dir_count > footer.table_len)
+		goto DAMAGED;
+	if (!(dirtab->dir = malloc(sizeof(uint64_t) * (footer.dir_count + 1)))) {
+		report_error(g_data, FATAL, "dirtab_open: malloc: %s\n", strerror(errno));
+		return 0;
+	}
+	/* the table is put back together in memory */
+	p = dirtab->map + footer.table_offset;
+	end = p + footer.table_len;
+	len = 0;
+	for (i = 0; i < footer.dir_count; i++) {
+		if (!dirtab_varint_get(&p, end, &prefix) ||
+		    (i && prefix >= len - dirtab->dir[i - 1]) ||
+		    (!i && prefix) || !(name = memchr(p, '\0', end - p)))
+			goto DAMAGED;
+		if (len + prefix + (name - p) + 1 > alloc) {
+			alloc = (len + prefix + (name - p) + 1) * 2;
+			if (!(ptr = realloc(dirtab->table, alloc))) {
+				report_error(g_data, FATAL, "dirtab_open: realloc: %s\n", strerror(errno));
+				return 0;
+			}
+			dirtab->table = ptr;
+		}
+		dirtab->dir[i] = len;
+		if (prefix)
+			memcpy(dirtab->table + len, dirtab->table + dirtab->dir[i - 1], prefix);
+		memcpy(dirtab->table + len + prefix, p, name - p + 1);
+		len += prefix + (name - p) + 1;
+		p = name + 1;
+	}
+	if (p != end)
+		goto DAMAGED;
+	dirtab->dir[i] = len;
+	dirtab->count = footer.dir_count;
+	/* both headers have the same size */
+	dirtab->pos = dirtab->map + sizeof(struct dirtab_header_s);
+	dirtab->end = dirtab->map + footer.table_offset;
+	dirtab->name = dirtab->names_end = NULL;
+	PROF_COUNT(bytes, footer.table_len);
+	return 1;
+DAMAGED:
+	report_error(g_data, FATAL, "dirtab_open: '%s': The database is truncated or damaged.\n", database);
+	return 0;
+}
+
+/*
+ * dirtab_next() reads the next record.
+ *
+ * Returns:  1 == ok
+ *           0 == no more records
+ *          -1 == the record is damaged
+ */
+static int dirtab_next(struct dirtab_reader_s *dirtab, uint64_t *id,
+		       const char **names, size_t *len)
+{
+	uint64_t names_len;
+
+	if (dirtab->pos == dirtab->end)
+		return 0;
+	if (!dirtab_varint_get(&dirtab->pos, dirtab->end, id) ||
+	    !dirtab_varint_get(&dirtab->pos, dirtab->end, &names_len) ||
+	    *id >= dirtab->count || !names_len ||
+	    names_len > (uint64_t)(dirtab->end - dirtab->pos) ||
+	    dirtab->pos[names_len - 1] != '\0') {
+		errno = EINVAL;
+		return -1;
+	}
+	*names = dirtab->pos;
+	*len = names_len;
+	dirtab->pos += names_len;
+	PROF_COUNT(bytes, names_len);
+	return 1;
+}
+
+/*
+ * dirtab_path() puts the directory 'id' and 'len' bytes of 'name' together
+ * in dirtab->path. The directory is only copied, if 'name' is NULL.
+ */
+static char *dirtab_path(struct dirtab_reader_s *dirtab, uint64_t id,
+			 const char *name, size_t len)
+{
+	size_t dir_len = dirtab->dir[id + 1] - dirtab->dir[id] - 1;
+	char *ptr;
+
+	if (dir_len + len + 1 > dirtab->path_alloc) {
+		if (!(ptr = realloc(dirtab->path, dir_len + len + PATH_MAX)))
+			return NULL;
+		dirtab->path = ptr;
+		dirtab->path_alloc = dir_len + len + PATH_MAX;
+	}
+	if (!name)
+		memcpy(dirtab->path, dirtab->table + dirtab->dir[id], dir_len);
+	else
+		memcpy(dirtab->path + dir_len, name, len);
+	dirtab->path[dir_len + len] = '\0';
+	return dirtab->path;
+}
+
+/*
+ * dirtab_encode() encodes the next path for dirtab_read() the way encode()
+ * does.
+ *
+ * Returns:  1 == ok
+ *           0 == no more paths
+ *          -1 == error
+ */
+static int dirtab_encode(struct dirtab_reader_s *dirtab)
+{
+	size_t len, prefix, name_len;
+	const char *names;
+	short code_num;
+	char *path, *ptr;
+	int ret;
+
+	if (dirtab->name == dirtab->names_end) {
+		if ((ret = dirtab_next(dirtab, &dirtab->cur, &names, &len)) != 1)
+			return ret;
+		dirtab->name = names;
+		dirtab->names_end = names + len;
+		if (!dirtab_path(dirtab, dirtab->cur, NULL, 0))
+			return -1;
+	}
+	name_len = strlen(dirtab->name);
+	if (!(path = dirtab_path(dirtab, dirtab->cur, dirtab->name, name_len)))
+		return -1;
+	dirtab->name += name_len + 1;
+	len = strlen(path);
+
+	if (3 + len + 1 > dirtab->pend_alloc) {
+		if (!(ptr = realloc(dirtab->pend, 3 + len + PATH_MAX)))
+			return -1;
+		dirtab->pend = ptr;
+		dirtab->pend_alloc = 3 + len + PATH_MAX;
+	}
+	for (prefix = 0; prefix < len && prefix < dirtab->prev_len &&
+		     path[prefix] == dirtab->prev[prefix]; prefix++)
+		;
+	code_num = prefix - dirtab->prev_code;
+	dirtab->prev_code = prefix;
+	ptr = dirtab->pend;
+	if (code_num < -127 || code_num > 127) {
+		*ptr++ = (char)SLOC_ESC;
+		*ptr++ = code_num >> 8;
+		*ptr++ = code_num;
+	} else {
+		*ptr++ = code_num;
+	}
+	memcpy(ptr, path + prefix, len - prefix + 1);
+	dirtab->pend_len = ptr + len - prefix + 1 - dirtab->pend;
+	dirtab->pend_pos = 0;
+
+	if (len + 1 > dirtab->prev_alloc) {
+		if (!(ptr = realloc(dirtab->prev, len + PATH_MAX)))
+			return -1;
+		dirtab->prev = ptr;
+		dirtab->prev_alloc = len + PATH_MAX;
+	}
+	memcpy(dirtab->prev + prefix, path + prefix, len - prefix + 1);
+	dirtab->prev_len = len;
+	return 1;
+}
+
+/*
+ * dirtab_read() reads up to 'count' bytes of the paths encoded like in the
+ * plain database. It is called by block_read().
+ */
+ssize_t dirtab_read(struct dirtab_reader_s *dirtab, void *buffer, size_t count)
+{
+	size_t done = 0, len;
+	int ret;
+
+	while (done < count) {
+		if (dirtab->pend_pos == dirtab->pend_len) {
+			if ((ret = dirtab_encode(dirtab)) == 0)
+				break;
+			if (ret == -1)
+				return -1;
+		}
+		len = dirtab->pend_len - dirtab->pend_pos;
+		if (len > count - done)
+			len = count - done;
+		memcpy((char *)buffer + done, dirtab->pend + dirtab->pend_pos, len);
+		dirtab->pend_pos += len;
+		done += len;
+	}
+	return done;
+}
+
+/*
+ * dirtab_search() searches the directory table database. A literal case
+ * sensitive string without '/' can only match within the directory or
+ * within the name, so the directory is matched once and the names of the
+ * records, whose directory does not match, are searched with memmem().
+ * All other patterns are matched path by path.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int dirtab_search(struct g_data_s *g_data, struct dirtab_reader_s *dirtab,
+		  const char *database, char *search_str, int globflag)
+{
+	char *dir_hit = NULL;	/* 0 not matched yet, 1 no, 2 yes */
+	const char *names, *name, *end, *hit;
+	size_t len, str_len = 0;
+	uint64_t id;
+	int fast;
+	int ret = 0;
+	int r = 0;
+
+	fast = search_str && !globflag && !g_data->nocase &&
+		!g_data->regexp_data && !g_data->batch && !strchr(search_str, '/');
+	if (fast) {
+		str_len = strlen(search_str);
+		if (!(dir_hit = calloc(dirtab->count + 1, 1))) {
+			report_error(g_data, FATAL, "dirtab_search: calloc: %s\n", strerror(errno));
+			goto EXIT;
+		}
+	}
+	PROF_PHASE(PROF_DECODE);
+	while (g_data->queries != 0 && (r = dirtab_next(dirtab, &id, &names, &len)) == 1) {
+		end = names + len;
+		if (!dirtab_path(dirtab, id, NULL, 0))
+			goto NOMEM;
+		if (fast && !dir_hit[id])
+			dir_hit[id] = strstr(dirtab->path, search_str) ? 2 : 1;
+		if (fast && dir_hit[id] == 1) {
+			/* only the names with the string in them */
+			for (name = names; name < end && g_data->queries != 0; ) {
+				if (!(hit = memmem(name, end - name, search_str, str_len)))
+					break;
+				for (name = hit; name > names && name[-1]; name--)
+					;
+				len = strlen(name);
+				if (!dirtab_path(dirtab, id, name, len))
+					goto NOMEM;
+				PROF_COUNT(records, 1);
+				if (!search_path(g_data, dirtab->path, search_str, globflag))
+					goto EXIT;
+				name += len + 1;
+			}
+			continue;
+		}
+		for (name = names; name < end && g_data->queries != 0; name += len + 1) {
+			len = strlen(name);
+			if (!dirtab_path(dirtab, id, name, len))
+				goto NOMEM;
+			PROF_COUNT(records, 1);
+			if (!search_path(g_data, dirtab->path, search_str, globflag))
+				goto EXIT;
+		}
+	}
+	if (g_data->queries != 0 && r == -1) {
+		report_error(g_data, FATAL, "dirtab_search: '%s': The database is truncated or damaged.\n", database);
+		goto EXIT;
+	}
+	ret = 1;
+	goto EXIT;
+NOMEM:
+	report_error(g_data, FATAL, "dirtab_search: realloc: %s\n", strerror(errno));
+EXIT:
+	if (dir_hit)
+		free(dir_hit);
+	return ret;
+}
+
+/*
+ * dirtab_close() frees the reader, it is called by block_close().
+ */
+void dirtab_close(struct dirtab_reader_s *dirtab)
+{
+	if (!dirtab)
+		return;
+	if (dirtab->map != MAP_FAILED)
+		munmap(dirtab->map, dirtab->map_len);
+	free(dirtab->table);
+	free(dirtab->dir);
+	free(dirtab->path);
+	free(dirtab->prev);
+	free(dirtab->pend);
+	free(dirtab);
+}
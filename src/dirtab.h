@@ -0,0 +1,98 @@
+#ifndef DIRTAB_H
+#define DIRTAB_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Directory table database, written by updatedb --dir-table. Every path is
+ * cut after its last '/' into the directory and the name. The directories
+ * are stored once in a table after the records, the names are grouped
+ * in records under the number of their directory:
+ *
+ *   record | record | ... | dir\0 dir\0 ... | footer
+ *
+ * A record is the number of the directory and the length of the names as
+ * varints, followed by the names, '\0' terminated. The records keep the
+ * order of the paths, so a directory gets another record, every time the
+ * crawl comes back to it from a subdirectory. A directory in the table is
+ * the length of the prefix it shares with the one before as a varint and
+ * the rest of it. It is the data of a database of version 2, a database of
+ * version 1 starts with its own header instead. */
+#define DIRTAB_MAGIC "RLDTAB\0\1"
+/* a record is written, when its names get longer */
+#define DIRTAB_NAMES_SIZE (256 * 1024)
+
+/* header of version 1 */
+struct dirtab_header_s {
+	char magic[8];
+	char slevel;
+	char pad[7];
+};
+
+struct dirtab_footer_s {
+	uint64_t table_offset;
+	uint64_t table_len;
+	uint64_t dir_count;
+	char magic[8];
+};
+
+/* Directory table writer */
+struct dirtab_writer_s {
+	char *table;		/* directories, '\0' terminated */
+	uint64_t table_len;
+	uint64_t table_alloc;
+	uint64_t *dir;		/* offsets in table */
+	uint64_t count;
+	uint64_t alloc;
+	uint64_t *slot;		/* hash of the directories, number + 1 */
+	uint64_t slots;
+	uint64_t cur;		/* directory of the record */
+	size_t cur_len;
+	char *names;		/* names of the record */
+	size_t names_len;
+	size_t names_alloc;
+	uint64_t offset;	/* of the next record */
+};
+
+/* Directory table reader */
+struct dirtab_reader_s {
+	char *map;
+	size_t map_len;
+	char *table;		/* directories, '\0' terminated */
+	uint64_t *dir;		/* offsets in table, and the end of it */
+	uint64_t count;
+	const char *pos;	/* next record */
+	const char *end;	/* of the records */
+	char *path;
+	size_t path_alloc;
+	/* encoded paths for block_read() */
+	const char *name;
+	const char *names_end;
+	uint64_t cur;
+	char *prev;
+	size_t prev_len;
+	size_t prev_alloc;
+	short prev_code;
+	char *pend;
+	size_t pend_len;
+	size_t pend_pos;
+	size_t pend_alloc;
+};
+
+struct block_reader_s;
+
+struct dirtab_writer_s *dirtab_create(struct g_data_s *g_data, FILE *fd);
+int dirtab_add(struct g_data_s *g_data, FILE *fd, struct dirtab_writer_s *dirtab,
+	       const char *path);
+int dirtab_flush(struct g_data_s *g_data, FILE *fd, struct dirtab_writer_s *dirtab);
+int dirtab_finish(struct g_data_s *g_data, FILE *fd, struct dirtab_writer_s *dirtab);
+void dirtab_free(struct dirtab_writer_s *dirtab);
+int dirtab_open(struct g_data_s *g_data, struct block_reader_s *reader,
+		const char *database, uint64_t data_end);
+ssize_t dirtab_read(struct dirtab_reader_s *dirtab, void *buffer, size_t count);
+int dirtab_search(struct g_data_s *g_data, struct dirtab_reader_s *dirtab,
+		  const char *database, char *search_str, int globflag);
+void dirtab_close(struct dirtab_reader_s *dirtab);
+
+#endif /* !DIRTAB_H */
@@ -0,0 +1,478 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Pipeline of the fast update: the old database is read and decoded, the
+ * added paths are merged in and the result is encoded on three threads at
+ * the same time. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "block.h"
+#include "dbinfo.h"
+#include "diff.h"
+#include "splice.h"
+#include "fast.h"
+
+/* extern functions are defined in slocate.c */
+extern int encode(struct g_data_s *g_data, FILE *fd, char *path, struct enc_data_s *enc_data);
+
+/*
+ * fast_fail() stops all the stages after an error.
+ */
+static void fast_fail(struct fast_s *fast)
+{
+	pthread_mutex_lock(&fast->lock);
+	fast->error = 1;
+	fast->stop = 1;
+	pthread_cond_broadcast(&fast->decoded.cond);
+	pthread_cond_broadcast(&fast->merged.cond);
+	pthread_mutex_unlock(&fast->lock);
+}
+
+static int fast_stopped(struct fast_s *fast)
+{
+	int stop;
+
+	pthread_mutex_lock(&fast->lock);
+	stop = fast->stop;
+	pthread_mutex_unlock(&fast->lock);
+	return stop;
+}
+
+/*
+ * fast_put() hands the batch, that is filled, to the consumer.
+ */
+static void fast_put(struct fast_s *fast, struct fast_queue_s *queue)
+{
+	if (!queue->fill)
+		return;
+	pthread_mutex_lock(&fast->lock);
+	queue->count++;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&fast->lock);
+	queue->fill = NULL;
+}
+
+/*
+ * fast_finish() hands the last batch to the consumer and tells it, that
+ * there are no more.
+ */
+static void fast_finish(struct fast_s *fast, struct fast_queue_s *queue)
+{
+	if (queue->fill && queue->fill->len)
+		fast_put(fast, queue);
+	pthread_mutex_lock(&fast->lock);
+	queue->done = 1;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&fast->lock);
+}
+
+/*
+ * fast_emit() appends a record of 'type' to the batch, that is filled. The
+ * data is 'head' of 'head_len' bytes followed by 'len' bytes at 'data'. A
+ * full batch is handed on and the producer waits for an empty one.
+ *
+ * Returns:  1 == ok
+ *           0 == error or stopped
+ */
+static int fast_emit(struct fast_s *fast, struct fast_queue_s *queue, char type,
+		     const char *head, size_t head_len, const void *data, size_t len)
+{
+	struct fast_batch_s *batch;
+	size_t need = 1 + head_len + len;
+	char *ptr;
+
+	if (queue->fill && queue->fill->len + need > FAST_BATCH_SIZE)
+		fast_put(fast, queue);
+	if (!queue->fill) {
+		pthread_mutex_lock(&fast->lock);
+		while (queue->count == FAST_SLOTS && !fast->stop)
+			pthread_cond_wait(&queue->cond, &fast->lock);
+		if (!fast->stop)
+			queue->fill = &queue->slot[(queue->head + queue->count) % FAST_SLOTS];
+		pthread_mutex_unlock(&fast->lock);
+		if (!queue->fill)
+			return 0;
+		queue->fill->len = 0;
+	}
+	batch = queue->fill;
+	/* a path longer than a batch gets a batch of its own */
+	if (batch->len + need > batch->alloc) {
+		if (!(ptr = realloc(batch->buf, need > FAST_BATCH_SIZE ? need : FAST_BATCH_SIZE))) {
+			report_error(fast->g_data, FATAL, "fast_emit: realloc: %s\n", strerror(errno));
+			fast_fail(fast);
+			return 0;
+		}
+		batch->buf = ptr;
+		batch->alloc = need > FAST_BATCH_SIZE ? need : FAST_BATCH_SIZE;
+	}
+	batch->buf[batch->len++] = type;
+	if (head_len)
+		memcpy(batch->buf + batch->len, head, head_len);
+	if (len)
+		memcpy(batch->buf + batch->len + head_len, data, len);
+	batch->len += head_len + len;
+	return 1;
+}
+
+/*
+ * fast_record() returns the type of the next record of the queue of 'cur'
+ * and sets 'data' to its data, or 0 at the end or if the pipeline stopped.
+ * The data is valid until the next call.
+ */
+static int fast_record(struct fast_s *fast, struct fast_cursor_s *cur, const char **data)
+{
+	struct fast_queue_s *queue = cur->queue;
+	char type;
+
+	if (cur->batch && cur->pos == cur->batch->len) {
+		pthread_mutex_lock(&fast->lock);
+		queue->head = (queue->head + 1) % FAST_SLOTS;
+		queue->count--;
+		pthread_cond_broadcast(&queue->cond);
+		pthread_mutex_unlock(&fast->lock);
+		cur->batch = NULL;
+	}
+	if (!cur->batch) {
+		pthread_mutex_lock(&fast->lock);
+		while (!queue->count && !queue->done && !fast->stop)
+			pthread_cond_wait(&queue->cond, &fast->lock);
+		if (queue->count && !fast->stop)
+			cur->batch = &queue->slot[queue->head];
+		pthread_mutex_unlock(&fast->lock);
+		if (!cur->batch)
+			return 0;
+		cur->pos = 0;
+	}
+	type = cur->batch->buf[cur->pos++];
+	*data = cur->batch->buf + cur->pos;
+	if (type == FAST_PATH)
+		cur->pos += strlen(*data) + 1;
+	else if (type == FAST_COPY)
+		cur->pos += sizeof(uint64_t);
+	return type;
+}
+
+/*
+ * fast_decode() decodes the complete paths of the 'len' bytes at 'raw' and
+ * hands them to the merger.
+ *
+ * Returns:  the number of bytes decoded
+ *           -1 == error
+ */
+static ssize_t fast_decode(struct fast_s *fast, const unsigned char *raw, size_t len)
+{
+	size_t pos = 0, start, n;
+	const char *name, *end;
+	short code_num;
+	int prefix;
+	char *ptr;
+
+	while (pos < len) {
+		start = pos;
+		code_num = (signed char)raw[pos++];
+		if (code_num == SLOC_ESC) {
+			if (pos + 2 > len)
+				return start;
+			code_num = (short)((raw[pos] << 8) | raw[pos + 1]);
+			pos += 2;
+		}
+		name = (const char *)raw + pos;
+		if (!(end = memchr(name, '\0', len - pos)))
+			return start;
+		prefix = fast->prefix + code_num;
+		if (prefix < 0 || (size_t)prefix > fast->path_len) {
+			report_error(fast->g_data, FATAL, "rlocate_fast_updatedb: The database is damaged.\n");
+			return -1;
+		}
+		n = end - name;
+		if (prefix + n + 1 > fast->path_alloc) {
+			if (!(ptr = realloc(fast->path, prefix + n + 1))) {
+				report_error(fast->g_data, FATAL, "fast_decode: realloc: %s\n", strerror(errno));
+				return -1;
+			}
+			fast->path = ptr;
+			fast->path_alloc = prefix + n + 1;
+		}
+		memcpy(fast->path + prefix, name, n + 1);
+		fast->path_len = prefix + n;
+		fast->prefix = prefix;
+		pos += n + 1;
+		if (!fast_emit(fast, &fast->decoded, FAST_PATH, NULL, 0, fast->path, fast->path_len + 1))
+			return -1;
+	}
+	return pos;
+}
+
+/*
+ * fast_read() is the reader. It decodes the whole data of the database or
+ * the chunks, that are decoded.
+ */
+static void *fast_read(void *arg)
+{
+	struct fast_s *fast = arg;
+	unsigned char *buf = NULL;
+	unsigned char *ptr;
+	size_t alloc = FAST_READ_SIZE;
+	size_t len = 0;
+	ssize_t n, used;
+	uint64_t i;
+
+	if (fast->chunks) {
+		for (i = 0; i < fast->count; i++) {
+			if (!fast->decode[i])
+				continue;
+			if ((n = block_chunk(&fast->chunk_reader, i, &ptr)) == -1) {
+				report_error(fast->g_data, FATAL, "fast_read: read: %s\n", strerror(errno));
+				goto ERROR;
+			}
+			/* the first path of a chunk has no common prefix */
+			fast->path_len = 0;
+			fast->prefix = i ? fast->chunks[i - 1].last_prefix : 0;
+			if ((used = fast_decode(fast, ptr, n)) == -1)
+				goto ERROR;
+			if (used != n)
+				goto DAMAGED;
+			if (!fast_emit(fast, &fast->decoded, FAST_END, NULL, 0, NULL, 0))
+				goto ERROR;
+		}
+		fast_finish(fast, &fast->decoded);
+		return NULL;
+	}
+	if (!(buf = malloc(alloc))) {
+		report_error(fast->g_data, FATAL, "fast_read: malloc: %s\n", strerror(errno));
+		goto ERROR;
+	}
+	while ((n = block_read(fast->reader, buf + len, alloc - len)) > 0) {
+		len += n;
+		if ((n = fast_decode(fast, buf, len)) == -1)
+			goto ERROR;
+		memmove(buf, buf + n, len - n);
+		len -= n;
+		/* a path longer than the buffer */
+		if (len == alloc) {
+			if (!(ptr = realloc(buf, alloc * 2))) {
+				report_error(fast->g_data, FATAL, "fast_read: realloc: %s\n", strerror(errno));
+				goto ERROR;
+			}
+			buf = ptr;
+			alloc *= 2;
+		}
+	}
+	if (n == -1) {
+		report_error(fast->g_data, FATAL, "fast_read: read: %s\n", strerror(errno));
+		goto ERROR;
+	}
+	if (len)
+		goto DAMAGED;
+	free(buf);
+	fast_finish(fast, &fast->decoded);
+	return NULL;
+DAMAGED:
+	report_error(fast->g_data, FATAL, "rlocate_fast_updatedb: The database is damaged.\n");
+ERROR:
+	free(buf);
+	fast_fail(fast);
+	return NULL;
+}
+
+/*
+ * fast_list() hands the added paths to the encoder, that are alphabetically
+ * before the path 'path', or all, if it is NULL.
+ */
+static int fast_list(struct fast_s *fast, const char *path)
+{
+	const char *head;
+
+	while ((head = diff_head(fast->diff)) &&
+	       (!path || strcmp(head, path + 1) <= 0)) {
+		// add leading '/'
+		if (!fast_emit(fast, &fast->merged, FAST_PATH, "/", 1, head, strlen(head) + 1) ||
+		    !diff_next(fast->g_data, fast->diff))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * fast_path() hands the added paths before the path 'path' of the database
+ * to the encoder, and the path, if it was not added again. It is kept, if
+ * that can not be read.
+ */
+static int fast_path(struct fast_s *fast, const char *path)
+{
+	if (!fast_list(fast, path))
+		return 0;
+	// ignore leading '/' in path
+	if (diff_find(fast->g_data, fast->diff, path + 1) == 1)
+		return 1;
+	return fast_emit(fast, &fast->merged, FAST_PATH, NULL, 0, path, strlen(path) + 1);
+}
+
+/*
+ * fast_merge() is the merger.
+ */
+static void *fast_merge(void *arg)
+{
+	struct fast_s *fast = arg;
+	struct fast_cursor_s cur = { &fast->decoded, NULL, 0 };
+	const char *data;
+	uint64_t i;
+	int type;
+
+	if (fast->chunks) {
+		for (i = 0; i < fast->count; i++) {
+			if (!fast_list(fast, fast->chunks[i].first))
+				goto ERROR;
+			if (!fast->decode[i]) {
+				if (!fast_emit(fast, &fast->merged, FAST_COPY, NULL, 0, &i, sizeof(i)))
+					goto ERROR;
+				continue;
+			}
+			while ((type = fast_record(fast, &cur, &data)) == FAST_PATH) {
+				if (!fast_path(fast, data))
+					goto ERROR;
+			}
+			if (type != FAST_END)
+				goto ERROR;
+		}
+	} else {
+		while ((type = fast_record(fast, &cur, &data)) == FAST_PATH) {
+			if (!fast_path(fast, data))
+				goto ERROR;
+		}
+		if (fast_stopped(fast))
+			goto ERROR;
+	}
+	// the rest of the added paths
+	if (!fast_list(fast, NULL))
+		goto ERROR;
+	fast_finish(fast, &fast->merged);
+	return NULL;
+ERROR:
+	fast_fail(fast);
+	return NULL;
+}
+
+/*
+ * fast_pipeline() writes the database 'reader' with the added paths 'diff'
+ * merged in to 'fd'. If 'chunks' is set, the 'count' chunks, that none of
+ * the added paths fall into, are copied with splice_chunk().
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int fast_pipeline(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data,
+		  struct block_reader_s *reader, struct diff_s *diff,
+		  struct db_chunk_s *chunks, uint64_t count)
+{
+	struct fast_s fast;
+	struct fast_cursor_s cur = { &fast.merged, NULL, 0 };
+	pthread_t thread[2];
+	const char *data;
+	uint64_t i;
+	int started = 0;
+	int type;
+	int added;
+	int ret = 0;
+
+	memset(&fast, 0, sizeof(fast));
+	fast.g_data = g_data;
+	fast.diff = diff;
+	fast.reader = reader;
+	fast.chunks = chunks;
+	fast.count = count;
+	pthread_mutex_init(&fast.lock, NULL);
+	pthread_cond_init(&fast.decoded.cond, NULL);
+	pthread_cond_init(&fast.merged.cond, NULL);
+
+	if (chunks) {
+		/* the chunks, that an added path falls into, are decided
+		 * before the merger uses the added paths */
+		if (!(fast.decode = calloc(count ? count : 1, 1))) {
+			report_error(g_data, FATAL, "fast_pipeline: calloc: %s\n", strerror(errno));
+			goto EXIT;
+		}
+		for (i = 0; i < count; i++) {
+			if (chunks[i].first[0] != '/' || chunks[i].min[0] != '/' || chunks[i].max[0] != '/') {
+				report_error(g_data, FATAL, "rlocate_fast_splice: The database is damaged.\n");
+				goto EXIT;
+			}
+			if ((added = diff_range(g_data, diff, chunks[i].min + 1, chunks[i].max + 1)) == -1)
+				goto EXIT;
+			fast.decode[i] = added;
+		}
+		/* splice_chunk() of the encoder reads with 'reader' too, the
+		 * reader decodes with buffers of its own, the index and the
+		 * info are shared and only read */
+		fast.chunk_reader = *reader;
+		fast.chunk_reader.raw = NULL;
+		fast.chunk_reader.raw_alloc = 0;
+		fast.chunk_reader.comp = NULL;
+		fast.chunk_reader.comp_alloc = 0;
+	}
+	for (started = 0; started < 2; started++) {
+		if ((errno = pthread_create(&thread[started], NULL, started ? fast_merge : fast_read, &fast))) {
+			report_error(g_data, FATAL, "fast_pipeline: pthread_create: %s\n", strerror(errno));
+			goto EXIT;
+		}
+	}
+	/* the encoder */
+	while ((type = fast_record(&fast, &cur, &data))) {
+		if (type == FAST_PATH) {
+			if (!encode(g_data, fd, (char *)data, enc_data))
+				goto EXIT;
+		} else {
+			memcpy(&i, data, sizeof(i));
+			if (!splice_chunk(g_data, fd, enc_data, reader, i,
+					  i ? chunks[i - 1].last_prefix : 0, &chunks[i]))
+				goto EXIT;
+		}
+	}
+	ret = !fast_stopped(&fast);
+EXIT:
+	if (!ret)
+		fast_fail(&fast);
+	for (i = 0; i < (uint64_t)started; i++)
+		pthread_join(thread[i], NULL);
+	for (i = 0; i < FAST_SLOTS; i++) {
+		free(fast.decoded.slot[i].buf);
+		free(fast.merged.slot[i].buf);
+	}
+	free(fast.decode);
+	free(fast.path);
+	free(fast.chunk_reader.raw);
+	free(fast.chunk_reader.comp);
+	pthread_cond_destroy(&fast.decoded.cond);
+	pthread_cond_destroy(&fast.merged.cond);
+	pthread_mutex_destroy(&fast.lock);
+	return ret;
+}
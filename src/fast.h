@@ -0,0 +1,80 @@
+#ifndef FAST_H
+#define FAST_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "block.h"
+#include "dbinfo.h"
+
+/* The fast update is a pipeline of three threads, that hand batches of
+ * records to each other through bounded queues:
+ *
+ *   reader: reads the old database and decodes its paths
+ *   merger: puts the added paths in between and drops the ones, that
+ *           were added again
+ *   encoder: encodes the paths and writes them, or copies a chunk
+ *
+ * The encoder is the calling thread, the database writers need the order
+ * of the writes to 'fd'. With the chunks of a database of version 2 the
+ * reader decodes only the chunks, that an added path falls into, the
+ * others are copied by the encoder. */
+#define FAST_BATCH_SIZE (64 * 1024)
+#define FAST_SLOTS 8		/* batches of a queue */
+#define FAST_READ_SIZE (64 * 1024)
+
+/* Records of a batch */
+#define FAST_PATH 'P'		/* the path, '\0' terminated */
+#define FAST_COPY 'C'		/* uint64_t number of a chunk to copy */
+#define FAST_END  'E'		/* end of a decoded chunk */
+
+/* Consumer of a queue */
+struct fast_cursor_s {
+	struct fast_queue_s *queue;
+	struct fast_batch_s *batch;
+	size_t pos;
+};
+
+struct fast_batch_s {
+	char *buf;
+	size_t len;
+	size_t alloc;
+};
+
+/* Ring of batches, the producer fills the one after the last full one */
+struct fast_queue_s {
+	struct fast_batch_s slot[FAST_SLOTS];
+	int head;		/* next full batch */
+	int count;		/* full batches */
+	int done;		/* the producer is finished */
+	struct fast_batch_s *fill;	/* batch, that the producer fills */
+	pthread_cond_t cond;
+};
+
+struct fast_s {
+	struct g_data_s *g_data;
+	pthread_mutex_t lock;
+	struct fast_queue_s decoded;	/* reader to merger */
+	struct fast_queue_s merged;	/* merger to encoder */
+	int stop;
+	int error;
+	struct diff_s *diff;
+	struct block_reader_s *reader;
+	struct block_reader_s chunk_reader;	/* with buffers of its own */
+	struct db_chunk_s *chunks;	/* NULL, if the whole data is decoded */
+	uint64_t count;
+	char *decode;			/* chunks, that are decoded */
+	/* decoder of the reader */
+	char *path;
+	size_t path_len;
+	size_t path_alloc;
+	int prefix;
+};
+
+int fast_pipeline(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data,
+		  struct block_reader_s *reader, struct diff_s *diff,
+		  struct db_chunk_s *chunks, uint64_t count);
+
+#endif /* !FAST_H */
@@ -0,0 +1,312 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Search image: an optional uncompressed copy of the database, that can be
+ * searched with memmem() over all paths at once instead of decoding them
+ * one by one. It is written by updatedb --search-image next to the
+ * database. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "image.h"
+#include "profile.h"
+
+extern int search_path(struct g_data_s *g_data, char *full_path, char *search_str, int globflag);
+
+/*
+ * image_name() returns a dbname with ".img" attached.
+ */
+char *image_name(const char *dbname)
+{
+	char *name;
+
+	if (!(name = malloc(strlen(dbname) + strlen(IMAGE_SUFFIX) + 1)))
+		return NULL;
+	strcpy(name, dbname);
+	strcat(name, IMAGE_SUFFIX);
+	return name;
+}
+
+/*
+ * image_abort() removes the temp image and frees the writer.
+ */
+void image_abort(struct img_writer_s *image)
+{
+	if (!image)
+		return;
+	if (image->fd) {
+		fclose(image->fd);
+		unlink(image->tmp_file);
+	}
+	free(image->tmp_file);
+	free(image->offsets);
+	free(image);
+}
+
+/*
+ * image_create() opens the temp search image for the output database. The
+ * header is written, when the image is finished.
+ */
+struct img_writer_s *image_create(struct g_data_s *g_data, mode_t mode)
+{
+	struct img_writer_s *image = NULL;
+	struct img_header_s header;
+	char *name = NULL;
+
+	if (!(image = calloc(1, sizeof(struct img_writer_s)))) {
+		report_error(g_data, FATAL, "image_create: calloc: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	/* .stf == Slocate Temporary File */
+	if (!(name = image_name(g_data->output_db)) ||
+	    !(image->tmp_file = malloc(strlen(name) + strlen(".stf") + 1))) {
+		report_error(g_data, FATAL, "image_create: malloc: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	strcpy(image->tmp_file, name);
+	strcat(image->tmp_file, ".stf");
+	if (!(image->fd = fopen(image->tmp_file, "w"))) {
+		report_error(g_data, FATAL, "Could not open file for writing: %s: %s\n", image->tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	if (mode && fchmod(fileno(image->fd), mode) == -1) {
+		report_error(g_data, FATAL, "Could not change permissions of '%u' on file: %s: %s\n", mode, image->tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	/* placeholder for the header */
+	memset(&header, 0, sizeof(header));
+	if (fwrite(&header, sizeof(header), 1, image->fd) != 1) {
+		report_error(g_data, FATAL, "image_create: fwrite: %s: %s\n", image->tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	free(name);
+	return image;
+EXIT:
+	if (name)
+		free(name);
+	image_abort(image);
+	return NULL;
+}
+
+/*
+ * image_add() appends a path to the search image.
+ */
+int image_add(struct g_data_s *g_data, struct img_writer_s *image,
+	      const char *path)
+{
+	int len = strlen(path) + 1;
+
+	if (image->count == image->alloc) {
+		image->alloc = image->alloc ? image->alloc * 2 : 4096;
+		if (!(image->offsets = realloc(image->offsets, sizeof(uint64_t) * image->alloc))) {
+			report_error(g_data, FATAL, "image_add: realloc: %s\n", strerror(errno));
+			return 0;
+		}
+	}
+	if (fwrite(path, len, 1, image->fd) != 1) {
+		report_error(g_data, FATAL, "image_add: fwrite: %s: %s\n", image->tmp_file, strerror(errno));
+		return 0;
+	}
+	image->offsets[image->count++] = image->blob_len;
+	image->blob_len += len;
+	return 1;
+}
+
+/*
+ * image_finish() writes the padding, the offset array and the header, and
+ * renames the image next to the output database. It must be called, after
+ * the temp database 'tmp_db' was closed and before it is renamed, so that
+ * the image is never older than its database. The writer is freed.
+ */
+int image_finish(struct g_data_s *g_data, struct img_writer_s *image,
+		 const char *tmp_db, uid_t uid, gid_t gid)
+{
+	struct img_header_s header;
+	struct stat db_stat;
+	static const char pad[8];
+	char *name = NULL;
+	int ret = 0;
+
+	if (stat(tmp_db, &db_stat) == -1) {
+		report_error(g_data, FATAL, "image_finish: stat: %s: %s\n", tmp_db, strerror(errno));
+		goto EXIT;
+	}
+	if (IMAGE_PAD(image->blob_len) != image->blob_len &&
+	    fwrite(pad, IMAGE_PAD(image->blob_len) - image->blob_len, 1, image->fd) != 1) {
+		report_error(g_data, FATAL, "image_finish: fwrite: %s: %s\n", image->tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	if (image->count && fwrite(image->offsets, sizeof(uint64_t), image->count, image->fd) != image->count) {
+		report_error(g_data, FATAL, "image_finish: fwrite: %s: %s\n", image->tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+	header.count = image->count;
+	header.blob_len = image->blob_len;
+	header.db_size = db_stat.st_size;
+	if (fseek(image->fd, 0, SEEK_SET) == -1 ||
+	    fwrite(&header, sizeof(header), 1, image->fd) != 1) {
+		report_error(g_data, FATAL, "image_finish: header: %s: %s\n", image->tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	if (fclose(image->fd) == EOF) {
+		image->fd = NULL;
+		report_error(g_data, FATAL, "fclose(): Could not close tmp file: %s: %s\n", image->tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	image->fd = NULL;
+	if (uid != (uid_t)-1 && chown(image->tmp_file, uid, gid) == -1) {
+		report_error(g_data, FATAL, "image_finish: chown: %s: %s\n", image->tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	if (!(name = image_name(g_data->output_db)) ||
+	    rename(image->tmp_file, name) == -1) {
+		report_error(g_data, FATAL, "image_finish: rename(): Could not rename '%s': %s\n", image->tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	ret = 1;
+EXIT:
+	if (!ret && !image->fd)
+		unlink(image->tmp_file);
+	if (name)
+		free(name);
+	image_abort(image);
+	return ret;
+}
+
+/*
+ * image_find() returns the index of the path, that contains the blob offset
+ * 'pos'.
+ */
+static uint64_t image_find(const uint64_t *offsets, uint64_t count, uint64_t pos)
+{
+	uint64_t lo = 0, hi = count, mid;
+
+	/* last offset <= pos */
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (offsets[mid] <= pos)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * image_search() searches the search image of 'database', if there is an
+ * up-to-date one. Literal case sensitive patterns are searched with memmem()
+ * over the whole image, the hits are mapped back to paths with a binary
+ * search over the offsets. All other patterns are matched path by path,
+ * without decoding.
+ *
+ * Returns:  1 == searched
+ *           0 == error
+ *          -1 == no usable image, the database must be searched
+ */
+int image_search(struct g_data_s *g_data, const char *database,
+		 struct stat *db_stat, char *search_str, int globflag)
+{
+	struct img_header_s *header;
+	struct stat img_stat;
+	char *name = NULL;
+	char *map = MAP_FAILED;
+	char *blob;
+	char *hit;
+	uint64_t *offsets;
+	uint64_t i, pos;
+	size_t str_len;
+	int fd = -1;
+	int ret = -1;
+
+	if (!(name = image_name(database)))
+		goto EXIT;
+	PROF_COUNT(syscalls, 2);
+	if ((fd = open(name, O_RDONLY)) == -1 ||
+	    fstat(fd, &img_stat) == -1)
+		goto EXIT;
+	/* the database was updated without the image */
+	if (img_stat.st_mtime < db_stat->st_mtime ||
+	    img_stat.st_size < (off_t)sizeof(struct img_header_s))
+		goto EXIT;
+	PROF_COUNT(syscalls, 1);
+	map = mmap(NULL, img_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		   fd, 0);
+	if (map == MAP_FAILED)
+		goto EXIT;
+	header = (struct img_header_s *)map;
+	if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) ||
+	    header->db_size != (uint64_t)db_stat->st_size ||
+	    (uint64_t)img_stat.st_size != sizeof(struct img_header_s) +
+	    IMAGE_PAD(header->blob_len) + header->count * sizeof(uint64_t)) {
+		if (g_data->VERBOSE)
+			report_error(g_data, WARNING, "ignoring stale search image: %s\n", name);
+		goto EXIT;
+	}
+	blob = map + sizeof(struct img_header_s);
+	offsets = (uint64_t *)(blob + IMAGE_PAD(header->blob_len));
+	PROF_COUNT(bytes, img_stat.st_size);
+	ret = 0;
+
+	PROF_PHASE(PROF_DECODE);
+	if (search_str && !globflag && !g_data->nocase && !g_data->regexp_data) {
+		str_len = strlen(search_str);
+		pos = 0;
+		while (pos < header->blob_len && g_data->queries != 0) {
+			if (!(hit = memmem(blob + pos, header->blob_len - pos,
+					   search_str, str_len)))
+				break;
+			i = image_find(offsets, header->count, hit - blob);
+			PROF_COUNT(records, 1);
+			if (!search_path(g_data, blob + offsets[i], search_str, globflag))
+				goto EXIT;
+			/* continue after the path that was hit */
+			pos = i + 1 < header->count ? offsets[i + 1] : header->blob_len;
+		}
+	} else {
+		for (i = 0; i < header->count && g_data->queries != 0; i++) {
+			PROF_COUNT(records, 1);
+			if (!search_path(g_data, blob + offsets[i], search_str, globflag))
+				goto EXIT;
+		}
+	}
+	ret = 1;
+EXIT:
+	if (map != MAP_FAILED)
+		munmap(map, img_stat.st_size);
+	if (fd != -1)
+		close(fd);
+	if (name)
+		free(name);
+	return ret;
+}
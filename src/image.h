@@ -0,0 +1,47 @@
+#ifndef IMAGE_H
+#define IMAGE_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/* The search image is an uncompressed sidecar of the database: all paths
+ * back-to-back, '\0' terminated, padded with '\0' to a multiple of 8 bytes,
+ * so that the array with the offset of every path, that follows, is
+ * aligned.
+ *
+ *   header | path\0 path\0 ... pad | uint64_t offsets[count]
+ */
+#define IMAGE_MAGIC "RLIMG\0\0\1"
+#define IMAGE_SUFFIX ".img"
+/* length of the paths with the padding */
+#define IMAGE_PAD(len) (((len) + 7) & ~(uint64_t)7)
+
+struct img_header_s {
+	char magic[8];
+	uint64_t count;		/* number of paths */
+	uint64_t blob_len;	/* length of all paths */
+	uint64_t db_size;	/* size of the database it was created with */
+};
+
+/* Search image writer */
+struct img_writer_s {
+	FILE *fd;
+	char *tmp_file;
+	uint64_t *offsets;
+	uint64_t count;
+	uint64_t alloc;
+	uint64_t blob_len;
+};
+
+char *image_name(const char *dbname);
+struct img_writer_s *image_create(struct g_data_s *g_data, mode_t mode);
+int image_add(struct g_data_s *g_data, struct img_writer_s *image,
+	      const char *path);
+int image_finish(struct g_data_s *g_data, struct img_writer_s *image,
+		 const char *tmp_db, uid_t uid, gid_t gid);
+void image_abort(struct img_writer_s *image);
+int image_search(struct g_data_s *g_data, const char *database,
+		 struct stat *db_stat, char *search_str, int globflag);
+
+#endif /* !IMAGE_H */
@@ -0,0 +1,560 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Database built from lists of paths or other databases instead of a
+ * crawl. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "prune.h"
+#include "import.h"
+
+/* extern functions are defined in slocate.c */
+extern int encode(struct g_data_s *g_data, FILE *fd, char *path, struct enc_data_s *enc_data);
+/* extern functions are defined in rlocate.c */
+extern char *get_diff_db_name(const char *dbname);
+extern char *get_tmp_db_name(const char *dbname);
+
+static int import_compare(const void *e1, const void *e2, void *names)
+{
+	return tree_compare((char *)names + *(const size_t *)e1,
+			    (char *)names + *(const size_t *)e2);
+}
+
+/*
+ * import_fail() stops the workers after an error.
+ */
+static void import_fail(struct import_s *imp)
+{
+	pthread_mutex_lock(&imp->lock);
+	imp->error = 1;
+	pthread_mutex_unlock(&imp->lock);
+}
+
+/*
+ * import_add_run() adds a run to the ones, that are merged.
+ */
+static int import_add_run(struct import_s *imp, struct import_run_s *run)
+{
+	struct import_run_s *r;
+	int *heap;
+	int ret = 1;
+
+	pthread_mutex_lock(&imp->lock);
+	if (imp->runs == imp->run_alloc) {
+		if (!(r = realloc(imp->run, sizeof(struct import_run_s) * (imp->run_alloc * 2 + 8))) ||
+		    !(imp->run = r) ||
+		    !(heap = realloc(imp->heap, sizeof(int) * (imp->run_alloc * 2 + 8)))) {
+			ret = 0;
+			goto EXIT;
+		}
+		imp->heap = heap;
+		imp->run_alloc = imp->run_alloc * 2 + 8;
+	}
+	imp->run[imp->runs++] = *run;
+EXIT:
+	pthread_mutex_unlock(&imp->lock);
+	return ret;
+}
+
+/*
+ * import_spill() sorts the paths of the worker and writes them to a new
+ * run, or, if 'keep' is set, hands them over as a run in memory.
+ */
+static int import_spill(struct import_worker_s *w, int keep)
+{
+	struct import_run_s run;
+	char *rec;
+	size_t i;
+
+	memset(&run, 0, sizeof(run));
+	if (!w->count)
+		return 1;
+	qsort_r(w->entry, w->count, sizeof(size_t), import_compare, w->names);
+	if (keep) {
+		run.names = w->names;
+		run.entry = w->entry;
+		run.count = w->count;
+		if (!import_add_run(w->imp, &run))
+			goto NOMEM;
+		w->names = NULL;
+		w->names_len = w->names_alloc = 0;
+		w->entry = NULL;
+		w->count = w->alloc = 0;
+		return 1;
+	}
+	if (!(run.fp = tmpfile())) {
+		report_error(w->imp->g_data, FATAL, "import_spill: tmpfile: %s\n", strerror(errno));
+		return 0;
+	}
+	for (i = 0; i < w->count; i++) {
+		rec = w->names + w->entry[i];
+		/* the same path is written once */
+		if (i && strcmp(rec, w->names + w->entry[i - 1]) == 0)
+			continue;
+		if (fwrite(rec, strlen(rec) + 1, 1, run.fp) != 1)
+			goto WRITE_ERROR;
+	}
+	if (fflush(run.fp) == EOF)
+		goto WRITE_ERROR;
+	rewind(run.fp);
+	if (!import_add_run(w->imp, &run)) {
+		fclose(run.fp);
+		goto NOMEM;
+	}
+	w->names_len = 0;
+	w->count = 0;
+	return 1;
+WRITE_ERROR:
+	report_error(w->imp->g_data, FATAL, "import_spill: write: %s\n", strerror(errno));
+	fclose(run.fp);
+	return 0;
+NOMEM:
+	report_error(w->imp->g_data, FATAL, "import_spill: realloc: %s\n", strerror(errno));
+	return 0;
+}
+
+/*
+ * import_below() returns 1, if 'path' is one of the indexed paths or below
+ * one.
+ */
+static int import_below(struct g_data_s *g_data, const char *path)
+{
+	char *root;
+	size_t len;
+	int i;
+
+	for (i = 0; (root = g_data->index_paths[i]); i++) {
+		len = strlen(root);
+		if (strcmp(root, "/") == 0)
+			return 1;
+		if (strncmp(path, root, len) == 0 && (path[len] == '\0' || path[len] == '/'))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * import_add() adds the path 'path' of 'len' bytes to the paths of the
+ * worker, unless it is not indexed or excluded. The trailing '/' are
+ * removed in place.
+ */
+static int import_add(struct import_worker_s *w, char *path, size_t len)
+{
+	struct g_data_s *g_data = w->imp->g_data;
+	size_t n;
+	void *ptr;
+
+	while (len > 1 && path[len - 1] == '/')
+		path[--len] = '\0';
+	if (!import_below(g_data, path) ||
+	    (g_data->prune && prune_match(g_data->prune, path, PRUNE_BELOW)))
+		return 1;
+	len++;
+	if (w->count &&
+	    w->names_len + len + sizeof(size_t) * (w->count + 1) > w->imp->memory &&
+	    !import_spill(w, 0))
+		return 0;
+	if (w->names_len + len > w->names_alloc) {
+		n = w->names_alloc * 2 + len;
+		if (n > w->imp->memory && w->names_len + len <= w->imp->memory)
+			n = w->imp->memory;
+		if (!(ptr = realloc(w->names, n)))
+			goto NOMEM;
+		w->names = ptr;
+		w->names_alloc = n;
+	}
+	if (w->count == w->alloc) {
+		if (!(ptr = realloc(w->entry, sizeof(size_t) * (w->alloc * 2 + 1024))))
+			goto NOMEM;
+		w->entry = ptr;
+		w->alloc = w->alloc * 2 + 1024;
+	}
+	memcpy(w->names + w->names_len, path, len);
+	w->entry[w->count++] = w->names_len;
+	w->names_len += len;
+	return 1;
+NOMEM:
+	report_error(g_data, FATAL, "import_add: realloc: %s\n", strerror(errno));
+	return 0;
+}
+
+/*
+ * import_diff() adds the path 'path' of 'len' bytes of a diff database,
+ * that has no leading '/'.
+ */
+static int import_diff(struct import_worker_s *w, const char *path, size_t len)
+{
+	char *ptr;
+
+	if (len + 2 > w->path_alloc) {
+		if (!(ptr = realloc(w->path, len + 2))) {
+			report_error(w->imp->g_data, FATAL, "import_diff: realloc: %s\n", strerror(errno));
+			return 0;
+		}
+		w->path = ptr;
+		w->path_alloc = len + 2;
+	}
+	w->path[0] = '/';
+	memcpy(w->path + 1, path, len + 1);
+	return import_add(w, w->path, len + 1);
+}
+
+/*
+ * import_read() reads the list 'list', "-" is stdin. The paths, that are
+ * not absolute, are left out with a warning. A diff database, that does
+ * not exist, is empty.
+ */
+static int import_read(struct import_worker_s *w, const struct import_list_s *list)
+{
+	struct g_data_s *g_data = w->imp->g_data;
+	const char *name = list->name;
+	FILE *fp;
+	char *buf, *ptr, *end;
+	size_t alloc = IMPORT_READ_SIZE;
+	size_t len = 0, start, n;
+	int sep = -1;
+	int relative = 0;
+	int ret = 0;
+
+	if (strcmp(name, "-") == 0 && !list->diff)
+		fp = stdin;
+	else if (!(fp = fopen(name, "r"))) {
+		if (list->diff && errno == ENOENT)
+			return 1;
+		report_error(g_data, FATAL, "import_read: %s: %s\n", name, strerror(errno));
+		return 0;
+	}
+	if (!(buf = malloc(alloc + 1))) {
+		report_error(g_data, FATAL, "import_read: malloc: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	for (;;) {
+		n = fread(buf + len, 1, alloc - len, fp);
+		len += n;
+		if (sep == -1 && len)
+			sep = memchr(buf, '\0', len) ? '\0' : '\n';
+		/* the last path may have no separator */
+		if (!n && len && !memchr(buf, sep, len))
+			buf[len++] = sep;
+		for (start = 0; (end = memchr(buf + start, sep, len - start)); start = end + 1 - buf) {
+			*end = '\0';
+			if (end == buf + start)
+				continue;
+			if (list->diff) {
+				if (!import_diff(w, buf + start, end - buf - start))
+					goto EXIT;
+				continue;
+			}
+			if (buf[start] != '/') {
+				relative++;
+				continue;
+			}
+			if (!import_add(w, buf + start, end - buf - start))
+				goto EXIT;
+		}
+		memmove(buf, buf + start, len - start);
+		len -= start;
+		if (!n)
+			break;
+		/* a path longer than the buffer */
+		if (len == alloc) {
+			if (!(ptr = realloc(buf, alloc * 2 + 1))) {
+				report_error(g_data, FATAL, "import_read: realloc: %s\n", strerror(errno));
+				goto EXIT;
+			}
+			buf = ptr;
+			alloc *= 2;
+		}
+	}
+	if (ferror(fp)) {
+		report_error(g_data, FATAL, "import_read: %s: %s\n", name, strerror(errno));
+		goto EXIT;
+	}
+	if (relative)
+		report_error(g_data, WARNING, "%s: %d paths, that are not absolute, were left out\n", name, relative);
+	ret = 1;
+EXIT:
+	free(buf);
+	if (fp != stdin)
+		fclose(fp);
+	return ret;
+}
+
+/*
+ * import_worker() reads the lists, that are left, one after another.
+ */
+static void *import_worker(void *arg)
+{
+	struct import_worker_s *w = arg;
+	struct import_s *imp = w->imp;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&imp->lock);
+		i = imp->error || imp->next == imp->lists ? -1 : imp->next++;
+		pthread_mutex_unlock(&imp->lock);
+		if (i == -1)
+			break;
+		if (!import_read(w, &imp->list[i])) {
+			import_fail(imp);
+			return NULL;
+		}
+	}
+	/* the last paths stay in memory */
+	if (!import_spill(w, 1))
+		import_fail(imp);
+	return NULL;
+}
+
+/*
+ * import_next() reads the next path of a run. The paths of a database,
+ * that are not indexed or excluded, are skipped.
+ *
+ * Returns:  1 == ok
+ *           0 == end of the run
+ *          -1 == error
+ */
+static int import_next(struct import_s *imp, struct import_run_s *run)
+{
+	struct g_data_s *g_data = imp->g_data;
+	int ret;
+
+	if (run->db) {
+		while ((ret = merge_next(g_data, run->db)) == 1 &&
+		       (!import_below(g_data, run->db->path) ||
+			(g_data->prune && prune_match(g_data->prune, run->db->path, PRUNE_BELOW))));
+		run->rec = run->db->path;
+		return ret;
+	}
+	if (run->fp)
+		return getdelim(&run->rec, &run->size, '\0', run->fp) > 0;
+	if (run->next == run->count)
+		return 0;
+	run->rec = run->names + run->entry[run->next++];
+	return 1;
+}
+
+/*
+ * import_sift() moves the run at position 'i' of the heap down.
+ */
+static void import_sift(struct import_s *imp, int i)
+{
+	int c, t;
+
+	for (;;) {
+		c = i * 2 + 1;
+		if (c >= imp->heap_len)
+			break;
+		if (c + 1 < imp->heap_len &&
+		    tree_compare(imp->run[imp->heap[c + 1]].rec, imp->run[imp->heap[c]].rec) < 0)
+			c++;
+		if (tree_compare(imp->run[imp->heap[c]].rec, imp->run[imp->heap[i]].rec) >= 0)
+			break;
+		t = imp->heap[i];
+		imp->heap[i] = imp->heap[c];
+		imp->heap[c] = t;
+		i = c;
+	}
+}
+
+/*
+ * import_merge() encodes the paths of all the runs in the order of the
+ * crawl, every path once.
+ */
+static int import_merge(struct import_s *imp, FILE *fd, struct enc_data_s *enc_data)
+{
+	struct g_data_s *g_data = imp->g_data;
+	struct import_run_s *run;
+	char *prev = NULL;
+	size_t prev_alloc = 0, len;
+	char *ptr;
+	int i, n;
+	int ret = 0;
+
+	for (i = 0; i < imp->runs; i++) {
+		if ((n = import_next(imp, &imp->run[i])) == -1)
+			goto EXIT;
+		if (n)
+			imp->heap[imp->heap_len++] = i;
+	}
+	for (i = imp->heap_len / 2 - 1; i >= 0; i--)
+		import_sift(imp, i);
+	while (imp->heap_len) {
+		run = &imp->run[imp->heap[0]];
+		if (!prev || strcmp(prev, run->rec) != 0) {
+			if (!encode(g_data, fd, run->rec, enc_data))
+				goto EXIT;
+			len = strlen(run->rec) + 1;
+			if (len > prev_alloc) {
+				if (!(ptr = realloc(prev, len))) {
+					report_error(g_data, FATAL, "import_merge: realloc: %s\n", strerror(errno));
+					goto EXIT;
+				}
+				prev = ptr;
+				prev_alloc = len;
+			}
+			memcpy(prev, run->rec, len);
+		}
+		if ((n = import_next(imp, run)) == -1)
+			goto EXIT;
+		if (!n)
+			imp->heap[0] = imp->heap[--imp->heap_len];
+		import_sift(imp, 0);
+	}
+	for (i = 0; i < imp->runs; i++) {
+		if (imp->run[i].fp && ferror(imp->run[i].fp)) {
+			report_error(g_data, FATAL, "import_merge: read: %s\n", strerror(errno));
+			goto EXIT;
+		}
+	}
+	ret = 1;
+EXIT:
+	free(prev);
+	return ret;
+}
+
+/*
+ * import_open() opens a cursor on every database of g_data->merge_db and
+ * adds it as a run.
+ */
+static int import_open(struct import_s *imp)
+{
+	struct g_data_s *g_data = imp->g_data;
+	struct import_run_s run;
+	int i;
+
+	for (i = 0; g_data->merge_db && g_data->merge_db[i]; i++) {
+		memset(&run, 0, sizeof(run));
+		if (!(run.db = malloc(sizeof(struct merge_db_s)))) {
+			report_error(g_data, FATAL, "import_open: malloc: %s\n", strerror(errno));
+			return 0;
+		}
+		if (!merge_open(g_data, run.db, g_data->merge_db[i])) {
+			merge_close(run.db);
+			free(run.db);
+			return 0;
+		}
+		if (!import_add_run(imp, &run)) {
+			report_error(g_data, FATAL, "import_open: realloc: %s\n", strerror(errno));
+			merge_close(run.db);
+			free(run.db);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * import_lists() encodes the paths of the lists g_data->from_list and of
+ * the databases g_data->merge_db with their diff databases below the
+ * indexed paths, that are not excluded, to the database 'fd'.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int import_lists(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data)
+{
+	struct import_s imp;
+	struct import_worker_s *worker = NULL;
+	pthread_t *thread = NULL;
+	int from, merge, workers, started = 0;
+	int i;
+	int ret = 0;
+
+	memset(&imp, 0, sizeof(imp));
+	imp.g_data = g_data;
+	pthread_mutex_init(&imp.lock, NULL);
+
+	for (from = 0; g_data->from_list && g_data->from_list[from]; from++);
+	for (merge = 0; g_data->merge_db && g_data->merge_db[merge]; merge++);
+	if (!(imp.list = calloc(from + merge * 2 + 1, sizeof(struct import_list_s)))) {
+		report_error(g_data, FATAL, "import_lists: calloc: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	for (i = 0; i < from; i++)
+		imp.list[imp.lists++].name = g_data->from_list[i];
+	/* the paths, that were added since the update of a database */
+	for (i = 0; i < merge; i++, imp.lists += 2) {
+		imp.list[imp.lists].diff = imp.list[imp.lists + 1].diff = 1;
+		imp.list[imp.lists].name = get_diff_db_name(g_data->merge_db[i]);
+		imp.list[imp.lists + 1].name = get_tmp_db_name(imp.list[imp.lists].name);
+	}
+	workers = g_data->THREADS > 1 ? g_data->THREADS : IMPORT_WORKERS;
+	if (workers > imp.lists)
+		workers = imp.lists;
+	imp.memory = g_data->DIFF_MEMORY / (workers ? workers : 1);
+	if (!(worker = calloc(workers ? workers : 1, sizeof(struct import_worker_s))) ||
+	    !(thread = calloc(workers ? workers : 1, sizeof(pthread_t)))) {
+		report_error(g_data, FATAL, "import_lists: calloc: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	for (started = 0; started < workers; started++) {
+		worker[started].imp = &imp;
+		if ((errno = pthread_create(&thread[started], NULL, import_worker, &worker[started]))) {
+			report_error(g_data, FATAL, "import_lists: pthread_create: %s\n", strerror(errno));
+			import_fail(&imp);
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(thread[i], NULL);
+	if (imp.error || !import_open(&imp))
+		goto EXIT;
+	ret = import_merge(&imp, fd, enc_data);
+EXIT:
+	for (i = 0; worker && i < workers; i++) {
+		free(worker[i].names);
+		free(worker[i].entry);
+		free(worker[i].path);
+	}
+	for (i = 0; i < imp.runs; i++) {
+		if (imp.run[i].db) {
+			merge_close(imp.run[i].db);
+			free(imp.run[i].db);
+		} else if (imp.run[i].fp) {
+			fclose(imp.run[i].fp);
+			free(imp.run[i].rec);
+		}
+		free(imp.run[i].names);
+		free(imp.run[i].entry);
+	}
+	for (i = 0; i < imp.lists; i++) {
+		if (imp.list[i].diff)
+			free((char *)imp.list[i].name);
+	}
+	free(imp.list);
+	free(imp.run);
+	free(imp.heap);
+	free(worker);
+	free(thread);
+	pthread_mutex_destroy(&imp.lock);
+	return ret;
+}
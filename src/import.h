@@ -0,0 +1,75 @@
+#ifndef IMPORT_H
+#define IMPORT_H 1
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "merge.h"
+
+/* --from-list: the database is built from lists of paths, that are read
+ * from files or stdin, instead of crawling. A list has a path on every
+ * line, or every path is terminated by '\0' like the output of
+ * find -print0, if there is a '\0' in the first IMPORT_READ_SIZE bytes.
+ * Every list is read by a worker, the paths are sorted in the order of the
+ * crawl in at most --diff-memory bytes for all the workers together,
+ * beyond it in runs in temporary files, and the runs of all the lists are
+ * merged.
+ *
+ * --merge-db: the databases are runs of their own, that are read by a
+ * cursor in the merge, and their diff databases are read like the lists. */
+#define IMPORT_READ_SIZE (64 * 1024)
+/* Workers, if --threads is not given */
+#define IMPORT_WORKERS 4
+
+/* List of paths */
+struct import_list_s {
+	const char *name;
+	int diff;		/* a diff database, the paths have no leading '/' */
+};
+
+/* Sorted paths of a worker, in memory or in a temporary file, or a
+ * database */
+struct import_run_s {
+	FILE *fp;		/* NULL, if the paths are in memory */
+	struct merge_db_s *db;	/* cursor of a database */
+	char *rec;		/* current path of the merge */
+	size_t size;
+	char *names;
+	size_t *entry;		/* offsets in names */
+	size_t count;
+	size_t next;
+};
+
+/* Import data, the next list and the runs are protected by lock */
+struct import_s {
+	struct g_data_s *g_data;
+	pthread_mutex_t lock;
+	struct import_list_s *list;
+	int lists;
+	int next;			/* list, that the next worker takes */
+	int error;
+	size_t memory;			/* of one worker */
+	struct import_run_s *run;
+	int runs;
+	int run_alloc;
+	int *heap;			/* runs ordered by their current path */
+	int heap_len;
+};
+
+/* Paths of a worker, that are not sorted yet */
+struct import_worker_s {
+	struct import_s *imp;
+	char *names;
+	size_t names_len;
+	size_t names_alloc;
+	size_t *entry;		/* offsets in names */
+	size_t count;
+	size_t alloc;
+	char *path;		/* path of a diff database with the '/' */
+	size_t path_alloc;
+};
+
+int import_lists(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data);
+
+#endif /* !IMPORT_H */
@@ -0,0 +1,474 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* --incremental: full update, that reads only the directories, that
+ * changed since the last --incremental update. The listing of every
+ * directory is kept in the directory file next to the database together
+ * with the stamp of the directory. A directory, whose stamp did not change,
+ * has the same entries, so its listing is taken from the directory file
+ * without opening the directory. Its subdirectories are still checked one
+ * by one, they can change without the parent. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "incr.h"
+#include "throttle.h"
+
+extern int encode(struct g_data_s *g_data, FILE *fd, char *path, struct enc_data_s *enc_data);
+
+/*
+ * incr_name() returns a dbname with ".dirs" attached.
+ */
+static char *incr_name(const char *dbname)
+{
+	char *name;
+
+	if (!(name = malloc(strlen(dbname) + strlen(INCR_SUFFIX) + 1)))
+		return NULL;
+	strcpy(name, dbname);
+	strcat(name, INCR_SUFFIX);
+	return name;
+}
+
+/*
+ * incr_path() returns the path of entry 'name' in 'dir', as fts_read()
+ * builds it.
+ */
+static char *incr_path(struct g_data_s *g_data, const char *dir,
+		       const char *name)
+{
+	int dir_len = strlen(dir);
+	char *path;
+
+	/* no double '/' below the root directory */
+	if (dir_len && dir[dir_len - 1] == '/')
+		dir_len--;
+	if (!(path = malloc(dir_len + strlen(name) + 2))) {
+		report_error(g_data, FATAL, "incr_path: malloc: %s\n", strerror(errno));
+		return NULL;
+	}
+	memcpy(path, dir, dir_len);
+	path[dir_len] = '/';
+	strcpy(path + dir_len + 1, name);
+	return path;
+}
+
+static int incr_compare(const void *e1, const void *e2, void *names)
+{
+	return strcmp((char *)names + *(const size_t *)e1 + 1,
+		      (char *)names + *(const size_t *)e2 + 1);
+}
+
+/*
+ * incr_add() appends an entry with 'flag' to the listing.
+ */
+static int incr_add(struct incr_list_s *list, char flag, const char *name)
+{
+	size_t len = strlen(name) + 2;
+	char *names;
+	size_t *entry;
+
+	if (list->names_len + len > list->names_alloc) {
+		if (!(names = realloc(list->names, list->names_alloc * 2 + len + 256)))
+			return 0;
+		list->names = names;
+		list->names_alloc = list->names_alloc * 2 + len + 256;
+	}
+	if (list->count == list->alloc) {
+		if (!(entry = realloc(list->entry, sizeof(size_t) * (list->alloc * 2 + 64))))
+			return 0;
+		list->entry = entry;
+		list->alloc = list->alloc * 2 + 64;
+	}
+	list->entry[list->count++] = list->names_len;
+	list->names[list->names_len] = flag;
+	memcpy(list->names + list->names_len + 1, name, len - 1);
+	list->names_len += len;
+	return 1;
+}
+
+static void incr_free_list(struct incr_list_s *list)
+{
+	free(list->names);
+	free(list->entry);
+	memset(list, 0, sizeof(struct incr_list_s));
+}
+
+static void incr_stamp(struct incr_stamp_s *stamp, const struct stat *st)
+{
+	stamp->dev = st->st_dev;
+	stamp->ino = st->st_ino;
+	stamp->mtime = st->st_mtim.tv_sec;
+	stamp->mtime_nsec = st->st_mtim.tv_nsec;
+	stamp->ctime = st->st_ctim.tv_sec;
+	stamp->ctime_nsec = st->st_ctim.tv_nsec;
+	stamp->count = 0;
+}
+
+/*
+ * incr_read() reads the next record of the old directory file. The file is
+ * closed at the end or when it is broken, the directories after that are
+ * read from the disk.
+ */
+static void incr_read(struct incr_s *incr)
+{
+	struct incr_list_s *list = &incr->rec_list;
+	int64_t i;
+
+	incr->have_rec = 0;
+	list->names_len = 0;
+	list->count = 0;
+	if (!incr->old_dirs)
+		return;
+	if (getdelim(&incr->rec_path, &incr->rec_path_size, '\0', incr->old_dirs) <= 1 ||
+	    fread(&incr->rec_stamp, sizeof(struct incr_stamp_s), 1, incr->old_dirs) != 1)
+		goto END;
+	for (i = 0; i < incr->rec_stamp.count; i++) {
+		if (getdelim(&incr->name, &incr->name_size, '\0', incr->old_dirs) <= 2 ||
+		    !incr_add(list, incr->name[0], incr->name + 1))
+			goto END;
+	}
+	incr->have_rec = 1;
+	return;
+END:
+	fclose(incr->old_dirs);
+	incr->old_dirs = NULL;
+}
+
+/*
+ * incr_seek() skips the records of the old directory file up to 'path'.
+ * Returns 1, if there is a record for 'path'.
+ */
+static int incr_seek(struct incr_s *incr, const char *path)
+{
+	while (incr->have_rec && tree_compare(incr->rec_path, path) < 0)
+		incr_read(incr);
+	return incr->have_rec && strcmp(incr->rec_path, path) == 0;
+}
+
+/*
+ * incr_list() reads the entries of a directory and sorts them. The
+ * entries are stat()ed and skipped exactly like fts_build() does with
+ * FTS_PHYSICAL | FTS_NOSTAT, see crawl_list(). 'cache' is set, if the
+ * listing is complete and can be reused.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+static int incr_list(struct incr_s *incr, const char *path, const struct stat *dir_st,
+		     struct incr_list_s *list, int *reemit, int *cache)
+{
+	DIR *dirp = NULL;
+	struct dirent *entry;
+	struct stat st;
+	char *name;
+	long nlinks;
+	char flag;
+	int fd;
+	int ret = 0;
+
+	*reemit = 0;
+	*cache = 0;
+	if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW)) == -1 ||
+	    !(dirp = fdopendir(fd))) {
+		if (fd != -1)
+			close(fd);
+		/* FTS_DNR */
+		*reemit = 1;
+		return 1;
+	}
+	/* no entries without search permission */
+	if (fstatat(fd, ".", &st, 0) == -1) {
+		ret = 1;
+		goto EXIT;
+	}
+	/* the subdirectories are counted with the link count */
+	nlinks = (long)dir_st->st_nlink - 2;
+
+	errno = 0;
+	while ((entry = readdir(dirp))) {
+		name = entry->d_name;
+		if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+			continue;
+		flag = INCR_LEAF;
+		if (nlinks && (entry->d_type == DT_DIR || entry->d_type == DT_UNKNOWN)) {
+			if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+				errno = 0;
+				continue;	/* FTS_NS */
+			}
+			if (S_ISDIR(st.st_mode)) {
+				if (nlinks > 0)
+					nlinks--;
+				flag = INCR_DIR;
+			}
+		}
+		if (!incr_add(list, flag, name)) {
+			report_error(incr->g_data, FATAL, "incr_list: realloc: %s\n", strerror(errno));
+			goto EXIT;
+		}
+	}
+	/* a directory, that could not be read to the end, is read again the
+	 * next time */
+	*cache = !errno;
+	throttle_read(incr->g_data->throttle, list->count);
+	if (list->count > 1)
+		qsort_r(list->entry, list->count, sizeof(size_t), incr_compare, list->names);
+	ret = 1;
+EXIT:
+	closedir(dirp);
+	return ret;
+}
+
+/*
+ * incr_write() writes the listing of directory 'path' to the new directory
+ * file.
+ */
+static int incr_write(struct incr_s *incr, const char *path,
+		      const struct incr_stamp_s *stamp, const struct incr_list_s *list)
+{
+	const char *rec;
+	int i;
+
+	if (fwrite(path, strlen(path) + 1, 1, incr->new_dirs) != 1 ||
+	    fwrite(stamp, sizeof(struct incr_stamp_s), 1, incr->new_dirs) != 1)
+		goto ERROR;
+	for (i = 0; i < list->count; i++) {
+		rec = list->names + list->entry[i];
+		if (fwrite(rec, strlen(rec) + 1, 1, incr->new_dirs) != 1)
+			goto ERROR;
+	}
+	return 1;
+ERROR:
+	report_error(incr->g_data, FATAL, "incr_write: fwrite: %s: %s\n", incr->tmp_file, strerror(errno));
+	return 0;
+}
+
+/*
+ * incr_walk() encodes the entries of directory 'path', that was encoded
+ * already, and walks its subdirectories.
+ */
+static int incr_walk(struct incr_s *incr, const char *path,
+		     const struct stat *st, struct incr_dir_s *parent)
+{
+	struct g_data_s *g_data = incr->g_data;
+	struct incr_list_s list;
+	struct incr_stamp_s stamp;
+	struct incr_dir_s dir, *t;
+	struct stat sub_st;
+	const char *rec;
+	char *sub = NULL;
+	int reemit = 0, cache = 0;
+	int matched, i;
+	int ret = 0;
+
+	memset(&list, 0, sizeof(list));
+	dir.dev = st->st_dev;
+	dir.ino = st->st_ino;
+	dir.parent = parent;
+	incr_stamp(&stamp, st);
+	if (incr_seek(incr, path) &&
+	    incr->rec_stamp.dev == stamp.dev && incr->rec_stamp.ino == stamp.ino &&
+	    incr->rec_stamp.mtime == stamp.mtime && incr->rec_stamp.mtime_nsec == stamp.mtime_nsec &&
+	    incr->rec_stamp.ctime == stamp.ctime && incr->rec_stamp.ctime_nsec == stamp.ctime_nsec) {
+		/* unchanged, the listing is taken over and the next record
+		 * is read into a new one */
+		list = incr->rec_list;
+		memset(&incr->rec_list, 0, sizeof(struct incr_list_s));
+		cache = 1;
+	} else if (!incr_list(incr, path, st, &list, &reemit, &cache))
+		goto EXIT;
+
+	/* a directory changed in the same second as the listing is not
+	 * reused, the next change might not change its stamp */
+	stamp.count = list.count;
+	if (cache && stamp.mtime < incr->start - 1 && stamp.ctime < incr->start - 1 &&
+	    !incr_write(incr, path, &stamp, &list))
+		goto EXIT;
+
+	for (i = 0; i < list.count; i++) {
+		rec = list.names + list.entry[i];
+		if (sub)
+			free(sub);
+		if (!(sub = incr_path(g_data, path, rec + 1)))
+			goto EXIT;
+		matched = 0;
+		if (g_data->exclude && (matched = match_exclude(g_data, sub))) {
+			if (matched == -1)
+				goto EXIT;
+			continue;
+		}
+		if (!encode(g_data, incr->fd, sub, incr->enc_data))
+			goto EXIT;
+		if (rec[0] != INCR_DIR ||
+		    lstat(sub, &sub_st) == -1 || !S_ISDIR(sub_st.st_mode))
+			continue;
+		/* FTS_DC */
+		for (t = &dir; t; t = t->parent)
+			if (t->dev == sub_st.st_dev && t->ino == sub_st.st_ino)
+				break;
+		if (t)
+			continue;
+		/* FTS_XDEV */
+		if (g_data->XDEV && sub_st.st_dev != incr->dev)
+			continue;
+		if (!incr_walk(incr, sub, &sub_st, &dir))
+			goto EXIT;
+	}
+	if (reemit && !encode(g_data, incr->fd, (char *)path, incr->enc_data))
+		goto EXIT;
+	ret = 1;
+EXIT:
+	if (sub)
+		free(sub);
+	incr_free_list(&list);
+	return ret;
+}
+
+/*
+ * incr_root() encodes the paths to index and walks them, the same way as
+ * crawl_tree().
+ */
+static int incr_root(struct incr_s *incr)
+{
+	struct g_data_s *g_data = incr->g_data;
+	struct stat root_stat;
+	char *root;
+	int matched = 0;
+	int i;
+
+	for (i = 0; (root = g_data->index_paths[i]); i++) {
+		/* fts_read() skips a root, that can not be stat()ed */
+		if (lstat(root, &root_stat) == -1)
+			continue;
+		if (g_data->exclude && (matched = match_exclude(g_data, root))) {
+			if (matched == -1)
+				return 0;
+			continue;
+		}
+		if (!encode(g_data, incr->fd, root, incr->enc_data))
+			return 0;
+		if (!S_ISDIR(root_stat.st_mode))
+			continue;
+		incr->dev = root_stat.st_dev;
+		if (!incr_walk(incr, root, &root_stat, NULL))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * incr_tree() encodes the paths to index and reuses the listings of the
+ * unchanged directories from the directory file of the output database.
+ * The new directory file is written with 'mode' and is owned by 'uid' and
+ * 'gid', unless 'uid' is -1.
+ */
+int incr_tree(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data,
+	      mode_t mode, uid_t uid, gid_t gid)
+{
+	struct incr_s incr;
+	char magic[sizeof(INCR_MAGIC) - 1];
+	char *name = NULL;
+	int ret = 0;
+
+	memset(&incr, 0, sizeof(incr));
+	incr.g_data = g_data;
+	incr.fd = fd;
+	incr.enc_data = enc_data;
+	incr.start = time(NULL);
+
+	/* .stf == Slocate Temporary File */
+	if (!(name = incr_name(g_data->output_db)) ||
+	    !(incr.tmp_file = malloc(strlen(name) + strlen(".stf") + 1))) {
+		report_error(g_data, FATAL, "incr_tree: malloc: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	strcpy(incr.tmp_file, name);
+	strcat(incr.tmp_file, ".stf");
+
+	/* without the directory file of the last update every directory is
+	 * read */
+	if ((incr.old_dirs = fopen(name, "r"))) {
+		if (fread(magic, sizeof(magic), 1, incr.old_dirs) != 1 ||
+		    memcmp(magic, INCR_MAGIC, sizeof(magic)) != 0) {
+			fclose(incr.old_dirs);
+			incr.old_dirs = NULL;
+		} else
+			incr_read(&incr);
+	}
+	if (!(incr.new_dirs = fopen(incr.tmp_file, "w"))) {
+		report_error(g_data, FATAL, "Could not open file for writing: %s: %s\n", incr.tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	if (mode && fchmod(fileno(incr.new_dirs), mode) == -1) {
+		report_error(g_data, FATAL, "Could not change permissions of '%u' on file: %s: %s\n", mode, incr.tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	if (fwrite(INCR_MAGIC, sizeof(magic), 1, incr.new_dirs) != 1) {
+		report_error(g_data, FATAL, "incr_tree: fwrite: %s: %s\n", incr.tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	if (!incr_root(&incr))
+		goto EXIT;
+
+	if (fclose(incr.new_dirs) == EOF) {
+		incr.new_dirs = NULL;
+		report_error(g_data, FATAL, "fclose(): Could not close tmp file: %s: %s\n", incr.tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	incr.new_dirs = NULL;
+	if (uid != (uid_t)-1 && chown(incr.tmp_file, uid, gid) == -1) {
+		report_error(g_data, FATAL, "incr_tree: chown: %s: %s\n", incr.tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	if (rename(incr.tmp_file, name) == -1) {
+		report_error(g_data, FATAL, "incr_tree: rename(): Could not rename '%s': %s\n", incr.tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	ret = 1;
+EXIT:
+	if (incr.old_dirs)
+		fclose(incr.old_dirs);
+	if (incr.new_dirs)
+		fclose(incr.new_dirs);
+	if (!ret && incr.tmp_file)
+		unlink(incr.tmp_file);
+	if (incr.tmp_file)
+		free(incr.tmp_file);
+	if (name)
+		free(name);
+	incr_free_list(&incr.rec_list);
+	free(incr.rec_path);
+	free(incr.name);
+	return ret;
+}
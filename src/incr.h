@@ -0,0 +1,74 @@
+#ifndef INCR_H
+#define INCR_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* The directory file is a sidecar of the database with the listing of
+ * every directory, that was read by the last --incremental update, in the
+ * order of the crawl:
+ *
+ *   magic | path\0 stamp name\0 name\0 ... | path\0 stamp ...
+ *
+ * Every name starts with INCR_DIR, if it is descended into, or INCR_LEAF.
+ * A listing is reused as long as the stamp of the directory is the same. */
+#define INCR_MAGIC "RLDIRS\0\1"
+#define INCR_SUFFIX ".dirs"
+#define INCR_DIR  'd'
+#define INCR_LEAF '-'
+
+/* Directory stamp, it changes when an entry is added, removed or renamed
+ * or the directory gets a different inode */
+struct incr_stamp_s {
+	int64_t dev;
+	int64_t ino;
+	int64_t mtime;
+	int64_t mtime_nsec;
+	int64_t ctime;
+	int64_t ctime_nsec;
+	int64_t count;		/* number of names */
+};
+
+/* Directory listing, the names are sorted */
+struct incr_list_s {
+	char *names;		/* flag, name and '\0' for every entry */
+	size_t names_len;
+	size_t names_alloc;
+	size_t *entry;		/* offsets in names */
+	int count;
+	int alloc;
+};
+
+/* Directory, that is walked, for the cycle check */
+struct incr_dir_s {
+	dev_t dev;
+	ino_t ino;
+	struct incr_dir_s *parent;
+};
+
+/* --incremental data */
+struct incr_s {
+	struct g_data_s *g_data;
+	FILE *fd;
+	struct enc_data_s *enc_data;
+	FILE *old_dirs;		/* directory file of the last update or NULL */
+	FILE *new_dirs;
+	char *tmp_file;
+	time_t start;
+	dev_t dev;		/* of the root for --xdev */
+	/* current record of old_dirs */
+	int have_rec;
+	char *rec_path;
+	size_t rec_path_size;
+	struct incr_stamp_s rec_stamp;
+	struct incr_list_s rec_list;
+	char *name;
+	size_t name_size;
+};
+
+int incr_tree(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data,
+	      mode_t mode, uid_t uid, gid_t gid);
+
+#endif /* !INCR_H */
@@ -0,0 +1,184 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Fast LZ77 compression of the database blocks. The matches are found with
+ * a hash table of the last position of every four byte sequence, there is
+ * no search for a longer match. */
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+static uint32_t lz_read32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t lz_hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * lz_length() writes the rest of a length, that did not fit in the token.
+ */
+static unsigned char *lz_length(unsigned char *op, size_t n)
+{
+	for (; n >= 255; n -= 255)
+		*op++ = 255;
+	*op++ = n;
+	return op;
+}
+
+/*
+ * lz_sequence() writes 'lit' literals from 'anchor' and a match of 'mlen'
+ * bytes at 'offset', if 'mlen' is not 0. Returns the new end of the output
+ * or NULL, if it does not fit in 'end'.
+ */
+static unsigned char *lz_sequence(unsigned char *op, unsigned char *end,
+				  const unsigned char *anchor, size_t lit,
+				  size_t offset, size_t mlen)
+{
+	unsigned char *token;
+
+	/* token, lengths, literals and offset */
+	if ((size_t)(end - op) < 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1)
+		return NULL;
+	token = op++;
+	if (lit >= 15) {
+		*token = 15 << 4;
+		op = lz_length(op, lit - 15);
+	} else
+		*token = lit << 4;
+	memcpy(op, anchor, lit);
+	op += lit;
+	if (!mlen)
+		return op;
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+	mlen -= LZ_MIN_MATCH;
+	if (mlen >= 15) {
+		*token |= 15;
+		op = lz_length(op, mlen - 15);
+	} else
+		*token |= mlen;
+	return op;
+}
+
+/*
+ * lz_compress() compresses 'len' bytes of 'src' to 'dst'. Returns the
+ * compressed length or 0, if it would be longer than 'cap'.
+ */
+size_t lz_compress(const unsigned char *src, size_t len,
+		   unsigned char *dst, size_t cap)
+{
+	uint32_t table[1 << LZ_HASH_BITS];
+	const unsigned char *anchor = src;
+	const unsigned char *ip = src;
+	const unsigned char *end = src + len;
+	const unsigned char *ref;
+	unsigned char *op = dst;
+	uint32_t h;
+	size_t mlen;
+
+	memset(table, 0, sizeof(table));
+	while (ip + LZ_MIN_MATCH <= end) {
+		h = lz_hash(lz_read32(ip));
+		ref = src + table[h];
+		table[h] = ip - src;
+		if (ref >= ip || ip - ref > LZ_MAX_OFFSET ||
+		    lz_read32(ref) != lz_read32(ip)) {
+			ip++;
+			continue;
+		}
+		for (mlen = LZ_MIN_MATCH; ip + mlen < end && ref[mlen] == ip[mlen]; mlen++)
+			;
+		if (!(op = lz_sequence(op, dst + cap, anchor, ip - anchor, ip - ref, mlen)))
+			return 0;
+		ip += mlen;
+		anchor = ip;
+	}
+	if (!(op = lz_sequence(op, dst + cap, anchor, end - anchor, 0, 0)))
+		return 0;
+	return op - dst;
+}
+
+/*
+ * lz_decompress() decompresses 'len' bytes of 'src' to 'dst'. Returns the
+ * decompressed length or -1, if the input is broken or does not fit in
+ * 'cap'.
+ */
+ssize_t lz_decompress(const unsigned char *src, size_t len,
+		      unsigned char *dst, size_t cap)
+{
+	const unsigned char *ip = src;
+	const unsigned char *end = src + len;
+	unsigned char *op = dst;
+	unsigned char *op_end = dst + cap;
+	size_t lit, mlen, offset;
+	unsigned char b;
+
+	while (ip < end) {
+		b = *ip++;
+		lit = b >> 4;
+		mlen = b & 15;
+		if (lit == 15) {
+			do {
+				if (ip == end)
+					return -1;
+				lit += *ip;
+			} while (*ip++ == 255);
+		}
+		if (lit > (size_t)(end - ip) || lit > (size_t)(op_end - op))
+			return -1;
+		memcpy(op, ip, lit);
+		ip += lit;
+		op += lit;
+		/* the last sequence */
+		if (ip == end)
+			break;
+		if (end - ip < 2)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dst))
+			return -1;
+		if (mlen == 15) {
+			do {
+				if (ip == end)
+					return -1;
+				mlen += *ip;
+			} while (*ip++ == 255);
+		}
+		mlen += LZ_MIN_MATCH;
+		if (mlen > (size_t)(op_end - op))
+			return -1;
+		/* the match can overlap the output */
+		for (; mlen; mlen--, op++)
+			*op = op[-offset];
+	}
+	return op - dst;
+}
@@ -0,0 +1,22 @@
+#ifndef LZ_H
+#define LZ_H 1
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Built-in LZ77 codec for the database blocks, in the spirit of LZ4. A
+ * sequence is a token with the literal length in the high and the match
+ * length in the low four bits, more literal length bytes, the literals, a
+ * two byte little endian offset and more match length bytes. A length of
+ * 15 in the token is continued with bytes, that are added to it, until one
+ * is not 255. The last sequence has only literals. */
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 14
+
+size_t lz_compress(const unsigned char *src, size_t len,
+		   unsigned char *dst, size_t cap);
+ssize_t lz_decompress(const unsigned char *src, size_t len,
+		      unsigned char *dst, size_t cap);
+
+#endif /* !LZ_H */
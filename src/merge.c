@@ -0,0 +1,315 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Streaming comparison of databases. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "shard.h"
+#include "merge.h"
+
+/* extern functions are defined in slocate.c */
+extern int search_path(struct g_data_s *g_data, char *full_path, char *search_str, int globflag);
+
+/*
+ * merge_open() opens the cursor 'db' on the database 'database'. The cursor
+ * has to be closed with merge_close() also on error.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int merge_open(struct g_data_s *g_data, struct merge_db_s *db, const char *database)
+{
+	memset(db, 0, sizeof(struct merge_db_s));
+	db->database = database;
+	if ((db->fd = open(database, O_RDONLY)) == -1) {
+		report_error(g_data, FATAL, "merge_open: open: '%s': %s\n", database, strerror(errno));
+		return 0;
+	}
+	/* the shards are not in the order of the crawl one after another */
+	if (shard_manifest(db->fd)) {
+		report_error(g_data, FATAL, "merge_open: '%s': A sharded database can not be read as a whole.\n", database);
+		return 0;
+	}
+	if (!block_open(g_data, &db->reader, db->fd, database))
+		return 0;
+	if (!(db->buf = malloc(MERGE_READ_SIZE))) {
+		report_error(g_data, FATAL, "merge_open: malloc: %s\n", strerror(errno));
+		return 0;
+	}
+	db->alloc = MERGE_READ_SIZE;
+	return 1;
+}
+
+/*
+ * merge_decode() decodes the path at the position of the cursor, if it is
+ * complete in the buffer.
+ *
+ * Returns:  1 == a path was decoded
+ *           0 == the path is not complete
+ *          -1 == error
+ */
+static int merge_decode(struct g_data_s *g_data, struct merge_db_s *db)
+{
+	const unsigned char *raw = db->buf;
+	size_t pos = db->pos, n;
+	const char *name, *end;
+	short code_num;
+	int prefix;
+	char *ptr;
+
+	if (pos == db->len)
+		return 0;
+	code_num = (signed char)raw[pos++];
+	if (code_num == SLOC_ESC) {
+		if (pos + 2 > db->len)
+			return 0;
+		code_num = (short)((raw[pos] << 8) | raw[pos + 1]);
+		pos += 2;
+	}
+	name = (const char *)raw + pos;
+	if (!(end = memchr(name, '\0', db->len - pos)))
+		return 0;
+	prefix = db->prefix + code_num;
+	if (prefix < 0 || (size_t)prefix > db->path_len) {
+		report_error(g_data, FATAL, "merge_next: '%s': The database is damaged.\n", db->database);
+		return -1;
+	}
+	n = end - name;
+	if (prefix + n + 1 > db->path_alloc) {
+		if (!(ptr = realloc(db->path, prefix + n + 1))) {
+			report_error(g_data, FATAL, "merge_next: realloc: %s\n", strerror(errno));
+			return -1;
+		}
+		db->path = ptr;
+		db->path_alloc = prefix + n + 1;
+	}
+	memcpy(db->path + prefix, name, n + 1);
+	db->path_len = prefix + n;
+	db->prefix = prefix;
+	db->pos = pos + n + 1;
+	return 1;
+}
+
+/*
+ * merge_next() moves the cursor to the next path of the database, that is
+ * in db->path then.
+ *
+ * Returns:  1 == ok
+ *           0 == end of the database
+ *          -1 == error
+ */
+int merge_next(struct g_data_s *g_data, struct merge_db_s *db)
+{
+	unsigned char *ptr;
+	ssize_t n;
+	int ret;
+
+	while (!(ret = merge_decode(g_data, db))) {
+		if (db->eof) {
+			if (db->pos == db->len)
+				return 0;
+			report_error(g_data, FATAL, "merge_next: '%s': The database is damaged.\n", db->database);
+			return -1;
+		}
+		memmove(db->buf, db->buf + db->pos, db->len - db->pos);
+		db->len -= db->pos;
+		db->pos = 0;
+		/* a path longer than the buffer */
+		if (db->len == db->alloc) {
+			if (!(ptr = realloc(db->buf, db->alloc * 2))) {
+				report_error(g_data, FATAL, "merge_next: realloc: %s\n", strerror(errno));
+				return -1;
+			}
+			db->buf = ptr;
+			db->alloc *= 2;
+		}
+		if ((n = block_read(&db->reader, db->buf + db->len, db->alloc - db->len)) == -1) {
+			report_error(g_data, FATAL, "merge_next: read: '%s': %s\n", db->database, strerror(errno));
+			return -1;
+		}
+		if (!n)
+			db->eof = 1;
+		db->len += n;
+	}
+	return ret;
+}
+
+/*
+ * merge_close() closes the cursor 'db'.
+ */
+void merge_close(struct merge_db_s *db)
+{
+	block_close(&db->reader);
+	if (db->fd != -1)
+		close(db->fd);
+	db->fd = -1;
+	free(db->buf);
+	db->buf = NULL;
+	free(db->path);
+	db->path = NULL;
+}
+
+/*
+ * merge_diff() prints the paths, that are in the database 'new_db' but not
+ * in 'old_db' after a '+', and the ones, that are only in 'old_db', after a
+ * '-'. With --count only the numbers of them are printed.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int merge_diff(struct g_data_s *g_data, const char *old_db, const char *new_db)
+{
+	struct merge_db_s old, new;
+	unsigned long long added = 0, removed = 0;
+	int have_old, have_new;
+	int c;
+	int ret = 0;
+
+	memset(&old, 0, sizeof(old));
+	memset(&new, 0, sizeof(new));
+	old.fd = new.fd = -1;
+	if (!merge_open(g_data, &old, old_db) || !merge_open(g_data, &new, new_db))
+		goto EXIT;
+	if ((have_old = merge_next(g_data, &old)) == -1 ||
+	    (have_new = merge_next(g_data, &new)) == -1)
+		goto EXIT;
+	while (have_old || have_new) {
+		if (!have_old)
+			c = 1;
+		else if (!have_new)
+			c = -1;
+		else
+			c = tree_compare(old.path, new.path);
+		if (c < 0) {
+			removed++;
+			if (!g_data->COUNT)
+				printf("-%s\n", old.path);
+		} else if (c > 0) {
+			added++;
+			if (!g_data->COUNT)
+				printf("+%s\n", new.path);
+		}
+		if (c <= 0 && (have_old = merge_next(g_data, &old)) == -1)
+			goto EXIT;
+		if (c >= 0 && (have_new = merge_next(g_data, &new)) == -1)
+			goto EXIT;
+	}
+	if (g_data->COUNT)
+		printf("added: %llu\nremoved: %llu\n", added, removed);
+	if (fflush(stdout) == EOF) {
+		report_error(g_data, FATAL, "merge_diff: write: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	ret = 1;
+EXIT:
+	merge_close(&old);
+	merge_close(&new);
+	return ret;
+}
+
+/*
+ * merge_sift() moves the cursor at position 'i' of the heap down.
+ */
+static void merge_sift(struct merge_db_s *db, int *heap, int heap_len, int i)
+{
+	int c, t;
+
+	for (;;) {
+		c = i * 2 + 1;
+		if (c >= heap_len)
+			break;
+		if (c + 1 < heap_len &&
+		    tree_compare(db[heap[c + 1]].path, db[heap[c]].path) < 0)
+			c++;
+		if (tree_compare(db[heap[c]].path, db[heap[i]].path) >= 0)
+			break;
+		t = heap[i];
+		heap[i] = heap[c];
+		heap[c] = t;
+		i = c;
+	}
+}
+
+/*
+ * merge_search() searches the databases 'databases', that are NULL
+ * terminated, as if they were one database: their paths are merged into
+ * the order of the crawl and searched with search_path().
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int merge_search(struct g_data_s *g_data, char **databases, char *search_str, int globflag)
+{
+	struct merge_db_s *db = NULL;
+	int *heap = NULL;
+	int count, heap_len = 0;
+	int i, n;
+	int ret = 0;
+
+	for (count = 0; databases[count]; count++);
+	if (!(db = calloc(count ? count : 1, sizeof(struct merge_db_s))) ||
+	    !(heap = malloc(sizeof(int) * (count ? count : 1)))) {
+		report_error(g_data, FATAL, "merge_search: malloc: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	for (i = 0; i < count; i++)
+		db[i].fd = -1;
+	for (i = 0; i < count; i++) {
+		if (!merge_open(g_data, &db[i], databases[i]))
+			goto EXIT;
+		/* the paths of every database are checked, if one asks for it */
+		if (!i || db[i].reader.slevel == VERIFY_ACCESS)
+			g_data->slevel = db[i].reader.slevel;
+		if ((n = merge_next(g_data, &db[i])) == -1)
+			goto EXIT;
+		if (n)
+			heap[heap_len++] = i;
+	}
+	for (i = heap_len / 2 - 1; i >= 0; i--)
+		merge_sift(db, heap, heap_len, i);
+	while (heap_len && g_data->queries != 0) {
+		if (!search_path(g_data, db[heap[0]].path, search_str, globflag))
+			goto EXIT;
+		if ((n = merge_next(g_data, &db[heap[0]])) == -1)
+			goto EXIT;
+		if (!n)
+			heap[0] = heap[--heap_len];
+		merge_sift(db, heap, heap_len, 0);
+	}
+	ret = 1;
+EXIT:
+	for (i = 0; db && i < count; i++)
+		merge_close(&db[i]);
+	free(db);
+	free(heap);
+	return ret;
+}
@@ -0,0 +1,40 @@
+#ifndef MERGE_H
+#define MERGE_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "block.h"
+
+/* Databases are read one path after another by a cursor, that decodes the
+ * front coded paths of any format through block_read(). The paths of a
+ * database are in the order of the crawl, so two databases are compared in
+ * one pass, like comm does with sorted files, and nothing of them is held
+ * in memory but the current path. The shards of a sharded database are
+ * searched the same way, merged into one database. */
+#define MERGE_READ_SIZE (64 * 1024)
+
+/* Cursor on a database */
+struct merge_db_s {
+	const char *database;
+	int fd;
+	struct block_reader_s reader;
+	unsigned char *buf;
+	size_t len;
+	size_t pos;
+	size_t alloc;
+	int eof;		/* block_read() returned 0 */
+	char *path;		/* current path */
+	size_t path_len;
+	size_t path_alloc;
+	int prefix;
+};
+
+int merge_open(struct g_data_s *g_data, struct merge_db_s *db, const char *database);
+int merge_next(struct g_data_s *g_data, struct merge_db_s *db);
+void merge_close(struct merge_db_s *db);
+int merge_diff(struct g_data_s *g_data, const char *old_db, const char *new_db);
+int merge_search(struct g_data_s *g_data, char **databases, char *search_str, int globflag);
+
+#endif /* !MERGE_H */
@@ -0,0 +1,762 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* The file systems below the indexed paths: the mount points are read from
+ * the mount table, the network and pseudo file systems are found with
+ * statfs() for --prune-fs, the bind mounts of crawled directories with the
+ * mountinfo of the kernel for --skip-binds and every file system is walked
+ * by a worker of its own for --per-filesystem. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <mntent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/vfs.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "walk.h"
+#include "prune.h"
+#include "mount.h"
+#include "throttle.h"
+
+/* extern functions are defined in slocate.c */
+extern int encode(struct g_data_s *g_data, FILE *fd, char *path, struct enc_data_s *enc_data);
+
+/* f_type of the file systems, that --prune-fs excludes */
+static const uint32_t mount_types[] = {
+	/* network */
+	0x00006969,	/* nfs */
+	0x0000517b,	/* smbfs */
+	0xff534d42,	/* cifs */
+	0xfe534d42,	/* smb2 */
+	0x73757245,	/* coda */
+	0x5346414f,	/* afs */
+	0x6b414653,	/* kafs */
+	0x0000564c,	/* ncpfs */
+	0x01021997,	/* 9p */
+	0x00c36400,	/* ceph */
+	0x0bd00bd0,	/* lustre */
+	/* pseudo */
+	0x00009fa0,	/* proc */
+	0x62656572,	/* sysfs */
+	0x00001cd1,	/* devpts */
+	0x01021994,	/* tmpfs, devtmpfs */
+	0x64626720,	/* debugfs */
+	0x74726163,	/* tracefs */
+	0x73636673,	/* securityfs */
+	0x0027e0eb,	/* cgroup */
+	0x63677270,	/* cgroup2 */
+	0x6165676c,	/* pstore */
+	0xcafe4a11,	/* bpf */
+	0x42494e4d,	/* binfmt_misc */
+	0x00000187,	/* autofs */
+	0x19800202,	/* mqueue */
+	0x958458f6,	/* hugetlbfs */
+	0x62656570,	/* configfs */
+	0x65735543,	/* fusectl */
+	0xde5e81e4,	/* efivarfs */
+	0xf97cff8c,	/* selinuxfs */
+	0x6e736673,	/* nsfs */
+	0x67596969,	/* rpc_pipefs */
+	0x00009fa2,	/* usbdevfs */
+	0
+};
+
+/*
+ * mount_below() returns 1, if 'path' is one of the indexed paths or below
+ * one.
+ */
+static int mount_below(struct g_data_s *g_data, const char *path)
+{
+	char *root;
+	size_t len;
+	int i;
+
+	for (i = 0; g_data->index_paths && (root = g_data->index_paths[i]); i++) {
+		len = strlen(root);
+		if (strcmp(root, "/") == 0)
+			return *path == '/';
+		if (strncmp(path, root, len) == 0 && (path[len] == '\0' || path[len] == '/'))
+			return 1;
+	}
+	return 0;
+}
+
+static int mount_compare(const void *e1, const void *e2)
+{
+	return tree_compare(*(char * const *)e1, *(char * const *)e2);
+}
+
+/*
+ * mount_points() returns the mount points at or below the indexed paths
+ * in the order of the crawl and sets 'count'. The array is NULL terminated.
+ */
+char **mount_points(struct g_data_s *g_data, int *count)
+{
+	FILE *fp;
+	struct mntent *ent;
+	char **mounts = NULL;
+	char **m;
+	int alloc = 0;
+	int n = 0;
+	int i;
+
+	if (!(fp = setmntent(MTAB_FILE, "r"))) {
+		report_error(g_data, FATAL, "mount_points: %s: %s\n", MTAB_FILE, strerror(errno));
+		return NULL;
+	}
+	while ((ent = getmntent(fp))) {
+		if (!mount_below(g_data, ent->mnt_dir))
+			continue;
+		if (n + 1 >= alloc) {
+			alloc = alloc * 2 + 16;
+			if (!(m = realloc(mounts, sizeof(char *) * alloc)))
+				goto NOMEM;
+			mounts = m;
+		}
+		if (!(mounts[n] = strdup(ent->mnt_dir)))
+			goto NOMEM;
+		n++;
+	}
+	endmntent(fp);
+	if (!mounts && !(mounts = malloc(sizeof(char *)))) {
+		report_error(g_data, FATAL, "mount_points: malloc: %s\n", strerror(errno));
+		return NULL;
+	}
+	qsort(mounts, n, sizeof(char *), mount_compare);
+	/* a path mounted over again is the same mount point */
+	for (*count = 0, i = 0; i < n; i++) {
+		if (*count && strcmp(mounts[*count - 1], mounts[i]) == 0)
+			free(mounts[i]);
+		else
+			mounts[(*count)++] = mounts[i];
+	}
+	mounts[*count] = NULL;
+	return mounts;
+NOMEM:
+	report_error(g_data, FATAL, "mount_points: malloc: %s\n", strerror(errno));
+	endmntent(fp);
+	for (i = 0; i < n; i++)
+		free(mounts[i]);
+	free(mounts);
+	return NULL;
+}
+
+/*
+ * mount_prune() excludes the mount points of the network and pseudo file
+ * systems below the indexed paths. The type is taken from statfs(), not
+ * from the name in the mount table.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int mount_prune(struct g_data_s *g_data)
+{
+	struct statfs st;
+	char **mounts;
+	char **exclude;
+	int count, len, i, j;
+	int ret = 0;
+
+	if (!(mounts = mount_points(g_data, &count)))
+		return 0;
+	for (len = 0; g_data->exclude && g_data->exclude[len]; len++);
+	for (i = 0; i < count; i++) {
+		if (statfs(mounts[i], &st) == -1)
+			continue;
+		for (j = 0; mount_types[j] && mount_types[j] != (uint32_t)st.f_type; j++);
+		if (!mount_types[j])
+			continue;
+		if (!(exclude = realloc(g_data->exclude, sizeof(char *) * (len + 2)))) {
+			report_error(g_data, FATAL, "mount_prune: realloc: %s\n", strerror(errno));
+			goto EXIT;
+		}
+		g_data->exclude = exclude;
+		exclude[len++] = mounts[i];
+		exclude[len] = NULL;
+		mounts[i] = NULL;
+	}
+	ret = 1;
+EXIT:
+	for (i = 0; i < count; i++)
+		free(mounts[i]);
+	free(mounts);
+	return ret;
+}
+
+/* Mount of the mount table of the kernel */
+struct mount_info_s {
+	int id;
+	unsigned int major;
+	unsigned int minor;
+	char *root;		/* the directory of the file system mounted */
+	char *dir;
+	int hidden;		/* mounted over */
+	int bind;		/* the same as 'alias' */
+	char *alias;
+};
+
+/*
+ * mount_unescape() decodes the octal escapes of a field of mountinfo in
+ * place.
+ */
+static void mount_unescape(char *s)
+{
+	char *d = s;
+
+	for (; *s; s++, d++) {
+		if (s[0] == '\\' && s[1] >= '0' && s[1] <= '3' &&
+		    s[2] >= '0' && s[2] <= '7' && s[3] >= '0' && s[3] <= '7') {
+			*d = (s[1] - '0') << 6 | (s[2] - '0') << 3 | (s[3] - '0');
+			s += 3;
+		} else
+			*d = *s;
+	}
+	*d = '\0';
+}
+
+/*
+ * mount_prefix() returns the length of 'dir', if 'path' is 'dir' or below
+ * it, otherwise -1.
+ */
+static int mount_prefix(const char *dir, const char *path)
+{
+	size_t len = strlen(dir);
+
+	if (strcmp(dir, "/") == 0)
+		return *path == '/' ? 0 : -1;
+	if (strncmp(path, dir, len) == 0 && (path[len] == '\0' || path[len] == '/'))
+		return len;
+	return -1;
+}
+
+/*
+ * mount_excluded() returns 1, if 'path' is one of the excluded paths or
+ * below one. The excludes are not compiled yet.
+ */
+static int mount_excluded(struct g_data_s *g_data, const char *path)
+{
+	int i;
+
+	for (i = 0; g_data->exclude && g_data->exclude[i]; i++) {
+		if (mount_prefix(g_data->exclude[i], path) >= 0)
+			return 1;
+	}
+	return 0;
+}
+
+static int mount_info_compare(const void *e1, const void *e2)
+{
+	const struct mount_info_s *m1 = e1;
+	const struct mount_info_s *m2 = e2;
+	size_t l1 = strlen(m1->root);
+	size_t l2 = strlen(m2->root);
+
+	if (l1 != l2)
+		return l1 < l2 ? -1 : 1;
+	return m1->id - m2->id;
+}
+
+/*
+ * mount_info() reads the mounts of MOUNTINFO_FILE and sets 'count'.
+ */
+static struct mount_info_s *mount_info(struct g_data_s *g_data, int *count)
+{
+	struct mount_info_s *info = NULL;
+	struct mount_info_s *m;
+	FILE *fp;
+	char *line = NULL;
+	size_t size = 0;
+	char root[PATH_MAX * 4], dir[PATH_MAX * 4];
+	int alloc = 0;
+	int n = 0;
+	int i;
+
+	if (!(fp = fopen(MOUNTINFO_FILE, "r"))) {
+		report_error(g_data, FATAL, "mount_info: %s: %s\n", MOUNTINFO_FILE, strerror(errno));
+		return NULL;
+	}
+	while (getline(&line, &size, fp) != -1) {
+		if (n >= alloc) {
+			alloc = alloc * 2 + 16;
+			if (!(m = realloc(info, sizeof(*info) * alloc)))
+				goto NOMEM;
+			info = m;
+		}
+		m = &info[n];
+		memset(m, 0, sizeof(*m));
+		if (strlen(line) >= sizeof(root) ||
+		    sscanf(line, "%d %*d %u:%u %s %s", &m->id, &m->major, &m->minor, root, dir) != 5)
+			continue;
+		mount_unescape(root);
+		mount_unescape(dir);
+		if (!(m->root = strdup(root)) || !(m->dir = strdup(dir))) {
+			free(m->root);
+			goto NOMEM;
+		}
+		n++;
+	}
+	free(line);
+	fclose(fp);
+	/* a mount is hidden by the ones mounted over it later */
+	for (i = 0; i < n; i++) {
+		int j;
+
+		for (j = i + 1; j < n && strcmp(info[i].dir, info[j].dir); j++);
+		info[i].hidden = j < n;
+	}
+	*count = n;
+	return info;
+NOMEM:
+	report_error(g_data, FATAL, "mount_info: malloc: %s\n", strerror(errno));
+	free(line);
+	fclose(fp);
+	for (i = 0; i < n; i++) {
+		free(info[i].root);
+		free(info[i].dir);
+	}
+	free(info);
+	return NULL;
+}
+
+/*
+ * mount_cover() returns the path, where the indexed file system 'n' shows
+ * the directory mounted by 'm', if it is crawled there, otherwise NULL.
+ */
+static char *mount_cover(struct g_data_s *g_data, struct mount_info_s *info,
+			 int count, struct mount_info_s *m, struct mount_info_s *n)
+{
+	const char *rest;
+	char *path;
+	int len, i;
+
+	if (n->major != m->major || n->minor != m->minor ||
+	    (len = mount_prefix(n->root, m->root)) < 0)
+		return NULL;
+	rest = m->root + len;
+	if (!(path = malloc(strlen(n->dir) + strlen(rest) + 1)))
+		return NULL;
+	if (strcmp(n->dir, "/") == 0)
+		strcpy(path, *rest ? rest : "/");
+	else
+		sprintf(path, "%s%s", n->dir, rest);
+	if (!mount_below(g_data, path) || mount_excluded(g_data, path))
+		goto NONE;
+	/* the path is not on 'n', if something is mounted in between, that
+	 * is 'm' too, if the path is below it */
+	for (i = 0; i < count; i++) {
+		if (&info[i] == n || info[i].hidden)
+			continue;
+		if (mount_prefix(n->dir, info[i].dir) >= 0 && mount_prefix(info[i].dir, path) >= 0)
+			goto NONE;
+	}
+	return path;
+NONE:
+	free(path);
+	return NULL;
+}
+
+/*
+ * mount_binds() excludes the mount points below the indexed paths, that
+ * are a bind mount of a directory, that is crawled at another place: the
+ * same device and a root, that is the root of the other mount or below it.
+ * The mount, that is kept, is the one with the shortest root and of these
+ * the one mounted first. A mount is kept too, if a file system, that is
+ * not crawled elsewhere, is mounted below it. The excluded mount points
+ * are recorded in the database as aliases of the paths, that are crawled.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int mount_binds(struct g_data_s *g_data)
+{
+	struct mount_info_s *info;
+	char **exclude, **alias;
+	int count, len, aliases, i, j, changed;
+	int ret = 0;
+
+	/* with --xdev the mounts below the indexed paths are not crawled */
+	if (g_data->XDEV)
+		return 1;
+	if (!(info = mount_info(g_data, &count)))
+		return 0;
+	qsort(info, count, sizeof(*info), mount_info_compare);
+	for (i = 0; i < count; i++) {
+		struct mount_info_s *m = &info[i];
+
+		if (m->hidden || !mount_below(g_data, m->dir) || mount_excluded(g_data, m->dir))
+			continue;
+		/* an indexed path is crawled as it was given */
+		for (j = 0; g_data->index_paths[j] && strcmp(g_data->index_paths[j], m->dir); j++);
+		if (g_data->index_paths[j])
+			continue;
+		for (j = 0; j < i && !m->bind; j++) {
+			if (info[j].hidden || info[j].bind)
+				continue;
+			if ((m->alias = mount_cover(g_data, info, count, m, &info[j])))
+				m->bind = 1;
+		}
+	}
+	/* a file system mounted below a bind mount would be lost */
+	do {
+		changed = 0;
+		for (i = 0; i < count; i++) {
+			if (!info[i].bind)
+				continue;
+			for (j = 0; j < count; j++) {
+				if (j == i || info[j].hidden || info[j].bind ||
+				    mount_prefix(info[i].dir, info[j].dir) < 0 ||
+				    mount_excluded(g_data, info[j].dir))
+					continue;
+				info[i].bind = 0;
+				changed = 1;
+				break;
+			}
+		}
+	} while (changed);
+
+	for (len = 0; g_data->exclude && g_data->exclude[len]; len++);
+	for (aliases = 0; g_data->alias && g_data->alias[aliases]; aliases++);
+	for (i = 0; i < count; i++) {
+		if (!info[i].bind)
+			continue;
+		if (!(exclude = realloc(g_data->exclude, sizeof(char *) * (len + 2))))
+			goto NOMEM;
+		g_data->exclude = exclude;
+		exclude[len] = NULL;
+		if (!(alias = realloc(g_data->alias, sizeof(char *) * (aliases + 2))))
+			goto NOMEM;
+		g_data->alias = alias;
+		alias[aliases] = NULL;
+		if (!(alias[aliases] = malloc(strlen(info[i].dir) + 4 + strlen(info[i].alias) + 1)))
+			goto NOMEM;
+		sprintf(alias[aliases++], "%s -> %s", info[i].dir, info[i].alias);
+		alias[aliases] = NULL;
+		exclude[len++] = info[i].dir;
+		exclude[len] = NULL;
+		info[i].dir = NULL;
+		if (g_data->VERBOSE)
+			fprintf(stderr, "%s: skipping the bind mount %s\n", g_data->progname, alias[aliases - 1]);
+	}
+	ret = 1;
+	goto EXIT;
+NOMEM:
+	report_error(g_data, FATAL, "mount_binds: malloc: %s\n", strerror(errno));
+EXIT:
+	for (i = 0; i < count; i++) {
+		free(info[i].root);
+		free(info[i].dir);
+		free(info[i].alias);
+	}
+	free(info);
+	return ret;
+}
+
+/* walk_tree() argument of a worker */
+struct mount_walk_s {
+	struct mount_crawl_s *crawl;
+	struct mount_unit_s *unit;
+	int len;		/* of the path of the unit */
+	int err;
+};
+
+/*
+ * mount_walk() writes a path of the unit to its temporary file. The mount
+ * points of the other units are written, but not descended into.
+ */
+static int mount_walk(const char *path, int len, void *arg)
+{
+	struct mount_walk_s *mw = arg;
+	struct mount_crawl_s *crawl = mw->crawl;
+
+	throttle_read(crawl->g_data->throttle, 1);
+	if (crawl->g_data->exclude && match_exclude(crawl->g_data, (char *)path))
+		return WALK_SKIP;
+	/* the mount point is written by the unit above */
+	if (len == mw->len) {
+		if (!mw->unit->root)
+			return WALK_CONTINUE;
+	} else if (prune_match(crawl->mounts, path, PRUNE_EXACT)) {
+		if (fwrite(path, len + 1, 1, mw->unit->fp) != 1)
+			goto ERROR;
+		return WALK_SKIP;
+	}
+	if (fwrite(path, len + 1, 1, mw->unit->fp) != 1)
+		goto ERROR;
+	return WALK_CONTINUE;
+ERROR:
+	mw->err = errno;
+	return WALK_ABORT;
+}
+
+/*
+ * mount_worker() walks the units, that no other worker took yet.
+ */
+static void *mount_worker(void *arg)
+{
+	struct mount_crawl_s *crawl = arg;
+	struct mount_walk_s mw;
+	struct mount_unit_s *unit;
+	int flags = WALK_SORTED | (crawl->g_data->XDEV ? WALK_XDEV : 0) |
+		    (crawl->g_data->INODE_ORDER ? WALK_INODE : 0);
+	int self, err;
+
+	pthread_mutex_lock(&crawl->lock);
+	self = crawl->workers++;
+	pthread_mutex_unlock(&crawl->lock);
+	while (1) {
+		/* a throttled worker waits, while the machine is busy */
+		if (throttle_park(crawl->g_data->throttle, self))
+			continue;
+		pthread_mutex_lock(&crawl->lock);
+		if (crawl->stop || crawl->next == crawl->count) {
+			pthread_mutex_unlock(&crawl->lock);
+			break;
+		}
+		unit = &crawl->unit[crawl->next++];
+		unit->state = MOUNT_RUNNING;
+		pthread_mutex_unlock(&crawl->lock);
+		if (unit->keep) {
+			pthread_mutex_lock(&crawl->lock);
+			unit->state = MOUNT_DONE;
+			pthread_cond_broadcast(&crawl->done);
+			pthread_mutex_unlock(&crawl->lock);
+			continue;
+		}
+
+		mw.crawl = crawl;
+		mw.unit = unit;
+		mw.len = strlen(unit->path);
+		mw.err = 0;
+		err = 0;
+		if (!(unit->fp = tmpfile()))
+			err = errno;
+		else if (!walk_tree(unit->path, flags, mount_walk, &mw))
+			err = mw.err ? mw.err : errno;
+		else if (fflush(unit->fp) == EOF)
+			err = errno;
+
+		pthread_mutex_lock(&crawl->lock);
+		unit->err = err;
+		unit->state = MOUNT_DONE;
+		pthread_cond_broadcast(&crawl->done);
+		pthread_mutex_unlock(&crawl->lock);
+	}
+	return NULL;
+}
+
+/*
+ * mount_units() sets up the units of the crawl: the indexed paths and the
+ * file systems mounted below them, that are not excluded.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int mount_units(struct g_data_s *g_data, struct mount_crawl_s *crawl)
+{
+	int i, j;
+
+	memset(crawl, 0, sizeof(*crawl));
+	crawl->g_data = g_data;
+	pthread_mutex_init(&crawl->lock, NULL);
+	pthread_cond_init(&crawl->done, NULL);
+
+	if (!(crawl->points = mount_points(g_data, &crawl->points_count)))
+		return 0;
+	for (i = 0; g_data->index_paths[i]; i++);
+	if (!(crawl->mounts = prune_create()) ||
+	    !(crawl->unit = calloc(i + crawl->points_count, sizeof(struct mount_unit_s)))) {
+		report_error(g_data, FATAL, "mount_units: calloc: %s\n", strerror(errno));
+		return 0;
+	}
+	for (i = 0; g_data->index_paths[i]; i++) {
+		crawl->unit[crawl->count].path = g_data->index_paths[i];
+		crawl->unit[crawl->count++].root = 1;
+	}
+	for (i = 0; i < crawl->points_count; i++) {
+		/* an indexed path, that is a mount point, is a root */
+		for (j = 0; g_data->index_paths[j] && strcmp(g_data->index_paths[j], crawl->points[i]); j++);
+		if (g_data->index_paths[j])
+			continue;
+		if (!prune_add(crawl->mounts, crawl->points[i])) {
+			report_error(g_data, FATAL, "mount_units: malloc: %s\n", strerror(errno));
+			return 0;
+		}
+		/* with --xdev the mount points are not descended into, a unit
+		 * below an excluded directory is never reached */
+		if (g_data->XDEV ||
+		    (g_data->prune && prune_match(g_data->prune, crawl->points[i], PRUNE_BELOW)))
+			continue;
+		crawl->unit[crawl->count].path = crawl->points[i];
+		crawl->unit[crawl->count++].root = 0;
+	}
+	return 1;
+}
+
+/*
+ * mount_start() starts the workers, that walk the units, at most
+ * g_data->THREADS or MOUNT_WORKERS at a time.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int mount_start(struct mount_crawl_s *crawl)
+{
+	struct g_data_s *g_data = crawl->g_data;
+	int threads;
+
+	threads = g_data->THREADS > 1 ? g_data->THREADS : MOUNT_WORKERS;
+	if (threads > crawl->count)
+		threads = crawl->count;
+	throttle_workers(g_data->throttle, threads);
+	if (!(crawl->thread = calloc(threads ? threads : 1, sizeof(pthread_t)))) {
+		report_error(g_data, FATAL, "mount_start: calloc: %s\n", strerror(errno));
+		return 0;
+	}
+	for (crawl->started = 0; crawl->started < threads; crawl->started++) {
+		if ((errno = pthread_create(&crawl->thread[crawl->started], NULL, mount_worker, crawl))) {
+			report_error(g_data, FATAL, "mount_start: pthread_create: %s\n", strerror(errno));
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * mount_wait() waits until unit 'u' is walked and rewinds its temporary
+ * file.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int mount_wait(struct mount_crawl_s *crawl, int u)
+{
+	struct mount_unit_s *unit = &crawl->unit[u];
+
+	pthread_mutex_lock(&crawl->lock);
+	while (unit->state != MOUNT_DONE)
+		pthread_cond_wait(&crawl->done, &crawl->lock);
+	pthread_mutex_unlock(&crawl->lock);
+	if (unit->err) {
+		report_error(crawl->g_data, FATAL, "mount_crawl: %s: %s\n", unit->path, strerror(unit->err));
+		return 0;
+	}
+	if (unit->fp)
+		rewind(unit->fp);
+	return 1;
+}
+
+/*
+ * mount_end() stops the workers and frees the crawl.
+ */
+void mount_end(struct mount_crawl_s *crawl)
+{
+	int i;
+
+	pthread_mutex_lock(&crawl->lock);
+	crawl->stop = 1;
+	pthread_mutex_unlock(&crawl->lock);
+	for (i = 0; i < crawl->started; i++)
+		pthread_join(crawl->thread[i], NULL);
+	for (i = 0; i < crawl->count; i++)
+		if (crawl->unit[i].fp)
+			fclose(crawl->unit[i].fp);
+	for (i = 0; i < crawl->points_count; i++)
+		free(crawl->points[i]);
+	if (crawl->points)
+		free(crawl->points);
+	if (crawl->unit)
+		free(crawl->unit);
+	if (crawl->thread)
+		free(crawl->thread);
+	prune_free(crawl->mounts);
+	pthread_cond_destroy(&crawl->done);
+	pthread_mutex_destroy(&crawl->lock);
+}
+
+/*
+ * mount_splice() encodes the paths of unit 'u' and the units mounted in
+ * it, after their mount points.
+ */
+static int mount_splice(struct mount_crawl_s *crawl, int u, FILE *fd,
+			struct enc_data_s *enc_data, char **buffer, size_t *len)
+{
+	struct g_data_s *g_data = crawl->g_data;
+	struct mount_unit_s *unit = &crawl->unit[u];
+	int i;
+
+	if (!mount_wait(crawl, u))
+		return 0;
+	while (getdelim(buffer, len, '\0', unit->fp) != -1) {
+		if (!encode(g_data, fd, *buffer, enc_data))
+			return 0;
+		if (!prune_match(crawl->mounts, *buffer, PRUNE_EXACT))
+			continue;
+		for (i = u + 1; i < crawl->count; i++)
+			if (!crawl->unit[i].root && strcmp(crawl->unit[i].path, *buffer) == 0)
+				break;
+		if (i < crawl->count && !mount_splice(crawl, i, fd, enc_data, buffer, len))
+			return 0;
+	}
+	if (ferror(unit->fp)) {
+		report_error(g_data, FATAL, "mount_crawl: read: %s\n", strerror(errno));
+		return 0;
+	}
+	fclose(unit->fp);
+	unit->fp = NULL;
+	return 1;
+}
+
+/*
+ * mount_crawl() encodes the indexed paths with one worker for every file
+ * system, at most g_data->THREADS or MOUNT_WORKERS at a time.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int mount_crawl(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data)
+{
+	struct mount_crawl_s crawl;
+	char *buffer = NULL;
+	size_t len = 0;
+	int i;
+	int ret = 0;
+
+	if (!mount_units(g_data, &crawl) || !mount_start(&crawl))
+		goto EXIT;
+	for (i = 0; i < crawl.count && crawl.unit[i].root; i++)
+		if (!mount_splice(&crawl, i, fd, enc_data, &buffer, &len))
+			goto EXIT;
+	ret = 1;
+EXIT:
+	mount_end(&crawl);
+	if (buffer)
+		free(buffer);
+	return ret;
+}
@@ -0,0 +1,58 @@
+#ifndef MOUNT_H
+#define MOUNT_H 1
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/* --per-filesystem: every indexed path and every file system mounted below
+ * one is walked by a worker of its own into a temporary file, so the disks
+ * are read at the same time. A worker does not descend into the mount
+ * points of the other workers, the encoder puts their paths in after the
+ * mount point, so the database is the same as with --native-crawl. */
+
+/* Workers, if --threads is not given */
+#define MOUNT_WORKERS 8
+
+/* Unit states */
+#define MOUNT_PENDING 0
+#define MOUNT_RUNNING 1
+#define MOUNT_DONE    2
+
+/* File system walked by one worker */
+struct mount_unit_s {
+	char *path;
+	int root;		/* an indexed path, not a mount point */
+	int keep;		/* not walked, the shard of it is kept */
+	int state;
+	int err;		/* errno of the walk */
+	FILE *fp;		/* the paths, '\0' terminated */
+};
+
+/* Crawl data, the states are protected by lock */
+struct mount_crawl_s {
+	struct g_data_s *g_data;
+	pthread_mutex_t lock;
+	pthread_cond_t done;		/* a unit was walked */
+	struct mount_unit_s *unit;
+	int count;
+	int next;			/* unit, that the next worker takes */
+	int stop;
+	struct prune_s *mounts;		/* mount points below the roots */
+	char **points;			/* of mount_points() */
+	int points_count;
+	pthread_t *thread;
+	int started;
+	int workers;			/* numbers of the workers */
+};
+
+char **mount_points(struct g_data_s *g_data, int *count);
+int mount_prune(struct g_data_s *g_data);
+int mount_binds(struct g_data_s *g_data);
+int mount_units(struct g_data_s *g_data, struct mount_crawl_s *crawl);
+int mount_start(struct mount_crawl_s *crawl);
+int mount_wait(struct mount_crawl_s *crawl, int u);
+void mount_end(struct mount_crawl_s *crawl);
+int mount_crawl(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data);
+
+#endif /* !MOUNT_H */
@@ -0,0 +1,143 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* --profile support: per phase wall and cpu time and query counters. */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "slocate.h"
+#include "profile.h"
+
+struct prof_data_s PROF;
+
+static const char *PHASE_NAME[PROF_PHASES] = {
+	"startup",
+	"run_rlocated",
+	"diff load",
+	"decode",
+	"match",
+	"verify_access",
+	"output"
+};
+
+/*
+ * prof_elapsed() returns the time between two timespecs in milliseconds.
+ */
+static double prof_elapsed(const struct timespec *from,
+			   const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000.0 +
+	       (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+/*
+ * prof_start() resets the counters and starts charging time to the startup
+ * phase.
+ */
+void prof_start(void)
+{
+	memset(&PROF, 0, sizeof(PROF));
+	PROF.enabled = 1;
+	PROF.phase = PROF_STARTUP;
+	clock_gettime(CLOCK_MONOTONIC, &PROF.wall_mark);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &PROF.cpu_mark);
+}
+
+/*
+ * prof_charge() charges the time since the last mark to the current phase.
+ */
+static void prof_charge(void)
+{
+	struct timespec wall, cpu;
+
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	PROF.wall[PROF.phase] += prof_elapsed(&PROF.wall_mark, &wall);
+	PROF.cpu[PROF.phase]  += prof_elapsed(&PROF.cpu_mark, &cpu);
+	PROF.wall_mark = wall;
+	PROF.cpu_mark  = cpu;
+}
+
+/*
+ * prof_phase() makes 'phase' the current phase. It returns the previous
+ * phase, so that callers can switch back to it.
+ */
+int prof_phase(const int phase)
+{
+	int prev = PROF.phase;
+
+	if (phase != prev) {
+		prof_charge();
+		PROF.phase = phase;
+	}
+	return prev;
+}
+
+/*
+ * prof_report() prints the profile on stderr.
+ */
+void prof_report(struct g_data_s *g_data)
+{
+	struct rusage usage;
+	double wall = 0, cpu = 0;
+	int i;
+
+	if (!PROF.enabled)
+		return;
+	prof_phase(PROF_OUTPUT);
+	fflush(stdout);
+	prof_charge();
+
+	fprintf(stderr, "%s: profile: %-16s %12s %12s\n", g_data->progname,
+		"phase", "wall ms", "cpu ms");
+	for (i = 0; i < PROF_PHASES; i++) {
+		fprintf(stderr, "%s: profile: %-16s %12.3f %12.3f\n",
+			g_data->progname, PHASE_NAME[i], PROF.wall[i],
+			PROF.cpu[i]);
+		wall += PROF.wall[i];
+		cpu += PROF.cpu[i];
+	}
+	fprintf(stderr, "%s: profile: %-16s %12.3f %12.3f\n", g_data->progname,
+		"total", wall, cpu);
+	fprintf(stderr, "%s: profile: records decoded: %llu\n"
+			"%s: profile: bytes read:      %llu\n"
+			"%s: profile: matches:         %llu\n"
+			"%s: profile: verified:        %llu\n"
+			"%s: profile: rejected:        %llu\n"
+			"%s: profile: syscalls:        %llu\n",
+		g_data->progname, PROF.records,
+		g_data->progname, PROF.bytes,
+		g_data->progname, PROF.matches,
+		g_data->progname, PROF.verified,
+		g_data->progname, PROF.rejected,
+		g_data->progname, PROF.syscalls);
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		fprintf(stderr, "%s: profile: peak rss:        %ld kB\n",
+			g_data->progname, usage.ru_maxrss);
+	if (getrusage(RUSAGE_CHILDREN, &usage) == 0 && usage.ru_maxrss > 0)
+		fprintf(stderr, "%s: profile: peak rss (rlocated): %ld kB\n",
+			g_data->progname, usage.ru_maxrss);
+}
@@ -0,0 +1,49 @@
+#ifndef PROFILE_H
+#define PROFILE_H 1
+
+#include <time.h>
+
+/* Query phases. Wall and cpu time is always charged to exactly one of
+ * them, so the phases add up to the total. */
+#define PROF_STARTUP  0
+#define PROF_RLOCATED 1
+#define PROF_DIFF     2
+#define PROF_DECODE   3
+#define PROF_MATCH    4
+#define PROF_VERIFY   5
+#define PROF_OUTPUT   6
+#define PROF_PHASES   7
+
+/* Profile data, filled in during a query and printed by prof_report() */
+struct prof_data_s {
+	int enabled;
+	int phase;
+	struct timespec wall_mark;
+	struct timespec cpu_mark;
+	double wall[PROF_PHASES];
+	double cpu[PROF_PHASES];
+	unsigned long long records;
+	unsigned long long bytes;
+	unsigned long long matches;
+	unsigned long long verified;
+	unsigned long long rejected;
+	unsigned long long syscalls;
+};
+
+extern struct prof_data_s PROF;
+
+/* Counting and timing are only done if --profile was given. The counters
+ * are also bumped by the threads of the crawl and of the fast update, so
+ * they are added to atomically. */
+#define PROF_COUNT(field, n) \
+	do { \
+		if (PROF.enabled) \
+			__atomic_fetch_add(&PROF.field, (n), __ATOMIC_RELAXED); \
+	} while (0)
+#define PROF_PHASE(p) (PROF.enabled ? prof_phase(p) : PROF.phase)
+
+void prof_start(void);
+int prof_phase(const int phase);
+void prof_report(struct g_data_s *g_data);
+
+#endif /* !PROFILE_H */
@@ -0,0 +1,223 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Trie of the excluded paths, that updatedb and rlocated prune the walk
+ * with. */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "prune.h"
+
+/*
+ * prune_component() returns the next component of the path at '*path' and
+ * its length in 'len', or NULL at the end. '*path' is moved after it.
+ */
+static const char *prune_component(const char **path, size_t *len)
+{
+	const char *name;
+
+	while (**path == '/')
+		(*path)++;
+	if (**path == '\0')
+		return NULL;
+	name = *path;
+	while (**path != '\0' && **path != '/')
+		(*path)++;
+	*len = *path - name;
+	return name;
+}
+
+/*
+ * prune_hash() is the FNV-1a hash of a component.
+ */
+static uint32_t prune_hash(const char *name, size_t len)
+{
+	uint32_t hash = 2166136261U;
+
+	while (len--) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/*
+ * prune_find() returns the child of 'node' with the name or NULL.
+ */
+static struct prune_node_s *prune_find(const struct prune_node_s *node,
+				       const char *name, size_t len, uint32_t hash)
+{
+	struct prune_node_s *child;
+	size_t mask = node->child_alloc - 1;
+	size_t i;
+
+	if (!node->child_alloc)
+		return NULL;
+	for (i = hash & mask; (child = node->child[i]); i = (i + 1) & mask)
+		if (child->hash == hash && child->len == len &&
+		    memcmp(child->name, name, len) == 0)
+			return child;
+	return NULL;
+}
+
+/*
+ * prune_insert() puts 'child' into the hash table of 'node', that has room
+ * for it.
+ */
+static void prune_insert(struct prune_node_s *node, struct prune_node_s *child)
+{
+	size_t mask = node->child_alloc - 1;
+	size_t i;
+
+	for (i = child->hash & mask; node->child[i]; i = (i + 1) & mask);
+	node->child[i] = child;
+}
+
+/*
+ * prune_child() returns the child of 'node' with the name, it is added, if
+ * there is none. Returns NULL with errno set on error.
+ */
+static struct prune_node_s *prune_child(struct prune_node_s *node,
+					const char *name, size_t len)
+{
+	uint32_t hash = prune_hash(name, len);
+	struct prune_node_s **old = node->child;
+	size_t old_alloc = node->child_alloc;
+	struct prune_node_s *child;
+	size_t i;
+
+	if ((child = prune_find(node, name, len, hash)))
+		return child;
+	/* the table is at most 3/4 full */
+	if ((node->child_count + 1) * 4 > node->child_alloc * 3) {
+		node->child_alloc = old_alloc ? old_alloc * 2 : PRUNE_CHILDREN;
+		if (!(node->child = calloc(node->child_alloc, sizeof(struct prune_node_s *)))) {
+			node->child = old;
+			node->child_alloc = old_alloc;
+			return NULL;
+		}
+		for (i = 0; i < old_alloc; i++)
+			if (old[i])
+				prune_insert(node, old[i]);
+		free(old);
+	}
+	if (!(child = calloc(1, sizeof(struct prune_node_s))))
+		return NULL;
+	if (!(child->name = malloc(len + 1))) {
+		free(child);
+		return NULL;
+	}
+	memcpy(child->name, name, len);
+	child->name[len] = '\0';
+	child->len = len;
+	child->hash = hash;
+	prune_insert(node, child);
+	node->child_count++;
+	return child;
+}
+
+/*
+ * prune_create() returns an empty exclusion trie or NULL with errno set.
+ */
+struct prune_s *prune_create(void)
+{
+	return calloc(1, sizeof(struct prune_s));
+}
+
+/*
+ * prune_add() adds an excluded path. Returns 0 with errno set on error.
+ */
+int prune_add(struct prune_s *prune, const char *path)
+{
+	struct prune_node_s *node = &prune->root;
+	const char *name;
+	size_t len;
+
+	if (*path == '/' && !(node = prune_child(node, "", 0)))
+		return 0;
+	while ((name = prune_component(&path, &len)))
+		if (!(node = prune_child(node, name, len)))
+			return 0;
+	if (!node->end)
+		prune->count++;
+	node->end = 1;
+	return 1;
+}
+
+/*
+ * prune_match() returns 1, if the path is excluded. With PRUNE_EXACT it
+ * has to be one of the excluded paths, with PRUNE_BELOW it can be below one
+ * too.
+ */
+int prune_match(const struct prune_s *prune, const char *path, int mode)
+{
+	const struct prune_node_s *node = &prune->root;
+	const char *name;
+	size_t len;
+
+	if (mode == PRUNE_BELOW && node->end)
+		return 1;
+	if (*path == '/') {
+		if (!(node = prune_find(node, "", 0, prune_hash("", 0))))
+			return 0;
+		if (mode == PRUNE_BELOW && node->end)
+			return 1;
+	}
+	while ((name = prune_component(&path, &len))) {
+		if (!(node = prune_find(node, name, len, prune_hash(name, len))))
+			return 0;
+		if (mode == PRUNE_BELOW && node->end)
+			return 1;
+	}
+	return node->end;
+}
+
+/*
+ * prune_free_node() frees the children of 'node'.
+ */
+static void prune_free_node(struct prune_node_s *node)
+{
+	size_t i;
+
+	for (i = 0; i < node->child_alloc; i++) {
+		if (!node->child[i])
+			continue;
+		prune_free_node(node->child[i]);
+		free(node->child[i]->name);
+		free(node->child[i]);
+	}
+	free(node->child);
+}
+
+/*
+ * prune_free() frees the trie.
+ */
+void prune_free(struct prune_s *prune)
+{
+	if (!prune)
+		return;
+	prune_free_node(&prune->root);
+	free(prune);
+}
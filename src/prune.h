@@ -0,0 +1,38 @@
+#ifndef PRUNE_H
+#define PRUNE_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The excluded paths of updatedb and rlocated are compiled once into a trie
+ * of the path components, so a path is tested in one step per component,
+ * not against every excluded path. The children of a node are in a hash
+ * table. A leading '/' is a component of its own, that is empty, the other
+ * empty components are ignored. */
+#define PRUNE_CHILDREN 4	/* initial size of a hash table */
+
+/* Match modes */
+#define PRUNE_EXACT 0		/* only the excluded path itself */
+#define PRUNE_BELOW 1		/* the excluded path and everything below */
+
+struct prune_node_s {
+	char *name;
+	size_t len;
+	uint32_t hash;
+	int end;			/* an excluded path ends here */
+	struct prune_node_s **child;	/* open addressing, size is a power of 2 */
+	size_t child_count;
+	size_t child_alloc;
+};
+
+struct prune_s {
+	struct prune_node_s root;
+	int count;			/* number of the excluded paths */
+};
+
+struct prune_s *prune_create(void);
+int prune_add(struct prune_s *prune, const char *path);
+int prune_match(const struct prune_s *prune, const char *path, int mode);
+void prune_free(struct prune_s *prune);
+
+#endif /* !PRUNE_H */
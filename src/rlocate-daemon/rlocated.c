@@ -30,6 +30,8 @@
 #include <errno.h>
 #include <signal.h>
 #include "../pidfile.h"
+#include "../walk.h"
+#include "../prune.h"
 #include <string.h>
 #include <paths.h>
 #include <fcntl.h>
@@ -43,8 +45,10 @@
 //#define __USE_GNU
 #include <search.h>
 #include <sys/types.h>
-
-#include <fts.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <time.h>
 
 #define RL_VERSION "rlocate daemon " VERSION "\n"
 
@@ -64,8 +68,8 @@ int LVM_MINOR_TO_DEV_LEN;
 static char *OUTPUT          = NULL; // can be set from command line
 static int  OUTPUT_OPTION    = 0; // 1 if --output option was specified
 static char *MODULE_VERSION  = NULL; // is set in parse_proc
-static char **EXCLUDE_DIR    = NULL; // is set in parse_proc
-static char *STARTING_PATH   = NULL; // is set in parse_proc
+static struct prune_s *EXCLUDE_DIR   = NULL; // is set in parse_proc
+static struct prune_s *STARTING_PATH = NULL; // is set in parse_proc
 static int  COUNTDOWN        = 0; // used for testing, always set it to 0
 static char *RLOCATEDEV      = DEVDIR"/rlocate";
 static char *RLOCATEPROC     = PROCDIR"/rlocate";
@@ -74,6 +78,7 @@ static char *RLOCATE_DIFF_DB = NULL;
 #define MB  (1024 * 1024);
 
 static char *PidFile = _PATH_VARRUN "rlocated.pid";
+static char *SockFile = _PATH_VARRUN "rlocated.sock";
 static int  NO_DAEMON = 0; /* don't run in daemon mode */
 static int  NO_LOOP   = 0; /* don't run in loop */
 static int  INTERVAL  = 2; /* read every 2 seconds */
@@ -82,6 +87,9 @@ static FILE *fd_dev;        /* file handle for dev file */
 static FILE *fd_db;         /* file handle for db file  */
 static int  fd_proc;       /* file handle for proc file  */
 static int  fd_cfg;        /* file handle for module config file  */
+static int  fd_sock = -1;   /* socket for flush requests */
+static int  fd_client = -1; /* client, that waits for the flush */
+static int  FLUSHED;        /* 1, if the diff database was written */
 
 static char buf[BUFSIZ];   /* buffer for copy from dev file to db file */
 static int RELOAD_CONFIG;      /* if set to 1, the config will be reloaded */
@@ -119,6 +127,8 @@ void print_log(int level, char *format_str, ...) {
  */
 static void clean_up()
 {
+        if (fd_sock >= 0)
+                unlink(SockFile);
         print_log(LOG_INFO, "rlocated daemon terminated");
         exit(1);
 }
@@ -147,6 +157,18 @@ void *xstrdup(const char *s) {
         exit(1);
 }
 
+/*
+ * xprune_add() add path to the trie, that is created, if it is NULL.
+ */
+void xprune_add(struct prune_s **prune, const char *path) {
+	if ((*prune == NULL && (*prune = prune_create()) == NULL) ||
+	    !prune_add(*prune, path)) {
+		print_log(LOG_ERR, "malloc: %s\n", strerror(errno));
+		clean_up();
+		exit(1);
+	}
+}
+
 /*
  * stop_daemon
  */
@@ -167,6 +189,115 @@ void reload_config(sig)
         RELOAD_CONFIG = 1;
         return;
 }
+/*
+ * open_socket() creates the socket, where rlocate asks for the diff
+ * database to be flushed, instead of running rlocated --noloop.
+ */
+void open_socket(void)
+{
+        struct sockaddr_un addr;
+        mode_t mask;
+
+        if ( (fd_sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ) {
+                print_log(LOG_WARNING, "cannot create socket: %s",
+                          strerror(errno));
+                return;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, SockFile, sizeof(addr.sun_path) - 1);
+        unlink(SockFile);
+        mask = umask(077);
+        if (bind(fd_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            listen(fd_sock, 16) < 0) {
+                print_log(LOG_WARNING, "cannot listen on %s: %s",
+                          SockFile, strerror(errno));
+                close(fd_sock);
+                fd_sock = -1;
+        } else {
+                fcntl(fd_sock, F_SETFD, FD_CLOEXEC);
+                fcntl(fd_sock, F_SETFL, O_NONBLOCK);
+        }
+        umask(mask);
+}
+
+/*
+ * flush_reply() tells the waiting client, if the diff database was
+ * written.
+ */
+void flush_reply(void)
+{
+        const char *reply = FLUSHED ? "ok\n" : "error\n";
+
+        if (fd_client < 0)
+                return;
+        if (send(fd_client, reply, strlen(reply), MSG_NOSIGNAL) < 0)
+                print_log(LOG_WARNING, "cannot reply on %s: %s",
+                          SockFile, strerror(errno));
+        close(fd_client);
+        fd_client = -1;
+}
+
+/*
+ * wait_interval() waits INTERVAL seconds, but returns earlier, if a client
+ * asks for a flush. The client gets its answer, when wait_interval() is
+ * called after the next pass.
+ */
+void wait_interval(void)
+{
+        struct pollfd pfd;
+        char request[16];
+        time_t end = time(NULL) + INTERVAL;
+        int timeout, len, fd;
+
+        flush_reply();
+        FLUSHED = 0;
+        if (fd_sock < 0) {
+                sleep(INTERVAL);
+                return;
+        }
+        while ( (timeout = end - time(NULL)) > 0 ) {
+                pfd.fd = fd_sock;
+                pfd.events = POLLIN;
+                if (poll(&pfd, 1, timeout * 1000) <= 0)
+                        continue;
+                if ( (fd = accept(fd_sock, NULL, NULL)) < 0 )
+                        continue;
+                /* don't wait for a silent client too long */
+                pfd.fd = fd;
+                if (poll(&pfd, 1, 1000) > 0 &&
+                    (len = recv(fd, request, sizeof(request) - 1, 0)) > 0) {
+                        request[len] = '\0';
+                        if (strcmp(request, "flush\n") == 0) {
+                                fd_client = fd;
+                                return;
+                        }
+                }
+                close(fd);
+        }
+}
+
+/*
+ * run_updatedb() updates the database, when the diff database is over the
+ * threshold. That updatedb and the searches of root, that run meanwhile,
+ * ask for a flush too, but the daemon can not answer, while it waits. So
+ * the waiting client gets its answer and the socket is closed until the
+ * update is done, and they run rlocated --noloop at once instead.
+ */
+void run_updatedb(void)
+{
+        int listening = (fd_sock >= 0);
+
+        flush_reply();
+        if (listening) {
+                close(fd_sock);
+                fd_sock = -1;
+        }
+        system("/usr/bin/updatedb --throttle");
+        if (listening)
+                open_socket();
+}
+
 /*
  * Usage
  */
@@ -334,13 +465,7 @@ char *get_diff_db_name(const char *dbname)
  */
 void destroy_exclude_dir()
 {
-	int i;
-	if (EXCLUDE_DIR == NULL)
-		return;
-	for (i = 0; EXCLUDE_DIR[i]; i++)
-		free(EXCLUDE_DIR[i]);
-
-	free(EXCLUDE_DIR);
+	prune_free(EXCLUDE_DIR);
 	EXCLUDE_DIR = NULL;
 }
 
@@ -352,9 +477,7 @@ void create_exclude_dir(char *exclude_dir_string)
 	char *startptr = exclude_dir_string;
 	char *endptr;
 	int err = 0;
-	int len = 0;
 	char *token;
-	int i = 0;
         if (EXCLUDE_DIR != NULL)
         	destroy_exclude_dir();
 	if (exclude_dir_string == NULL || *exclude_dir_string == '\0')
@@ -362,7 +485,6 @@ void create_exclude_dir(char *exclude_dir_string)
 	// check exclude_dir_string
 	if (*exclude_dir_string == '*' && exclude_dir_string[strlen(exclude_dir_string) - 1] == '*') {
 		while ((token = index(startptr + 1, '*'))) {
-			len++;
 			if (*(token + 1) == '\0')
 				break;
 			if (*(token + 1) != '*') {
@@ -379,24 +501,18 @@ void create_exclude_dir(char *exclude_dir_string)
 			  "get_exclude_dir: cannot parse exclude dir\n");
 		return;
 	}
-	// create 2d array with exclude dirs
+	// compile the exclude dirs into a trie
 	startptr = exclude_dir_string;
-	EXCLUDE_DIR = (char **)malloc(sizeof(char *) * (len + 1));
 	while (1) {
 		for (endptr = startptr + 1; *endptr != '*' && *endptr != '\0';
 		     endptr++);
 		*endptr = '\0';
-		/* add '/' to the exclude dir */
-		EXCLUDE_DIR[i] =(char *)xmalloc(strlen(startptr) + 1);
-		strcpy(EXCLUDE_DIR[i] , startptr + 1);
-		strcat(EXCLUDE_DIR[i], "/");
+		xprune_add(&EXCLUDE_DIR, startptr + 1);
 		*endptr = '*';
 		startptr = endptr + 1;
-		i++;
 		if (*startptr == '\0')
 			break;
 	}
-	EXCLUDE_DIR[i] = NULL;
 }
 
 /*
@@ -428,10 +544,11 @@ void parse_proc()
                         	endstr = strstr(buf + 14, "\n");
                         	*endstr = '\0';
                         	if (STARTING_PATH != NULL) {
-                                	free(STARTING_PATH);
+                                	prune_free(STARTING_PATH);
 					STARTING_PATH = NULL;
 				}
-                        	STARTING_PATH = xstrdup( buf + 14 );
+				if (buf[14] != '\0')
+                        		xprune_add(&STARTING_PATH, buf + 14);
 			} else if (OUTPUT_OPTION == 0 &&
 				   !strncmp(buf, "output: ", 8)) {
 				// --option has precedence
@@ -448,76 +565,48 @@ void parse_proc()
 	}
 }
 
-/* Check to see if a path matches an excluded one. */
+/* Check to see if a path matches an excluded one. The path is excluded,
+ * if it is an exclude dir or below one. */
 int match_exclude(char *path) {
-	int i;
-        int starting_path_len;
-        int path_len = strlen(path);
-	int excl_dir_len;
-
 	/* check path against STARTING_PATH_ARG */
-        if (STARTING_PATH != NULL && *STARTING_PATH != '\0') {
-		starting_path_len = strlen(STARTING_PATH);
-                if (strncmp(STARTING_PATH, path,
-			    (starting_path_len - 1 == path_len ?
-			     path_len : starting_path_len)))
-               		return 1; // this path is not in starting path
-	}
+        if (STARTING_PATH != NULL &&
+	    !prune_match(STARTING_PATH, path, PRUNE_BELOW))
+		return 1; // this path is not in starting path
 	if (!EXCLUDE_DIR)
 		return 1;
-	for (i = 0; EXCLUDE_DIR[i]; i++) {
-		excl_dir_len = strlen(EXCLUDE_DIR[i]);
-		if (strncmp(path, EXCLUDE_DIR[i],
-			    (excl_dir_len - 1 == path_len ?
-			     path_len : excl_dir_len)) == 0)
-			return 1;
-	}
 
-        return 0;
+        return prune_match(EXCLUDE_DIR, path, PRUNE_BELOW);
+}
+
+/*
+ * traverse_path() writes a path found by walk_tree() to the db, unless it
+ * is excluded.
+ */
+static int traverse_path(const char *path, int len, void *arg)
+{
+	(void)arg;
+	if (EXCLUDE_DIR != NULL && match_exclude((char *)path))
+		return WALK_SKIP;
+	// write to the db without leading '/', with '\0' at the end of the
+	// line.
+	if (fwrite(path + 1, len, sizeof(char), fd_db) != 1)
+		print_log(LOG_WARNING,
+			  "write error %s: %s",
+			  RLOCATE_DIFF_DB,
+			  strerror(errno) );
+	return WALK_CONTINUE;
 }
 
 /*
  * traverse_dir() traverse directory 'dirstr' and put the paths, that match
- * the pattern, to the tree.
+ * the pattern, to the tree. The order of the paths does not matter, the
+ * directories are not sorted.
  */
 void traverse_dir(char *dirstr)
 {
-        FTSENT *file;
-        FTS *dir;
-        int i;
-        char **dir_array;
-	int dirstr_len = strlen(dirstr);
-
-        //dirstr[dirstr_len - 1] = '\0'; // remove '\n'
-        dir_array = (char **)xmalloc(sizeof(char **)*2);
-        *dir_array = dirstr;
-        dir_array[1] = NULL;
-        dir = fts_open(dir_array, FTS_PHYSICAL|FTS_NOSTAT, NULL);
-        for (i = 0; i > -1; i += 1) {
-                file = fts_read(dir);
-
-                if (!file)
-                        break;
-
-                if (file->fts_info != FTS_DP && file->fts_info != FTS_NS) {
-                        if ((EXCLUDE_DIR != NULL &&
-                             !match_exclude(file->fts_path)) ||
-                            EXCLUDE_DIR == NULL) {
-                                // write to the db without leading '/', with
-                                // '\n' at the end of the line.
-                                strcpy(dirstr, file->fts_path + 1);
-                                dirstr_len = strlen(dirstr);
-                                if (fwrite(dirstr, strlen(dirstr) + 1, sizeof(char), fd_db) == EOF)
-                                	print_log(LOG_WARNING,
-                                               	"write error %s: %s",
-                                                RLOCATE_DIFF_DB,
-                                                strerror(errno) );
-                        } else
-                                fts_set(dir,file,FTS_SKIP);
-                }
-        }
-        fts_close(dir);
-        free(dir_array);
+	if (!walk_tree(dirstr, 0, traverse_path, NULL) && errno)
+		print_log(LOG_WARNING, "traverse %s: %s", dirstr,
+			  strerror(errno));
 }
 
 
@@ -881,6 +970,7 @@ int main(int argc, char **argv)
                 signal(SIGKILL, stop_daemon);
                 signal(SIGTERM, stop_daemon);
                 signal(SIGHUP, reload_config);
+                open_socket();
         }
 
         fl.l_pid = getpid();
@@ -910,10 +1000,9 @@ int main(int argc, char **argv)
                 }
 
                 if (!NO_LOOP)
-                        sleep(INTERVAL);
-                if (get_file_size(RLOCATE_DIFF_DB) > THRESHOLD) {
-                    system("/usr/bin/updatedb");
-                }
+                        wait_interval();
+                if (get_file_size(RLOCATE_DIFF_DB) > THRESHOLD)
+                        run_updatedb();
 
                 /* open db file */
                 if ( (fd_db = fopen(RLOCATE_DIFF_DB, "a")) == NULL ) {
@@ -998,6 +1087,8 @@ int main(int argc, char **argv)
                 if (fclose(fd_db) < 0)
                         print_log(LOG_WARNING, "cannot close %s: %s",
                                   RLOCATE_DIFF_DB, strerror(errno) );
+                else
+                        FLUSHED = 1;
                 if (NO_LOOP) break;
 
                 if (COUNTDOWN != 0 ) {
@@ -1007,7 +1098,7 @@ int main(int argc, char **argv)
                 }
         }
         if (STARTING_PATH != NULL)
-                free(STARTING_PATH);
+                prune_free(STARTING_PATH);
         if (RLOCATE_DIFF_DB != NULL)
                 free(RLOCATE_DIFF_DB);
         if (OUTPUT != NULL)
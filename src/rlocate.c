@@ -37,11 +37,22 @@
 #include <ctype.h>
 #include <signal.h>
 #include <paths.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "slocate.h"
 #include "rlocate.h"
 #include "utils.h"
 #include "pidfile.h"
+#include "profile.h"
+#include "session.h"
+#include "batch.h"
+#include "block.h"
+#include "dbinfo.h"
+#include "fast.h"
+#include "diff.h"
+#include "prune.h"
 /* GLOBALS */
 #define MIN_BLK 4096
 #define SLOC_ESC -0x80
@@ -49,6 +60,8 @@
 #define RLOCATEPROC  PROCDIR"/rlocate"
 
 #define SLOC_UID 0
+/* how long to wait for rlocated to flush the diff database, in ms */
+#define FLUSH_TIMEOUT 5000
 /* MAX_UPDATEDB_COUNT specifies a count after which a full database update will
  * be performed */
 #define MAX_UPDATEDB_COUNT 10;
@@ -57,7 +70,6 @@
 extern int QUIET;
 extern int encode(struct g_data_s *g_data, FILE *fd, char *path, struct enc_data_s *enc_data);
 extern int get_short(char **fp);
-extern char *set_path_head(struct g_data_s *g_data, char *path_head, int code_num, char *prev_code_str);
 
 /* global variables STR, CASESTR, GLOBFLAG and PREG are set in rlocate_init()*/
 static char *STR; 
@@ -72,6 +84,7 @@ static unsigned char UPDATEDB_COUNT; /* this value will be decremented when
                                         update will be run */
 
 static char *PidFile = _PATH_VARRUN "rlocated.pid";
+static char *SockFile = _PATH_VARRUN "rlocated.sock";
 
 static void *paths_tree_root;          // root of the tree, that contains paths
 static char *tmp_output_diff = NULL;   // temp output diff database
@@ -147,21 +160,61 @@ char *get_tmp_db_name(const char *dbname)
 }
 
 /*
- * run_rlocated() run rlocated with --noloop option if user is root.
+ * flush_rlocated() asks the running rlocated to write the kernel buffer to
+ * the diff database and waits until it is done. It returns 1, if it was.
+ */
+static int flush_rlocated(void)
+{
+        struct sockaddr_un addr;
+        struct pollfd pfd;
+        char reply[16];
+        int fd, len;
+        int ret = 0;
+
+        if ( (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 )
+                return 0;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, SockFile, sizeof(addr.sun_path) - 1);
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+                goto EXIT;
+        if (send(fd, "flush\n", 6, MSG_NOSIGNAL) != 6)
+                goto EXIT;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, FLUSH_TIMEOUT) <= 0)
+                goto EXIT;
+        if ( (len = recv(fd, reply, sizeof(reply) - 1, 0)) <= 0 )
+                goto EXIT;
+        reply[len] = '\0';
+        ret = (strcmp(reply, "ok\n") == 0);
+EXIT:
+        close(fd);
+        return ret;
+}
+
+/*
+ * run_rlocated() makes the diff database up-to-date if user is root. The
+ * running daemon is asked to do it, if there is none, rlocated is run with
+ * --noloop option.
  */
 void run_rlocated(struct g_data_s *g_data)
 {
         pid_t pid;
 
         if (g_data->uid == SLOC_UID) {
-                if ( (pid = fork()) < 0 )
+                if (flush_rlocated())
+                        return;
+                if ( (pid = fork()) < 0 ) {
                         fprintf(stderr, "%s: run_rlocated: fork error\n", 
 				PROGNAME);
-                else if (pid == 0) {
-                        if (execlp(RLOCATED_CMD, "rlocated", "--noloop", NULL)<0) 
-                                fprintf(stderr, 
-					"%s: run_rlocated: execlp error\n", 
-					PROGNAME);
+                        return;
+                } else if (pid == 0) {
+                        execlp(RLOCATED_CMD, "rlocated", "--noloop", NULL);
+                        fprintf(stderr, 
+				"%s: run_rlocated: execlp error\n", 
+				PROGNAME);
+                        _exit(1);
                 }
                 if (waitpid(pid, NULL, 0) < 0)
                         fprintf(stderr, "%s: run_rlocated: waitpid error\n",
@@ -499,6 +552,69 @@ void rlocate_end_updatedb(struct g_data_s *g_data) {
         }
 }
 
+/*
+ * rlocate_append() appends the file 'from' to the file 'to' under the lock,
+ * that rlocated writes it with.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+static int rlocate_append(const char *from, const char *to)
+{
+	struct flock fl = { F_WRLCK, SEEK_SET, 0, 0, 0 };
+	char buf[8192];
+	ssize_t n = -1;
+	int fd_from, fd_to;
+
+	if ((fd_from = open(from, O_RDONLY)) == -1)
+		return 0;
+	if ((fd_to = open(to, O_WRONLY | O_APPEND)) == -1) {
+		close(fd_from);
+		return 0;
+	}
+	fl.l_pid = getpid();
+	if (fcntl(fd_to, F_SETLKW, &fl) != -1) {
+		while ((n = read(fd_from, buf, sizeof(buf))) > 0)
+			if (write(fd_to, buf, n) != n) {
+				n = -1;
+				break;
+			}
+	}
+	if (close(fd_to) == -1)
+		n = -1;
+	close(fd_from);
+	return n == 0;
+}
+
+/*
+ * rlocate_abort_updatedb() is called instead of rlocate_end_updatedb(), when
+ * the update failed. The paths of the temp rlocate diff database are not in
+ * the database, so they are put back into the rlocate diff database, that
+ * rlocated may have started again meanwhile.
+ */
+void rlocate_abort_updatedb(struct g_data_s *g_data)
+{
+	char *output_diff;
+
+	if (tmp_output_diff != NULL) {
+		output_diff = get_diff_db_name(g_data->output_db);
+		/* without a new one, the old one becomes it again */
+		if (link(tmp_output_diff, output_diff) == -1 &&
+		    !rlocate_append(tmp_output_diff, output_diff)) {
+			/* the temp one is still searched */
+			fprintf(stderr, "%s: rlocate_abort_updatedb: can't put %s "
+				"back into %s: %s\n", PROGNAME, tmp_output_diff,
+				output_diff, strerror(errno));
+			free(tmp_output_diff);
+			tmp_output_diff = NULL;
+		}
+		free(output_diff);
+	}
+	/* the update count is not reset */
+	g_data->FULL_UPDATE = 0;
+	rlocate_end_updatedb(g_data);
+}
+
 /*
  * path_strcmp() compares two paths like strings except '/', which will come
  * before any other character, so that sort result is the same as from fts.
@@ -556,7 +672,9 @@ int check_path(struct g_data_s *g_data, const char *path)
         //char *cp = NULL;
         char *codedpath;
         codedpath = make_path(path);
-	if (g_data->regexp_data) {
+	if (g_data->batch) {
+	        foundit = batch_match(g_data, codedpath);
+	} else if (g_data->regexp_data) {
 	        foundit = !regexec(g_data->regexp_data->preg ,codedpath,nmatch,pmatch,0);
 	} else if (g_data->nocase) {
 #ifdef FNM_CASEFOLD /* i suppose i also have strcasestr */
@@ -590,15 +708,24 @@ int check_path(struct g_data_s *g_data, const char *path)
 
 /* 
  * print_path() checks if path is accesible and prints it, if it is.
+ * 'matched' tells, that the path was matched last, see batch_print().
  */
-void print_path(struct g_data_s *g_data, const char *path)
+void print_path(struct g_data_s *g_data, const char *path, int matched)
 {
         char *pathcopy = make_path(path);
+	int phase = PROF_PHASE(PROF_VERIFY);
 	if ( verify_access(pathcopy)) { 
 		if (g_data->queries > 0)
 			g_data->queries--;
-        	printf("/%s\n", path);
+		PROF_PHASE(PROF_OUTPUT);
+		if (g_data->batch)
+			batch_print(g_data, path, matched);
+		else
+	        	printf("/%s\n", path);
+		if (g_data->session)
+			session_add(g_data, pathcopy);
 	}
+	PROF_PHASE(phase);
 	free(pathcopy);
 }
 
@@ -682,10 +809,14 @@ void rlocate_init(struct g_data_s* g_data, const char *rlocate_db, char *str,
 
         /* start rlocated once if the user is root, so that the database is 
          * up-to-date */
+        PROF_PHASE(PROF_RLOCATED);
         run_rlocated(g_data);
+        PROF_PHASE(PROF_DIFF);
         /* open and read rlocate diff database */
+        PROF_COUNT(syscalls, 1);
         if ( (fd = fopen(tmp_rlocate_diff_db, "r")) != NULL ) {
                 while ( (getdelim(&buffer, &len, '\0', fd)) != -1 ) {
+                        PROF_COUNT(bytes, strlen(buffer) + 1);
                         store_path(g_data, buffer);
                 }
 		if (buffer)
@@ -697,8 +828,10 @@ void rlocate_init(struct g_data_s* g_data, const char *rlocate_db, char *str,
 					             tmp_rlocate_diff_db,
 						     strerror(errno) );
         }
+        PROF_COUNT(syscalls, 1);
         if ( (fd = fopen(rlocate_diff_db, "r")) != NULL ) {
                 while ( (getdelim(&buffer, &len, '\0', fd)) != -1 ) {
+                        PROF_COUNT(bytes, strlen(buffer) + 1);
                         store_path(g_data, buffer);
                 }
 		if (buffer)
@@ -723,6 +856,8 @@ void rlocate_printit(struct g_data_s *g_data, const char *codedpath)
 {
         Paths_list *f;
         int str_ret;
+	/* codedpath was matched last, unless an added path is printed */
+	int matched = 1;
 
 	if (g_data->queries == 0)
 		return;
@@ -730,7 +865,8 @@ void rlocate_printit(struct g_data_s *g_data, const char *codedpath)
          * codedpath */
         while (paths_list_root != NULL && 
                (str_ret = strcmp(paths_list_root->path, codedpath + 1)) <=0) {
-                print_path(g_data, paths_list_root->path);
+                print_path(g_data, paths_list_root->path, 0);
+		matched = 0;
 		if (g_data->queries == 0)
 			return;
 
@@ -743,7 +879,7 @@ void rlocate_printit(struct g_data_s *g_data, const char *codedpath)
 	/* print coded path, if it is not in the tree of added paths */
         if (tfind((void *)codedpath+1, &paths_tree_root, 
                 path_compare) == NULL) { // ignore leading '/' in codedpath 
-	                print_path(g_data, codedpath + 1);
+	                print_path(g_data, codedpath + 1, matched);
         }
 }
 
@@ -764,9 +900,8 @@ void rlocate_done(struct g_data_s *g_data)
         Paths_list *f;
         // print the rest of the paths
         while ( paths_list_root != NULL ) {
-		if (g_data->queries == 0)
-			return;
-                print_path(g_data, paths_list_root->path);
+		if (g_data->queries != 0)
+	                print_path(g_data, paths_list_root->path, 0);
 
                 f = paths_list_root;
                 paths_list_root = paths_list_root->next;
@@ -776,34 +911,81 @@ void rlocate_done(struct g_data_s *g_data)
 }
 
 /*
- * rlocate_updatedb_writeit() is called from rlocate_fast_updatedb() and it 
- * writes one path at a time coded with encode to the tmp database.
+ * rlocate_fast_init() reads both rlocate and temp rlocate diff databases
+ * into the added paths of the fast update. They are sorted in at most
+ * --diff-memory bytes.
  */
-void rlocate_fast_updatedb_writeit(struct g_data_s *g_data, const char *codedpath, FILE *fd_tmp, struct enc_data_s *enc_data) 
+static struct diff_s *rlocate_fast_init(struct g_data_s *g_data, const char *rlocate_db)
 {
-        Paths_list *f;
-        int str_ret;
-        char *path;
-	/* write all paths from the list, that are alphabetically before the 
-         * codedpath */
-        while (paths_list_root != NULL && 
-               (str_ret = strcmp(paths_list_root->path, codedpath+1)) <=0) {
-                path = make_path(paths_list_root->path); // add leading '/'
-                //encode(fd_tmp, path, "");
-                encode(g_data, fd_tmp, path, enc_data);
-                free(path);
-                f = paths_list_root;
-                paths_list_root = paths_list_root->next;
-                free(f); /* the path string will be freed, when the tree is 
-                            destroyed */
-        }
-	/* write coded path, if it is not in the tree of added paths */
-        if (tfind((void *)codedpath+1, &paths_tree_root, 
-                path_compare) == NULL) { // ignore leading '/' in codedpath 
-                        encode(g_data, fd_tmp, (char *)codedpath, enc_data);
-        }
+	struct diff_s *diff;
+	struct prune_s *roots = NULL;
+	char *diff_db[2];
+	char *buffer = NULL;
+	size_t len = 0;
+	FILE *fd;
+	int i;
+
+	PROGNAME = g_data->progname;
+	if (!(diff = diff_create(g_data, g_data->DIFF_MEMORY)))
+		return NULL;
+	/* rlocated watches the directory above several paths to index, the
+	 * paths outside of them are left out */
+	if (g_data->index_paths && g_data->index_paths[0] && g_data->index_paths[1]) {
+		if (!(roots = prune_create())) {
+			report_error(g_data, FATAL, "rlocate_fast_init: malloc: %s\n", strerror(errno));
+			diff_free(diff);
+			return NULL;
+		}
+		for (i = 0; g_data->index_paths[i]; i++) {
+			if (!prune_add(roots, g_data->index_paths[i] + (*g_data->index_paths[i] == '/'))) {
+				report_error(g_data, FATAL, "rlocate_fast_init: malloc: %s\n", strerror(errno));
+				prune_free(roots);
+				diff_free(diff);
+				return NULL;
+			}
+		}
+	}
+	diff_db[1] = get_diff_db_name(rlocate_db);
+	diff_db[0] = get_tmp_db_name(diff_db[1]);
+	/* start rlocated once, so that the database is up-to-date */
+	PROF_PHASE(PROF_RLOCATED);
+	run_rlocated(g_data);
+	PROF_PHASE(PROF_DIFF);
+	for (i = 0; i < 2; i++) {
+		PROF_COUNT(syscalls, 1);
+		if (!(fd = fopen(diff_db[i], "r")))
+			continue;
+		while (getdelim(&buffer, &len, '\0', fd) != -1) {
+			PROF_COUNT(bytes, strlen(buffer) + 1);
+			if (roots && !prune_match(roots, buffer, PRUNE_BELOW))
+				continue;
+			if (!diff_add(g_data, diff, buffer))
+				break;
+		}
+		if (fclose(fd) < 0)
+			fprintf(stderr, "%s: rlocate_fast_init: fclose: can't close %s: %s\n",
+				PROGNAME, diff_db[i], strerror(errno));
+	}
+	free(buffer);
+	free(diff_db[0]);
+	free(diff_db[1]);
+	prune_free(roots);
+	if (!diff_finish(g_data, diff)) {
+		diff_free(diff);
+		return NULL;
+	}
+	return diff;
 }
 
+/*
+ * rlocate_diff_kept() returns 1, if rlocated keeps the paths, that are added
+ * to the database, that is created, in its diff database. That is only done
+ * for user root with --initdiffdb, or for the default database.
+ */
+int rlocate_diff_kept(struct g_data_s *g_data)
+{
+	return g_data->uid == SLOC_UID && g_data->INITDIFFDB;
+}
 
 /* 
  * rlocate_fast_updatedb() fast updatedb will be performed everytime except
@@ -817,27 +999,21 @@ void rlocate_fast_updatedb_writeit(struct g_data_s *g_data, const char *codedpat
  * done the rlocate database will contain more and more file names, that were 
  * removed from the file system a full database update is needed after one week
  * or so.
+ *
+ * Returns:  1 == ok
+ *           0 == no fast update, nothing was written to 'fd_tmp'
+ *          -1 == error after paths were written to 'fd_tmp'
  */
 int rlocate_fast_updatedb(struct g_data_s *g_data, FILE *fd_tmp, struct enc_data_s *enc_data)
 {
 	int fd = -1;
-	char ch[1];
-	int buf_len;
-	signed char buffer[BLOCK_SIZE];
+	struct block_reader_s reader;
 	int ret = 0;
-	int code_num = 0;
-	char *path_head = NULL;
-	char *prev_code_str = NULL;
-	char *full_path = NULL;
-	char *code_str = NULL;
-	int b = 0;
-	int b_mark;
-	int STATE = DC_CODE;
-	int size = 0;
 	struct stat db_stat;
-	Paths_list *f;
-	char *path;
 	char *database = g_data->output_db;
+	struct diff_s *diff;
+	struct db_chunk_s *chunks = NULL;
+	uint64_t chunks_count = 0;
 	if (g_data->FULL_UPDATE)
 		return 0;
         // fast db update only for user root and if INITDIFFDB is 1 
@@ -848,169 +1024,34 @@ int rlocate_fast_updatedb(struct g_data_s *g_data, FILE *fd_tmp, struct enc_data
 	if ((fd = open(database,O_RDONLY)) == -1)
 		return 0;
 
-	/* slevel */
-	buf_len = read(fd, ch, 1);
-
-	g_data->slevel = ch[0];
-	b = 0;
-	buf_len = read(fd, buffer, BLOCK_SIZE);
-	rlocate_init(g_data, database, "", "", 0);
-	while (buf_len > 0) {
-		code_num = buffer[b];
-		/* Escape char, read extra byte */
-		if (code_num == SLOC_ESC) {
-			b += 1;
-			if (b == buf_len) {
-				//printf("I 1 - %d\n", BLOCK_SIZE);
-				//exit(0);
-				buf_len = read(fd, buffer, BLOCK_SIZE);
-				b = 0;				
-			}
-			/* A DC_ESC character indicates that we must read in two bytes
-			 * for our code_num due to a long path. */
-			code_num = buffer[b];
-			b += 1;			
-			if (b == buf_len) {
-				buf_len = read(fd, buffer, BLOCK_SIZE);
-				b = 0;
-			}
-			code_num = (code_num << 8) | (buffer[b] & 0xff);
-		}
-
-		/* Data */
-		b += 1;
-		if (b == buf_len) {			
-			buf_len = read(fd, buffer, BLOCK_SIZE);
-			b = 0;			    
-		}		
-		/* If we are not resuming from an interrupted state then call
-		 * this function to construct the beginning of the path to
-		 * search */
-		if (!(path_head = set_path_head(g_data, path_head, code_num, prev_code_str)) && code_num != 0)
-		    goto EXIT;
-
-		/* Mark the current location in the buffer so we can parse out
-		 * the string data for the path */
-		while(1) {
-			b_mark = b;
-			while (buffer[b] != '\0' && b < buf_len)
-			    b += 1;			
-			/* If we are not resuming an interruption then initialize the
-			 * code_str variable */
-			if (STATE != DC_DATA_INTR) {				
-				if (!(code_str = malloc(sizeof(char) * (b-b_mark+1)))) {
-					if (!report_error(g_data, FATAL, "search_db: code_str: malloc: %s\n", strerror(errno)))
-					    goto EXIT;
-				}
-				code_str[0] = 0;
-			} else {
-				size = strlen(code_str)+(b-b_mark)+1;
-				if (size < 0)
-				    size = 0;
-				if (!(code_str = realloc(code_str, sizeof(char) * size))) {
-					if (!report_error(g_data, FATAL, "search_db: code_str: realloc: %s\n", strerror(errno)))
-					    goto EXIT;
-				}
-				code_str[size-1] = 0;
-				STATE = DC_NONE;
-			}
-
-			/* recast, buffer doesn't need to be signed here. */
-			code_str = strncat(code_str, ((char *)buffer)+b_mark, b-b_mark);
-			/* If we ran into the end of the current buffer, set the state
-			 * to DC_DATA_INTR and exit so we can read more data and
-			 * return to this state */
-			if (b == buf_len && buffer[b-1] != '\0') {
-				buf_len = read(fd, buffer, BLOCK_SIZE);
-				b = 0;
-				STATE = DC_DATA_INTR;
-			} else
-			    break;
-		}
-		
-		if (!path_head) {
-			if (!(full_path = strdup(code_str))) {
-				if (!report_error(g_data, FATAL, "search_db: full_path: strdup: %s\n", strerror(errno)))
-				    goto EXIT;
-			}
-		} else {
-			if (!(full_path = malloc(sizeof(char) * (strlen(path_head)+strlen(code_str)+1)))) {
-				if (!report_error(g_data, FATAL, "search_db: full_path: malloc: %s\n", strerror(errno)))
-				    goto EXIT;
-			}
-			strcpy(full_path, path_head);
-			strcat(full_path, code_str);
-		}		
-		if (prev_code_str) {
-			free(prev_code_str);
-			prev_code_str = NULL;
-		}
-				
-		/* Save a pointer to the current path, we need it for the next
-		 * path we decode */		
-		if (!(prev_code_str = strdup(code_str))) {
-			if (!report_error(g_data, FATAL, "search_db: prev_code_str: strdup: %s\n", strerror(errno)))			    
-			    goto EXIT;
-		}		
-		if (code_str) {
-			free(code_str);
-			code_str = NULL;
-		}				
-		
-		/* Search the current path string */
-		// if (!search_path(g_data, full_path, search_str, globflag))
-		//     goto EXIT;		
-
-		// if (g_data->queries == 0)
-		//     break;
-		rlocate_fast_updatedb_writeit(g_data, full_path, fd_tmp, enc_data);
-		if (full_path) {
-			free(full_path);
-			full_path = NULL;
-		}
-		
-		b += 1;
-		if (b == buf_len) {
-			buf_len = read(fd, buffer, BLOCK_SIZE);
-			b = 0;
-		}
-	}
-
-	if (buf_len == -1) {
-		if (!report_error(g_data, FATAL, "search_db: read: '%s': %s\n", database, strerror(errno)))
-		    goto EXIT;
-	}
-	
-	ret = 1;
-EXIT:
-	// write the rest of the paths coded with frcode to the tmp database
-	while ( paths_list_root != NULL ) {
-		path = make_path(paths_list_root->path); // add leading '/'
-		encode(g_data, fd_tmp, path, enc_data);
-		free(path);
-		f = paths_list_root;
-		paths_list_root = paths_list_root->next;
-		free(f);
-	}
-	tdestroy(paths_tree_root, free_string);
-	if (fd > -1)
-	    close(fd);
-	if (full_path) {
-		free(full_path);
-		full_path = NULL;
-	}	
-	if (code_str) {
-		free(code_str);
-		code_str = NULL;
-	}
-	if (prev_code_str) {
-		free(prev_code_str);
-		prev_code_str = NULL;
+	/* slevel and the block index of a block database */
+	if (!block_open(g_data, &reader, fd, database)) {
+		block_close(&reader);
+		close(fd);
+		return 0;
 	}
-	if (path_head) {
-		free(path_head);
-		path_head = NULL;
+	g_data->slevel = reader.slevel;
+	if (!(diff = rlocate_fast_init(g_data, database))) {
+		block_close(&reader);
+		close(fd);
+		return 0;
 	}
-
-	return ret;
+	/* Copy the unchanged chunks of a database of the same format, decode
+	 * the whole database otherwise, also if every path is printed */
+	if (reader.info.version > 1 && reader.info.chunks_len && !enc_data->image &&
+	    !g_data->VERBOSE &&
+	    !reader.dirtab && !enc_data->dirtab &&
+	    (reader.blocks ? enc_data->block != NULL : enc_data->block == NULL) &&
+	    (chunks = db_chunks(g_data, &reader.info, &chunks_count)) &&
+	    chunks_count == (reader.blocks ? reader.count : reader.info.offsets_count))
+		ret = fast_pipeline(g_data, fd_tmp, enc_data, &reader, diff, chunks, chunks_count);
+	else
+		ret = fast_pipeline(g_data, fd_tmp, enc_data, &reader, diff, NULL, 0);
+	diff_free(diff);
+	free(chunks);
+	block_close(&reader);
+	close(fd);
+	/* the paths, that were written, can not be taken back, so a crawl
+	 * into the same file is no fallback */
+	return ret ? 1 : -1;
 }
@@ -7,6 +7,7 @@
 void rlocate_start_updatedb(struct g_data_s *g_data);
 int rlocate_ftscompare(const FTSENT **e1, const FTSENT **e2);
 void rlocate_end_updatedb();
+void rlocate_abort_updatedb(struct g_data_s *g_data);
 void rlocate_init(struct g_data_s* g_data,
 		  const char *rlocate_db, 
                   char *str, 
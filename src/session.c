@@ -0,0 +1,317 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* --session: search-as-you-type mode. Queries are read from stdin, one per
+ * line, and the answer to every query is terminated with an empty line.
+ * The paths found for a query are kept, so that a query, that extends the
+ * previous one, is answered without a new scan of the databases. A query,
+ * that arrives while a scan is running, cancels the scan. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "session.h"
+
+extern int search_db(struct g_data_s *g_data, char *database, char *search_str);
+
+/*
+ * session_clear() frees the candidates of the previous query.
+ */
+static void session_clear(struct session_s *session)
+{
+	int i;
+
+	for (i = 0; i < session->cand_len; i++)
+		free(session->cand[i]);
+	session->cand_len = 0;
+	session->complete = 0;
+}
+
+/*
+ * session_fill() reads from stdin into the input buffer. If 'wait' is not
+ * set, it only reads, if there is data available.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+static int session_fill(struct g_data_s *g_data, struct session_s *session,
+			int wait)
+{
+	struct pollfd pfd;
+	int len;
+
+	if (session->eof)
+		return 1;
+	if (!wait) {
+		pfd.fd = STDIN_FILENO;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 0) <= 0)
+			return 1;
+	}
+	if (session->in_alloc - session->in_len < BLOCK_SIZE) {
+		session->in_alloc += BLOCK_SIZE;
+		if (!(session->in_buf = realloc(session->in_buf, session->in_alloc))) {
+			report_error(g_data, FATAL, "session_fill: realloc: %s\n", strerror(errno));
+			return 0;
+		}
+	}
+	do {
+		len = read(STDIN_FILENO, session->in_buf + session->in_len,
+			   session->in_alloc - session->in_len);
+	} while (len == -1 && errno == EINTR);
+	if (len == -1) {
+		report_error(g_data, FATAL, "session_fill: read: %s\n", strerror(errno));
+		return 0;
+	}
+	if (len == 0)
+		session->eof = 1;
+	session->in_len += len;
+	return 1;
+}
+
+/*
+ * session_pending() returns 1, if there is a complete query in the input
+ * buffer.
+ */
+static int session_pending(struct session_s *session)
+{
+	return memchr(session->in_buf, '\n', session->in_len) != NULL;
+}
+
+/*
+ * session_read() returns the next query from stdin or NULL on end of input
+ * or error. The query has to be freed.
+ */
+static char *session_read(struct g_data_s *g_data, struct session_s *session)
+{
+	char *query;
+	char *nl;
+	int len;
+
+	while (!session_pending(session) && !session->eof)
+		if (!session_fill(g_data, session, 1))
+			return NULL;
+	if (!session->in_len)
+		return NULL;
+	if ((nl = memchr(session->in_buf, '\n', session->in_len)))
+		len = nl - session->in_buf;
+	else
+		len = session->in_len;
+	if (!(query = malloc(len + 1))) {
+		report_error(g_data, FATAL, "session_read: malloc: %s\n", strerror(errno));
+		return NULL;
+	}
+	memcpy(query, session->in_buf, len);
+	query[len] = '\0';
+	if (len && query[len - 1] == '\r')
+		query[len - 1] = '\0';
+	if (nl)
+		len++;
+	session->in_len -= len;
+	memmove(session->in_buf, session->in_buf + len, session->in_len);
+	return query;
+}
+
+/*
+ * session_cancelled() is called for every record, that is searched. Every
+ * SESSION_POLL_RECORDS records it checks, whether a new query arrived and
+ * stops the running search, if it did.
+ */
+int session_cancelled(struct g_data_s *g_data)
+{
+	struct session_s *session = g_data->session;
+
+	if (session->cancelled)
+		return 1;
+	if (++session->ticks < SESSION_POLL_RECORDS)
+		return 0;
+	session->ticks = 0;
+	if (!session_pending(session))
+		session_fill(g_data, session, 0);
+	if (session_pending(session)) {
+		session->cancelled = 1;
+		g_data->queries = 0;
+	}
+	return session->cancelled;
+}
+
+/*
+ * session_add() is called for every path, that is printed, and keeps it as
+ * a candidate for the next query.
+ */
+void session_add(struct g_data_s *g_data, const char *path)
+{
+	struct session_s *session = g_data->session;
+
+	if (!session->collecting)
+		return;
+	if (session->cand_len == SESSION_MAX_CANDIDATES) {
+		/* too many, the next query will be a new scan */
+		session_clear(session);
+		session->collecting = 0;
+		return;
+	}
+	if (session->cand_len == session->cand_alloc) {
+		session->cand_alloc = session->cand_alloc ? session->cand_alloc * 2 : 1024;
+		if (!(session->cand = realloc(session->cand, sizeof(char *) * session->cand_alloc))) {
+			report_error(g_data, FATAL, "session_add: realloc: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+	if (!(session->cand[session->cand_len] = strdup(path))) {
+		report_error(g_data, FATAL, "session_add: strdup: %s\n", strerror(errno));
+		exit(1);
+	}
+	session->cand_len++;
+}
+
+/*
+ * session_extends() returns 1, if every path, that matches 'query', matches
+ * the previous query as well, so that only the candidates have to be
+ * searched. This is the case, if both are plain strings and the new one
+ * contains the old one.
+ */
+static int session_extends(struct g_data_s *g_data, struct session_s *session,
+			   const char *query)
+{
+	if (!session->complete || !session->query)
+		return 0;
+	if (strpbrk(session->query, "*?[") || strpbrk(query, "*?["))
+		return 0;
+	if (g_data->nocase)
+		return strcasestr(query, session->query) != NULL;
+	return strstr(query, session->query) != NULL;
+}
+
+/*
+ * session_refine() prints the candidates, that match 'query', and drops
+ * the others.
+ */
+static int session_refine(struct g_data_s *g_data, struct session_s *session,
+			  char *query)
+{
+	int i, n = 0;
+	int match_ret = 0;
+
+	for (i = 0; i < session->cand_len; i++) {
+		if (g_data->queries == 0 || session_cancelled(g_data))
+			break;
+		if ((match_ret = match(g_data, session->cand[i], query, 0)) == -1)
+			break;
+		if (!match_ret) {
+			free(session->cand[i]);
+			continue;
+		}
+		if (g_data->queries > 0)
+			g_data->queries--;
+		printf("%s\n", session->cand[i]);
+		session->cand[n++] = session->cand[i];
+	}
+	/* stopped early, the rest is not known to match */
+	if (i < session->cand_len) {
+		session->complete = 0;
+		for (; i < session->cand_len; i++)
+			free(session->cand[i]);
+	}
+	session->cand_len = n;
+	return match_ret != -1;
+}
+
+/*
+ * session_scan() searches all databases for 'query' and collects the
+ * paths, that were found.
+ */
+static int session_scan(struct g_data_s *g_data, struct session_s *session,
+			char *query)
+{
+	int i;
+
+	session_clear(session);
+	session->collecting = 1;
+	for (i = 0; g_data->input_db[i] && g_data->queries != 0; i++)
+		if (!search_db(g_data, g_data->input_db[i], query))
+			return 0;
+	/* the candidates are complete, unless the search was stopped or
+	 * there were too many of them */
+	session->complete = session->collecting && g_data->queries != 0;
+	session->collecting = 0;
+	return 1;
+}
+
+/*
+ * session_run() answers queries from stdin until the end of input.
+ */
+int session_run(struct g_data_s *g_data)
+{
+	struct session_s session;
+	char *query = NULL;
+	int queries = g_data->queries;
+	int ret = 0;
+
+	if (g_data->regexp_data) {
+		report_error(g_data, FATAL, "--session can not be used with a regular expression.\n");
+		return 0;
+	}
+	memset(&session, 0, sizeof(session));
+	g_data->session = &session;
+
+	while ((query = session_read(g_data, &session))) {
+		session.cancelled = 0;
+		session.ticks = 0;
+		g_data->queries = queries;
+		/* skip queries, that are already outdated, the previous
+		 * query and its candidates are kept */
+		if (!*query || session_pending(&session)) {
+			if (!*query)
+				session_clear(&session);
+			free(query);
+		} else {
+			if (session_extends(g_data, &session, query)) {
+				if (!session_refine(g_data, &session, query))
+					goto EXIT;
+			} else if (!session_scan(g_data, &session, query))
+				goto EXIT;
+			free(session.query);
+			session.query = query;
+		}
+		query = NULL;
+		printf("\n");
+		fflush(stdout);
+	}
+	ret = session.eof && !session.in_len;
+EXIT:
+	if (query)
+		free(query);
+	g_data->session = NULL;
+	session_clear(&session);
+	free(session.cand);
+	free(session.query);
+	free(session.in_buf);
+	return ret;
+}
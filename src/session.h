@@ -0,0 +1,31 @@
+#ifndef SESSION_H
+#define SESSION_H 1
+
+/* Candidates are only kept up to this many paths, a broader query is
+ * always answered with a new scan. */
+#define SESSION_MAX_CANDIDATES 100000
+
+/* Check for a new query every so many records */
+#define SESSION_POLL_RECORDS 4096
+
+/* Search session data */
+struct session_s {
+	char *query;		/* previous query */
+	char **cand;		/* paths printed for the previous query */
+	int cand_len;
+	int cand_alloc;
+	int complete;		/* cand holds all matches of query */
+	int collecting;
+	int cancelled;		/* a new query arrived during the search */
+	int ticks;
+	int eof;
+	char *in_buf;		/* stdin data, that was not parsed yet */
+	int in_len;
+	int in_alloc;
+};
+
+int session_run(struct g_data_s *g_data);
+void session_add(struct g_data_s *g_data, const char *path);
+int session_cancelled(struct g_data_s *g_data);
+
+#endif /* !SESSION_H */
@@ -0,0 +1,585 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Sharded databases: every indexed path and every file system mounted
+ * below one has a database of its own, that an update builds again only
+ * when its file system changed. The manifest lists the shards and
+ * search_db() merges them into the order of the crawl with merge_search(). */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "block.h"
+#include "dirtab.h"
+#include "dbinfo.h"
+#include "mount.h"
+#include "shard.h"
+
+/* extern functions are defined in slocate.c */
+extern int encode(struct g_data_s *g_data, FILE *fd, char *path, struct enc_data_s *enc_data);
+extern int encode_flush(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data);
+/* extern functions are defined in rlocate.c */
+extern char *get_diff_db_name(const char *dbname);
+extern char *get_tmp_db_name(const char *dbname);
+extern int rlocate_diff_kept(struct g_data_s *g_data);
+
+/*
+ * shard_manifest() returns 1, if the database open as 'fd' is the manifest
+ * of a sharded database.
+ */
+int shard_manifest(int fd)
+{
+	char magic[sizeof(SHARD_MAGIC) - 1];
+
+	return pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+	       memcmp(magic, SHARD_MAGIC, sizeof(magic)) == 0;
+}
+
+/*
+ * shard_name() returns the file name of shard 'number' of 'database'.
+ */
+static char *shard_name(const char *database, int number)
+{
+	char *name;
+
+	if (!(name = malloc(strlen(database) + 16)))
+		return NULL;
+	sprintf(name, "%s.%d", database, number);
+	return name;
+}
+
+static void shard_free(struct shard_list_s *list)
+{
+	int i;
+
+	for (i = 0; i < list->count; i++) {
+		free(list->shard[i].path);
+		free(list->shard[i].stamp);
+	}
+	free(list->shard);
+	free(list->options);
+	memset(list, 0, sizeof(*list));
+}
+
+/*
+ * shard_add() appends a shard to the list. 'path' and 'stamp' are taken
+ * over.
+ */
+static struct shard_s *shard_add(struct shard_list_s *list, char *path, char *stamp)
+{
+	struct shard_s *shard;
+
+	if (list->count == list->alloc) {
+		if (!(shard = realloc(list->shard, sizeof(struct shard_s) * (list->alloc * 2 + 16))))
+			return NULL;
+		list->shard = shard;
+		list->alloc = list->alloc * 2 + 16;
+	}
+	shard = &list->shard[list->count++];
+	memset(shard, 0, sizeof(*shard));
+	shard->path = path;
+	shard->stamp = stamp;
+	shard->unit = -1;
+	return shard;
+}
+
+/*
+ * shard_read() reads the manifest 'database' into 'list'. A missing file
+ * or one, that is no manifest, is an empty list.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+static int shard_read(struct g_data_s *g_data, const char *database, struct shard_list_s *list)
+{
+	char magic[sizeof(SHARD_MAGIC) - 1];
+	struct shard_s *shard;
+	char *field[3] = { NULL, NULL, NULL };
+	size_t len[3] = { 0, 0, 0 };
+	FILE *fp;
+	int i;
+	int ret = 0;
+
+	memset(list, 0, sizeof(*list));
+	if (!(fp = fopen(database, "r")))
+		return 1;
+	if (fread(magic, sizeof(magic), 1, fp) != 1 ||
+	    memcmp(magic, SHARD_MAGIC, sizeof(magic)) != 0) {
+		fclose(fp);
+		return 1;
+	}
+	if (getdelim(&field[0], &len[0], '\0', fp) == -1)
+		goto CORRUPT;
+	list->options = field[0];
+	field[0] = NULL;
+	len[0] = 0;
+	while (getdelim(&field[0], &len[0], '\0', fp) != -1) {
+		if (getdelim(&field[1], &len[1], '\0', fp) == -1 ||
+		    getdelim(&field[2], &len[2], '\0', fp) == -1)
+			goto CORRUPT;
+		if (!(shard = shard_add(list, field[0], field[2]))) {
+			report_error(g_data, FATAL, "shard_read: realloc: %s\n", strerror(errno));
+			goto EXIT;
+		}
+		shard->number = atoi(field[1]);
+		field[0] = field[2] = NULL;
+		len[0] = len[2] = 0;
+	}
+	if (ferror(fp)) {
+		report_error(g_data, FATAL, "shard_read: %s: %s\n", database, strerror(errno));
+		goto EXIT;
+	}
+	ret = 1;
+	goto EXIT;
+CORRUPT:
+	report_error(g_data, FATAL, "shard_read: %s: the manifest is corrupt\n", database);
+EXIT:
+	fclose(fp);
+	for (i = 0; i < 3; i++)
+		free(field[i]);
+	if (!ret)
+		shard_free(list);
+	return ret;
+}
+
+/*
+ * shard_files() returns the file names of the shards of the manifest
+ * 'database' in the order of the crawl. The array is NULL terminated.
+ */
+char **shard_files(struct g_data_s *g_data, const char *database)
+{
+	struct shard_list_s list;
+	char **files;
+	int i;
+
+	if (!shard_read(g_data, database, &list))
+		return NULL;
+	if (!(files = calloc(list.count + 1, sizeof(char *))))
+		goto NOMEM;
+	for (i = 0; i < list.count; i++)
+		if (!(files[i] = shard_name(database, list.shard[i].number)))
+			goto NOMEM;
+	shard_free(&list);
+	return files;
+NOMEM:
+	report_error(g_data, FATAL, "shard_files: malloc: %s\n", strerror(errno));
+	for (i = 0; files && files[i]; i++)
+		free(files[i]);
+	free(files);
+	shard_free(&list);
+	return NULL;
+}
+
+/*
+ * shard_options() returns what the shards are built with, an update with
+ * other options builds all of them.
+ */
+static char *shard_options(struct g_data_s *g_data)
+{
+	char *options;
+	size_t len = 64;
+	int i;
+
+	for (i = 0; g_data->exclude && g_data->exclude[i]; i++)
+		len += strlen(g_data->exclude[i]) + 9;
+	if (!(options = malloc(len)))
+		return NULL;
+	sprintf(options, "format=%d\nslevel=%c\nxdev=%d\n",
+		g_data->DIR_TABLE ? DB_DIRTAB : g_data->COMPRESS ? DB_BLOCK : DB_PLAIN,
+		g_data->slevel, g_data->XDEV ? 1 : 0);
+	for (i = 0; g_data->exclude && g_data->exclude[i]; i++) {
+		strcat(options, "exclude=");
+		strcat(options, g_data->exclude[i]);
+		strcat(options, "\n");
+	}
+	return options;
+}
+
+/*
+ * shard_stamp() returns the stamp of the file system of 'path', an empty
+ * string, if there is none.
+ */
+static char *shard_stamp(const char *path)
+{
+	struct stat st;
+	struct statfs fs;
+	char buf[64];
+
+	*buf = '\0';
+	/* the number of the used inodes changes, when a file is created or
+	 * removed, not when one is written */
+	if (stat(path, &st) == 0 && statfs(path, &fs) == 0 && fs.f_files)
+		sprintf(buf, "%llu:%llu", (unsigned long long)st.st_dev,
+			(unsigned long long)(fs.f_files - fs.f_ffree));
+	return strdup(buf);
+}
+
+/*
+ * shard_owner() returns the shard of the list, that 'path' belongs to: the
+ * deepest one, that it is below of. A mount point belongs to the shard
+ * above it. Returns -1, if it is in none.
+ */
+static int shard_owner(struct shard_list_s *list, const char *path)
+{
+	struct shard_s *shard;
+	size_t len, best = 0;
+	int owner = -1;
+	int i;
+
+	for (i = 0; i < list->count; i++) {
+		shard = &list->shard[i];
+		len = strcmp(shard->path, "/") == 0 ? 0 : strlen(shard->path);
+		if (strcmp(path, shard->path) == 0) {
+			if (!shard->root)
+				continue;
+		} else if (len ? strncmp(path, shard->path, len) != 0 || path[len] != '/' :
+			   *path != '/')
+			continue;
+		if (owner == -1 || len > best) {
+			owner = i;
+			best = len;
+		}
+	}
+	return owner;
+}
+
+static int shard_compare(const void *e1, const void *e2)
+{
+	return tree_compare(((const struct shard_s *)e1)->path, ((const struct shard_s *)e2)->path);
+}
+
+/*
+ * shard_diff() marks the shards, that rlocated saw a path added in since
+ * the last update. They are the paths, that rlocate_start_updatedb() moved
+ * aside and that rlocate_end_updatedb() removes.
+ */
+static void shard_diff(struct g_data_s *g_data, struct shard_list_s *list)
+{
+	char *diff_db, *tmp_diff_db;
+	char *buffer = NULL;
+	char *path = NULL;
+	size_t len = 0, alloc = 0;
+	ssize_t n;
+	FILE *fp;
+	int i;
+
+	diff_db = get_diff_db_name(g_data->output_db);
+	tmp_diff_db = get_tmp_db_name(diff_db);
+	if ((fp = fopen(tmp_diff_db, "r"))) {
+		while ((n = getdelim(&buffer, &len, '\0', fp)) != -1) {
+			/* the paths of the diff database have no leading '/' */
+			if ((size_t)n + 2 > alloc) {
+				alloc = n + 2;
+				if (!(path = realloc(path, alloc)))
+					break;
+			}
+			*path = '/';
+			strcpy(path + 1, buffer);
+			if ((i = shard_owner(list, path)) != -1)
+				list->shard[i].build = 1;
+		}
+		fclose(fp);
+	}
+	free(buffer);
+	free(path);
+	free(tmp_diff_db);
+	free(diff_db);
+}
+
+/*
+ * shard_write() writes the paths of the walked unit of 'shard' to the
+ * shard file 'name'.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+static int shard_write(struct g_data_s *g_data, struct mount_crawl_s *crawl,
+		       struct shard_s *shard, const char *name,
+		       mode_t mode, uid_t uid, gid_t gid)
+{
+	struct mount_unit_s *unit = &crawl->unit[shard->unit];
+	struct enc_data_s enc_data;
+	char *buffer = NULL;
+	size_t len = 0;
+	FILE *fd = NULL;
+	int ret = 0;
+
+	memset(&enc_data, 0, sizeof(enc_data));
+	if (!mount_wait(crawl, shard->unit))
+		goto EXIT;
+	if (!(fd = fopen(name, "w"))) {
+		report_error(g_data, FATAL, "Could not open file for writing: %s: %s\n", name, strerror(errno));
+		goto EXIT;
+	}
+	if (mode && fchmod(fileno(fd), mode) == -1) {
+		report_error(g_data, FATAL, "Could not change permissions of '%u' on file: %s: %s\n", mode, name, strerror(errno));
+		goto EXIT;
+	}
+	if (!(enc_data.db = db_create(g_data, fd, g_data->DIR_TABLE ? DB_DIRTAB :
+				      g_data->COMPRESS ? DB_BLOCK : DB_PLAIN)))
+		goto EXIT;
+	if (g_data->DIR_TABLE) {
+		if (!(enc_data.dirtab = dirtab_create(g_data, fd)))
+			goto EXIT;
+	} else if (g_data->COMPRESS) {
+		if (!(enc_data.block = block_create(g_data, fd)))
+			goto EXIT;
+	}
+	while (getdelim(&buffer, &len, '\0', unit->fp) != -1)
+		if (!encode(g_data, fd, buffer, &enc_data))
+			goto EXIT;
+	if (ferror(unit->fp)) {
+		report_error(g_data, FATAL, "shard_write: read: %s\n", strerror(errno));
+		goto EXIT;
+	}
+	if (!encode_flush(g_data, fd, &enc_data))
+		goto EXIT;
+	if (enc_data.block && !block_finish(g_data, fd, enc_data.block))
+		goto EXIT;
+	if (enc_data.dirtab && !dirtab_finish(g_data, fd, enc_data.dirtab))
+		goto EXIT;
+	if (!db_finish(g_data, fd, enc_data.db))
+		goto EXIT;
+	if (fclose(fd) == EOF) {
+		fd = NULL;
+		report_error(g_data, FATAL, "fclose(): Could not close shard: %s: %s\n", name, strerror(errno));
+		goto EXIT;
+	}
+	fd = NULL;
+	if (uid != (uid_t)-1 && chown(name, uid, gid) == -1) {
+		report_error(g_data, FATAL, "shard_write: chown: %s: %s\n", name, strerror(errno));
+		goto EXIT;
+	}
+	ret = 1;
+EXIT:
+	if (fd)
+		fclose(fd);
+	if (!ret)
+		unlink(name);
+	/* the walk is not needed any more */
+	if (unit->fp) {
+		fclose(unit->fp);
+		unit->fp = NULL;
+	}
+	free(buffer);
+	free(enc_data.prev_line);
+	free(enc_data.buf);
+	block_free(enc_data.block);
+	dirtab_free(enc_data.dirtab);
+	db_free(enc_data.db);
+	return ret;
+}
+
+/*
+ * shard_number() returns the smallest number, that no shard of 'old' or
+ * 'new' has.
+ */
+static int shard_number(struct shard_list_s *old, struct shard_list_s *new)
+{
+	int number, i;
+
+	for (number = 0; ; number++) {
+		for (i = 0; i < old->count && old->shard[i].number != number; i++);
+		if (i < old->count)
+			continue;
+		for (i = 0; i < new->count && new->shard[i].number != number; i++);
+		if (i == new->count)
+			return number;
+	}
+}
+
+/*
+ * shard_update() updates the sharded database g_data->output_db. The
+ * shards, that are built again, get numbers of their own, so the shards of
+ * the old manifest stay, until the new one is in place. The files are
+ * written with 'mode' and are owned by 'uid' and 'gid', unless 'uid' is
+ * -1.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int shard_update(struct g_data_s *g_data, mode_t mode, uid_t uid, gid_t gid)
+{
+	struct mount_crawl_s crawl;
+	struct shard_list_s old, new;
+	struct shard_s *shard;
+	char *tmp_file = NULL;
+	char *name = NULL;
+	char *path, *stamp;
+	char number[16];
+	FILE *fd = NULL;
+	int i, j, built = 0;
+	int diff;
+	int ret = 0;
+
+	memset(&old, 0, sizeof(old));
+	memset(&new, 0, sizeof(new));
+	/* a file renamed or replaced leaves the stamp as it is, only the diff
+	 * database of rlocated tells, that the shard changed */
+	diff = rlocate_diff_kept(g_data);
+	if (!mount_units(g_data, &crawl))
+		goto EXIT;
+	if (!(new.options = shard_options(g_data)))
+		goto NOMEM;
+	for (i = 0; i < crawl.count; i++) {
+		if (!(path = strdup(crawl.unit[i].path)))
+			goto NOMEM;
+		if (!(stamp = shard_stamp(path)) || !(shard = shard_add(&new, path, stamp))) {
+			free(path);
+			free(stamp);
+			goto NOMEM;
+		}
+		shard->root = crawl.unit[i].root;
+		shard->unit = i;
+		shard->number = -1;
+	}
+	qsort(new.shard, new.count, sizeof(struct shard_s), shard_compare);
+
+	if (!shard_read(g_data, g_data->output_db, &old))
+		goto EXIT;
+	for (i = 0; i < new.count; i++) {
+		shard = &new.shard[i];
+		for (j = 0; j < old.count && strcmp(old.shard[j].path, shard->path); j++);
+		if (j == old.count) {
+			/* a file system was mounted in the shard above */
+			shard->build = 1;
+			if ((j = shard_owner(&new, shard->path)) != -1)
+				new.shard[j].build = 1;
+			continue;
+		}
+		if (g_data->FULL_UPDATE || !diff || strcmp(old.options, new.options) != 0 ||
+		    !*shard->stamp || strcmp(old.shard[j].stamp, shard->stamp) != 0)
+			shard->build = 1;
+		else if ((name = shard_name(g_data->output_db, old.shard[j].number))) {
+			if (access(name, F_OK) == 0)
+				shard->number = old.shard[j].number;
+			else
+				shard->build = 1;
+			free(name);
+			name = NULL;
+		}
+	}
+	/* a file system was unmounted in the shard above */
+	for (j = 0; j < old.count; j++) {
+		for (i = 0; i < new.count && strcmp(old.shard[j].path, new.shard[i].path); i++);
+		if (i == new.count && (i = shard_owner(&new, old.shard[j].path)) != -1)
+			new.shard[i].build = 1;
+	}
+	shard_diff(g_data, &new);
+	for (i = 0; i < new.count; i++) {
+		shard = &new.shard[i];
+		if (shard->build || shard->number == -1) {
+			shard->build = 1;
+			shard->number = -1;
+		} else
+			crawl.unit[shard->unit].keep = 1;
+	}
+	for (i = 0; i < new.count; i++)
+		if (new.shard[i].build)
+			new.shard[i].number = shard_number(&old, &new);
+
+	if (!mount_start(&crawl))
+		goto EXIT;
+	for (i = 0; i < new.count; i++) {
+		shard = &new.shard[i];
+		if (!shard->build)
+			continue;
+		if (!(name = shard_name(g_data->output_db, shard->number)))
+			goto NOMEM;
+		if (!shard_write(g_data, &crawl, shard, name, mode, uid, gid))
+			goto EXIT;
+		free(name);
+		name = NULL;
+		built++;
+	}
+	if (g_data->VERBOSE)
+		fprintf(stderr, "%s: %d of %d shards built\n", g_data->progname, built, new.count);
+
+	if (!(tmp_file = get_temp_file(g_data)))
+		goto EXIT;
+	if (!(fd = fopen(tmp_file, "w"))) {
+		report_error(g_data, FATAL, "Could not open file for writing: %s: %s\n", tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	if (mode && fchmod(fileno(fd), mode) == -1) {
+		report_error(g_data, FATAL, "Could not change permissions of '%u' on file: %s: %s\n", mode, tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	fwrite(SHARD_MAGIC, sizeof(SHARD_MAGIC) - 1, 1, fd);
+	fwrite(new.options, strlen(new.options) + 1, 1, fd);
+	for (i = 0; i < new.count; i++) {
+		shard = &new.shard[i];
+		sprintf(number, "%d", shard->number);
+		fwrite(shard->path, strlen(shard->path) + 1, 1, fd);
+		fwrite(number, strlen(number) + 1, 1, fd);
+		fwrite(shard->stamp, strlen(shard->stamp) + 1, 1, fd);
+	}
+	if (ferror(fd) || fclose(fd) == EOF) {
+		fd = NULL;
+		report_error(g_data, FATAL, "shard_update: write: %s: %s\n", tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	fd = NULL;
+	if (uid != (uid_t)-1 && chown(tmp_file, uid, gid) == -1) {
+		report_error(g_data, FATAL, "shard_update: chown: %s: %s\n", tmp_file, strerror(errno));
+		goto EXIT;
+	}
+	if (rename(tmp_file, g_data->output_db) == -1) {
+		report_error(g_data, FATAL, "shard_update: rename(): Could not rename '%s' to '%s': %s\n", tmp_file, g_data->output_db, strerror(errno));
+		goto EXIT;
+	}
+	/* the shards, that are not in the new manifest */
+	for (j = 0; j < old.count; j++) {
+		for (i = 0; i < new.count && new.shard[i].number != old.shard[j].number; i++);
+		if (i < new.count || !(name = shard_name(g_data->output_db, old.shard[j].number)))
+			continue;
+		if (unlink(name) == -1 && errno != ENOENT)
+			report_error(g_data, WARNING, "shard_update: unlink(): %s: %s\n", name, strerror(errno));
+		free(name);
+		name = NULL;
+	}
+	ret = 1;
+	goto EXIT;
+NOMEM:
+	report_error(g_data, FATAL, "shard_update: malloc: %s\n", strerror(errno));
+EXIT:
+	if (fd)
+		fclose(fd);
+	if (!ret && tmp_file)
+		unlink(tmp_file);
+	free(tmp_file);
+	free(name);
+	mount_end(&crawl);
+	shard_free(&old);
+	shard_free(&new);
+	return ret;
+}
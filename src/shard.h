@@ -0,0 +1,41 @@
+#ifndef SHARD_H
+#define SHARD_H 1
+
+#include <sys/types.h>
+
+/* --shards: the database is a manifest of shards, one for every indexed
+ * path and every file system mounted below one, in the order of the crawl:
+ *
+ *   SHARD_MAGIC | options '\0' | { path '\0' number '\0' stamp '\0' } ...
+ *
+ * The shard of a path is the database '<database>.<number>'. The options
+ * are the format and the excludes the shards were built with. The stamp
+ * is the device and the number of the used inodes of the file system. An
+ * update builds a shard again only if the stamp changed, if rlocated saw a
+ * path added in it or if a file system was mounted or unmounted in it.
+ * Without the diff database of rlocated every shard is built. */
+#define SHARD_MAGIC "RLSHARD\1"
+
+/* Shard of a manifest */
+struct shard_s {
+	char *path;
+	int root;		/* an indexed path, not a mount point */
+	int number;		/* of the file '<database>.<number>' */
+	char *stamp;
+	int unit;		/* of the crawl */
+	int build;		/* is built again */
+};
+
+/* Manifest */
+struct shard_list_s {
+	char *options;
+	struct shard_s *shard;
+	int count;
+	int alloc;
+};
+
+int shard_manifest(int fd);
+char **shard_files(struct g_data_s *g_data, const char *database);
+int shard_update(struct g_data_s *g_data, mode_t mode, uid_t uid, gid_t gid);
+
+#endif /* !SHARD_H */
@@ -30,6 +30,7 @@
  *****************************************************************************/
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -47,6 +48,24 @@
 #include "cmds.h"
 #include "conf.h"
 #include "rlocate.h"
+#include "profile.h"
+#include "image.h"
+#include "session.h"
+#include "batch.h"
+#include "crawl.h"
+#include "walk.h"
+#include "incr.h"
+#include "block.h"
+#include "dirtab.h"
+#include "dbinfo.h"
+#include "diff.h"
+#include "prune.h"
+#include "mount.h"
+#include "shard.h"
+#include "throttle.h"
+#include "ckpt.h"
+#include "import.h"
+#include "merge.h"
 
 /* Init Input DB variable */
 char **init_input_db(struct g_data_s *g_data, int len)
@@ -100,6 +119,12 @@ void free_global_data(struct g_data_s * g_data)
 	    free(g_data->progname);
 	if (g_data->index_path)
 	    free(g_data->index_path);
+	if (g_data->index_paths) {
+		for (i = 0; g_data->index_paths[i]; i++)
+		    free(g_data->index_paths[i]);
+
+		free(g_data->index_paths);
+	}
 	if (g_data->output_db)
 	    free(g_data->output_db);
 	if (g_data->input_db) {
@@ -114,6 +139,25 @@ void free_global_data(struct g_data_s * g_data)
 
 		free(g_data->exclude);
 	}
+	prune_free(g_data->prune);
+	if (g_data->alias) {
+		for (i = 0; g_data->alias[i]; i++)
+		    free(g_data->alias[i]);
+
+		free(g_data->alias);
+	}
+	if (g_data->from_list) {
+		for (i = 0; g_data->from_list[i]; i++)
+		    free(g_data->from_list[i]);
+
+		free(g_data->from_list);
+	}
+	if (g_data->merge_db) {
+		for (i = 0; g_data->merge_db[i]; i++)
+		    free(g_data->merge_db[i]);
+
+		free(g_data->merge_db);
+	}
 	if (g_data->regexp_data) {
 		if (g_data->regexp_data->pattern)
 		    free(g_data->regexp_data->pattern);
@@ -157,17 +201,46 @@ struct g_data_s * init_global_data(char **argv)
 	g_data->slevel = VERIFY_ACCESS;
 	g_data->nocase = 0;
 	g_data->index_path = strdup("/");
+	g_data->index_paths = NULL;
 	g_data->uid = getuid();
 	g_data->gid = getgid();
 	g_data->input_db = NULL;
 	g_data->output_db = NULL;	
 	g_data->exclude = NULL;
+	g_data->prune = NULL;
+	g_data->alias = NULL;
+	g_data->from_list = NULL;
+	g_data->merge_db = NULL;
 	g_data->regexp_data = NULL;
 	g_data->queries = -1;
 	g_data->SLOCATE_GID = get_gid(g_data, DB_GROUP, &ret);
 	g_data->FULL_UPDATE = 0;
 	g_data->FAST_UPDATE = 0;
 	g_data->INITDIFFDB  = 0;
+	g_data->PROFILE = 0;
+	g_data->SEARCH_IMAGE = 0;
+	g_data->SESSION = 0;
+	g_data->session = NULL;
+	g_data->STDIN_PATTERNS = 0;
+	g_data->THREADS = 1;
+	g_data->NATIVE_CRAWL = 0;
+	g_data->INODE_ORDER = 0;
+	g_data->INCREMENTAL = 0;
+	g_data->COMPRESS = 0;
+	g_data->DIR_TABLE = 0;
+	g_data->STATISTICS = 0;
+	g_data->DIFF_DB = 0;
+	g_data->COUNT = 0;
+	g_data->DIFF_MEMORY = DIFF_MEMORY_SIZE;
+	g_data->XDEV = 0;
+	g_data->PRUNE_FS = 0;
+	g_data->SKIP_BINDS = 0;
+	g_data->PER_FILESYSTEM = 0;
+	g_data->SHARDS = 0;
+	g_data->THROTTLE = 0;
+	g_data->CHECKPOINT = 0;
+	g_data->throttle = NULL;
+	g_data->batch = NULL;
 
 	if (!ret)
 	    goto EXIT;	
@@ -181,14 +254,61 @@ EXIT:
 	return g_data;
 }
 
+/*
+ * common_prefix() returns the length of the common prefix of 's1' and 's2',
+ * that are 'len' bytes long at least. It compares a word at a time.
+ */
+static size_t common_prefix(const char *s1, const char *s2, size_t len)
+{
+	uint64_t w1, w2;
+	size_t i;
+
+	for (i = 0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+		memcpy(&w1, s1 + i, sizeof(uint64_t));
+		memcpy(&w2, s2 + i, sizeof(uint64_t));
+		if (w1 != w2)
+			break;
+	}
+	while (i < len && s1[i] == s2[i])
+		i++;
+	return i;
+}
+
+/*
+ * encode_flush() writes the encoded paths, that are in the buffer, to the
+ * database 'fd', as the next block of a block database. It has to be
+ * called before 'fd' is closed.
+ */
+int encode_flush(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data)
+{
+	if (enc_data->dirtab)
+	    return dirtab_flush(g_data, fd, enc_data->dirtab);
+	if (enc_data->block) {
+		if (!block_write(g_data, fd, enc_data->block, enc_data->buf, enc_data->buf_len))
+		    return 0;
+		enc_data->buf_len = 0;
+		/* a block is a chunk */
+		return !enc_data->db || db_chunk_end(g_data, enc_data->db);
+	}
+	/* anything written to 'fd' with stdio goes first */
+	if (fflush(fd) == EOF || !write_all(fileno(fd), enc_data->buf, enc_data->buf_len)) {
+		report_error(g_data, FATAL, "encode_flush: write(): %s\n", strerror(errno));
+		return 0;
+	}
+	if (enc_data->db)
+	    enc_data->db->offset += enc_data->buf_len;
+	enc_data->buf_len = 0;
+	return 1;
+}
+
 /* Incremental Encoding algorithm */
 int encode(struct g_data_s *g_data, FILE *fd, char *path, struct enc_data_s *enc_data)
 {
 	short code_len = 0;
 	short code_num = 0;
-	char *ptr1 = NULL;
-	char *ptr2 = NULL;
-	char *code_line = NULL;
+	size_t len, prefix, need, limit;
+	int restart = 0;
+	char *ptr;
 	int ret = 0;
 
 	if (!path) {
@@ -197,79 +317,329 @@ int encode(struct g_data_s *g_data, FILE *fd, char *path, struct enc_data_s *enc
 	}
 	if (g_data->VERBOSE)
 	    fprintf(stdout, "%s\n", path);       
-	/* Match number string */
-	ptr1 = path;
-	code_len = 0;
-	if (enc_data->prev_line) {
-		ptr2 = enc_data->prev_line;
-		while (*ptr1 != '\0' && *ptr2 != '\0' && *ptr1 == *ptr2) {
-			ptr1 += 1;
-			ptr2 += 1;
-			code_len += 1;
+	len = strlen(path);
+	if (enc_data->db)
+	    enc_data->db->count += 1;
+
+	/* The directory table database keeps the names itself */
+	if (enc_data->dirtab) {
+		if (!dirtab_add(g_data, fd, enc_data->dirtab, path))
+		    goto EXIT;
+		if (enc_data->image && !image_add(g_data, enc_data->image, path))
+		    goto EXIT;
+		ret = 1;
+		goto EXIT;
+	}
+
+	/* escape, two bytes of code_num, the path and '\0' at most */
+	need = 3 + len + 1;
+	limit = enc_data->block ? BLOCK_RAW_SIZE : ENC_BUF_SIZE;
+	if (enc_data->buf_len && enc_data->buf_len + need > limit &&
+	    !encode_flush(g_data, fd, enc_data))
+	    goto EXIT;
+	/* a path longer than the buffer gets a buffer of its own */
+	if (enc_data->buf_len + need > enc_data->buf_alloc) {
+		if (!(ptr = realloc(enc_data->buf, need > limit ? need : limit))) {
+			if (!report_error(g_data, FATAL, "encode: realloc(): %s\n", strerror(errno)))
+			    goto EXIT;
+		}
+		enc_data->buf = ptr;
+		enc_data->buf_alloc = need > limit ? need : limit;
+	}
+
+	/* The first path of every chunk of DB_OFFSET_EVERY paths of the plain
+	 * database goes to the offset table */
+	if (enc_data->db && !enc_data->block) {
+		if (enc_data->db->chunk_count == DB_OFFSET_EVERY &&
+		    !db_chunk_end(g_data, enc_data->db))
+		    goto EXIT;
+		if (!enc_data->db->chunk_count) {
+			if (!db_offset(g_data, enc_data->db, enc_data->db->offset + enc_data->buf_len))
+			    goto EXIT;
+			restart = 1;
 		}
 	}
+
+	/* Match number string, a block and an entry of the offset table
+	 * start without a common prefix, so that they can be decoded on their
+	 * own */
+	prefix = 0;
+	if (enc_data->prev_line && !restart && (!enc_data->block || enc_data->buf_len))
+	    prefix = common_prefix(path, enc_data->prev_line,
+				   len < enc_data->prev_line_len ? len : enc_data->prev_line_len);
+	code_len = prefix;
 	code_num = code_len - enc_data->prev_len;
 	enc_data->prev_len = code_len;	
-	code_line = ptr1;
+
+	ptr = enc_data->buf + enc_data->buf_len;
 	if (code_num < -127 || code_num > 127) {
-		if (fputc((char)SLOC_ESC, fd) == EOF) {
-			if (!report_error(g_data, FATAL, "encode: fputc(): SLOC_ESC: %s\n", strerror(errno)))
-			    goto EXIT;
-		}
-		if (fputc(code_num >> 8, fd) == EOF) {
-			if (!report_error(g_data, FATAL, "encode: fputc(): SLOC_ESC: code_num >> 8: %s\n", strerror(errno)))
+		*ptr++ = (char)SLOC_ESC;
+		*ptr++ = code_num >> 8;
+		*ptr++ = code_num;
+	} else {
+		*ptr++ = code_num;
+	}
+	memcpy(ptr, path + prefix, len - prefix + 1);
+	ptr += len - prefix + 1;
+	enc_data->buf_len = ptr - enc_data->buf;
+	if (enc_data->db && !db_chunk_add(g_data, enc_data->db, path, len, prefix))
+	    goto EXIT;
+
+	if (enc_data->image && !image_add(g_data, enc_data->image, path))
+	    goto EXIT;
+
+	/* Only the part after the common prefix is copied */
+	if (len + 1 > enc_data->prev_alloc) {
+		if (!(ptr = realloc(enc_data->prev_line, len + 1))) {
+			if (!report_error(g_data, FATAL, "encode: realloc(): %s\n", strerror(errno)))
 			    goto EXIT;
 		}
-		if (fputc(code_num, fd) == EOF) {
-			if (!report_error(g_data, FATAL, "encode: fputc(): SLOC_ESC: code_num: %s\n", strerror(errno)))
-			    goto EXIT;
+		enc_data->prev_line = ptr;
+		enc_data->prev_alloc = len + 1;
+	}
+	memcpy(enc_data->prev_line + prefix, path + prefix, len - prefix + 1);
+	enc_data->prev_line_len = len;
+	ret = 1;
+EXIT:
+	return ret;
+}
+
+/* walk_tree() argument of create_db() */
+struct create_walk_s {
+	struct g_data_s *g_data;
+	FILE *fd;
+	struct enc_data_s *enc_data;
+	struct ckpt_s *ckpt;
+	int failed;
+};
+
+/*
+ * create_walk() encodes a path found by walk_tree() or skips it, if it is
+ * excluded.
+ */
+static int create_walk(const char *path, int len, void *arg)
+{
+	struct create_walk_s *cw = arg;
+	int matched = 0;
+
+	(void)len;
+	throttle_read(cw->g_data->throttle, 1);
+	switch (ckpt_skip(cw->ckpt, path)) {
+	case CKPT_SKIP:
+		return WALK_SKIP;
+	case CKPT_DESCEND:
+		return WALK_CONTINUE;
+	}
+	if (!cw->g_data->exclude || !(matched = match_exclude(cw->g_data, (char *)path))) {
+		if (!encode(cw->g_data, cw->fd, (char *)path, cw->enc_data) ||
+		    !ckpt_save(cw->ckpt, cw->fd, cw->enc_data)) {
+			cw->failed = 1;
+			return WALK_ABORT;
 		}
+	} else if (matched != -1) {
+		return WALK_SKIP;
 	} else {
-		if (fputc(code_num, fd) == EOF) {
-			if (!report_error(g_data, FATAL, "encode: fputc(): code_num: %s\n", strerror(errno)))
-			    goto EXIT;
+		cw->failed = 1;
+		return WALK_ABORT;
+	}
+	return WALK_CONTINUE;
+}
+
+static int create_compare(const void *e1, const void *e2)
+{
+	return tree_compare(*(char * const *)e1, *(char * const *)e2);
+}
+
+/*
+ * create_roots() sorts the paths to index in the order of the crawl and
+ * leaves out the ones below another one. g_data->index_path is set to the
+ * directory, that all of them are in, for rlocated.
+ */
+static int create_roots(struct g_data_s *g_data)
+{
+	char **roots;
+	char *path;
+	size_t len, n, common;
+	int count, i, j;
+
+	if (!g_data->index_paths && !add_index_path(g_data, g_data->index_path))
+	    return 0;
+	roots = g_data->index_paths;
+
+	/* Remove the trailing '/' if not the main root directory */
+	for (count = 0; (path = roots[count]); count++) {
+		len = strlen(path);
+		while (len > 1 && path[len-1] == '/')
+		    path[--len] = 0;
+	}
+	qsort(roots, count, sizeof(char *), create_compare);
+	for (i = j = 0; i < count; i++) {
+		len = j ? strlen(roots[j-1]) : 0;
+		if (j && (strcmp(roots[j-1], "/") == 0 ||
+			  (strncmp(roots[i], roots[j-1], len) == 0 &&
+			   (roots[i][len] == 0 || roots[i][len] == '/')))) {
+			free(roots[i]);
+			continue;
 		}
+		roots[j++] = roots[i];
 	}
-	if (fputs(code_line, fd) == EOF) {
-		if (!report_error(g_data, FATAL, "encode: fprintf(): code_line: %s\n", strerror(errno)))
-		    goto EXIT;
+	roots[j] = NULL;
+
+	/* The common directory is above all of them */
+	common = strlen(roots[0]);
+	for (i = 1; i < j; i++) {
+		for (n = 0; roots[0][n] && roots[0][n] == roots[i][n]; n++);
+		while (n > 0 && roots[0][--n] != '/');
+		if (n < common)
+		    common = n;
 	}
-	if (fputc('\0', fd) == EOF) {
-		if (!report_error(g_data, FATAL, "encode: fputc(): '\0': %s\n", strerror(errno)))
-		    goto EXIT;
+	if (g_data->index_path)
+	    free(g_data->index_path);
+	if (common == 0 && j > 1)
+	    g_data->index_path = strdup(roots[0][0] == '/' ? "/" : ".");
+	else
+	    g_data->index_path = sl_strndup(roots[0], common);
+	if (!g_data->index_path) {
+		report_error(g_data, FATAL, "create_roots: malloc: %s\n", strerror(errno));
+		return 0;
 	}
 
-	if (enc_data->prev_line)
-	    free(enc_data->prev_line);
+	return 1;
+}
 
-	if (!(enc_data->prev_line = strdup(path))) {
-		if (!report_error(g_data, FATAL, "encode: strdup(): %s\n", strerror(errno)))
-		    goto EXIT;
+/*
+ * create_fts() encodes the paths below 'path' read with fts in the order of
+ * rlocate_ftscompare().
+ */
+static int create_fts(struct g_data_s *g_data, char *path, FILE *fd,
+		      struct enc_data_s *enc_data, struct ckpt_s *ckpt)
+{
+	char *index_path_list[2] = { path, NULL };
+	FTS *dir;
+	FTSENT *file;
+	int matched = 0;
+	int ret = 0;
+
+	if (!(dir = fts_open(index_path_list, FTS_PHYSICAL | FTS_NOSTAT | (g_data->XDEV ? FTS_XDEV : 0), rlocate_ftscompare))) {
+		report_error(g_data, FATAL, "fts_open: %s\n", strerror(errno));
+		return 0;
+	}
+	/* The new FTS() funtionality */
+	while ((file = fts_read(dir))) {
+		/* fts_read () from glibc fails with EOVERFLOW when fts_pathlen
+		 * would overflow the u_short file->fts_pathlen. */
+		if (file->fts_info == FTS_DP || file->fts_info == FTS_NS)
+		    continue;
+
+		matched = 0;
+		throttle_read(g_data->throttle, 1);
+		if ((matched = ckpt_skip(ckpt, file->fts_path)) != CKPT_ENCODE) {
+			if (matched == CKPT_SKIP)
+			    fts_set(dir, file, FTS_SKIP);
+			continue;
+		}
+		if (!g_data->exclude || !(matched = match_exclude(g_data, file->fts_path))) {
+			if (!encode(g_data, fd, file->fts_path, enc_data) ||
+			    !ckpt_save(ckpt, fd, enc_data))
+			    goto EXIT;
+		} else if (matched != -1) {
+			fts_set(dir, file, FTS_SKIP);
+		} else {
+			goto EXIT;
+		}
 	}
 	ret = 1;
 EXIT:
+	if (fts_close(dir) == -1 && ret) {
+		report_error(g_data, FATAL, "fts_close(): Could not close fts: %s\n", strerror(errno));
+		ret = 0;
+	}
 	return ret;
 }
 
+/*
+ * create_crawl() encodes the paths of a full update with the crawl, that
+ * the options chose.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+static int create_crawl(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data,
+			struct ckpt_s *ckpt, mode_t db_mode, uid_t db_uid, gid_t db_gid)
+{
+	struct create_walk_s cw;
+	int i;
+
+	/* Encode the paths of the lists and databases instead of a crawl */
+	if (g_data->from_list || g_data->merge_db)
+	    return import_lists(g_data, fd, enc_data);
+	/* Reuse the listings of the unchanged directories */
+	if (g_data->INCREMENTAL)
+	    return incr_tree(g_data, fd, enc_data, db_mode, db_uid, db_gid);
+	/* Read every file system with a worker of its own */
+	if (g_data->PER_FILESYSTEM)
+	    return mount_crawl(g_data, fd, enc_data);
+	/* The paths to index one after another */
+	for (i = 0; g_data->index_paths[i]; i++) {
+		if (ckpt)
+		    ckpt->root = i;
+		/* Read the directories with worker threads */
+		if (g_data->THREADS > 1) {
+			if (!crawl_tree(g_data, g_data->index_paths[i], fd, enc_data))
+			    return 0;
+		/* --inode-order needs the stat()s of the native walk */
+		} else if (g_data->NATIVE_CRAWL || g_data->INODE_ORDER) {
+			cw.g_data = g_data;
+			cw.fd = fd;
+			cw.enc_data = enc_data;
+			cw.ckpt = ckpt;
+			cw.failed = 0;
+			if (!walk_tree(g_data->index_paths[i], WALK_SORTED | (g_data->XDEV ? WALK_XDEV : 0) |
+				       (g_data->INODE_ORDER ? WALK_INODE : 0), create_walk, &cw)) {
+				if (!cw.failed)
+				    report_error(g_data, FATAL, "create_db: walk_tree: %s\n", strerror(errno));
+				return 0;
+			}
+		} else if (!create_fts(g_data, g_data->index_paths[i], fd, enc_data, ckpt)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
 /* Create the database */
 int create_db(struct g_data_s *g_data)
 {
 	FILE *fd = NULL;
-	FTS *dir = NULL;
-	FTSENT *file = NULL;
-	char **index_path_list = NULL;
 	char *tmp_file = NULL;
+	char *img_file = NULL;
 	uid_t db_uid = -1;
 	gid_t db_gid = -1;
 	mode_t db_mode = 0;
 	int fd_int = -1;
 	int ret = 0;
-	int matched = 0;
+	int i;
 	struct enc_data_s enc_data;
+	struct ckpt_s *ckpt = NULL;
+	int resumed = 0;
+	int fast = 0;
+	/* rlocate_start_updatedb() moved the diff database aside */
+	int started = 0;
+	/* the paths come from --from-list or --merge-db, not from a crawl */
+	int import = g_data->from_list || g_data->merge_db;
 	
 	/* Initialize encode data struct */
 	enc_data.prev_line = NULL;
+	enc_data.prev_line_len = 0;
+	enc_data.prev_alloc = 0;
 	enc_data.prev_len = 0;
+	enc_data.image = NULL;
+	enc_data.buf = NULL;
+	enc_data.buf_len = 0;
+	enc_data.buf_alloc = 0;
+	enc_data.block = NULL;
+	enc_data.dirtab = NULL;
+	enc_data.db = NULL;
 	if (!rlocate_lock(g_data))
 		goto EXIT;
 	if (strcmp(g_data->output_db, DEFAULT_DB) == 0 && g_data->uid != DB_UID) {
@@ -291,16 +661,63 @@ int create_db(struct g_data_s *g_data)
 		/* Leave it to umask */
 		db_mode = 0;
 	}
-	/* Make sure we can access the directory that we want to start
-	 * searching on. */
-	if (access(g_data->index_path, R_OK | X_OK) != 0) {
-		if (!report_error(g_data, FATAL, "Could not access index path '%s': %s\n", g_data->index_path, strerror(errno)))
-		    goto EXIT;		
-	}	
+	if (!create_roots(g_data))
+	    goto EXIT;
+	/* Make sure we can access the directories that we want to start
+	 * searching on, unless the paths are imported. */
+	for (i = 0; !import && g_data->index_paths[i]; i++) {
+		if (access(g_data->index_paths[i], R_OK | X_OK) != 0) {
+			if (!report_error(g_data, FATAL, "Could not access index path '%s': %s\n", g_data->index_paths[i], strerror(errno)))
+			    goto EXIT;
+		}
+	}
+	for (i = 0; g_data->merge_db && g_data->merge_db[i]; i++) {
+		if (access(g_data->merge_db[i], R_OK) != 0) {
+			if (!report_error(g_data, FATAL, "Could not access database '%s': %s\n", g_data->merge_db[i], strerror(errno)))
+			    goto EXIT;
+		}
+	}
+	/* The file systems, that are pruned by type, are excluded too */
+	if (g_data->PRUNE_FS && !mount_prune(g_data))
+	    goto EXIT;
+	/* and the bind mounts of directories, that are crawled elsewhere */
+	if (g_data->SKIP_BINDS && !mount_binds(g_data))
+	    goto EXIT;
+	if (!compile_exclude(g_data))
+	    goto EXIT;
+	/* Crawl with the idle I/O priority and slow down, while the machine
+	 * is busy */
+	if (g_data->THROTTLE && !(g_data->throttle = throttle_create(g_data, g_data->THROTTLE)))
+	    goto EXIT;
+	if (g_data->SHARDS && import) {
+		report_error(g_data, WARNING, "--shards is ignored with --from-list and --merge-db\n");
+		g_data->SHARDS = 0;
+	}
+	/* Build the shards of the file systems, that changed */
+	if (g_data->SHARDS) {
+		rlocate_start_updatedb(g_data);
+		started = 1;
+		if (!shard_update(g_data, db_mode, strcmp(g_data->output_db, DEFAULT_DB) ? (uid_t)-1 : db_uid, db_gid))
+		    goto EXIT;
+		rlocate_end_updatedb(g_data);
+		started = 0;
+		ret = 1;
+		goto EXIT;
+	}
 	if (!(tmp_file = get_temp_file(g_data)))
 	    goto EXIT;
+	/* Go on from the checkpoint of an update, that was interrupted */
+	if (g_data->CHECKPOINT) {
+		if (g_data->COMPRESS || g_data->DIR_TABLE || g_data->SEARCH_IMAGE ||
+		    g_data->INCREMENTAL || g_data->PER_FILESYSTEM || g_data->THREADS > 1 ||
+		    import) {
+			report_error(g_data, WARNING, "--checkpoint is ignored without a plain database and a serial crawl\n");
+		} else if (!(ckpt = ckpt_create(g_data, tmp_file)) ||
+			   (resumed = ckpt_restore(ckpt, tmp_file, &fd, &enc_data)) == -1)
+		    goto EXIT;
+	}
 
-	if (!(fd = fopen(tmp_file, "w"))) {
+	if (!resumed && !(fd = fopen(tmp_file, "w"))) {
 		if (!report_error(g_data, FATAL, "Could not open file for writing: %s: %s\n", tmp_file, strerror(errno)))
 		    goto EXIT;
 	}
@@ -316,64 +733,61 @@ int create_db(struct g_data_s *g_data)
 			    goto EXIT;		
 		}
 	}
-
-	/* Set the security level */
-	if (putc((char)g_data->slevel, fd) == EOF) {
-		if (!report_error(g_data, FATAL, "create_db: Could not write to database. putc returned EOF.\n"))
-		    goto EXIT;		
-	}
-	/* Remove the leading '/' if not the main root directory */
-	if (strlen(g_data->index_path) > 1) {
-		if (g_data->index_path[strlen(g_data->index_path)-1] == '/')
-		    g_data->index_path[strlen(g_data->index_path)-1] = 0;
-	}
-	// XXX: TODO: Support for multiple paths to index
-	if (!(index_path_list = malloc(sizeof(char **) * 2))) {
-		if (!report_error(g_data, FATAL, "create_db: 'index_path_list': malloc: %s\n",strerror(errno)))
+	/* Write the uncompressed search image along with the database */
+	if (g_data->SEARCH_IMAGE) {
+		if (!(enc_data.image = image_create(g_data, db_mode)))
 		    goto EXIT;
 	}
 
-	*index_path_list = g_data->index_path;
-	index_path_list[1] = NULL;
-	/* Open a handle to fts */
-	// XXX: TODO: Support limiting to single device FTS_XDEV
+	/* The header has the format and the security level */
+	if (!enc_data.db && !(enc_data.db = db_create(g_data, fd, g_data->DIR_TABLE ? DB_DIRTAB :
+				      g_data->COMPRESS ? DB_BLOCK : DB_PLAIN)))
+	    goto EXIT;
+	if (g_data->DIR_TABLE) {
+		if (!(enc_data.dirtab = dirtab_create(g_data, fd)))
+		    goto EXIT;
+	} else if (g_data->COMPRESS) {
+		if (!(enc_data.block = block_create(g_data, fd)))
+		    goto EXIT;
+	}
 	rlocate_start_updatedb(g_data);
-	if (!rlocate_fast_updatedb(g_data, fd, &enc_data)) {
+	started = 1;
+	if (!resumed && !import && (fast = rlocate_fast_updatedb(g_data, fd, &enc_data)) == -1)
+	    goto EXIT;
+	if (resumed || import || !fast) {
 		g_data->FULL_UPDATE = 1;
-
-	if (!(dir = fts_open(index_path_list, FTS_PHYSICAL | FTS_NOSTAT, rlocate_ftscompare))) {
-		if (!report_error(g_data, FATAL, "fts_open: %s\n", strerror(errno)))
-		    goto EXIT;		
-	}
-	/* The new FTS() funtionality */
-	while ((file = fts_read(dir))) {
-		/* fts_read () from glibc fails with EOVERFLOW when fts_pathlen
-		 * would overflow the u_short file->fts_pathlen. */
-		if (file->fts_info == FTS_DP || file->fts_info == FTS_NS)
-		    continue;
-		
-		matched = 0;
-		if (!g_data->exclude || !(matched = match_exclude(g_data, file->fts_path))) {
-			if (!encode(g_data, fd, file->fts_path, &enc_data))
-			    goto EXIT;
-		} else if (matched != -1) {
-			fts_set(dir, file, FTS_SKIP);
-		} else {
-			goto EXIT;
-		}
+		if (!create_crawl(g_data, fd, &enc_data, ckpt, db_mode,
+				  strcmp(g_data->output_db, DEFAULT_DB) ? (uid_t)-1 : db_uid, db_gid))
+		    goto EXIT;
 	}
-	
-	if (fts_close(dir) == -1) {
-		if (!report_error(g_data, FATAL, "fts_close(): Could not close fts: %s\n", strerror(errno)))
-		    goto EXIT;		
-	}	
-	} // rlocate_fast_updatedb
+	if (fd && !encode_flush(g_data, fd, &enc_data))
+	    goto EXIT;
+	if (fd && enc_data.block && !block_finish(g_data, fd, enc_data.block))
+	    goto EXIT;
+	if (fd && enc_data.dirtab && !dirtab_finish(g_data, fd, enc_data.dirtab))
+	    goto EXIT;
+	if (fd && !db_finish(g_data, fd, enc_data.db))
+	    goto EXIT;
 	if (fd && fclose(fd) == -1) {
 		if (!report_error(g_data, FATAL, "fclose(): Could not close tmp file: %s: %s\n", tmp_file, strerror(errno)))
 		    goto EXIT;		
 	}
 	fd = NULL;
+	if (enc_data.image) {
+		/* The image is renamed first, so that it is never older than
+		 * the database */
+		if (!image_finish(g_data, enc_data.image, tmp_file, strcmp(g_data->output_db, DEFAULT_DB) ? (uid_t)-1 : db_uid, db_gid)) {
+			enc_data.image = NULL;
+			goto EXIT;
+		}
+		enc_data.image = NULL;
+	} else if ((img_file = image_name(g_data->output_db))) {
+		/* Remove a search image left from an earlier update */
+		if (unlink(img_file) == -1 && errno != ENOENT)
+		    report_error(g_data, WARNING, "create_db(): unlink(): %s: %s\n", img_file, strerror(errno));
+	}
 	rlocate_end_updatedb(g_data);
+	started = 0;
 	if (rename(tmp_file, g_data->output_db) == -1) {
 		if (!report_error(g_data, FATAL, "create_db(): rename(): Could not rename '%s' to '%s': %s\n", tmp_file, g_data->output_db, strerror(errno)))
 		    goto EXIT;		
@@ -386,23 +800,41 @@ int create_db(struct g_data_s *g_data)
 			    goto EXIT;			
 		}
 	}
+	ckpt_done(ckpt, 1);
+	ckpt = NULL;
 	
 	ret = 1;
 EXIT:
-	
+	/* the added paths are not in a database, that was not written */
+	if (started)
+	    rlocate_abort_updatedb(g_data);
 	if (fd)
 	    free(fd);
 	fd = NULL;
 	if (tmp_file)
 	    free(tmp_file);
 	tmp_file = NULL;
-	if (index_path_list)
-	    free(index_path_list);	
-	index_path_list = NULL;
+	if (img_file)
+	    free(img_file);
+	img_file = NULL;
 	if (enc_data.prev_line)
 	    free(enc_data.prev_line);
 	enc_data.prev_line = NULL;
 	enc_data.prev_len = 0;
+	if (enc_data.buf)
+	    free(enc_data.buf);
+	enc_data.buf = NULL;
+	block_free(enc_data.block);
+	enc_data.block = NULL;
+	dirtab_free(enc_data.dirtab);
+	enc_data.dirtab = NULL;
+	db_free(enc_data.db);
+	enc_data.db = NULL;
+	image_abort(enc_data.image);
+	enc_data.image = NULL;
+	throttle_free(g_data->throttle);
+	g_data->throttle = NULL;
+	ckpt_done(ckpt, 0);
 	rlocate_unlock();
 
 	return ret;
@@ -447,8 +879,9 @@ char * set_path_head(struct g_data_s *g_data, char *path_head, int code_num, cha
 		/* NOTE '+code_num' is done because code_num will be < 0 thus
 		 * cancelling the + */
 		len = path_len+code_num;
-		if (len <= 0) {
-			if (!report_error(g_data, FATAL, "set_path_head: path_head len <= 0: %d\n", len))
+		/* the first path of a block has no common prefix */
+		if (len < 0) {
+			if (!report_error(g_data, FATAL, "set_path_head: path_head len < 0: %d\n", len))
 			    goto EXIT;
 		}
 		if (!(path_head = realloc(path_head, (sizeof(char) * (len+1))))) {
@@ -473,14 +906,21 @@ int search_path(struct g_data_s *g_data, char *full_path, char *search_str, int
 {
 	int ret = 0;
 	int match_ret = 0;
+	int phase;
 
+	if (g_data->session && session_cancelled(g_data))
+	    return 1;
+	phase = PROF_PHASE(PROF_MATCH);
 	match_ret = match(g_data, full_path, search_str, globflag);
 	if (match_ret == 1) {
+		PROF_COUNT(matches, 1);
+		PROF_PHASE(PROF_VERIFY);
 		if (g_data->slevel == VERIFY_ACCESS && !verify_access(full_path))
 		    match_ret = 0;
 	} else if (match_ret == -1) {
 		goto EXIT;
 	}
+	PROF_PHASE(phase);
 	if (match_ret == 1) {
 		// if (g_data->queries > 0)
 		//    g_data->queries -= 1;
@@ -490,6 +930,7 @@ int search_path(struct g_data_s *g_data, char *full_path, char *search_str, int
 	}
 	ret = 1;
 EXIT:
+	PROF_PHASE(phase);
 	return ret;
 }
 
@@ -497,7 +938,7 @@ EXIT:
 int search_db(struct g_data_s *g_data, char *database, char *search_str)
 {
 	int fd = -1;
-	char ch[1];
+	struct block_reader_s reader;
 	int buf_len;
 	signed char buffer[BLOCK_SIZE];
 	int ret = 0;
@@ -506,18 +947,25 @@ int search_db(struct g_data_s *g_data, char *database, char *search_str)
 	char *prev_code_str = NULL;
 	char *full_path = NULL;
 	char *code_str = NULL;
+	char *glob_str = NULL;
+	char **shards = NULL;
+	int i;
 	int b = 0;
 	int b_mark;
 	int STATE = DC_CODE;
 	int size = 0;
 	int globflag = 0;
+	int image_ret = 0;
 	struct stat db_stat;
 	gid_t effective_gid = 0;
 	time_t now = 0;
 
+	memset(&reader, 0, sizeof(reader));
+	PROF_PHASE(PROF_STARTUP);
 	effective_gid = getegid();
 
 	/* Drop priviledges if the database's group is not slocate */
+	PROF_COUNT(syscalls, 1);
 	if (stat(database, &db_stat) == -1) {
 		if (!report_error(g_data, FATAL, "Could not obtain information on database file '%s': %s\n", database, strerror(errno)))
 		    goto EXIT;
@@ -545,42 +993,63 @@ int search_db(struct g_data_s *g_data, char *database, char *search_str)
 			    goto EXIT;
 		}
 	}
+	PROF_COUNT(syscalls, 1);
 	if ((fd = open(database, O_RDONLY)) == -1) {
 		if (!report_error(g_data, FATAL, "search_db: open: '%s': %s\n", database, strerror(errno)))
 		    goto EXIT;
 	}
 
-	/* slevel */
-	buf_len = read(fd, ch, 1);
-	if (buf_len == 0) {
-		if (!report_error(g_data, FATAL, "search_db: read: '%s': Database file is empty.\n", database))
-		    goto EXIT;
-	} else if (buf_len == -1) {
-		if (!report_error(g_data, FATAL, "serach_db: read: '%s': %s\n", database, strerror(errno)))
-		    goto EXIT;
-	}
-	
 	if (search_str && (strchr(search_str,'*') != NULL || strchr(search_str,'?') ||
 			   (strchr(search_str,'[') && strchr(search_str,']')))) {
-		char *tmp_str = NULL;
 		int ss_len = strlen(search_str);
 		globflag = 1;
 		/* Wrap search string with '*' wildcard characters
-		 * since fnmatch will not match midstring */
-		tmp_str = malloc(ss_len+3);
-		*tmp_str = '*';
-		memcpy(tmp_str+1, search_str, ss_len);
-		tmp_str[ss_len+1] = '*';
-		tmp_str[ss_len+2] = 0;
-		free(search_str);
-		search_str = tmp_str;
+		 * since fnmatch will not match midstring. The search string
+		 * belongs to the caller, so the copy is freed on exit. */
+		if (!(glob_str = malloc(ss_len+3))) {
+			if (!report_error(g_data, FATAL, "search_db: glob_str: malloc: %s\n", strerror(errno)))
+			    goto EXIT;
+		}
+		*glob_str = '*';
+		memcpy(glob_str+1, search_str, ss_len);
+		glob_str[ss_len+1] = '*';
+		glob_str[ss_len+2] = 0;
+		search_str = glob_str;
 	}	
 
-	g_data->slevel = ch[0];
-	b = 0;
-	buf_len = read(fd, buffer, BLOCK_SIZE);
+	/* The shards of a sharded database are merged into the order of the
+	 * crawl and searched as one database */
+	if (shard_manifest(fd)) {
+		rlocate_init(g_data, database, search_str, search_str, globflag);
+		if ((shards = shard_files(g_data, database)) &&
+		    merge_search(g_data, shards, search_str, globflag))
+		    ret = 1;
+		goto EXIT;
+	}
+
+	/* slevel and the block index of a block database */
+	if (!block_open(g_data, &reader, fd, database))
+	    goto EXIT;
+
+	g_data->slevel = reader.slevel;
 	rlocate_init(g_data, database, search_str, search_str, globflag);
+	/* Search the search image instead, if there is an up-to-date one */
+	if ((image_ret = image_search(g_data, database, &db_stat, search_str, globflag)) != -1) {
+		if (image_ret)
+		    ret = 1;
+		goto EXIT;
+	}
+	/* The directory table database matches the names on their own */
+	if (reader.dirtab) {
+		if (dirtab_search(g_data, reader.dirtab, database, search_str, globflag))
+		    ret = 1;
+		goto EXIT;
+	}
+	b = 0;
+	buf_len = block_read(&reader, buffer, BLOCK_SIZE);
+	PROF_PHASE(PROF_DECODE);
 	while (buf_len > 0) {
+		PROF_COUNT(records, 1);
 		code_num = buffer[b];
 		/* Escape char, read extra byte */
 		if (code_num == SLOC_ESC) {
@@ -588,7 +1057,7 @@ int search_db(struct g_data_s *g_data, char *database, char *search_str)
 			if (b == buf_len) {
 				//printf("I 1 - %d\n", BLOCK_SIZE);
 				//exit(0);
-				buf_len = read(fd, buffer, BLOCK_SIZE);
+				buf_len = block_read(&reader, buffer, BLOCK_SIZE);
 				b = 0;				
 			}
 			/* A DC_ESC character indicates that we must read in two bytes
@@ -596,7 +1065,7 @@ int search_db(struct g_data_s *g_data, char *database, char *search_str)
 			code_num = buffer[b];
 			b += 1;			
 			if (b == buf_len) {
-				buf_len = read(fd, buffer, BLOCK_SIZE);
+				buf_len = block_read(&reader, buffer, BLOCK_SIZE);
 				b = 0;
 			}
 			code_num = (code_num << 8) | (buffer[b] & 0xff);
@@ -605,7 +1074,7 @@ int search_db(struct g_data_s *g_data, char *database, char *search_str)
 		/* Data */
 		b += 1;
 		if (b == buf_len) {			
-			buf_len = read(fd, buffer, BLOCK_SIZE);
+			buf_len = block_read(&reader, buffer, BLOCK_SIZE);
 			b = 0;			    
 		}		
 		/* If we are not resuming from an interrupted state then call
@@ -618,7 +1087,7 @@ int search_db(struct g_data_s *g_data, char *database, char *search_str)
 		 * the string data for the path */
 		while(1) {
 			b_mark = b;
-			while (buffer[b] != '\0' && b < buf_len)
+			while (b < buf_len && buffer[b] != '\0')
 			    b += 1;			
 			/* If we are not resuming an interruption then initialize the
 			 * code_str variable */
@@ -646,7 +1115,7 @@ int search_db(struct g_data_s *g_data, char *database, char *search_str)
 			 * to DC_DATA_INTR and exit so we can read more data and
 			 * return to this state */
 			if (b == buf_len && buffer[b-1] != '\0') {
-				buf_len = read(fd, buffer, BLOCK_SIZE);
+				buf_len = block_read(&reader, buffer, BLOCK_SIZE);
 				b = 0;
 				STATE = DC_DATA_INTR;
 			} else
@@ -695,7 +1164,7 @@ int search_db(struct g_data_s *g_data, char *database, char *search_str)
 		
 		b += 1;
 		if (b == buf_len) {
-			buf_len = read(fd, buffer, BLOCK_SIZE);
+			buf_len = block_read(&reader, buffer, BLOCK_SIZE);
 			b = 0;
 		}
 	}
@@ -708,8 +1177,11 @@ int search_db(struct g_data_s *g_data, char *database, char *search_str)
 	ret = 1;
 EXIT:
 	rlocate_done(g_data);
-	if (fd > -1)
-	    close(fd);
+	block_close(&reader);
+	if (fd > -1) {
+		PROF_COUNT(syscalls, 1);
+		close(fd);
+	}
 	if (full_path) {
 		free(full_path);
 		full_path = NULL;
@@ -726,6 +1198,14 @@ EXIT:
 		free(path_head);
 		path_head = NULL;
 	}
+	if (glob_str) {
+		free(glob_str);
+		glob_str = NULL;
+	}
+	for (i = 0; shards && shards[i]; i++)
+	    free(shards[i]);
+	if (shards)
+	    free(shards);
 
 	return ret;
 }
@@ -753,6 +1233,8 @@ int main(int argc, char **argv)
 		ret = 0;
 		goto EXIT;
 	}	
+	if (g_data->PROFILE && !cmd_data->updatedb)
+	    prof_start();
 
 #if 0
 	printf("Q: %d\n", g_data->QUIET);
@@ -787,6 +1269,28 @@ int main(int argc, char **argv)
 		if (create_db(g_data))
 		    ret = 0;
 		goto EXIT;
+	} else if (g_data->STATISTICS) {
+		if (!g_data->input_db || !g_data->input_db[0]) {
+			g_data->input_db = init_input_db(g_data, 1);
+			g_data->input_db[0] = strdup(DEFAULT_DB);
+		}
+		for (i = 0; g_data->input_db[i]; i += 1) {
+			if (!db_statistics(g_data, g_data->input_db[i]))
+			    goto EXIT;
+		}
+	} else if (g_data->DIFF_DB) {
+		if (!cmd_data->search_str || !cmd_data->search_str[0] || !cmd_data->search_str[1] ||
+		    cmd_data->search_str[2]) {
+			report_error(g_data, FATAL, "--diff-db needs the old and the new database.\n");
+			goto EXIT;
+		}
+		/* Only the databases, that the user can read, are compared */
+		if (setgid(g_data->gid) == -1) {
+			if (!report_error(g_data, FATAL, "Could not drop privileges."))
+			    goto EXIT;
+		}
+		if (!merge_diff(g_data, cmd_data->search_str[0], cmd_data->search_str[1]))
+		    goto EXIT;
 	} else if (argc >= 2) {
 		/* Search the database */
 		if (!g_data->input_db || !g_data->input_db[0]) {
@@ -794,9 +1298,19 @@ int main(int argc, char **argv)
 			g_data->input_db[0] = strdup(DEFAULT_DB);
 		}
 
+		/* Read all search strings from stdin */
+		if (g_data->STDIN_PATTERNS && !batch_init(g_data))
+		    goto EXIT;
+		/* Answer queries from stdin */
+		if (g_data->SESSION && !g_data->batch) {
+			if (session_run(g_data))
+			    ret = 0;
+			goto EXIT;
+		}
+
 		for (i = 0; g_data->input_db[i]; i += 1) {
-			/* Regular expression search */
-			if (g_data->regexp_data)
+			/* Regular expression or --stdin-patterns search */
+			if (g_data->regexp_data || g_data->batch)
 			    search_ret = search_db(g_data, g_data->input_db[i], NULL);
 			/* Search each string */
 			else {
@@ -816,6 +1330,10 @@ int main(int argc, char **argv)
 	ret = 0;
 
 EXIT:
+	if (g_data) {
+		prof_report(g_data);
+		batch_free(g_data);
+	}
 	/* Free up memory */
 	free_global_data(g_data);
 	g_data = NULL;
@@ -33,6 +33,7 @@
 #define WARN_MESSAGE "8 days"
 
 #define MTAB_FILE "/etc/mtab"
+#define MOUNTINFO_FILE "/proc/self/mountinfo"
 #define UPDATEDB_FILE UPDATEDB_CONF
 
 /* More fitting paths for FreeBSD -matt */
@@ -73,23 +74,73 @@ struct g_data_s {
 	char slevel;
 	int nocase;
 	char *index_path;
+	char **index_paths;	/* every -U, sorted by create_db() */
 	uid_t uid;
 	gid_t gid;
 	gid_t SLOCATE_GID;
 	char *output_db;
 	char **exclude;
+	struct prune_s *prune;	/* exclude compiled by compile_exclude() */
+	char **alias;		/* 'mount point -> path' of the skipped binds */
+	char **from_list;	/* every --from-list, the paths to encode */
+	char **merge_db;	/* every --merge-db, the databases to merge */
 	char **input_db;
 	int queries;
 	struct regexp_data_s *regexp_data;
 	int INITDIFFDB;
 	int FULL_UPDATE;
 	int FAST_UPDATE;
+	int PROFILE;
+	int SEARCH_IMAGE;
+	int SESSION;
+	struct session_s *session;
+	int STDIN_PATTERNS;
+	int THREADS;
+	int NATIVE_CRAWL;
+	int INODE_ORDER;
+	int INCREMENTAL;
+	int COMPRESS;
+	int DIR_TABLE;
+	int STATISTICS;
+	int DIFF_DB;
+	int COUNT;
+	size_t DIFF_MEMORY;
+	int XDEV;
+	int PRUNE_FS;
+	int SKIP_BINDS;
+	int PER_FILESYSTEM;
+	int SHARDS;
+	int THROTTLE;		/* percent of the time stalled, 0 is off */
+	int CHECKPOINT;		/* seconds between the checkpoints, 0 is off */
+	struct throttle_s *throttle;
+	struct batch_s *batch;
 };
 
+struct img_writer_s;
+struct block_writer_s;
+struct dirtab_writer_s;
+struct db_writer_s;
+struct session_s;
+struct batch_s;
+struct prune_s;
+struct throttle_s;
+
+/* Size of the encoder output buffer */
+#define ENC_BUF_SIZE (256 * 1024)
+
 /* Encoding data */
 struct enc_data_s {
-	char *prev_line;
+	char *prev_line;	/* previous path, grows with the longest one */
+	size_t prev_line_len;
+	size_t prev_alloc;
 	short prev_len;
+	struct img_writer_s *image;
+	char *buf;		/* encoded paths, that are not written yet */
+	size_t buf_len;
+	size_t buf_alloc;
+	struct block_writer_s *block;	/* set for a block database */
+	struct dirtab_writer_s *dirtab;	/* set for a directory table database */
+	struct db_writer_s *db;		/* header, footer and offset table */
 };
 
 /* Decoding data */
@@ -0,0 +1,206 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Copying of the unchanged chunks in the fast update. The bytes go from
+ * the old database to the new one with copy_file_range(), so they do not
+ * pass through the user space, if the kernel can do it, and with pread()
+ * and write() if it cannot. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "profile.h"
+#include "block.h"
+#include "dbinfo.h"
+#include "splice.h"
+
+#define SPLICE_BUF_SIZE (64 * 1024)
+
+/* extern functions are defined in slocate.c */
+extern int encode_flush(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data);
+
+/*
+ * splice_copy() copies 'count' bytes at 'offset' of 'fd_in' to 'fd_out'.
+ * Returns 0 with errno set on error.
+ */
+static int splice_copy(int fd_in, off_t offset, int fd_out, size_t count)
+{
+	char buffer[SPLICE_BUF_SIZE];
+	loff_t off = offset;
+	ssize_t len;
+
+	while (count) {
+		len = copy_file_range(fd_in, &off, fd_out, NULL, count, 0);
+		PROF_COUNT(syscalls, 1);
+		if (len == -1 && errno == EINTR)
+			continue;
+		/* not supported for these files, the rest is copied below */
+		if (len <= 0)
+			break;
+		PROF_COUNT(bytes, len);
+		count -= len;
+	}
+	offset = off;
+	while (count) {
+		len = pread(fd_in, buffer, count < sizeof(buffer) ? count : sizeof(buffer), offset);
+		PROF_COUNT(syscalls, 1);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		if (len == 0) {
+			errno = EIO;
+			return 0;
+		}
+		PROF_COUNT(bytes, len);
+		if (!write_all(fd_out, buffer, len))
+			return 0;
+		offset += len;
+		count -= len;
+	}
+	return 1;
+}
+
+/*
+ * splice_code() writes 'code_num' like encode() does and returns the number
+ * of bytes.
+ */
+static size_t splice_code(unsigned char *buf, short code_num)
+{
+	if (code_num < -127 || code_num > 127) {
+		buf[0] = (unsigned char)SLOC_ESC;
+		buf[1] = code_num >> 8;
+		buf[2] = code_num;
+		return 3;
+	}
+	buf[0] = code_num;
+	return 1;
+}
+
+/*
+ * splice_first() checks, that the chunk of 'len' bytes at 'raw' starts with
+ * the code 'code_num', and returns its length or 0.
+ */
+static size_t splice_first(const unsigned char *raw, size_t len, short code_num)
+{
+	unsigned char head[3];
+	size_t head_len = splice_code(head, code_num);
+
+	if (len <= head_len || memcmp(raw, head, head_len) != 0)
+		return 0;
+	return head_len;
+}
+
+/*
+ * splice_chunk() copies the chunk 'i' of the database 'reader' to the
+ * database 'fd', that is written with 'enc_data'. 'prev_prefix' is the
+ * common prefix of the last path of the chunk before in the database, the
+ * code of the first path is relative to it.
+ *
+ * Returns:  1 == ok
+ *           0 == error
+ */
+int splice_chunk(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data,
+		 struct block_reader_s *reader, uint64_t i, uint64_t prev_prefix,
+		 const struct db_chunk_s *chunk)
+{
+	struct db_writer_s *db = enc_data->db;
+	struct block_entry_s *entry;
+	unsigned char head[3], old[3];
+	unsigned char *raw;
+	uint64_t offset, end;
+	size_t head_len, old_len;
+	ssize_t raw_len;
+	char *ptr;
+
+	/* the chunk, that is written, ends before */
+	if (!encode_flush(g_data, fd, enc_data) || !db_chunk_end(g_data, db))
+		return 0;
+	head_len = splice_code(head, -enc_data->prev_len);
+	if (reader->blocks) {
+		entry = &reader->index[i];
+		if ((uint64_t)enc_data->prev_len == prev_prefix) {
+			if (fflush(fd) == EOF ||
+			    !splice_copy(reader->fd, entry->offset, fileno(fd), entry->comp_len))
+				goto WRITE_ERROR;
+			if (!block_add(g_data, enc_data->block, entry->comp_len, entry->raw_len))
+				return 0;
+		} else {
+			/* the block is compressed again with the new code */
+			if ((raw_len = block_chunk(reader, i, &raw)) == -1)
+				goto READ_ERROR;
+			if (!(old_len = splice_first(raw, raw_len, -(short)prev_prefix)))
+				goto DAMAGED;
+			if (raw_len - old_len + head_len > enc_data->buf_alloc) {
+				if (!(ptr = realloc(enc_data->buf, raw_len - old_len + head_len))) {
+					report_error(g_data, FATAL, "splice_chunk: realloc: %s\n", strerror(errno));
+					return 0;
+				}
+				enc_data->buf = ptr;
+				enc_data->buf_alloc = raw_len - old_len + head_len;
+			}
+			memcpy(enc_data->buf, head, head_len);
+			memcpy(enc_data->buf + head_len, raw + old_len, raw_len - old_len);
+			if (!block_write(g_data, fd, enc_data->block, enc_data->buf, raw_len - old_len + head_len))
+				return 0;
+		}
+	} else {
+		offset = reader->info.offsets[i];
+		end = i + 1 < reader->info.offsets_count ? reader->info.offsets[i + 1] : reader->data_end;
+		old_len = prev_prefix > 127 ? 3 : 1;
+		if (offset + old_len > end || end > reader->data_end)
+			goto DAMAGED;
+		PROF_COUNT(syscalls, 1);
+		if (pread(reader->fd, old, old_len, offset) != (ssize_t)old_len)
+			goto READ_ERROR;
+		if (!splice_first(old, end - offset, -(short)prev_prefix))
+			goto DAMAGED;
+		if (fflush(fd) == EOF || !write_all(fileno(fd), head, head_len) ||
+		    !splice_copy(reader->fd, offset + old_len, fileno(fd), end - offset - old_len))
+			goto WRITE_ERROR;
+		if (!db_offset(g_data, db, db->offset))
+			return 0;
+		db->offset += head_len + end - offset - old_len;
+	}
+	if (!db_chunk_copy(g_data, db, chunk))
+		return 0;
+	/* the next path starts a new chunk, or a new block */
+	enc_data->prev_len = chunk->last_prefix;
+	return 1;
+READ_ERROR:
+	report_error(g_data, FATAL, "splice_chunk: read: %s\n", strerror(errno));
+	return 0;
+WRITE_ERROR:
+	report_error(g_data, FATAL, "splice_chunk: write(): %s\n", strerror(errno));
+	return 0;
+DAMAGED:
+	report_error(g_data, FATAL, "splice_chunk: The database is damaged.\n");
+	return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef SPLICE_H
+#define SPLICE_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dbinfo.h"
+
+/* The fast update copies the chunks of a database of version 2, that none
+ * of the added paths fall into, to the new database as they are. Only the
+ * first path of a chunk is encoded again, it starts without a common
+ * prefix, but its code is relative to the last path before it. A block,
+ * whose first path has the same code in the new database, is copied as it
+ * is compressed. */
+
+struct block_reader_s;
+
+int splice_chunk(struct g_data_s *g_data, FILE *fd, struct enc_data_s *enc_data,
+		 struct block_reader_s *reader, uint64_t i, uint64_t prev_prefix,
+		 const struct db_chunk_s *chunk);
+
+#endif /* !SPLICE_H */
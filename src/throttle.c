@@ -0,0 +1,220 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Throttled crawl for updates in the background: the idle I/O priority,
+ * fewer workers and a sleep between the directories read, while the
+ * pressure stall information of the kernel says, that the machine is busy
+ * with other work. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "slocate.h"
+#include "utils.h"
+#include "throttle.h"
+
+/*
+ * throttle_psi() reads the "some" total stall time of 'psi'. Returns 0, if
+ * the kernel has no pressure stall information.
+ */
+static int throttle_psi(struct throttle_psi_s *psi)
+{
+	char line[256];
+	char *total;
+	FILE *fp;
+	int ok = 0;
+
+	if (!(fp = fopen(psi->file, "r")))
+		return 0;
+	while (fgets(line, sizeof(line), fp)) {
+		if (strncmp(line, "some ", 5) == 0 && (total = strstr(line, "total="))) {
+			psi->total = strtoull(total + 6, NULL, 10);
+			ok = 1;
+			break;
+		}
+	}
+	fclose(fp);
+	return ok;
+}
+
+static long throttle_elapsed(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000L + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+static void throttle_sleep(long usec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+/*
+ * throttle_create() sets the idle I/O priority, that the worker threads
+ * inherit, and reads the stall times, that the first check compares with.
+ * 'budget' is the percent of the time, that the tasks of the machine may
+ * be stalled.
+ */
+struct throttle_s *throttle_create(struct g_data_s *g_data, int budget)
+{
+	struct throttle_s *throttle;
+	int i;
+
+	if (!(throttle = calloc(1, sizeof(struct throttle_s)))) {
+		report_error(g_data, FATAL, "throttle_create: calloc: %s\n", strerror(errno));
+		return NULL;
+	}
+	throttle->g_data = g_data;
+	throttle->budget = budget;
+	throttle->workers = throttle->max_workers = 1;
+	throttle->psi[0].file = "/proc/pressure/io";
+	throttle->psi[1].file = "/proc/pressure/cpu";
+	pthread_mutex_init(&throttle->lock, NULL);
+
+	if (syscall(SYS_ioprio_set, THROTTLE_IOPRIO_WHO_PROCESS, 0,
+		    THROTTLE_IOPRIO_CLASS_IDLE << THROTTLE_IOPRIO_CLASS_SHIFT) == -1 &&
+	    g_data->VERBOSE)
+		fprintf(stderr, "%s: throttle_create: ioprio_set: %s\n", g_data->progname, strerror(errno));
+	for (i = 0; i < 2; i++)
+		if ((throttle->psi[i].ok = throttle_psi(&throttle->psi[i])) == 0 && g_data->VERBOSE)
+			fprintf(stderr, "%s: throttle_create: %s: no pressure stall information\n",
+				g_data->progname, throttle->psi[i].file);
+	clock_gettime(CLOCK_MONOTONIC, &throttle->checked);
+	return throttle;
+}
+
+/*
+ * throttle_workers() tells, how many workers the crawl starts. All of them
+ * may run, until the machine is busy.
+ */
+void throttle_workers(struct throttle_s *throttle, int workers)
+{
+	if (!throttle)
+		return;
+	pthread_mutex_lock(&throttle->lock);
+	throttle->workers = throttle->max_workers = workers > 0 ? workers : 1;
+	pthread_mutex_unlock(&throttle->lock);
+}
+
+/*
+ * throttle_check() compares the stall time since the last check with the
+ * budget and adjusts the sleep and the workers. Called with the lock held.
+ */
+static void throttle_check(struct throttle_s *throttle, const struct timespec *now)
+{
+	struct throttle_psi_s *psi;
+	uint64_t prev;
+	long elapsed = throttle_elapsed(&throttle->checked, now);
+	int stalled = 0, percent;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		psi = &throttle->psi[i];
+		prev = psi->total;
+		if (!psi->ok || !throttle_psi(psi) || psi->total < prev)
+			continue;
+		percent = (int)((psi->total - prev) * 100 / elapsed);
+		if (percent > stalled)
+			stalled = percent;
+	}
+	throttle->checked = *now;
+
+	if (stalled > throttle->budget) {
+		throttle->delay = throttle->delay ? throttle->delay * 2 : THROTTLE_MIN_DELAY;
+		if (throttle->delay > THROTTLE_MAX_DELAY)
+			throttle->delay = THROTTLE_MAX_DELAY;
+		if (throttle->workers > 1)
+			throttle->workers /= 2;
+	} else if (stalled * 2 < throttle->budget) {
+		if ((throttle->delay /= 2) < THROTTLE_MIN_DELAY)
+			throttle->delay = 0;
+		if (!throttle->delay && throttle->workers < throttle->max_workers)
+			throttle->workers++;
+	}
+	if (throttle->g_data->VERBOSE)
+		fprintf(stderr, "%s: throttle: %d%% stalled, %d of %d workers, %ld us sleep\n",
+			throttle->g_data->progname, stalled, throttle->workers,
+			throttle->max_workers, throttle->delay);
+}
+
+/*
+ * throttle_read() is called, when 'entries' directory entries were read.
+ * After every THROTTLE_BATCH entries, the pressure is checked, if
+ * THROTTLE_INTERVAL passed, and the caller sleeps, while the machine is
+ * busy.
+ */
+void throttle_read(struct throttle_s *throttle, int entries)
+{
+	struct timespec now;
+	long count;
+	long delay;
+
+	if (!throttle)
+		return;
+	count = __sync_add_and_fetch(&throttle->count, entries);
+	if (count / THROTTLE_BATCH == (count - entries) / THROTTLE_BATCH)
+		return;
+	pthread_mutex_lock(&throttle->lock);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (throttle_elapsed(&throttle->checked, &now) >= THROTTLE_INTERVAL)
+		throttle_check(throttle, &now);
+	delay = throttle->delay;
+	pthread_mutex_unlock(&throttle->lock);
+	if (delay)
+		throttle_sleep(delay);
+}
+
+/*
+ * throttle_park() lets worker 'self' sleep for a while, if it may not run.
+ * Returns 1, if it did, the worker checks its work again then.
+ */
+int throttle_park(struct throttle_s *throttle, int self)
+{
+	int park;
+
+	if (!throttle)
+		return 0;
+	pthread_mutex_lock(&throttle->lock);
+	park = self >= throttle->workers;
+	pthread_mutex_unlock(&throttle->lock);
+	if (park)
+		throttle_sleep(THROTTLE_PARK);
+	return park;
+}
+
+void throttle_free(struct throttle_s *throttle)
+{
+	if (!throttle)
+		return;
+	pthread_mutex_destroy(&throttle->lock);
+	free(throttle);
+}
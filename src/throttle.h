@@ -0,0 +1,52 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H 1
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+/* --throttle: the crawl runs with the idle I/O priority and watches the
+ * stall time of /proc/pressure/io and /proc/pressure/cpu. While more than
+ * the budget percent of the time is stalled, it halves the running workers
+ * and doubles a sleep after every THROTTLE_BATCH entries read. While less
+ * than half of the budget is stalled, it halves the sleep and, without a
+ * sleep, lets one more worker run. */
+#define THROTTLE_BUDGET 10		/* percent of the time stalled */
+#define THROTTLE_INTERVAL 1000000	/* microseconds between the checks */
+#define THROTTLE_BATCH 256		/* entries read between the sleeps */
+#define THROTTLE_MIN_DELAY 1000		/* microseconds */
+#define THROTTLE_MAX_DELAY 500000
+#define THROTTLE_PARK 100000		/* sleep of a worker, that may not run */
+
+/* ioprio_set() */
+#define THROTTLE_IOPRIO_WHO_PROCESS 1
+#define THROTTLE_IOPRIO_CLASS_IDLE 3
+#define THROTTLE_IOPRIO_CLASS_SHIFT 13
+
+/* Stall time of a resource */
+struct throttle_psi_s {
+	const char *file;
+	int ok;			/* the file could be read */
+	uint64_t total;		/* "some" total in microseconds */
+};
+
+/* Throttle data, the fields below lock are protected by it */
+struct throttle_s {
+	struct g_data_s *g_data;
+	int budget;
+	volatile long count;	/* entries read */
+	pthread_mutex_t lock;
+	struct throttle_psi_s psi[2];
+	struct timespec checked;
+	long delay;		/* sleep after THROTTLE_BATCH entries */
+	int workers;		/* that may run */
+	int max_workers;
+};
+
+struct throttle_s *throttle_create(struct g_data_s *g_data, int budget);
+void throttle_workers(struct throttle_s *throttle, int workers);
+void throttle_read(struct throttle_s *throttle, int entries);
+int throttle_park(struct throttle_s *throttle, int self);
+void throttle_free(struct throttle_s *throttle);
+
+#endif /* !THROTTLE_H */
@@ -28,6 +28,13 @@
 
 #include "slocate.h"
 #include "utils.h"
+#include "profile.h"
+#include "batch.h"
+#include "block.h"
+#include "dirtab.h"
+#include "prune.h"
+#include "shard.h"
+#include "ckpt.h"
 
 #ifdef RAND_MAX
 # undef RAND_MAX
@@ -64,8 +71,11 @@ int match(struct g_data_s *g_data, char *full_path, char *search_str, int globfl
 	char *nocase_path = NULL;
 #endif
 
+	/* If searching with the patterns from stdin */
+	if (g_data->batch) {
+		foundit = batch_match(g_data, full_path);
 	/* If searching with regular expressions */
-	if (g_data->regexp_data) {
+	} else if (g_data->regexp_data) {
 		foundit = ! regexec(g_data->regexp_data->preg, full_path, nmatch, pmatch, 0);
 	/* Case sensitive search */
 	} else if (search_str && !g_data->nocase) {
@@ -151,6 +161,35 @@ EXIT:
 	return ret;
 }
 
+/* Compile the exclude paths into the trie, that match_exclude() tests
+ * every path with. It is done once, before the walk starts.
+ *
+ * 1 == ok
+ * 0 == error
+ */
+int compile_exclude(struct g_data_s *g_data)
+{
+	int i;
+
+	prune_free(g_data->prune);
+	g_data->prune = NULL;
+	if (!g_data->exclude)
+	    return 1;
+
+	if (!(g_data->prune = prune_create())) {
+		report_error(g_data, FATAL, "compile_exclude: malloc: %s\n", strerror(errno));
+		return 0;
+	}
+	for (i = 0; g_data->exclude[i]; i++) {
+		if (!prune_add(g_data->prune, g_data->exclude[i])) {
+			report_error(g_data, FATAL, "compile_exclude: malloc: %s\n", strerror(errno));
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
 /* Match exclude
  * 
  * 1  == match
@@ -158,23 +197,37 @@ EXIT:
  * -1 == error
  */
 int match_exclude(struct g_data_s *g_data, char *path) {
-	int i;
-
-	if (!g_data->exclude || !path)
+	if (!g_data->prune || !path)
 	    return 0;
 
-	/* Compare inode numbers to check if the exclude path matches */
-	for (i = 0; g_data->exclude[i]; i++) {		
-		if (strcmp(path, g_data->exclude[i]) == 0) {
-			if (g_data->VERBOSE)
-			    printf("Excluding: %s\n", path);
-			return 1;
-		}
+	if (prune_match(g_data->prune, path, PRUNE_EXACT)) {
+		if (g_data->VERBOSE)
+		    printf("Excluding: %s\n", path);
+		return 1;
 	}
 
 	return 0;
 }
 
+/* Compare two paths in the order of the crawl: a directory comes right
+ * before its entries and the entries of a directory are in strcmp() order.
+ */
+int tree_compare(const char *p1, const char *p2)
+{
+	while (*p1 && *p1 == *p2) {
+		p1++;
+		p2++;
+	}
+	if (*p1 == *p2)
+	    return 0;
+	/* the name, that ends first, is smaller */
+	if (*p1 == '/')
+	    return *p2 ? -1 : 1;
+	if (*p2 == '/')
+	    return *p1 ? 1 : -1;
+	return (unsigned char)*p1 - (unsigned char)*p2;
+}
+
 /* strndup() seems to be a GNU thing */
 char *sl_strndup(const char *str, size_t size) 
 {
@@ -274,16 +327,20 @@ unsigned short
 
 /* Verify DB
  * For now we just check if there is a '1' or '0' as the first character
- * of the DB. (security level).
+ * of the DB. (security level) or the magic of a database of version 2 or of
+ * a block, a directory table or a sharded database. A database of version
+ * 2 with a checkpoint of --checkpoint is a partial one, that an update goes
+ * on with.
  * 
  * Returns:  0 == Invalid
  *          -1 == File does not exist or inaccessible
  *           1 == Valid
+ *           2 == Partial
  */
 int
 verify_slocate_db(struct g_data_s *g_data, char *file)
 {
-	char ch[1];
+	char ch[sizeof(DB_MAGIC) - 1];
 	struct stat tf_stat;
 	int bytes = 0;
 	int fd = -1;
@@ -303,7 +360,7 @@ verify_slocate_db(struct g_data_s *g_data, char *file)
 			
 		}
 
-		bytes = read(fd, ch, 1);
+		bytes = read(fd, ch, sizeof(ch));
 		
 		if (close(fd) == -1) {
 			if (!report_error(g_data, FATAL, "get_temp_file: close(): %s: %s\n", file, strerror(errno)))
@@ -317,8 +374,15 @@ verify_slocate_db(struct g_data_s *g_data, char *file)
 			
 		}
 		
-		if (ch[0] != '1' && ch[0] != '0')
+		if (ch[0] != '1' && ch[0] != '0' &&
+		    (bytes != sizeof(ch) || (memcmp(ch, DB_MAGIC, sizeof(ch)) != 0 &&
+					     memcmp(ch, BLOCK_MAGIC, sizeof(ch)) != 0 &&
+					     memcmp(ch, DIRTAB_MAGIC, sizeof(ch)) != 0 &&
+					     memcmp(ch, SHARD_MAGIC, sizeof(ch)) != 0)))
 		    return 0;
+		if (bytes == sizeof(ch) && memcmp(ch, DB_MAGIC, sizeof(ch)) == 0 &&
+		    ckpt_check(file, tf_stat.st_size))
+		    return 2;
 		
 	} else
 	    return -2;
@@ -351,6 +415,8 @@ get_temp_file(struct g_data_s *g_data)
 	} else if (ret == -1) {
 		
 		goto EXIT;
+	} else if (ret == 2 && g_data->VERBOSE) {
+		fprintf(stderr, "%s: the temp file '%s' is a partial database with a checkpoint\n", g_data->progname, tmp_file);
 	}
 
 	return tmp_file;
@@ -526,14 +592,17 @@ int verify_access(const char *path)
 	int ret = 0;
 	char *ptr = NULL;
 
+	PROF_COUNT(syscalls, 1);
 	if (lstat(path, &path_stat) == -1)
 	    goto EXIT;
 
 	if (!S_ISLNK(path_stat.st_mode)) {
+		PROF_COUNT(syscalls, 1);
 		if (access(path, F_OK) != 0)
 		    goto EXIT;
 	} else if ((ptr = rindex(path, '/'))) {
 		*ptr = 0;
+		PROF_COUNT(syscalls, 1);
 		if (access(path, F_OK) == 0)
 		    ret = 1;
 		*ptr = '/';
@@ -542,5 +611,27 @@ int verify_access(const char *path)
 
 	ret = 1;
 EXIT:
+	if (ret)
+	    PROF_COUNT(verified, 1);
+	else
+	    PROF_COUNT(rejected, 1);
 	return ret;
 }
+
+/* write() all of 'buffer', returns 0 with errno set on error */
+int write_all(int fd, const void *buffer, size_t count)
+{
+	const char *ptr = buffer;
+	ssize_t len;
+
+	while (count) {
+		if ((len = write(fd, ptr, count)) == -1) {
+			if (errno == EINTR)
+			    continue;
+			return 0;
+		}
+		ptr += len;
+		count -= len;
+	}
+	return 1;
+}
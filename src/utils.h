@@ -27,7 +27,9 @@ int report_error(struct g_data_s *g_data, int STATUS, const char *format, ...);
 
 char * tolower_strdup(char *str);
 int match(struct g_data_s *g_data, char *full_path, char *search_str, int globflag);
+int compile_exclude(struct g_data_s *g_data);
 int match_exclude(struct g_data_s *gdata, char *path);
+int tree_compare(const char *p1, const char *p2);
 char *sl_strndup(const char *str, size_t size);
 char * make_absolute_path(struct g_data_s *g_data, char *path);
 char * get_temp_file(struct g_data_s *g_data);
@@ -35,5 +37,6 @@ int access_path(char *path);
 unsigned short get_gid(struct g_data_s *g_data, const char *group, int *ret);
 int load_file(struct g_data_s *g_data, char *filename, char **file_data);
 int verify_access(const char *path);
+int write_all(int fd, const void *buffer, size_t count);
 
 #endif
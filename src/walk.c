@@ -0,0 +1,570 @@
+/*****************************************************************************
+ * Real-Time Locate
+ *
+ * Copyright (c) 2004,2005 Rasto Levrinc
+ *
+ * Real-Time Locate: http://rlocate.sourceforge.net/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* Native directory walk for updatedb and rlocated, that replaces fts.
+ * Directories are read with getdents64() into one buffer, the
+ * subdirectories are opened relative to the parent with openat() and the
+ * type of the entry is taken from d_type, so only file systems without
+ * d_type are stat()ed. Only the path of the current entry is kept and a
+ * directory is sorted in memory only up to WALK_MAX_NAMES bytes of names,
+ * bigger directories are sorted in runs in temporary files. With
+ * WALK_INODE the entries, that are stat()ed, are stat()ed in inode order,
+ * before the names are sorted, so the disk reads the inode table in one
+ * direction: the entries without d_type and, on rotational media or on the
+ * network, also the subdirectories, whose inodes are read again, when they
+ * are opened. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+
+#include "walk.h"
+
+/* Type of an entry, that could not be stat()ed */
+#define WALK_GONE 0x7e
+
+/* f_type of the network file systems */
+static const uint32_t walk_network[] = {
+	0x00006969,	/* nfs */
+	0x0000517b,	/* smbfs */
+	0xff534d42,	/* cifs */
+	0xfe534d42,	/* smb2 */
+	0
+};
+
+/* getdents64() record */
+struct walk_dirent_s {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/*
+ * walk_compare() compares the names of two records, the first byte of the
+ * record is the type.
+ */
+static int walk_compare(const void *e1, const void *e2, void *names)
+{
+	return strcmp((char *)names + *(const size_t *)e1 + 1,
+		      (char *)names + *(const size_t *)e2 + 1);
+}
+
+/*
+ * walk_add() appends an entry to the directory. The type is stored
+ * increased by one, so that the record never contains '\0' before the end.
+ */
+static int walk_add(struct walk_level_s *lv, unsigned char type, const char *name,
+		    uint64_t ino)
+{
+	size_t len = strlen(name) + 2;
+	char *names;
+	size_t *entry;
+	uint64_t *inos;
+
+	if (lv->names_len + len > lv->names_alloc) {
+		if (!(names = realloc(lv->names, lv->names_alloc * 2 + len)))
+			return 0;
+		lv->names = names;
+		lv->names_alloc = lv->names_alloc * 2 + len;
+	}
+	if (lv->count == lv->alloc) {
+		if (!(entry = realloc(lv->entry, sizeof(size_t) * (lv->alloc * 2 + 64))))
+			return 0;
+		lv->entry = entry;
+		if (!(inos = realloc(lv->ino, sizeof(uint64_t) * (lv->alloc * 2 + 64))))
+			return 0;
+		lv->ino = inos;
+		lv->alloc = lv->alloc * 2 + 64;
+	}
+	lv->ino[lv->count] = ino;
+	lv->entry[lv->count++] = lv->names_len;
+	lv->names[lv->names_len] = type + 1;
+	memcpy(lv->names + lv->names_len + 1, name, len - 1);
+	lv->names_len += len;
+	return 1;
+}
+
+/*
+ * walk_slow() checks, if the directory 'fd' is on rotational media or on a
+ * network file system. The answer is kept for the file system.
+ */
+static int walk_slow(struct walk_s *walk, int fd)
+{
+	struct stat st;
+	struct statfs sf;
+	char name[64];
+	FILE *fp;
+	int i, c;
+
+	if (fstat(fd, &st) == -1)
+		return 0;
+	if (walk->checked && st.st_dev == walk->dev)
+		return walk->slow;
+	walk->checked = 1;
+	walk->dev = st.st_dev;
+	walk->slow = 0;
+	if (fstatfs(fd, &sf) == 0) {
+		for (i = 0; walk_network[i] && walk_network[i] != (uint32_t)sf.f_type; i++);
+		if (walk_network[i])
+			return walk->slow = 1;
+	}
+	/* a partition has no queue of its own */
+	snprintf(name, sizeof(name), "/sys/dev/block/%u:%u/queue/rotational",
+		 major(st.st_dev), minor(st.st_dev));
+	if (!(fp = fopen(name, "r"))) {
+		snprintf(name, sizeof(name), "/sys/dev/block/%u:%u/../queue/rotational",
+			 major(st.st_dev), minor(st.st_dev));
+		if (!(fp = fopen(name, "r")))
+			return 0;
+	}
+	c = fgetc(fp);
+	fclose(fp);
+	return walk->slow = c == '1';
+}
+
+static int walk_order_compare(const void *e1, const void *e2)
+{
+	uint64_t i1 = ((const struct walk_order_s *)e1)->ino;
+	uint64_t i2 = ((const struct walk_order_s *)e2)->ino;
+
+	return i1 < i2 ? -1 : i1 > i2;
+}
+
+/*
+ * walk_stat() stat()s the entries of directory 'fd', that are in memory, in
+ * inode order: the ones without d_type get their type or WALK_GONE, the
+ * subdirectories of a slow file system are only read into the inode cache.
+ */
+static int walk_stat(struct walk_s *walk, struct walk_level_s *lv, int fd)
+{
+	struct walk_order_s *order;
+	struct stat st;
+	char *rec;
+	int slow = -1;
+	int n = 0;
+	int i, type;
+
+	for (i = 0; i < lv->count; i++) {
+		type = lv->names[lv->entry[i]] - 1;
+		if (type != DT_UNKNOWN && type != DT_DIR)
+			continue;
+		if (type == DT_DIR && !(slow == -1 ? (slow = walk_slow(walk, fd)) : slow))
+			continue;
+		if (n == walk->order_alloc) {
+			if (!(order = realloc(walk->order, sizeof(struct walk_order_s) * (n * 2 + 64))))
+				return 0;
+			walk->order = order;
+			walk->order_alloc = n * 2 + 64;
+		}
+		walk->order[n].ino = lv->ino[i];
+		walk->order[n++].i = i;
+	}
+	/* one entry is stat()ed by walk_tree() */
+	if (n < 2)
+		return 1;
+	qsort(walk->order, n, sizeof(struct walk_order_s), walk_order_compare);
+	for (i = 0; i < n; i++) {
+		rec = lv->names + lv->entry[walk->order[i].i];
+		if (fstatat(fd, rec + 1, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+			if (rec[0] - 1 == DT_UNKNOWN)
+				rec[0] = WALK_GONE + 1;
+			continue;
+		}
+		if (rec[0] - 1 == DT_UNKNOWN)
+			rec[0] = (S_ISDIR(st.st_mode) ? DT_DIR : DT_REG) + 1;
+	}
+	return 1;
+}
+
+/*
+ * walk_spill() writes the entries, that are in memory, to a new run.
+ */
+static int walk_spill(struct walk_s *walk, struct walk_level_s *lv, int fd)
+{
+	struct walk_run_s *run;
+	int *heap;
+	FILE *fp;
+	char *rec;
+	int i;
+
+	if (lv->runs == lv->run_alloc) {
+		if (!(run = realloc(lv->run, sizeof(struct walk_run_s) * (lv->run_alloc * 2 + 8))))
+			return 0;
+		lv->run = run;
+		if (!(heap = realloc(lv->heap, sizeof(int) * (lv->run_alloc * 2 + 8))))
+			return 0;
+		lv->heap = heap;
+		lv->run_alloc = lv->run_alloc * 2 + 8;
+	}
+	if (walk->inode && !walk_stat(walk, lv, fd))
+		return 0;
+	if (walk->sorted && lv->count > 1)
+		qsort_r(lv->entry, lv->count, sizeof(size_t), walk_compare, lv->names);
+	if (!(fp = tmpfile()))
+		return 0;
+	for (i = 0; i < lv->count; i++) {
+		rec = lv->names + lv->entry[i];
+		if (fwrite(rec, strlen(rec) + 1, 1, fp) != 1) {
+			fclose(fp);
+			return 0;
+		}
+	}
+	run = &lv->run[lv->runs++];
+	run->fp = fp;
+	run->rec = NULL;
+	run->size = 0;
+	lv->names_len = 0;
+	lv->count = 0;
+	return 1;
+}
+
+/*
+ * walk_read() reads the next record of a run. Returns 0 at the end.
+ */
+static int walk_read(struct walk_run_s *run)
+{
+	return getdelim(&run->rec, &run->size, '\0', run->fp) > 0;
+}
+
+/*
+ * walk_sift() moves the run at position 'i' of the heap down.
+ */
+static void walk_sift(struct walk_level_s *lv, int i)
+{
+	int c, t;
+
+	for (;;) {
+		c = i * 2 + 1;
+		if (c >= lv->heap_len)
+			break;
+		if (c + 1 < lv->heap_len &&
+		    strcmp(lv->run[lv->heap[c + 1]].rec + 1, lv->run[lv->heap[c]].rec + 1) < 0)
+			c++;
+		if (strcmp(lv->run[lv->heap[c]].rec + 1, lv->run[lv->heap[i]].rec + 1) >= 0)
+			break;
+		t = lv->heap[i];
+		lv->heap[i] = lv->heap[c];
+		lv->heap[c] = t;
+		i = c;
+	}
+}
+
+/*
+ * walk_list() reads the entries of directory 'fd' without "." and "..".
+ * A read error ends the directory like in readdir().
+ */
+static int walk_list(struct walk_s *walk, struct walk_level_s *lv, int fd)
+{
+	struct walk_dirent_s *d;
+	long n, off;
+	int i;
+
+	lv->names_len = 0;
+	lv->count = 0;
+	lv->next = 0;
+	lv->heap_len = 0;
+	lv->advance = -1;
+	while ((n = syscall(SYS_getdents64, fd, walk->buf, WALK_BUF_SIZE)) > 0) {
+		for (off = 0; off < n; off += d->d_reclen) {
+			d = (struct walk_dirent_s *)(walk->buf + off);
+			if (d->d_name[0] == '.' &&
+			    (!d->d_name[1] || (d->d_name[1] == '.' && !d->d_name[2])))
+				continue;
+			if (!walk_add(lv, d->d_type, d->d_name, d->d_ino))
+				return 0;
+			if (lv->names_len >= WALK_MAX_NAMES && !walk_spill(walk, lv, fd))
+				return 0;
+		}
+	}
+	if (!lv->runs) {
+		if (walk->inode && !walk_stat(walk, lv, fd))
+			return 0;
+		if (walk->sorted && lv->count > 1)
+			qsort_r(lv->entry, lv->count, sizeof(size_t), walk_compare, lv->names);
+		return 1;
+	}
+	if (lv->count && !walk_spill(walk, lv, fd))
+		return 0;
+	for (i = 0; i < lv->runs; i++) {
+		if (fflush(lv->run[i].fp) == EOF)
+			return 0;
+		rewind(lv->run[i].fp);
+		if (walk->sorted && walk_read(&lv->run[i]))
+			lv->heap[lv->heap_len++] = i;
+	}
+	for (i = lv->heap_len / 2 - 1; i >= 0; i--)
+		walk_sift(lv, i);
+	return 1;
+}
+
+/*
+ * walk_next() returns the next record of the directory or NULL at the end.
+ */
+static const char *walk_next(struct walk_s *walk, struct walk_level_s *lv)
+{
+	if (!lv->runs)
+		return lv->next < lv->count ? lv->names + lv->entry[lv->next++] : NULL;
+	if (!walk->sorted) {
+		/* the runs one after another */
+		for (; lv->next < lv->runs; lv->next++)
+			if (walk_read(&lv->run[lv->next]))
+				return lv->run[lv->next].rec;
+		return NULL;
+	}
+	/* the record returned last is replaced with the next one of its run */
+	if (lv->advance != -1) {
+		if (!walk_read(&lv->run[lv->advance]))
+			lv->heap[0] = lv->heap[--lv->heap_len];
+		walk_sift(lv, 0);
+		lv->advance = -1;
+	}
+	if (!lv->heap_len)
+		return NULL;
+	lv->advance = lv->heap[0];
+	return lv->run[lv->advance].rec;
+}
+
+/*
+ * walk_leave() closes the directory and its runs.
+ */
+static void walk_leave(struct walk_level_s *lv)
+{
+	int i;
+
+	if (lv->fd != -1)
+		close(lv->fd);
+	lv->fd = -1;
+	for (i = 0; i < lv->runs; i++) {
+		fclose(lv->run[i].fp);
+		free(lv->run[i].rec);
+	}
+	lv->runs = 0;
+}
+
+/*
+ * walk_enter() lists directory 'fd' at 'depth', whose path is the first
+ * 'path_len' bytes of walk->path.
+ */
+static int walk_enter(struct walk_s *walk, int depth, int fd, int path_len)
+{
+	struct walk_level_s *level, *lv;
+
+	if (depth == walk->levels) {
+		if (!(level = realloc(walk->level, sizeof(struct walk_level_s) * (depth + 1)))) {
+			close(fd);
+			return 0;
+		}
+		walk->level = level;
+		memset(&level[depth], 0, sizeof(struct walk_level_s));
+		level[depth].fd = -1;
+		walk->levels++;
+	}
+	lv = &walk->level[depth];
+	lv->fd = fd;
+	lv->path_len = path_len;
+	if (!walk_list(walk, lv, fd))
+		return 0;
+	if (depth >= WALK_MAX_FDS) {
+		close(fd);
+		lv->fd = -1;
+	}
+	return 1;
+}
+
+/*
+ * walk_search() checks, that the directory 'fd' can be searched. Without the
+ * search permission its entries can not be stat()ed or opened and fts leaves
+ * them out, so they are left out here too.
+ */
+static int walk_search(int fd)
+{
+	return faccessat(fd, ".", X_OK, AT_EACCESS) == 0;
+}
+
+/*
+ * walk_join() appends 'name' to the first 'path_len' bytes of walk->path.
+ * Returns the length of the new path or -1.
+ */
+static int walk_join(struct walk_s *walk, int path_len, const char *name)
+{
+	size_t len = strlen(name);
+	size_t need = path_len + len + 2;
+	char *path;
+
+	if (need > walk->path_alloc) {
+		if (!(path = realloc(walk->path, need * 2)))
+			return -1;
+		walk->path = path;
+		walk->path_alloc = need * 2;
+	}
+	if (path_len != 1 || walk->path[0] != '/')
+		walk->path[path_len++] = '/';
+	memcpy(walk->path + path_len, name, len + 1);
+	return path_len + len;
+}
+
+/*
+ * walk_tree() calls 'func' for 'root' and for every entry below it, a
+ * directory before its entries. With WALK_SORTED the entries of a
+ * directory come in strcmp() order, like from fts with rlocate_ftscompare(),
+ * otherwise in the order of the directory. With WALK_XDEV the directories
+ * on other file systems than 'root' are not descended into, like with
+ * FTS_XDEV. With WALK_INODE the entries are stat()ed in inode order. Symbolic
+ * links are not followed and the entries, that can not be stat()ed, are
+ * left out, like the entries of the directories without search permission.
+ *
+ * Returns:  1 == ok
+ *           0 == error, errno is set or 0, if 'func' returned WALK_ABORT
+ */
+int walk_tree(const char *root, int flags, walk_func_t func, void *arg)
+{
+	struct walk_s walk;
+	struct walk_level_s *lv;
+	struct stat st;
+	dev_t dev = 0;
+	const char *rec;
+	int depth = 0;
+	int len, fd, dirfd, type, i;
+	int ret = 0, err = 0;
+
+	memset(&walk, 0, sizeof(walk));
+	walk.sorted = flags & WALK_SORTED;
+	walk.inode = flags & WALK_INODE;
+	len = strlen(root);
+	while (len > 1 && root[len - 1] == '/')
+		len--;
+	if (!(walk.buf = malloc(WALK_BUF_SIZE)) ||
+	    !(walk.path = malloc(len + 1))) {
+		err = errno;
+		goto EXIT;
+	}
+	walk.path_alloc = len + 1;
+	memcpy(walk.path, root, len);
+	walk.path[len] = '\0';
+
+	switch (func(walk.path, len, arg)) {
+	case WALK_ABORT:
+		goto EXIT;
+	case WALK_SKIP:
+		ret = 1;
+		goto EXIT;
+	}
+	/* not a directory, not readable or not searchable */
+	if ((fd = open(walk.path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) == -1) {
+		ret = 1;
+		goto EXIT;
+	}
+	if (!walk_search(fd)) {
+		close(fd);
+		ret = 1;
+		goto EXIT;
+	}
+	if (flags & WALK_XDEV) {
+		if (fstat(fd, &st) == -1) {
+			close(fd);
+			ret = 1;
+			goto EXIT;
+		}
+		dev = st.st_dev;
+	}
+	if (!walk_enter(&walk, 0, fd, len)) {
+		err = errno;
+		goto EXIT;
+	}
+	while (depth >= 0) {
+		lv = &walk.level[depth];
+		if (!(rec = walk_next(&walk, lv))) {
+			walk_leave(lv);
+			depth--;
+			continue;
+		}
+		if ((len = walk_join(&walk, lv->path_len, rec + 1)) == -1) {
+			err = errno;
+			goto EXIT;
+		}
+		/* deep directories are not open, their entries are reached
+		 * with the full path */
+		dirfd = lv->fd != -1 ? lv->fd : AT_FDCWD;
+		type = rec[0] - 1;
+		if (type == WALK_GONE)
+			continue;
+		if (type == DT_UNKNOWN) {
+			if (fstatat(dirfd, lv->fd != -1 ? rec + 1 : walk.path, &st, AT_SYMLINK_NOFOLLOW) == -1)
+				continue;
+			type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+		}
+		switch (func(walk.path, len, arg)) {
+		case WALK_ABORT:
+			goto EXIT;
+		case WALK_SKIP:
+			continue;
+		}
+		if (type != DT_DIR)
+			continue;
+		if ((fd = openat(dirfd, lv->fd != -1 ? rec + 1 : walk.path,
+				 O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) == -1)
+			continue;
+		if (!walk_search(fd)) {
+			close(fd);
+			continue;
+		}
+		/* a mount point is reported, but not descended into */
+		if ((flags & WALK_XDEV) && (fstat(fd, &st) == -1 || st.st_dev != dev)) {
+			close(fd);
+			continue;
+		}
+		if (!walk_enter(&walk, depth + 1, fd, len)) {
+			err = errno;
+			goto EXIT;
+		}
+		depth++;
+	}
+	ret = 1;
+EXIT:
+	for (i = 0; i < walk.levels; i++) {
+		walk_leave(&walk.level[i]);
+		free(walk.level[i].names);
+		free(walk.level[i].entry);
+		free(walk.level[i].ino);
+		free(walk.level[i].run);
+		free(walk.level[i].heap);
+	}
+	free(walk.level);
+	free(walk.order);
+	free(walk.path);
+	free(walk.buf);
+	errno = err;
+	return ret;
+}
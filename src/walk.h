@@ -0,0 +1,81 @@
+#ifndef WALK_H
+#define WALK_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Size of the getdents64() buffer */
+#define WALK_BUF_SIZE 32768
+/* Bytes of names of one directory, that are kept in memory. Bigger
+ * directories are sorted in runs in temporary files, that are merged. */
+#define WALK_MAX_NAMES (1 << 20)
+/* Directories deeper than this are opened with the full path, so that the
+ * open descriptors are bounded. */
+#define WALK_MAX_FDS 128
+
+/* Flags of walk_tree() */
+#define WALK_SORTED 1		/* entries of a directory in strcmp() order */
+#define WALK_XDEV   2		/* do not descend into other file systems */
+#define WALK_INODE  4		/* stat() the entries in inode order */
+
+/* Return values of the walk function */
+#define WALK_CONTINUE 0
+#define WALK_SKIP     1		/* do not descend into the directory */
+#define WALK_ABORT    2
+
+/* Walk function, it gets the full path of every entry, parents first */
+typedef int (*walk_func_t)(const char *path, int len, void *arg);
+
+/* Sorted run of a big directory */
+struct walk_run_s {
+	FILE *fp;
+	char *rec;		/* type byte, name and '\0' */
+	size_t size;
+};
+
+/* Directory, that is being walked */
+struct walk_level_s {
+	int fd;			/* -1, if it is opened with the full path */
+	int path_len;
+	char *names;		/* type byte, name and '\0' for every entry */
+	size_t names_len;
+	size_t names_alloc;
+	size_t *entry;		/* offsets in names */
+	uint64_t *ino;		/* inode of every entry, before it is sorted */
+	int count;
+	int alloc;
+	int next;
+	struct walk_run_s *run;
+	int runs;
+	int run_alloc;
+	int *heap;		/* runs ordered by their current record */
+	int heap_len;
+	int advance;		/* run, whose record was returned last or -1 */
+};
+
+/* Entry, that is stat()ed in inode order */
+struct walk_order_s {
+	uint64_t ino;
+	int i;
+};
+
+/* Walk data, the levels and the buffers are reused for every directory */
+struct walk_s {
+	int sorted;
+	int inode;		/* WALK_INODE */
+	dev_t dev;		/* file system, that was checked last */
+	int slow;		/* it is on rotational media or on the network */
+	int checked;
+	struct walk_order_s *order;
+	int order_alloc;
+	char *buf;
+	char *path;
+	size_t path_alloc;
+	struct walk_level_s *level;
+	int levels;
+};
+
+int walk_tree(const char *root, int flags, walk_func_t func, void *arg);
+
+#endif /* !WALK_H */